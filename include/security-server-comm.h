@@ -22,6 +22,11 @@
 #ifndef SECURITY_SERVER_COMM_H
 #define SECURITY_SERVER_COMM_H
 
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "security-server-cookie.h"
+
 /* Message */
 typedef struct
 {
@@ -36,6 +41,136 @@ typedef struct
 	unsigned char return_code;
 } response_header;
 
+/* Message (protocol version 2) *
+ * First 4 bytes have the same layout as basic_header, so the version byte *
+ * tells the server which framing the peer speaks */
+typedef struct
+{
+	unsigned char version;
+	unsigned char msg_id;
+	unsigned short flags;
+	unsigned int request_id;
+	unsigned int msg_len;
+} basic_header_v2;
+
+typedef struct
+{
+	basic_header_v2 basic_hdr;
+	unsigned char return_code;
+} response_header_v2;
+
+/* Per-connection receive buffer *
+ * Whatever the client has sent is pulled in with one read, and the request *
+ * is parsed from memory. Unconsumed bytes are kept for the next request */
+typedef struct
+{
+	int sockfd;
+	int seqpacket;				/* One datagram per message */
+	int start;				/* First unconsumed byte */
+	int end;				/* End of received data */
+	unsigned char data[SECURITY_SERVER_RECV_BUFFER_LEN];
+} recv_buffer;
+
+/* Outgoing message *
+ * Header and fields are gathered without copying and sent with one sendmsg() */
+typedef struct
+{
+	struct iovec iov[SECURITY_SERVER_MSG_MAX_IOV];
+	int iovcnt;
+	int len;				/* Total length, -1 on overflow */
+	int fds[SECURITY_SERVER_MSG_MAX_FDS];	/* Passed with SCM_RIGHTS */
+	int nfds;
+} msg_builder;
+
+/* Request being served by the server *
+ * v1 requests are one per connection and the body is read from the socket. *
+ * v2 requests are read as a whole frame, so requests pipelined on one *
+ * connection can be served concurrently and answered out of order */
+typedef struct
+{
+	int sockfd;				/* Client socket */
+	int server_sockfd;			/* Listening socket */
+	recv_buffer *rbuf;			/* v1 only: body is read from here */
+	unsigned char version;			/* Protocol version of the request */
+	unsigned char msg_id;
+	unsigned int request_id;		/* v2 only: echoed back in the response */
+	unsigned int msg_len;			/* Length of the message body */
+	unsigned char *payload;			/* v2 only: message body */
+	unsigned int offset;			/* v2 only: bytes of payload consumed */
+	pthread_mutex_t *send_mutex;		/* v2 only: serializes responses on the socket */
+	unsigned long long deadline;		/* CLOCK_MONOTONIC usec the client waits. 0 is none */
+	int sock_class;				/* Class of the listener it came on */
+} request_context;
+
+/* Shared-memory channel *
+ * Trusted middleware may map a memfd shared with the server and exchange *
+ * privilege checks through two single-producer single-consumer rings. *
+ * Indexes run freely and are masked with the ring size. A consumer sets *
+ * 'waiting' before it sleeps on the doorbell eventfd, and the producer *
+ * rings the doorbell only then, so busy rings cost no system call */
+typedef struct
+{
+	unsigned int tail;			/* Written by producer */
+	unsigned char pad1[60];
+	unsigned int head;			/* Written by consumer */
+	unsigned int waiting;			/* Consumer sleeps on doorbell */
+	unsigned char pad2[56];
+} shm_ring_index;
+
+typedef struct
+{
+	unsigned int request_id;
+	unsigned char msg_id;			/* CHECK_PRIVILEGE(_NEW)_REQUEST */
+	unsigned char padding[3];
+	int privilege;
+	unsigned char cookie[SECURITY_SERVER_COOKIE_LEN];
+	char object[MAX_OBJECT_LABEL_LEN + 1];
+	char access_rights[MAX_MODE_STR_LEN + 1];
+} shm_request_entry;
+
+typedef struct
+{
+	unsigned int request_id;
+	unsigned char return_code;
+	unsigned char padding[3];
+} shm_response_entry;
+
+typedef struct
+{
+	unsigned int magic;
+	unsigned int ring_size;
+	unsigned char pad[56];
+	shm_ring_index req_idx;			/* Client -> server */
+	shm_ring_index resp_idx;		/* Server -> client */
+	shm_request_entry req[SECURITY_SERVER_SHM_RING_SIZE];
+	shm_response_entry resp[SECURITY_SERVER_SHM_RING_SIZE];
+} shm_channel;
+
+/* Revocation event *
+ * Pushed to subscribed middleware for every deleted cookie, as one write, *
+ * so a subscriber reads whole events only
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x2b |      Message Length = 24      |
+ * |---------------------------------------------------------------|
+ * |                                                               |
+ * |                                                               |
+ * |                      Cookie (20bytes)                         |
+ * |                                                               |
+ * |                                                               |
+ * |---------------------------------------------------------------|
+ * |                              PID                              |
+ * |---------------------------------------------------------------|
+ */
+typedef struct
+{
+	basic_header hdr;
+	unsigned char cookie[SECURITY_SERVER_COOKIE_LEN];
+	int pid;
+} revocation_event;
+
 /* Message Types */
 #define SECURITY_SERVER_MSG_TYPE_COOKIE_REQUEST		0x01
 #define SECURITY_SERVER_MSG_TYPE_COOKIE_RESPONSE	0x02
@@ -65,6 +200,21 @@ typedef struct
 #define SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_RESPONSE  0x1a
 #define SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_REQUEST    0x1b
 #define SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_RESPONSE   0x1c
+#define SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_REQUEST	0x1d
+#define SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_RESPONSE	0x1e
+#define SECURITY_SERVER_MSG_TYPE_GET_STATS_REQUEST	0x1f
+#define SECURITY_SERVER_MSG_TYPE_GET_STATS_RESPONSE	0x20
+#define SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_REQUEST	0x21
+#define SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_RESPONSE	0x22
+#define SECURITY_SERVER_MSG_TYPE_DEADLINE		0x23	/* Precedes a request. No response */
+#define SECURITY_SERVER_MSG_TYPE_HANDOFF_REQUEST	0x24
+#define SECURITY_SERVER_MSG_TYPE_HANDOFF_RESPONSE	0x25
+#define SECURITY_SERVER_MSG_TYPE_COOKIE_RECORD		0x26	/* Follows handoff response */
+#define SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_REQUEST	0x27
+#define SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_RESPONSE	0x28
+#define SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_REQUEST	0x29
+#define SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_RESPONSE	0x2a
+#define SECURITY_SERVER_MSG_TYPE_REVOCATION_EVENT	0x2b	/* Pushed after subscribe response */
 #define SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE	0xff
 
 /* Return code */
@@ -83,21 +233,44 @@ typedef struct
 #define SECURITY_SERVER_RETURN_CODE_PASSWORD_REUSED	0x0c
 #define SECURITY_SERVER_RETURN_CODE_PASSWORD_RETRY_TIMER	0x0d
 #define SECURITY_SERVER_RETURN_CODE_SERVER_ERROR	0x0e
+#define SECURITY_SERVER_RETURN_CODE_BUSY		0x0f
 
 int return_code_to_error_code(int ret_code);
+int create_server_socket(int *sockfd, const char *path, int type);
+int get_listen_fds(int *fds, int max);
+int adopt_server_socket(int *sockfd, int *fds, int num_fds, const char *path, int type);
 int create_new_socket(int *sockfd);
 int safe_server_sock_close(int client_sockfd);
+int connect_to_server_class(int *fd, int sock_class, int type);
+int connect_to_server_type(int *fd, int type);
 int connect_to_server(int *fd);
-int accept_client(int server_sockfd);
+int accept_client(const int *server_sockfds, int num_sockfds, const int *event_fds, int num_event_fds,
+		int *listener);
 int authenticate_client_application(int sockfd, int *pid, int *uid);
 int authenticate_client_middleware(int sockfd, int *pid);
 int authenticate_developer_shell(int sockfd);
 char *read_cmdline_from_proc(pid_t pid);
-int send_generic_response (int sockfd, unsigned char msgid, unsigned char return_code);
-int send_cookie(int sockfd, unsigned char *cookie);
-int send_object_name(int sockfd, char *obj);
-int send_gid(int sockfd, int gid);
+int search_middleware_cmdline(char *cmdline);
+void init_msg_builder(msg_builder *msg);
+void append_msg(msg_builder *msg, const void *data, int len);
+void append_msg_fds(msg_builder *msg, const int *fds, int nfds);
+int send_msg(int sockfd, msg_builder *msg);
+int send_response(request_context *req, unsigned char msgid, unsigned char return_code,
+	const void *data, unsigned int data_len);
+int send_response_fds(request_context *req, unsigned char msgid, unsigned char return_code,
+	const void *data, unsigned int data_len, const int *fds, int nfds);
+int send_generic_response (request_context *req, unsigned char msgid, unsigned char return_code);
+int send_cookie(request_context *req, unsigned char *cookie);
+int send_object_name(request_context *req, char *obj);
+int send_gid(request_context *req, int gid);
+int send_deadline(int sock_fd, unsigned long long deadline);
 int send_cookie_request(int sock_fd);
+int send_shm_channel_request(int sock_fd);
+int send_handoff_request(int sock_fd);
+int send_subscribe_revocation_request(int sock_fd);
+int recv_revocation_event(int sockfd, revocation_event *event);
+int send_cookie_record(int sock_fd, const cookie_snapshot_entry *cookie);
+int recv_cookie_record(recv_buffer *rbuf, cookie_list **cookie);
 int send_gid_request(int sock_fd, const char* object);
 int send_object_name_request(int sock_fd, int gid);
 int send_privilege_check_request(int sock_fd, const char*cookie, int gid);
@@ -110,27 +283,54 @@ int recv_get_object_name(int sockfd, response_header *hdr, char *object, int max
 int recv_cookie(int sockfd, response_header *hdr, char *cookie);
 int recv_privilege_check_response(int sockfd, response_header *hdr);
 int recv_privilege_check_new_response(int sockfd, response_header *hdr);
-int recv_hdr(int client_sockfd, basic_header *basic_hdr);
-int recv_check_privilege_request(int sockfd, unsigned char *requested_cookie, int *requested_privilege);
-int recv_check_privilege_new_request(int sockfd,
+void init_recv_buffer(recv_buffer *rbuf, int sockfd, int type);
+int recv_buffered(recv_buffer *rbuf, void *buf, int len);
+int recv_hdr(recv_buffer *rbuf, basic_header *basic_hdr);
+int recv_hdr_v2(recv_buffer *rbuf, const basic_header *basic_hdr, basic_header_v2 *hdr);
+int recv_request_data(request_context *req, void *buf, int len);
+int recv_check_privilege_request(request_context *req, unsigned char *requested_cookie, int *requested_privilege);
+int recv_check_privilege_new_request(request_context *req,
                                      unsigned char *requested_cookie,
                                      char *object_label,
                                      char *access_rights);
 int send_pid_request(int sock_fd, const char*cookie);
+int send_prepare_cookie_request(int sock_fd, int pid);
 int recv_pid_response(int sockfd, response_header *hdr, int *pid);
-int recv_pid_request(int sockfd, unsigned char *requested_cookie);
-int send_pid(int sockfd, int pid);
+int recv_pid_request(request_context *req, unsigned char *requested_cookie);
+int recv_prepare_cookie_request(request_context *req, int *pid);
+int recv_deadline(request_context *req, unsigned long long *deadline);
+int peek_deadline(int sockfd, unsigned long long *deadline);
+int send_pid(request_context *req, int pid);
 int send_launch_tool_request(int sock_fd, int argc, const char **argv);
 int recv_generic_response(int sockfd, response_header *hdr);
-int recv_launch_tool_request(int sockfd, int argc, char *argv[]);
+int recv_response(int sockfd, response_header *hdr, void *body, int max_body_len);
+int recv_response_fds(int sockfd, response_header *hdr, void *body, int max_body_len,
+	int *fds, int *nfds);
+int recv_launch_tool_request(request_context *req, int argc, char *argv[]);
 int recv_pwd_response(int sockfd, response_header *hdr, unsigned int *current_attempts,
 	unsigned int *max_attempts, unsigned int *valid_days);
+int send_pwd_response(request_context *req,
+	const unsigned char msg_id,
+	const unsigned char return_code,
+	const unsigned int current_attempts,
+	const unsigned int max_attempts,
+	const unsigned int expire_time);
 int send_set_pwd_request(int sock_fd, const char*cur_pwd, const char*new_pwd,
 	const unsigned int max_challenge, const unsigned int valid_period_in_days);
 int send_set_pwd_validity_request(int sock_fd, const unsigned int valid_period_in_days);
 int send_set_pwd_max_challenge_request(int sock_fd, const unsigned int max_challenge);
 int send_chk_pwd_request(int sock_fd, const char*challenge);
 int check_socket_poll(int sockfd, int event, int timeout);
+unsigned long long set_client_deadline(int timeout_ms);
+void restore_client_deadline(unsigned long long deadline);
+int client_poll_timeout(void);
+int client_has_deadline(void);
+int shm_push_request(shm_channel *ch, const shm_request_entry *entry);
+int shm_pop_request(shm_channel *ch, shm_request_entry *entry);
+int shm_push_response(shm_channel *ch, const shm_response_entry *entry);
+int shm_pop_response(shm_channel *ch, shm_response_entry *entry);
+void shm_ring_notify(shm_ring_index *idx, int efd);
+int shm_ring_wait(shm_ring_index *idx, int efd, int ctl_sockfd, int timeout);
 int free_argv(char **argv, int argc);
 
 #endif
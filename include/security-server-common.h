@@ -51,10 +51,16 @@
 #define SECURITY_SERVER_ERROR_FILE_OPERATION		-22
 #define SECURITY_SERVER_ERROR_TIMEOUT			-23
 #define SECURITY_SERVER_ERROR_POLL			-24
+#define SECURITY_SERVER_ERROR_SERVER_BUSY		-25
 #define SECURITY_SERVER_ERROR_UNKNOWN			-255
 
 /* Miscellaneous Definitions */
 #define SECURITY_SERVER_SOCK_PATH			"/tmp/.security_server.sock"
+#define SECURITY_SERVER_SEQPACKET_SOCK_PATH		"/tmp/.security_server_seq.sock"
+#define SECURITY_SERVER_MIDDLEWARE_SOCK_PATH		"/tmp/.security_server_mw.sock"
+#define SECURITY_SERVER_MIDDLEWARE_SEQPACKET_SOCK_PATH	"/tmp/.security_server_mw_seq.sock"
+#define SECURITY_SERVER_PASSWORD_SOCK_PATH		"/tmp/.security_server_pwd.sock"
+#define SECURITY_SERVER_PASSWORD_SEQPACKET_SOCK_PATH	"/tmp/.security_server_pwd_seq.sock"
 #define SECURITY_SERVER_DEFAULT_COOKIE_PATH		"/tmp/.security_server.coo"
 #define SECURITY_SERVER_DAEMON_PATH			"/usr/bin/security-server"
 #define SECURITY_SERVER_COOKIE_LEN			20
@@ -64,7 +70,32 @@
 #define SECURITY_SERVER_MAX_OBJ_NAME			30
 #define SECURITY_SERVER_MAX_PATH_LEN			50
 #define SECURITY_SERVER_MSG_VERSION			0x01
+#define SECURITY_SERVER_MSG_VERSION_2			0x02
+#define SECURITY_SERVER_MAX_MSG_LEN			0x100000
+#define SECURITY_SERVER_MAX_PIPELINED_REQUESTS		8
+#define SECURITY_SERVER_PIPELINE_THREADS		4	/* Shared by all v2 connections */
+#define SECURITY_SERVER_PIPELINE_QUEUE			32
+#define SECURITY_SERVER_RECV_BUFFER_LEN			4096
+#define SECURITY_SERVER_MSG_MAX_IOV			8
+#define SECURITY_SERVER_MAX_LISTENERS			6	/* Stream and SOCK_SEQPACKET per class */
+#define SECURITY_SERVER_MAX_EVENT_FDS			4	/* Polled by accept loop besides listeners */
+#define SECURITY_SERVER_LISTEN_FDS_START		3	/* First socket passed by init system */
+#define SECURITY_SERVER_MAX_LISTEN_FDS			16
+#define SECURITY_SERVER_MSG_MAX_FDS			6	/* Listeners of a handoff */
+#define SECURITY_SERVER_SHM_RING_SIZE			64	/* Power of two */
+#define SECURITY_SERVER_SHM_MAGIC			0x53534348
+#define SECURITY_SERVER_MAX_SHM_CHANNELS		16
+#define SECURITY_SERVER_MAX_SUBSCRIBERS			16	/* Revocation streams */
+
+/* Transport used by the client library. SOCK_SEQPACKET keeps message *
+ * boundaries, so each request and response is one datagram */
+#ifdef SECURITY_SERVER_USE_SEQPACKET
+#define SECURITY_SERVER_CLIENT_SOCK_TYPE		SOCK_SEQPACKET
+#else
+#define SECURITY_SERVER_CLIENT_SOCK_TYPE		SOCK_STREAM
+#endif
 #define SECURITY_SERVER_ACCEPT_TIMEOUT_MILISECOND	10000
+#define SECURITY_SERVER_IDLE_TIMEOUT_MILISECOND		10000
 #define SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND	3000
 #define SECURITY_SERVER_DEVELOPER_UID			5100
 #define SECURITY_SERVER_DEBUG_TOOL_PATH			"/usr/bin/debug-util"
@@ -76,7 +107,44 @@
 #define SECURITY_SERVER_HASHED_PWD_LEN			32  /* SHA256 */
 #define SECURITY_SERVER_PASSWORD_RETRY_TIMEOUT_SECOND		1
 #define SECURITY_SERVER_MAX_PASSWORD_HISTORY	50
-#define SECURITY_SERVER_NUM_THREADS			10
+
+/* Listening socket classes *
+ * Each class has its own sockets, accept queue and worker threads, so a *
+ * burst of app requests can't hold up middleware. The app class sockets *
+ * are the original ones and still serve any request for old clients */
+#define SECURITY_SERVER_SOCK_CLASS_APP			0	/* Cookie, gid, object name, tool */
+#define SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE		1	/* Privilege checks, cookie PID, util */
+#define SECURITY_SERVER_SOCK_CLASS_PASSWORD		2
+#define SECURITY_SERVER_NUM_SOCK_CLASSES		3
+#define SECURITY_SERVER_APP_THREADS			10
+#define SECURITY_SERVER_MIDDLEWARE_THREADS		6
+#define SECURITY_SERVER_PASSWORD_THREADS		2
+#define SECURITY_SERVER_NUM_THREADS			(SECURITY_SERVER_APP_THREADS + \
+		SECURITY_SERVER_MIDDLEWARE_THREADS + SECURITY_SERVER_PASSWORD_THREADS)
+#define SECURITY_SERVER_APP_BACKLOG			64
+#define SECURITY_SERVER_MIDDLEWARE_BACKLOG		32
+#define SECURITY_SERVER_PASSWORD_BACKLOG		8
+
+/* Admission control *
+ * Connections wait in a queue of their class for a worker. Ones that don't *
+ * fit or wait too long get SECURITY_SERVER_RETURN_CODE_BUSY before their *
+ * request is read, so clients can always retry them */
+#define SECURITY_SERVER_APP_QUEUE			32
+#define SECURITY_SERVER_MIDDLEWARE_QUEUE		16
+#define SECURITY_SERVER_PASSWORD_QUEUE			4
+#define SECURITY_SERVER_MAX_QUEUE			32
+#define SECURITY_SERVER_QUEUE_TIMEOUT_MILISECOND	1000
+#define SECURITY_SERVER_BUSY_RETRIES			3
+#define SECURITY_SERVER_BUSY_RETRY_MILISECOND		20	/* Doubled on each retry */
+
+/* Restart without downtime. A new server started with -u takes the listening *
+ * sockets and cookies from the running one, which stops accepting and waits *
+ * up to this long for its workers before handing them over */
+#define SECURITY_SERVER_HANDOFF_DRAIN_MILISECOND	1000
+
+/* While middleware is subscribed to revocations, cookies of exited *
+ * processes are reaped this often instead of on the next lookup */
+#define SECURITY_SERVER_REAPER_MILISECOND		1000
 
 /* API prefix */
 #ifndef SECURITY_SERVER_API
@@ -93,9 +161,13 @@ typedef struct _cookie_list
 	int		path_len;				/* Client process cmd line length */
 	int		permission_len;				/* Client process permissions (aka group IDs) */
 	pid_t		pid;					/* Client process's PID */
+	unsigned long long	start_time;			/* Client process's start time. With pid, identifies it */
 	char		*path;					/* Client process's cmd line string */
 	int		*permissions;				/* Array of GID that the client process has */
         char            *smack_label;                           /* SMACK label of the client process */
+	int		store_record;				/* 1 + index in cookie store, 0 for none */
+	int		provisional;				/* Prepared by the launcher, not asked by the process yet */
+	unsigned int	seq;					/* Increases along the list. Cursor of cookie dumps */
 	struct _cookie_list	*prev;				/* Next cookie list */
 	struct _cookie_list	*next;				/* Previous cookie list */
 } cookie_list;
@@ -114,7 +186,12 @@ void printhex(const unsigned char *data, int size);
 #elif SECURITY_SERVER_DEBUG_DLOG	/* debug msg will be printed by dlog daemon */
 #define LOG_TAG "SECURITY_SERVER"
 #include <dlog.h>
+#ifdef SECURITY_SERVER_ASYNC_LOG	/* Formatted and sent to dlog by a logger thread */
+#include "security-server-log.h"
+#define SEC_SVR_DBG(FMT, ARG ...) SEC_SVR_LOG(SECURITY_SERVER_LOG_DEBUG, FMT, ##ARG)
+#else
 #define SEC_SVR_DBG	SLOGD
+#endif
 #else /* No debug output */
 #define SEC_SVR_DBG(FMT, ARG ...) {}
 #endif
@@ -0,0 +1,85 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_CONFIG_H
+#define SECURITY_SERVER_CONFIG_H
+
+#include <sys/types.h>
+
+/* Runtime configuration *
+ * Defaults are the paths in security-server-common.h. A config file can move *
+ * all of them under a sandbox directory, so tests and benchmarks can run the *
+ * real server without root. The file is given by SECURITY_SERVER_CONFIG *
+ * environment variable, which the client library also reads to find the *
+ * sockets, or by -c option of security-server. The variable is ignored in *
+ * setuid, setgid and capability-raised processes.
+ *
+ * Config file format: one "key = value" per line, '#' starts a comment
+ *  root             prefix of all default paths below except proc
+ *  socket           stream socket path
+ *  seqpacket_socket SOCK_SEQPACKET socket path
+ *  mw_socket, mw_seqpacket_socket     sockets of middleware requests
+ *  pwd_socket, pwd_seqpacket_socket   sockets of password requests
+ *  default_cookie   stored default cookie
+ *  mw_list          middleware list
+ *  data_dir         password data directory
+ *  group_file       group database (/etc/group)
+ *  proc             proc file system (/proc)
+ *  privileged_uid   UID of the server and middleware daemons, or "self" (0)
+ *  smack            "real" or "stub" (real)
+ *  smack_label      label of every peer with the stub backend (_)
+ *  smack_rules      "subject object access" rules of the stub backend.
+ *                   Without it, the stub allows everything
+ *  cookie_store     file keeping cookies over a server restart, on tmpfs.
+ *                   Cookies are in memory only without it
+ */
+
+#define SECURITY_SERVER_CONFIG_ENV		"SECURITY_SERVER_CONFIG"
+#define SECURITY_SERVER_MAX_CONFIG_PATH		256
+#define SECURITY_SERVER_MAX_SOCK_PATH		108	/* sun_path */
+#define SECURITY_SERVER_GROUP_FILE_PATH		"/etc/group"
+#define SECURITY_SERVER_PROC_PATH		"/proc"
+
+typedef struct
+{
+	char	sock_path[SECURITY_SERVER_MAX_SOCK_PATH];
+	char	seqpacket_sock_path[SECURITY_SERVER_MAX_SOCK_PATH];
+	char	mw_sock_path[SECURITY_SERVER_MAX_SOCK_PATH];
+	char	mw_seqpacket_sock_path[SECURITY_SERVER_MAX_SOCK_PATH];
+	char	pwd_sock_path[SECURITY_SERVER_MAX_SOCK_PATH];
+	char	pwd_seqpacket_sock_path[SECURITY_SERVER_MAX_SOCK_PATH];
+	char	default_cookie_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	middleware_list_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	data_directory_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	group_file_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	proc_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	smack_label[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	smack_rules_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	char	cookie_store_path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	uid_t	privileged_uid;
+	int	smack_stub;
+} security_server_config;
+
+const security_server_config *get_config(void);
+const char *get_sock_path(int sock_class, int type);
+int load_config(const char *filename);
+
+#endif
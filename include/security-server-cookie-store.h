@@ -0,0 +1,76 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_COOKIE_STORE_H
+#define SECURITY_SERVER_COOKIE_STORE_H
+
+#include "security-server-common.h"
+
+/* Persistent cookie store *
+ * Optional copy of the cookie list in a file of fixed size records, mapped *
+ * shared and updated in place as cookies are created and deleted. It's meant *
+ * to be on tmpfs, so it lives as long as the system but not the server. A *
+ * restarted server scans it and keeps the cookies of processes that still *
+ * run with the same start time, so applications don't have to request them *
+ * again. PIDs and start times repeat across boots, so a store written in *
+ * another boot is cleared. Cookies whose fields don't fit a record are kept *
+ * in memory only */
+
+#define SECURITY_SERVER_STORE_MAGIC		0x53534353
+#define SECURITY_SERVER_STORE_VERSION		3
+#define SECURITY_SERVER_STORE_RECORDS		1024
+#define SECURITY_SERVER_STORE_MAX_PATH		256
+#define SECURITY_SERVER_STORE_MAX_GROUPS	64
+#define SECURITY_SERVER_STORE_MAX_LABEL		256
+#define SECURITY_SERVER_STORE_BOOT_ID_LEN	40	/* UUID of /proc/sys/kernel/random/boot_id */
+
+typedef struct
+{
+	unsigned int	magic;
+	unsigned int	version;
+	unsigned int	record_size;
+	unsigned int	num_records;
+	char		boot_id[SECURITY_SERVER_STORE_BOOT_ID_LEN];	/* Boot the records were written in */
+} cookie_store_header;
+
+typedef struct
+{
+	unsigned int	in_use;					/* Set last, cleared first */
+	pid_t		pid;
+	unsigned long long	start_time;
+	unsigned char	cookie[SECURITY_SERVER_COOKIE_LEN];
+	int		path_len;
+	int		permission_len;
+	int		label_len;
+	char		path[SECURITY_SERVER_STORE_MAX_PATH];
+	int		permissions[SECURITY_SERVER_STORE_MAX_GROUPS];
+	char		smack_label[SECURITY_SERVER_STORE_MAX_LABEL];
+} cookie_store_record;
+
+/* All but cookie_store_open() do nothing without a store. Callers hold *
+ * cookie_mutex, or run before any worker */
+int cookie_store_open(const char *path);
+int cookie_store_load(cookie_list *c_list);
+void cookie_store_reset(void);
+void cookie_store_add(cookie_list *cookie);
+void cookie_store_remove(cookie_list *cookie);
+
+#endif
@@ -1,7 +1,7 @@
 /*
  *  security-server
  *
- *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
  *
  *  Contact: Bumjin Im <bj.im@samsung.com>
  *
@@ -19,11 +19,35 @@
  *
  */
 
-#ifndef SECURITY_SERVER_COOKIE_H
-#define SECURITY_SERVER_COOKIE_H
-
-#include "security-server-common.h"
-
+#ifndef SECURITY_SERVER_COOKIE_H
+#define SECURITY_SERVER_COOKIE_H
+
+#include "security-server-common.h"
+
+/* Read-only copy of cookies *
+ * Diagnostic paths take a snapshot under cookie_mutex and work on it after *
+ * the lock is released, so slow readers never hold up privilege checks. *
+ * Only the cookies to be sent are copied, a page at a time for dumps */
+typedef struct
+{
+	unsigned char	cookie[SECURITY_SERVER_COOKIE_LEN];
+	int		path_len;
+	int		permission_len;
+	int		label_len;
+	pid_t		pid;
+	unsigned int	seq;
+	unsigned long long	start_time;
+	char		*path;				/* Points into the snapshot */
+	int		*permissions;			/* Points into the snapshot */
+	char		*smack_label;			/* Points into the snapshot. No terminator */
+} cookie_snapshot_entry;
+
+typedef struct
+{
+	int		num;				/* Number of entries */
+	cookie_snapshot_entry	*entries;
+} cookie_snapshot;
+
 int free_cookie_item(cookie_list *cookie);
 cookie_list *delete_cookie_item(cookie_list *cookie);
 cookie_list *search_existing_cookie(int pid, const cookie_list *c_list);
@@ -35,8 +59,14 @@ cookie_list *search_cookie_new(const cookie_list *c_list,
 int generate_random_cookie(unsigned char *cookie, int size);
 cookie_list *create_cookie_item(int pid, int sockfd, cookie_list *c_list);
 cookie_list *create_default_cookie(void);
+cookie_list *restore_cookie_item(cookie_list *cookie, cookie_list *c_list);
+int read_start_time_from_proc(pid_t pid, unsigned long long *start_time);
 cookie_list * garbage_collection(cookie_list *cookie);
+void reap_cookies(cookie_list *c_list);
 cookie_list *search_cookie_from_pid(cookie_list *c_list, int pid);
-void printhex(const unsigned char *data, int size);
-
-#endif
+void printhex(const unsigned char *data, int size);
+cookie_snapshot *copy_cookies(const cookie_list *first, int max);
+cookie_snapshot *snapshot_cookie(const cookie_list *cookie);
+void release_cookie_snapshot(cookie_snapshot *snapshot);
+
+#endif
@@ -0,0 +1,31 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+
+#ifndef SECURITY_SERVER_GROUP_H
+#define SECURITY_SERVER_GROUP_H
+
+/* Group database lookups. Privileges are group IDs and objects are group *
+ * names, both read from the group file on every call */
+int search_object_name(int gid, char *obj, int obj_size);
+int search_gid(const char *obj);
+
+#endif
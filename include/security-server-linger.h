@@ -0,0 +1,53 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_LINGER_H
+#define SECURITY_SERVER_LINGER_H
+
+/* Lingering close of client connections *
+ * After the response is written, the server waits for the client to close *
+ * first, so the response is not lost to a reset. Workers hand the socket *
+ * over and return at once. An epoll set owned by the accept loop closes it *
+ * when the peer hangs up or SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND has *
+ * passed, whichever comes first */
+
+#define SECURITY_SERVER_LINGER_MAX		256	/* Oldest is closed when full */
+
+/* Idle v2 connections are parked in the same set between requests, so *
+ * they don't keep a worker. The accept loop takes one back when its next *
+ * request comes, as if it had been just accepted. It's closed when the *
+ * peer hangs up or SECURITY_SERVER_IDLE_TIMEOUT_MILISECOND has passed */
+#define SECURITY_SERVER_PARKED_MAX		256	/* Oldest is closed when full */
+
+typedef struct
+{
+	int	sockfd;
+	int	server_sockfd;
+	int	sock_type;
+	int	sock_class;
+} parked_conn;
+
+int linger_init(int *event_fd);
+void linger_close(int sockfd);
+int linger_park(const parked_conn *conn);
+int linger_process(parked_conn *ready, int max);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_LOG_H
+#define SECURITY_SERVER_LOG_H
+
+/* Asynchronous logger of security-server *
+ * Log calls copy format pointer and arguments into a ring buffer owned by *
+ * the calling thread. A background thread formats the records and sends *
+ * them to dlog, so request threads pay neither formatting nor IPC */
+
+/* Log levels */
+#define SECURITY_SERVER_LOG_NONE		0
+#define SECURITY_SERVER_LOG_ERROR		1
+#define SECURITY_SERVER_LOG_INFO		2
+#define SECURITY_SERVER_LOG_DEBUG		3
+
+#define SECURITY_SERVER_LOG_RINGS		128	/* Threads logging at a time */
+#define SECURITY_SERVER_LOG_RING_SIZE		32	/* Records per thread. Power of two */
+#define SECURITY_SERVER_LOG_MAX_ARGS		8
+#define SECURITY_SERVER_LOG_STR_LEN		176	/* Space for copied string arguments */
+
+/* Call site of a log statement. Lives in static storage */
+typedef struct
+{
+	const char	*fmt;
+	const char	*file;
+	const char	*func;
+	int		line;
+} log_site;
+
+extern int security_server_log_level;
+
+#define SEC_SVR_LOG(LEVEL, FMT, ARG ...) do { \
+	static const log_site __log_site = { FMT, __FILE__, __func__, __LINE__ }; \
+	if(__atomic_load_n(&security_server_log_level, __ATOMIC_RELAXED) >= (LEVEL)) \
+		security_server_log(&__log_site, ##ARG); \
+	if(0) \
+		log_check_format(FMT, ##ARG); \
+} while(0)
+
+void security_server_log(const log_site *site, ...);
+int log_init(void);
+int log_set_level(int level);
+
+/* Never called. Lets the compiler check arguments against the format */
+static inline void __attribute__((format(printf, 1, 2))) log_check_format(const char *fmt, ...)
+{
+	(void)fmt;
+}
+
+#endif
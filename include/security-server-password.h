@@ -25,13 +25,17 @@
 #include "security-server-common.h"
 #include "security-server-comm.h"
 
-int process_valid_pwd_request(int sockfd);
-int process_set_pwd_request(int sockfd);
-int process_reset_pwd_request(int sockfd);
-int process_reset_pwd_request(int sockfd);
-int process_chk_pwd_request(int sockfd);
-int process_set_pwd_max_challenge_request(int sockfd);
-int process_set_pwd_validity_request(int sockfd);
+int process_valid_pwd_request(request_context *req);
+int process_set_pwd_request(request_context *req);
+int process_reset_pwd_request(request_context *req);
+int process_reset_pwd_request(request_context *req);
+int process_chk_pwd_request(request_context *req);
+int process_set_pwd_max_challenge_request(request_context *req);
+int process_set_pwd_validity_request(request_context *req);
+int process_set_pwd_history_request(request_context *req);
 int init_try(void);
+int load_password(unsigned char *cur_pwd, unsigned int *max_attempt, unsigned int *expire_time);
+int set_history(int num);
+int check_history(const unsigned char *requested_pwd);
 
 #endif
@@ -0,0 +1,58 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_PROBES_H
+#define SECURITY_SERVER_PROBES_H
+
+/* Static probe points for perf and bpftrace *
+ * With <sys/sdt.h> each probe is a single NOP plus a note in the ELF file *
+ * telling the tracer where the arguments are. Nothing else runs unless a *
+ * tracer is attached. Provider name is "security_server". *
+ * Sample scripts are in tools/bpftrace.
+ *
+ * request__accept(sockfd, listener)
+ * request__header(sockfd, version, msg_id, request_id, msg_len)
+ * handler__start(msg_id, request_id)
+ * handler__end(msg_id, request_id, usec)
+ * cookie__lock(wait_usec)
+ * cookie__unlock()
+ * cookie__gc(pid)
+ * smack__access(pid, subject, object, access, result)
+ * password__io__start(path, write)
+ * password__io__end(path, write, retval)
+ */
+
+#ifdef SECURITY_SERVER_USDT
+#include <sys/sdt.h>
+#define SEC_SVR_PROBE(NAME)				DTRACE_PROBE(security_server, NAME)
+#define SEC_SVR_PROBE1(NAME, A1)			DTRACE_PROBE1(security_server, NAME, A1)
+#define SEC_SVR_PROBE2(NAME, A1, A2)			DTRACE_PROBE2(security_server, NAME, A1, A2)
+#define SEC_SVR_PROBE3(NAME, A1, A2, A3)		DTRACE_PROBE3(security_server, NAME, A1, A2, A3)
+#define SEC_SVR_PROBE5(NAME, A1, A2, A3, A4, A5)	DTRACE_PROBE5(security_server, NAME, A1, A2, A3, A4, A5)
+#else
+#define SEC_SVR_PROBE(NAME)				do {} while(0)
+#define SEC_SVR_PROBE1(NAME, A1)			do {} while(0)
+#define SEC_SVR_PROBE2(NAME, A1, A2)			do {} while(0)
+#define SEC_SVR_PROBE3(NAME, A1, A2, A3)		do {} while(0)
+#define SEC_SVR_PROBE5(NAME, A1, A2, A3, A4, A5)	do {} while(0)
+#endif
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_REVOKE_H
+#define SECURITY_SERVER_REVOKE_H
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+
+/* Cookie revocation stream *
+ * A middleware daemon caching access decisions subscribes on a connection *
+ * it keeps open, and gets (cookie, PID) of every cookie deleted after the *
+ * subscribe response. Events are written without blocking, since cookies *
+ * are deleted under cookie_mutex. A subscriber that falls behind is *
+ * disconnected instead, and must drop its cache as it has missed events. *
+ * A handoff disconnects every subscriber the same way */
+
+int process_subscribe_revocation_request(request_context *req);
+void revoke_notify(const cookie_list *cookie);
+void revoke_wait_subscribers(int timeout);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_SMACK_H
+#define SECURITY_SERVER_SMACK_H
+
+/* SMACK backend *
+ * Goes to libsmack, or to a stub when config says "smack = stub", so the *
+ * server can run on kernels without SMACK. Same return values as libsmack */
+
+int label_from_socket(int sockfd, char **label);
+int label_from_process(int pid, char **label);
+int label_have_access(const char *subject, const char *object, const char *access_rights);
+int label_server_socket(int sockfd);
+
+#endif
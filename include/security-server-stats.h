@@ -0,0 +1,55 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#ifndef SECURITY_SERVER_STATS_H
+#define SECURITY_SERVER_STATS_H
+
+#include <pthread.h>
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+
+/* Stats rows *
+ * Requests have odd message IDs, so row of a request is msg_id >> 1. *
+ * Other rows count time spent outside of handlers */
+#define SECURITY_SERVER_STATS_MSG_ROWS		0x40	/* Message IDs below 0x80 */
+#define SECURITY_SERVER_STAT_OTHER_MSG		0x40	/* Any other message ID */
+#define SECURITY_SERVER_STAT_THREAD_SLOT	0x41	/* Accepted connection waiting for a thread */
+#define SECURITY_SERVER_STAT_COOKIE_MUTEX	0x42	/* Waiting for cookie_mutex, if it was taken */
+#define SECURITY_SERVER_STAT_PROC_READ		0x43	/* Reading /proc for a cookie */
+#define SECURITY_SERVER_STAT_LINGER		0x44	/* Client closing the connection after response */
+#define SECURITY_SERVER_STAT_SHED		0x45	/* Answered busy, after waiting in queue */
+#define SECURITY_SERVER_STAT_EXPIRED		0x46	/* Dropped after the client deadline, time past it */
+#define SECURITY_SERVER_NUM_STATS		0x47
+
+/* Log-linear latency histogram in microseconds. 0-3us have a bucket each, *
+ * then every power of two is split in 4. Last bucket takes everything above */
+#define SECURITY_SERVER_STATS_BUCKETS		80
+#define SECURITY_SERVER_STATS_SHARDS		4
+
+unsigned long long stats_clock(void);
+void stats_record(int stat, unsigned long long start);
+void stats_record_request(unsigned char msg_id, unsigned long long start);
+void stats_lock(pthread_mutex_t *mutex);
+void stats_unlock(pthread_mutex_t *mutex);
+int process_stats_request(request_context *req);
+
+#endif
@@ -22,6 +22,9 @@
 #ifndef SECURITY_SERVER_UTIL_H
 #define SECURITY_SERVER_UTIL_H
 
+#include "security-server-common.h"
+#include "security-server-comm.h"
+
 /* Only for test */
 /* These msg type MUST BE REMOVED before release **************************/
 #define SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_REQUEST	0x51
@@ -29,11 +32,12 @@
 #define SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_PID_REQUEST	0x53
 #define SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE	0x54
 #define SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_COOKIE_REQUEST	0x55
+#define SECURITY_SERVER_COOKIE_PAGE_LEN		0x4000	/* Fits v1 message length */
 /**********************************************************************/
 
-int util_process_all_cookie(int sockfd, cookie_list* list);
-int util_process_cookie_from_pid(int sockfd, cookie_list* list);
-int util_process_cookie_from_cookie(int sockfd, cookie_list* list);
+int util_process_all_cookie(request_context *req, cookie_list* list);
+int util_process_cookie_from_pid(request_context *req, cookie_list* list);
+int util_process_cookie_from_cookie(request_context *req, cookie_list* list);
 
 
 #endif
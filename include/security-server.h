@@ -124,6 +124,12 @@
 /*! \brief   indicating password retry timeout is not occurred yet  */
 #define SECURITY_SERVER_API_ERROR_PASSWORD_REUSED	-20
 
+/*! \brief   indicating the server didn't answer before the timeout of a *_with_timeout API */
+#define SECURITY_SERVER_API_ERROR_TIMEOUT		-23
+
+/*! \brief   indicating the server is overloaded. Retried a few times by the library */
+#define SECURITY_SERVER_API_ERROR_SERVER_BUSY		-25
+
 /*! \brief   indicating the error with unknown reason */
 #define SECURITY_SERVER_API_ERROR_UNKNOWN		-255
 /** @}*/
@@ -450,6 +456,132 @@ int security_server_check_privilege_by_sockfd(int sockfd,
                                               const char *object,
                                               const char *access_rights);
 
+/**
+ * \par Description:
+ * Variants of the APIs above that give up after timeout_ms milliseconds.
+ *
+ * \par Method of function operation:
+ * The deadline covers connecting, retries while the server is busy and waiting for the response. It is sent with the request, and Security Server drops the request without serving it when the deadline has passed before the request is started. Privilege checks through an open channel don't use the deadline.
+ *
+ * \par Sync (or) Async:
+ * These are Synchronous APIs.
+ *
+ * \param[in] timeout_ms Time to wait for the answer in milliseconds
+ *
+ * \return Same as the API without timeout, or SECURITY_SERVER_API_ERROR_TIMEOUT when the timeout has passed.
+ *
+ * \see security_server_get_gid(), security_server_get_object_name(), security_server_request_cookie(), security_server_check_privilege(), security_server_check_privilege_by_cookie(), security_server_get_cookie_pid()
+*/
+int security_server_get_gid_with_timeout(const char *object, int timeout_ms);
+int security_server_get_object_name_with_timeout(gid_t gid, char *object, size_t max_object_size,
+                                                 int timeout_ms);
+int security_server_request_cookie_with_timeout(char *cookie, size_t max_cookie, int timeout_ms);
+int security_server_check_privilege_with_timeout(const char *cookie, gid_t privilege, int timeout_ms);
+int security_server_check_privilege_by_cookie_with_timeout(const char *cookie,
+                                                           const char *object,
+                                                           const char *access_rights,
+                                                           int timeout_ms);
+
+/**
+ * \par Description:
+ * This API opens a shared-memory channel to Security Server for privilege checks.
+ *
+ * \par Purpose:
+ * This API may be used by middleware daemons which check privileges of many client requests.
+ *
+ * \par Typical use case:
+ * A middleware daemon opens the channel once at start-up. From then on, security_server_check_privilege() and security_server_check_privilege_by_cookie() are served through the channel instead of a new socket connection per call.
+ *
+ * \par Method of function operation:
+ * Security Server authenticates the caller as a middleware daemon and passes it a shared memory area and two event descriptors over the socket. Requests and responses are exchanged through rings in the shared memory. The event descriptors are written only when the other side sleeps, so no system call is made while the server is busy, and requests queued meanwhile are answered as one batch.
+ *
+ * \par Sync (or) Async:
+ * This is a Synchronous API.
+ *
+ * \par Important notes:
+ * Calling this API again while the channel is open does nothing.\n
+ * If Security Server stops answering, privilege checks go to the socket again. Calling this API then replaces the broken channel with a new one.\n
+ * A check with a deadline waits on the channel only until the deadline, and then returns timeout without breaking the channel.
+ *
+ * \return 0 on success, or negative error code on error.
+ *
+ * \par Prospective clients:
+ * Only pre-defiend middleware daemons
+ *
+ * \par Known issues/bugs:
+ * None
+ * \pre None
+ *
+ * \post None
+ *
+ * \see security_server_close_channel(), security_server_check_privilege(), security_server_check_privilege_by_cookie()
+ *
+ * \remarks None
+ *
+ * \par Sample code:
+ * \code
+ * #include <security-server.h>
+ * ...
+ * int retval;
+ *
+ * retval = security_server_open_channel();
+ * if(retval < 0)
+ * {
+ * 	printf("%s", "Privilege checks will use socket\n");
+ * }
+ * ...
+ * retval = security_server_check_privilege(recved_cookie, (gid_t)call_gid);
+ * ...
+ * security_server_close_channel();
+ *
+ * \endcode
+*/
+int security_server_open_channel(void);
+
+/**
+ * \par Description:
+ * This API closes the shared-memory channel opened by security_server_open_channel().
+ *
+ * \par Purpose:
+ * This API may be used by middleware daemons to release the channel.
+ *
+ * \par Typical use case:
+ * A middleware daemon closes the channel on exit, or to recover from a channel Security Server stopped answering.
+ *
+ * \par Method of function operation:
+ * Waits for privilege checks in flight on the channel and releases the shared memory and the connection. Security Server ends its side of the channel when the connection is closed.
+ *
+ * \par Sync (or) Async:
+ * This is a Synchronous API.
+ *
+ * \par Important notes:
+ * None
+ *
+ * \return 0 on success, or negative error code on error.
+ *
+ * \par Prospective clients:
+ * Only pre-defiend middleware daemons
+ *
+ * \par Known issues/bugs:
+ * None
+ * \pre None
+ *
+ * \post None
+ *
+ * \see security_server_open_channel()
+ *
+ * \remarks None
+ *
+ * \par Sample code:
+ * \code
+ * #include <security-server.h>
+ * ...
+ * security_server_close_channel();
+ *
+ * \endcode
+*/
+int security_server_close_channel(void);
+
 /**
  * \par Description:
  * This API searchs a cookie value and returns PID of the given cookie.
@@ -513,6 +645,169 @@ int security_server_check_privilege_by_sockfd(int sockfd,
 */
 int security_server_get_cookie_pid(const char *cookie);
 
+/* See security_server_get_gid_with_timeout() */
+int security_server_get_cookie_pid_with_timeout(const char *cookie, int timeout_ms);
+
+
+
+/**
+ * \par Description:
+ * This API asks Security Server to prepare the cookie of a process which has just been launched.
+ *
+ * \par Purpose:
+ * This API may be used by the application launcher so that the first security_server_request_cookie() of an application doesn't wait for the cookie to be made.
+ *
+ * \par Typical use case:
+ * The launcher spawns an application process, and calls this API with PID of the process. When the application calls security_server_request_cookie() later, its cookie is already there.
+ *
+ * \par Method of function operation:
+ * When Security Server receives this request, it responds at once and then creates the cookie of the given PID as security_server_request_cookie() would. If it fails, the cookie is created on the request of the application as usual.
+ *
+ * \par Sync (or) Async:
+ * This is an Asynchronous API. It returns before the cookie is created.
+ *
+ * \par Important notes:
+ * The cookie takes groups and SMACK label of the process at the time it's created. So call this API after the process has dropped its privileges and set its label.\n
+ * The prepared cookie is provisional until the application calls security_server_request_cookie(). If its groups or SMACK label have changed by then, a new cookie is made instead.\n
+ * This API is abled to be called only by pre-defined middleware servers.
+ *
+ * \param[in] pid PID of the launched process
+ *
+ * \return 0 on success, negative integer error code on error.
+ *
+ * \par Prospective clients:
+ * Application launcher
+ *
+ * \par Known issues/bugs:
+ * None
+ *
+ * \pre The process must be running.
+ *
+ * \post None
+ *
+ * \see security_server_request_cookie()
+ *
+ * \par Sample code:
+ * \code
+ * #include <security-server.h>
+ * ...
+ * pid_t pid;
+ * int retval;
+ *
+ * pid = fork();
+ * ... // Child sets its groups and label, and executes the application
+ *
+ * retval = security_server_prepare_cookie(pid);
+ * if(retval < 0)
+ * {
+ * 	printf("%s", "Error has occurred\n");
+ * }
+ * ...
+ * \endcode
+*/
+int security_server_prepare_cookie(int pid);
+
+
+
+/**
+ * \par Description:
+ * This API subscribes the caller to revocations of cookies.
+ *
+ * \par Purpose:
+ * This API may be used by middleware daemons which cache results of privilege checks or cookie PIDs.
+ *
+ * \par Typical use case:
+ * A middleware daemon caches the result of security_server_check_privilege() per cookie. It subscribes once at start-up, waits for the returned descriptor in its main loop, and drops the cached results of every cookie security_server_recv_revocation() reports.
+ *
+ * \par Method of function operation:
+ * Security Server authenticates the caller as a middleware daemon and keeps the connection open. Whenever a cookie is deleted because its process has gone, the cookie and its PID are written to the connection. While anyone is subscribed, Security Server looks for exited processes periodically, so revocations don't wait for the next request.
+ *
+ * \par Sync (or) Async:
+ * This is a Synchronous API.
+ *
+ * \par Important notes:
+ * Every cookie deleted after this API returns is reported. Cache only results received after that.\n
+ * If the caller reads too slowly, Security Server closes the connection. When security_server_recv_revocation() fails, drop the whole cache, close the descriptor and subscribe again.\n
+ * This API is abled to be called only by pre-defined middleware servers.
+ *
+ * \return Descriptor of the subscription on success, or negative error code on error.
+ *
+ * \par Prospective clients:
+ * Only pre-defiend middleware daemons
+ *
+ * \par Known issues/bugs:
+ * None
+ *
+ * \pre None
+ *
+ * \post Close the descriptor with close() to unsubscribe.
+ *
+ * \see security_server_recv_revocation()
+ *
+ * \par Sample code:
+ * \code
+ * #include <security-server.h>
+ * ...
+ * int fd, pid, retval;
+ * char cookie[20];
+ *
+ * fd = security_server_subscribe_revocation();
+ * ...
+ * // fd is readable
+ * retval = security_server_recv_revocation(fd, cookie, sizeof(cookie), &pid);
+ * if(retval < 0)
+ * {
+ * 	// Drop all cached results and subscribe again
+ * 	close(fd);
+ * 	...
+ * }
+ * ...
+ * \endcode
+*/
+int security_server_subscribe_revocation(void);
+
+/**
+ * \par Description:
+ * This API reads one revocation from the descriptor returned by security_server_subscribe_revocation().
+ *
+ * \par Purpose:
+ * This API may be used by middleware daemons to learn which cookie is no longer valid.
+ *
+ * \par Typical use case:
+ * A middleware daemon calls this API when the descriptor becomes readable, and drops what it has cached for the cookie.
+ *
+ * \par Method of function operation:
+ * Reads one event of fixed size from the descriptor.
+ *
+ * \par Sync (or) Async:
+ * This is a Synchronous API. It blocks until a revocation comes.
+ *
+ * \par Important notes:
+ * Any error means revocations may have been lost.
+ *
+ * \param[in] fd Descriptor returned by security_server_subscribe_revocation()
+ * \param[out] cookie Revoked cookie
+ * \param[in] max_cookie Size of the cookie buffer. It must be security_server_get_cookie_size() or more
+ * \param[out] pid PID the cookie was issued to
+ *
+ * \return 0 on success, or negative error code on error.
+ *
+ * \par Prospective clients:
+ * Only pre-defiend middleware daemons
+ *
+ * \par Known issues/bugs:
+ * None
+ *
+ * \pre None
+ *
+ * \post None
+ *
+ * \see security_server_subscribe_revocation()
+ *
+ * \remarks the cookie is not a null terminated string.
+*/
+int security_server_recv_revocation(int fd, char *cookie, size_t max_cookie, int *pid);
+
 
 
 /**
@@ -69,6 +69,8 @@ rm -f /etc/rc.d/rc5.d/S10security-server
 /usr/bin/security-server
 /usr/bin/sec-svr-util
 /usr/share/security-server/mw-list
+/usr/lib/systemd/system/security-server.service
+/usr/lib/systemd/system/security-server.socket
 
 
 %files -n libsecurity-server-client
@@ -26,11 +26,16 @@
 #include <errno.h>
 #include <unistd.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/smack.h>
 
 #include "security-server.h"
 #include "security-server-common.h"
 #include "security-server-comm.h"
+#include "security-server-smack.h"
 
 #if 0
 void printhex(unsigned char *data, int size)
@@ -93,6 +98,29 @@ error:
 #endif
 
 
+/* Server answered busy or its accept queue is full. Sleeps for a random *
+ * time in the second half of a window that doubles each attempt, so *
+ * clients shed together don't come back together. Returns 0 when *
+ * SECURITY_SERVER_BUSY_RETRIES have been used or the deadline of the call *
+ * would pass while sleeping */
+static int busy_retry(int *attempt)
+{
+	struct timespec ts;
+	unsigned int window, delay;
+
+	if(*attempt >= SECURITY_SERVER_BUSY_RETRIES)
+		return 0;
+	window = (SECURITY_SERVER_BUSY_RETRY_MILISECOND * 1000) << *attempt;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	delay = window / 2 + (unsigned int)(ts.tv_nsec ^ getpid()) % (window / 2);
+	if(delay / 1000 >= (unsigned int)client_poll_timeout())
+		return 0;
+	(*attempt)++;
+	SEC_SVR_DBG("Server is busy. Retry %d", *attempt);
+	usleep(delay);
+	return 1;
+}
+
 /* We may need to filter error code */
 int convert_to_public_error_code(int err_code)
 {
@@ -105,7 +133,7 @@ int convert_to_public_error_code(int err_code)
 	SECURITY_SERVER_API
 int security_server_get_gid(const char *object)
 {
-	int sockfd = -1, retval, gid;
+	int sockfd = -1, retval, attempt = 0, gid;
 	response_header hdr;
 
 	if(object == NULL)
@@ -129,6 +157,7 @@ int security_server_get_gid(const char *object)
 	}
 
 	SEC_SVR_DBG("%s", "Client: security_server_get_gid() is called");
+retry:
 	retval = connect_to_server(&sockfd);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
@@ -181,6 +210,11 @@ int security_server_get_gid(const char *object)
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 	/* If error happened */
 	if(retval < 0)
 		retval = convert_to_public_error_code(retval);
@@ -194,7 +228,7 @@ error:
 	SECURITY_SERVER_API
 int security_server_get_object_name(gid_t gid, char *object, size_t max_object_size)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(object == NULL)
@@ -203,6 +237,7 @@ int security_server_get_object_name(gid_t gid, char *object, size_t max_object_s
 		goto error;
 	}
 
+retry:
 	retval = connect_to_server(&sockfd);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
@@ -247,6 +282,11 @@ int security_server_get_object_name(gid_t gid, char *object, size_t max_object_s
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -257,7 +297,7 @@ error:
 	SECURITY_SERVER_API
 int security_server_request_cookie(char *cookie, size_t max_cookie)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(cookie == NULL)
@@ -272,6 +312,7 @@ int security_server_request_cookie(char *cookie, size_t max_cookie)
 	}
 
 	SEC_SVR_DBG("%s", "Client: security_server_request_cookie() is called");
+retry:
 	retval = connect_to_server(&sockfd);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
@@ -312,20 +353,323 @@ int security_server_request_cookie(char *cookie, size_t max_cookie)
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
+
+	retval = convert_to_public_error_code(retval);
+	return retval;
+}
+
+
+
+
+
+/* Shared-memory channel, see security_server_open_channel() *
+ * Any thread may push a request, one at a time. The thread that finds no *
+ * reader becomes the reader: it sleeps on the response doorbell and hands *
+ * out every response it drains to its waiting thread */
+#define CHANNEL_SLOT_FREE	0
+#define CHANNEL_SLOT_PENDING	1
+#define CHANNEL_SLOT_DONE	2
+#define CHANNEL_SLOT_ABANDONED	3	/* Caller ran out of its deadline. Freed by its response */
+
+typedef struct
+{
+	int sockfd;				/* Control connection */
+	int req_efd;
+	int resp_efd;
+	shm_channel *shm;
+	int broken;				/* Server stopped answering */
+	int closing;
+	int users;				/* Threads using the channel */
+	int reader;				/* A thread is draining responses */
+	int in_flight;
+	unsigned int generation;
+	unsigned int request_id[SECURITY_SERVER_SHM_RING_SIZE];
+	unsigned char state[SECURITY_SERVER_SHM_RING_SIZE];
+	unsigned char return_code[SECURITY_SERVER_SHM_RING_SIZE];
+} client_channel;
+
+static client_channel *channel = NULL;
+static pthread_mutex_t channel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t channel_cond = PTHREAD_COND_INITIALIZER;
+
+void free_client_channel(client_channel *ch)
+{
+	munmap(ch->shm, sizeof(shm_channel));
+	close(ch->sockfd);
+	close(ch->req_efd);
+	close(ch->resp_efd);
+	free(ch);
+}
+
+/* Drain response ring. Called by the reader with channel_mutex held */
+void drain_channel_responses(client_channel *ch)
+{
+	shm_response_entry resp;
+	int retval, slot;
+
+	while((retval = shm_pop_response(ch->shm, &resp)) == 1)
+	{
+		slot = resp.request_id % SECURITY_SERVER_SHM_RING_SIZE;
+		if(ch->state[slot] == CHANNEL_SLOT_ABANDONED && ch->request_id[slot] == resp.request_id)
+		{
+			ch->state[slot] = CHANNEL_SLOT_FREE;
+			ch->in_flight--;
+			continue;
+		}
+		if(ch->state[slot] != CHANNEL_SLOT_PENDING || ch->request_id[slot] != resp.request_id)
+		{
+			SEC_SVR_DBG("Client: Stale channel response: %u", resp.request_id);
+			continue;
+		}
+		ch->return_code[slot] = resp.return_code;
+		ch->state[slot] = CHANNEL_SLOT_DONE;
+	}
+	if(retval < 0)
+		ch->broken = 1;
+}
+
+/* Check privilege through the shared-memory channel *
+ * Returns SECURITY_SERVER_ERROR_SOCKET if there is no usable channel, and *
+ * the caller goes to the socket instead. Returns SECURITY_SERVER_ERROR_TIMEOUT *
+ * if the deadline of the call has passed, which doesn't break the channel */
+int channel_check_privilege(shm_request_entry *entry, unsigned char *return_code)
+{
+	client_channel *ch;
+	int slot, retval = SECURITY_SERVER_ERROR_SOCKET;
+
+	pthread_mutex_lock(&channel_mutex);
+	ch = channel;
+	if(ch == NULL || ch->broken || ch->closing)
+		goto out;
+	ch->users++;
+
+	while(ch->in_flight >= SECURITY_SERVER_SHM_RING_SIZE && !ch->broken)
+		pthread_cond_wait(&channel_cond, &channel_mutex);
+	if(ch->broken)
+		goto release;
+
+	for(slot = 0; ch->state[slot] != CHANNEL_SLOT_FREE; slot++);
+	ch->generation++;
+	ch->request_id[slot] = ch->generation * SECURITY_SERVER_SHM_RING_SIZE + slot;
+	ch->state[slot] = CHANNEL_SLOT_PENDING;
+	ch->in_flight++;
+
+	/* Never full. Requests in the ring are fewer than those in flight */
+	entry->request_id = ch->request_id[slot];
+	shm_push_request(ch->shm, entry);
+	shm_ring_notify(&ch->shm->req_idx, ch->req_efd);
+
+	while(ch->state[slot] != CHANNEL_SLOT_DONE && !ch->broken)
+	{
+		if(ch->reader)
+		{
+			pthread_cond_wait(&channel_cond, &channel_mutex);
+			continue;
+		}
+		if(client_has_deadline() && client_poll_timeout() == 0)
+			goto abandon;
+
+		ch->reader = 1;
+		pthread_mutex_unlock(&channel_mutex);
+		retval = shm_ring_wait(&ch->shm->resp_idx, ch->resp_efd, ch->sockfd,
+				client_poll_timeout());
+		pthread_mutex_lock(&channel_mutex);
+		drain_channel_responses(ch);
+		ch->reader = 0;
+		pthread_cond_broadcast(&channel_cond);
+		if(retval == SECURITY_SERVER_SUCCESS || ch->state[slot] == CHANNEL_SLOT_DONE)
+			continue;
+		if(retval == SECURITY_SERVER_ERROR_TIMEOUT && client_has_deadline())
+			goto abandon;
+		SEC_SVR_DBG("Client: Channel is not answering: %d", retval);
+		ch->broken = 1;
+	}
+
+	if(ch->state[slot] == CHANNEL_SLOT_DONE)
+	{
+		*return_code = ch->return_code[slot];
+		retval = SECURITY_SERVER_SUCCESS;
+	}
+	else
+	{
+		retval = SECURITY_SERVER_ERROR_SOCKET;
+	}
+	ch->state[slot] = CHANNEL_SLOT_FREE;
+	ch->in_flight--;
+	goto release;
+
+abandon:
+	/* Only this call has run out of time. The slot is freed by its response */
+	SEC_SVR_DBG("%s", "Client: Deadline passed on channel");
+	ch->state[slot] = CHANNEL_SLOT_ABANDONED;
+	retval = SECURITY_SERVER_ERROR_TIMEOUT;
+
+release:
+	ch->users--;
+	pthread_cond_broadcast(&channel_cond);
+out:
+	pthread_mutex_unlock(&channel_mutex);
+	return retval;
+}
+
+/* Take the channel away from new users and wait for the ones using it. *
+ * Called with channel_mutex held. Caller frees it */
+static void detach_channel(client_channel *ch)
+{
+	ch->closing = 1;
+	while(ch->users > 0)
+		pthread_cond_wait(&channel_cond, &channel_mutex);
+	channel = NULL;
+	pthread_cond_broadcast(&channel_cond);
+}
+
+	SECURITY_SERVER_API
+int security_server_open_channel(void)
+{
+	int sockfd = -1, retval, fds[SECURITY_SERVER_MSG_MAX_FDS], nfds = 0, i;
+	response_header hdr;
+	client_channel *ch = NULL;
+	shm_channel *shm = MAP_FAILED;
+
+	pthread_mutex_lock(&channel_mutex);
+	while(channel != NULL && channel->closing)
+		pthread_cond_wait(&channel_cond, &channel_mutex);
+	if(channel != NULL && !channel->broken)
+	{
+		retval = SECURITY_SERVER_SUCCESS;
+		goto error;
+	}
+	if(channel != NULL)
+	{
+		/* Server stopped answering on it. Connect again */
+		SEC_SVR_DBG("%s", "Client: Reopening broken channel");
+		ch = channel;
+		detach_channel(ch);
+		free_client_channel(ch);
+		ch = NULL;
+	}
+
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		goto error;
+	}
+
+	/* make request packet */
+	retval = send_shm_channel_request(sockfd);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		SEC_SVR_DBG("Send failed: %d", retval);
+		goto error;
+	}
+
+	retval = recv_response_fds(sockfd, &hdr, NULL, 0, fds, &nfds);
+	if(retval < 0)
+		goto error;
+
+	retval = return_code_to_error_code(hdr.return_code);
+	if(hdr.basic_hdr.msg_id != SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_RESPONSE)
+	{
+		if(hdr.basic_hdr.msg_id == SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE)
+		{
+			/* There must be some error */
+			SEC_SVR_DBG("Client: Error has been received. return code:%d", hdr.return_code);
+		}
+		else
+		{
+			/* Something wrong with response */
+			SEC_SVR_DBG("Client ERROR: Unexpected error occurred:%d", retval);
+			retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		}
+		goto error;
+	}
+	if(retval != SECURITY_SERVER_SUCCESS)
+		goto error;
+	if(nfds != 3)
+	{
+		SEC_SVR_DBG("Client: Wrong number of descriptors: %d", nfds);
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+
+	shm = mmap(NULL, sizeof(shm_channel), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+	if(shm == MAP_FAILED)
+	{
+		SEC_SVR_DBG("Client: mmap() failed. errno=%d", errno);
+		retval = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto error;
+	}
+	if(shm->magic != SECURITY_SERVER_SHM_MAGIC || shm->ring_size != SECURITY_SERVER_SHM_RING_SIZE)
+	{
+		SEC_SVR_DBG("%s", "Client: Channel layout mismatch");
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+
+	ch = calloc(1, sizeof(client_channel));
+	if(ch == NULL)
+	{
+		retval = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+		goto error;
+	}
+	close(fds[0]);
+	ch->sockfd = sockfd;
+	ch->req_efd = fds[1];
+	ch->resp_efd = fds[2];
+	ch->shm = shm;
+	channel = ch;
+	pthread_mutex_unlock(&channel_mutex);
+	return SECURITY_SERVER_API_SUCCESS;
+
+error:
+	pthread_mutex_unlock(&channel_mutex);
+	if(shm != MAP_FAILED)
+		munmap(shm, sizeof(shm_channel));
+	for(i = 0; i < nfds; i++)
+		close(fds[i]);
+	if(sockfd >= 0)
+		close(sockfd);
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
 }
 
+	SECURITY_SERVER_API
+int security_server_close_channel(void)
+{
+	client_channel *ch;
 
+	pthread_mutex_lock(&channel_mutex);
+	ch = channel;
+	if(ch == NULL || ch->closing)
+	{
+		pthread_mutex_unlock(&channel_mutex);
+		return SECURITY_SERVER_API_SUCCESS;
+	}
 
+	/* Let requests in flight finish */
+	detach_channel(ch);
+	pthread_mutex_unlock(&channel_mutex);
 
+	free_client_channel(ch);
+	return SECURITY_SERVER_API_SUCCESS;
+}
 
 	SECURITY_SERVER_API
 int security_server_check_privilege(const char *cookie, gid_t privilege)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
+	shm_request_entry entry;
+	unsigned char return_code;
 
 	if(cookie == NULL)
 	{
@@ -333,7 +677,22 @@ int security_server_check_privilege(const char *cookie, gid_t privilege)
 		goto error;
 	}
 
-	retval = connect_to_server(&sockfd);
+	memset(&entry, 0, sizeof(entry));
+	entry.msg_id = SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_REQUEST;
+	entry.privilege = privilege;
+	memcpy(entry.cookie, cookie, SECURITY_SERVER_COOKIE_LEN);
+	retval = channel_check_privilege(&entry, &return_code);
+	if(retval == SECURITY_SERVER_SUCCESS)
+	{
+		retval = return_code_to_error_code(return_code);
+		goto error;
+	}
+	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
+		goto error;
+
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -371,6 +730,11 @@ int security_server_check_privilege(const char *cookie, gid_t privilege)
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -382,9 +746,11 @@ int security_server_check_privilege_by_cookie(const char *cookie,
                                               const char *object,
                                               const char *access_rights)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
         int olen, alen;
 	response_header hdr;
+	shm_request_entry entry;
+	unsigned char return_code;
 
 	if(cookie == NULL || object == NULL || access_rights == NULL)
 	{
@@ -401,7 +767,23 @@ int security_server_check_privilege_by_cookie(const char *cookie,
 		goto error;
 	}
 
-	retval = connect_to_server(&sockfd);
+	memset(&entry, 0, sizeof(entry));
+	entry.msg_id = SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_REQUEST;
+	memcpy(entry.cookie, cookie, SECURITY_SERVER_COOKIE_LEN);
+	memcpy(entry.object, object, olen);
+	memcpy(entry.access_rights, access_rights, alen);
+	retval = channel_check_privilege(&entry, &return_code);
+	if(retval == SECURITY_SERVER_SUCCESS)
+	{
+		retval = return_code_to_error_code(return_code);
+		goto error;
+	}
+	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
+		goto error;
+
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -442,6 +824,11 @@ int security_server_check_privilege_by_cookie(const char *cookie,
 error:
 	if(sockfd >= 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -454,12 +841,12 @@ int security_server_check_privilege_by_sockfd(int sockfd,
 {
     char *subject;
     int ret;
-    ret = smack_new_label_from_socket(sockfd, &subject);
+    ret = label_from_socket(sockfd, &subject);
     if (ret != 0)
     {
         return SECURITY_SERVER_API_ERROR_SERVER_ERROR;
     }
-    ret = smack_have_access(subject, object, access_rights);
+    ret = label_have_access(subject, object, access_rights);
     SEC_SVR_DBG("check by sockfd, subject >%s< object >%s< rights >%s< ====> %d",
                 subject, object, access_rights, ret);
     free(subject);
@@ -485,7 +872,7 @@ int security_server_get_cookie_size(void)
 	SECURITY_SERVER_API
 int security_server_get_cookie_pid(const char *cookie)
 {
-	int sockfd = -1, retval, pid = -1;
+	int sockfd = -1, retval, attempt = 0, pid = -1;
 	response_header hdr;
 
 	if(cookie == NULL)
@@ -494,7 +881,9 @@ int security_server_get_cookie_pid(const char *cookie)
 		goto error;
 	}
 
-	retval = connect_to_server(&sockfd);
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -536,6 +925,11 @@ int security_server_get_cookie_pid(const char *cookie)
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	if(retval == 0)
@@ -545,11 +939,242 @@ error:
 }
 
 
+	SECURITY_SERVER_API
+int security_server_prepare_cookie(int pid)
+{
+	int sockfd = -1, retval, attempt = 0;
+	response_header hdr;
+
+	if(pid <= 0)
+	{
+		retval = SECURITY_SERVER_ERROR_INPUT_PARAM;
+		goto error;
+	}
+
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		goto error;
+	}
+
+	/* make request packet */
+	retval = send_prepare_cookie_request(sockfd, pid);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		SEC_SVR_DBG("Client: Send failed: %d", retval);
+		goto error;
+	}
+
+	retval = recv_generic_response(sockfd, &hdr);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Client: Receive failed: %d", retval);
+		goto error;
+	}
+
+	retval = return_code_to_error_code(hdr.return_code);
+	if(hdr.basic_hdr.msg_id != SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_RESPONSE)	/* Wrong response */
+	{
+		if(hdr.basic_hdr.msg_id == SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE)
+		{
+			/* There must be some error */
+			SEC_SVR_DBG("Client: Error has been received. return code:%d", hdr.return_code);
+		}
+		else
+		{
+			/* Something wrong with response */
+			SEC_SVR_DBG("Client ERROR: Unexpected error occurred:%d", retval);
+			retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		}
+		goto error;
+	}
+
+error:
+	if(sockfd > 0)
+		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
+
+	return convert_to_public_error_code(retval);
+}
+
+	SECURITY_SERVER_API
+int security_server_subscribe_revocation(void)
+{
+	int sockfd = -1, retval, attempt = 0;
+	response_header hdr;
+
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		goto error;
+	}
+
+	/* make request packet */
+	retval = send_subscribe_revocation_request(sockfd);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		SEC_SVR_DBG("Client: Send failed: %d", retval);
+		goto error;
+	}
+
+	retval = recv_generic_response(sockfd, &hdr);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Client: Receive failed: %d", retval);
+		goto error;
+	}
+	if(hdr.basic_hdr.msg_id != SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_RESPONSE)
+	{
+		/* Something wrong with response */
+		SEC_SVR_DBG("Client ERROR: Unexpected response:%d", hdr.basic_hdr.msg_id);
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+	return sockfd;
+
+error:
+	if(sockfd > 0)
+		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
+
+	return convert_to_public_error_code(retval);
+}
+
+	SECURITY_SERVER_API
+int security_server_recv_revocation(int fd, char *cookie, size_t max_cookie, int *pid)
+{
+	revocation_event event;
+	int retval;
+
+	if(fd < 0 || cookie == NULL || pid == NULL || max_cookie < SECURITY_SERVER_COOKIE_LEN)
+	{
+		retval = SECURITY_SERVER_ERROR_INPUT_PARAM;
+		goto error;
+	}
+
+	retval = recv_revocation_event(fd, &event);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		goto error;
+
+	memcpy(cookie, event.cookie, SECURITY_SERVER_COOKIE_LEN);
+	*pid = event.pid;
+
+error:
+	return convert_to_public_error_code(retval);
+}
+
+
+/* Variants with a deadline *
+ * The deadline bounds connecting, busy retries and waiting for the response, *
+ * and is sent to the server, which drops the request when it can't start on *
+ * it in time */
+
+	SECURITY_SERVER_API
+int security_server_get_gid_with_timeout(const char *object, int timeout_ms)
+{
+	unsigned long long saved;
+	int retval;
+
+	if(timeout_ms < 0)
+		return SECURITY_SERVER_API_ERROR_INPUT_PARAM;
+	saved = set_client_deadline(timeout_ms);
+	retval = security_server_get_gid(object);
+	restore_client_deadline(saved);
+	return retval;
+}
+
+	SECURITY_SERVER_API
+int security_server_get_object_name_with_timeout(gid_t gid, char *object, size_t max_object_size,
+		int timeout_ms)
+{
+	unsigned long long saved;
+	int retval;
+
+	if(timeout_ms < 0)
+		return SECURITY_SERVER_API_ERROR_INPUT_PARAM;
+	saved = set_client_deadline(timeout_ms);
+	retval = security_server_get_object_name(gid, object, max_object_size);
+	restore_client_deadline(saved);
+	return retval;
+}
+
+	SECURITY_SERVER_API
+int security_server_request_cookie_with_timeout(char *cookie, size_t max_cookie, int timeout_ms)
+{
+	unsigned long long saved;
+	int retval;
+
+	if(timeout_ms < 0)
+		return SECURITY_SERVER_API_ERROR_INPUT_PARAM;
+	saved = set_client_deadline(timeout_ms);
+	retval = security_server_request_cookie(cookie, max_cookie);
+	restore_client_deadline(saved);
+	return retval;
+}
+
+	SECURITY_SERVER_API
+int security_server_check_privilege_with_timeout(const char *cookie, gid_t privilege, int timeout_ms)
+{
+	unsigned long long saved;
+	int retval;
+
+	if(timeout_ms < 0)
+		return SECURITY_SERVER_API_ERROR_INPUT_PARAM;
+	saved = set_client_deadline(timeout_ms);
+	retval = security_server_check_privilege(cookie, privilege);
+	restore_client_deadline(saved);
+	return retval;
+}
+
+	SECURITY_SERVER_API
+int security_server_check_privilege_by_cookie_with_timeout(const char *cookie,
+		const char *object, const char *access_rights, int timeout_ms)
+{
+	unsigned long long saved;
+	int retval;
+
+	if(timeout_ms < 0)
+		return SECURITY_SERVER_API_ERROR_INPUT_PARAM;
+	saved = set_client_deadline(timeout_ms);
+	retval = security_server_check_privilege_by_cookie(cookie, object, access_rights);
+	restore_client_deadline(saved);
+	return retval;
+}
+
+	SECURITY_SERVER_API
+int security_server_get_cookie_pid_with_timeout(const char *cookie, int timeout_ms)
+{
+	unsigned long long saved;
+	int retval;
+
+	if(timeout_ms < 0)
+		return SECURITY_SERVER_API_ERROR_INPUT_PARAM;
+	saved = set_client_deadline(timeout_ms);
+	retval = security_server_get_cookie_pid(cookie);
+	restore_client_deadline(saved);
+	return retval;
+}
 
 	SECURITY_SERVER_API
 int security_server_launch_debug_tool(int argc, const char **argv)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(argc < 1 || argv == NULL || argv[0] == NULL)
@@ -576,6 +1201,7 @@ int security_server_launch_debug_tool(int argc, const char **argv)
 		goto error;
 	}
 
+retry:
 	retval = connect_to_server(&sockfd);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
@@ -614,6 +1240,11 @@ int security_server_launch_debug_tool(int argc, const char **argv)
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -626,7 +1257,7 @@ int security_server_is_pwd_valid(unsigned int *current_attempts,
 	unsigned int *max_attempts,
 	unsigned int *valid_secs)
 {
-	int sockfd = -1, retval = SECURITY_SERVER_ERROR_UNKNOWN;
+	int sockfd = -1, retval = SECURITY_SERVER_ERROR_UNKNOWN, attempt = 0;
 	response_header hdr;
 
 	if(current_attempts == NULL || max_attempts == NULL ||valid_secs == NULL)
@@ -639,7 +1270,9 @@ int security_server_is_pwd_valid(unsigned int *current_attempts,
 	/* 1st, check cmdline which is setting app */
 	/* 2nd, check /proc/self/attr/current for the SMACK label */
 
-	retval = connect_to_server(&sockfd);
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -676,6 +1309,11 @@ int security_server_is_pwd_valid(unsigned int *current_attempts,
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -689,7 +1327,7 @@ int security_server_set_pwd(const char *cur_pwd,
 			const unsigned int max_challenge,
 			const unsigned int valid_period_in_days)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(new_pwd == NULL || strlen(new_pwd) > SECURITY_SERVER_MAX_PASSWORD_LEN)
@@ -702,7 +1340,9 @@ int security_server_set_pwd(const char *cur_pwd,
 	/* 1st, check cmdline which is setting app */
 	/* 2nd, check /proc/self/attr/current for the SMACK label */
 
-	retval = connect_to_server(&sockfd);
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -739,6 +1379,11 @@ int security_server_set_pwd(const char *cur_pwd,
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -748,10 +1393,12 @@ error:
 	SECURITY_SERVER_API
 int security_server_set_pwd_validity(const unsigned int valid_period_in_days)
 {
-    int sockfd = -1, retval;
+    int sockfd = -1, retval, attempt = 0;
     response_header hdr;
 
-    retval = connect_to_server(&sockfd);
+retry:
+    retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
     if(retval != SECURITY_SERVER_SUCCESS)
     {
         /* Error on socket */
@@ -788,6 +1435,11 @@ int security_server_set_pwd_validity(const unsigned int valid_period_in_days)
 error:
     if(sockfd > 0)
         close(sockfd);
+    if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+    {
+        sockfd = -1;
+        goto retry;
+    }
 
     retval = convert_to_public_error_code(retval);
     return retval;
@@ -796,10 +1448,12 @@ error:
 	SECURITY_SERVER_API
 int security_server_set_pwd_max_challenge(const unsigned int max_challenge)
 {
-    int sockfd = -1, retval;
+    int sockfd = -1, retval, attempt = 0;
     response_header hdr;
 
-    retval = connect_to_server(&sockfd);
+retry:
+    retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
     if(retval != SECURITY_SERVER_SUCCESS)
     {
         /* Error on socket */
@@ -836,6 +1490,11 @@ int security_server_set_pwd_max_challenge(const unsigned int max_challenge)
 error:
     if(sockfd > 0)
         close(sockfd);
+    if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+    {
+        sockfd = -1;
+        goto retry;
+    }
 
     retval = convert_to_public_error_code(retval);
     return retval;
@@ -848,7 +1507,7 @@ int security_server_reset_pwd(const char *new_pwd,
 			const unsigned int max_challenge,
 			const unsigned int valid_period_in_days)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(new_pwd == NULL || strlen(new_pwd) > SECURITY_SERVER_MAX_PASSWORD_LEN)
@@ -861,7 +1520,9 @@ int security_server_reset_pwd(const char *new_pwd,
 	/* 1st, check cmdline which is setting app */
 	/* 2nd, check /proc/self/attr/current for the SMACK label */
 
-	retval = connect_to_server(&sockfd);
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -898,6 +1559,11 @@ int security_server_reset_pwd(const char *new_pwd,
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -911,7 +1577,7 @@ int security_server_chk_pwd(const char *challenge,
 	unsigned int *max_attempts,
 	unsigned int *valid_secs)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(challenge == NULL || strlen(challenge) > SECURITY_SERVER_MAX_PASSWORD_LEN
@@ -923,7 +1589,9 @@ int security_server_chk_pwd(const char *challenge,
 
 	/* Authenticate self goes here */
 
-	retval = connect_to_server(&sockfd);
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -960,6 +1628,11 @@ int security_server_chk_pwd(const char *challenge,
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
@@ -968,7 +1641,7 @@ error:
 	SECURITY_SERVER_API
 int security_server_set_pwd_history(int number_of_history)
 {
-	int sockfd = -1, retval;
+	int sockfd = -1, retval, attempt = 0;
 	response_header hdr;
 
 	if(number_of_history > SECURITY_SERVER_MAX_PASSWORD_HISTORY || number_of_history < 0)
@@ -978,7 +1651,9 @@ int security_server_set_pwd_history(int number_of_history)
 	/* 1st, check cmdline which is setting app */
 	/* 2nd, check /proc/self/attr/current for the SMACK label */
 
-	retval = connect_to_server(&sockfd);
+retry:
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_PASSWORD,
+			SECURITY_SERVER_CLIENT_SOCK_TYPE);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -1014,6 +1689,11 @@ int security_server_set_pwd_history(int number_of_history)
 error:
 	if(sockfd > 0)
 		close(sockfd);
+	if(retval == SECURITY_SERVER_ERROR_SERVER_BUSY && busy_retry(&attempt))
+	{
+		sockfd = -1;
+		goto retry;
+	}
 
 	retval = convert_to_public_error_code(retval);
 	return retval;
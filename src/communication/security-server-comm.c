@@ -21,17 +21,24 @@
 
 #include <poll.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <sys/un.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "security-server-common.h"
 #include "security-server-comm.h"
+#include "security-server-config.h"
+#include "security-server-smack.h"
 
 void printhex(const unsigned char *data, int size)
 {
@@ -51,11 +58,11 @@ void printhex(const unsigned char *data, int size)
 char *read_cmdline_from_proc(pid_t pid)
 {
 	int memsize = 32;
-	char path[32];
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH + 32];
 	char *cmdline = NULL, *tempptr = NULL;
 	FILE *fp = NULL;
 
-	snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+	snprintf(path, sizeof(path), "%s/%d/cmdline", get_config()->proc_path, pid);
 
 	fp = fopen(path, "r");
 	if(fp == NULL)
@@ -152,6 +159,9 @@ int return_code_to_error_code(int ret_code)
 		case SECURITY_SERVER_RETURN_CODE_PASSWORD_REUSED:
 			ret = SECURITY_SERVER_ERROR_PASSWORD_REUSED;
 			break;
+		case SECURITY_SERVER_RETURN_CODE_BUSY:
+			ret = SECURITY_SERVER_ERROR_SERVER_BUSY;
+			break;
 		default:
 			ret = SECURITY_SERVER_ERROR_UNKNOWN;
 			break;
@@ -166,17 +176,14 @@ int check_socket_poll(int sockfd, int event, int timeout)
 
 	poll_fd[0].fd = sockfd;
 	poll_fd[0].events = event;
-	retval = poll(poll_fd, 1, timeout);
+	do
+	{
+		retval = poll(poll_fd, 1, timeout);
+	} while(retval < 0 && errno == EINTR);
 	if(retval < 0)
 	{
 		SEC_SVR_DBG("poll() error. errno=%d", errno);
-		if(errno != EINTR)
-			return SECURITY_SERVER_ERROR_POLL;
-		else
-		{
-			/* Chile process has been closed. Not poll() problem. Call it once again */
-			return check_socket_poll(sockfd, event, timeout);
-		}
+		return SECURITY_SERVER_ERROR_POLL;
 	}
 
 	/* Timed out */
@@ -193,6 +200,63 @@ int check_socket_poll(int sockfd, int event, int timeout)
 	return SECURITY_SERVER_SUCCESS;
 }
 
+/* Deadline of the client API call in progress on this thread *
+ * CLOCK_MONOTONIC microseconds, which the server shares. 0 is none, and the *
+ * client polls with SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND as before */
+static __thread unsigned long long client_deadline = 0;
+
+static unsigned long long monotonic_usec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Set deadline timeout_ms from now. A nested call can't extend the *
+ * deadline it runs in. Returns previous one for restore_client_deadline() */
+unsigned long long set_client_deadline(int timeout_ms)
+{
+	unsigned long long prev = client_deadline, deadline;
+
+	deadline = monotonic_usec() + (unsigned long long)timeout_ms * 1000ULL;
+	if(prev == 0 || deadline < prev)
+		client_deadline = deadline;
+	return prev;
+}
+
+void restore_client_deadline(unsigned long long deadline)
+{
+	client_deadline = deadline;
+}
+
+/* Poll timeout in milliseconds for the client API call in progress */
+int client_poll_timeout(void)
+{
+	unsigned long long now;
+
+	if(client_deadline == 0)
+		return SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND;
+	now = monotonic_usec();
+	if(now >= client_deadline)
+		return 0;
+	return (int)((client_deadline - now + 999) / 1000);
+}
+
+/* Whether the client API call in progress has a deadline */
+int client_has_deadline(void)
+{
+	return client_deadline != 0;
+}
+
+/* Client side poll error. Running out of a given deadline is reported as *
+ * timeout. Otherwise it's the error of the operation as before */
+static int client_poll_error(int retval, int error)
+{
+	if(retval == SECURITY_SERVER_ERROR_TIMEOUT && client_deadline != 0)
+		return SECURITY_SERVER_ERROR_TIMEOUT;
+	return error;
+}
+
 int safe_server_sock_close(int client_sockfd)
 {
 	struct pollfd poll_fd[1];
@@ -207,17 +271,17 @@ int safe_server_sock_close(int client_sockfd)
 }
 
 /* Create a Unix domain socket and bind */
-int create_new_socket(int *sockfd)
+int create_server_socket(int *sockfd, const char *path, int type)
 {
 	int retval = 0, localsockfd = 0, flags;
 	struct sockaddr_un serveraddr;
 	mode_t sock_mode;
 
 	/* Deleted garbage Unix domain socket file */
-	remove(SECURITY_SERVER_SOCK_PATH);
+	remove(path);
 
 	/* Create Unix domain socket */
-	if((localsockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 )
+	if((localsockfd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0)) < 0 )
 	{
 		retval = SECURITY_SERVER_ERROR_SOCKET;
 		localsockfd = -1;
@@ -225,24 +289,12 @@ int create_new_socket(int *sockfd)
 		goto error;
 	}
 
-	if((fsetxattr(localsockfd, "security.SMACK64IPOUT", "@", 2, 0)) < 0)
+	if(label_server_socket(localsockfd) != SECURITY_SERVER_SUCCESS)
 	{
-		SEC_SVR_DBG("%s", "SMACK labeling failed");
-		if(errno != EOPNOTSUPP)
-		{
-			retval = SECURITY_SERVER_ERROR_SOCKET;
-			localsockfd = -1;
-			goto error;
-		}
-	}
-	if((fsetxattr(localsockfd, "security.SMACK64IPIN", "*", 2, 0)) < 0)
-	{	SEC_SVR_DBG("%s", "SMACK labeling failed");
-		if(errno != EOPNOTSUPP)
-		{
-			retval = SECURITY_SERVER_ERROR_SOCKET;
-			localsockfd = -1;
-			goto error;
-		}
+		retval = SECURITY_SERVER_ERROR_SOCKET;
+		close(localsockfd);
+		localsockfd = -1;
+		goto error;
 	}
 
 	/* Make socket as non blocking */
@@ -258,9 +310,7 @@ int create_new_socket(int *sockfd)
 
 	bzero (&serveraddr, sizeof(serveraddr));
 	serveraddr.sun_family = AF_UNIX;
-	strncpy(serveraddr.sun_path, SECURITY_SERVER_SOCK_PATH,
-			strlen(SECURITY_SERVER_SOCK_PATH));
-	serveraddr.sun_path[strlen(SECURITY_SERVER_SOCK_PATH)] = 0;
+	strncpy(serveraddr.sun_path, path, sizeof(serveraddr.sun_path) - 1);
 
 	/* Bind the socket */
 	if((bind(localsockfd, (struct sockaddr *)&serveraddr, sizeof(serveraddr))) < 0)
@@ -273,12 +323,13 @@ int create_new_socket(int *sockfd)
 	}
 
 
-	/* Change permission to accept all processes that has different uID/gID */
+	/* Change permission to accept all processes that has different uID/gID. *
+	 * Server takes only the messages of the class on each socket */
 	sock_mode = (S_IRWXU | S_IRWXG | S_IRWXO);
 	/* Flawfinder hits this chmod function as level 5 CRITICAL as race condition flaw *
 	 * Flawfinder recommends to user fchmod insted of chmod
 	 * But, fchmod doesn't work on socket file so there is no other choice at this point */
-	if(chmod(SECURITY_SERVER_SOCK_PATH, sock_mode) < 0)		/* Flawfinder: ignore */
+	if(chmod(path, sock_mode) < 0)		/* Flawfinder: ignore */
 	{
 		SEC_SVR_DBG("%s", "chmod() error");
 		retval = SECURITY_SERVER_ERROR_SOCKET;
@@ -294,6 +345,91 @@ error:
 	return retval;
 }
 
+/* Listening sockets passed by the init system *
+ * LISTEN_PID and LISTEN_FDS are set as sd_listen_fds(3) describes, and the *
+ * sockets are descriptors from SECURITY_SERVER_LISTEN_FDS_START on. The *
+ * variables are removed, so children don't take them. Returns number of *
+ * the sockets stored to fds */
+int get_listen_fds(int *fds, int max)
+{
+	const char *env;
+	int num = 0, i;
+
+	env = getenv("LISTEN_PID");
+	if(env == NULL || strtoul(env, NULL, 10) != (unsigned long)getpid())
+		goto out;
+	env = getenv("LISTEN_FDS");
+	if(env == NULL)
+		goto out;
+	num = atoi(env);
+	if(num < 0 || num > max)
+	{
+		SEC_SVR_DBG("Ignoring LISTEN_FDS=%s", env);
+		num = 0;
+		goto out;
+	}
+	for(i = 0; i < num; i++)
+	{
+		fds[i] = SECURITY_SERVER_LISTEN_FDS_START + i;
+		fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+	}
+
+out:
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return num;
+}
+
+/* Use a passed socket listening on path with type instead of creating *
+ * one, so connections queued before the server started are kept. The one *
+ * taken is set to -1 in fds. Returns SECURITY_SERVER_ERROR_SOCKET when *
+ * there is no such socket */
+int adopt_server_socket(int *sockfd, int *fds, int num_fds, const char *path, int type)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int i, fd, sock_type, listening, flags;
+
+	*sockfd = -1;
+	for(i = 0; i < num_fds; i++)
+	{
+		fd = fds[i];
+		if(fd < 0)
+			continue;
+		len = sizeof(sock_type);
+		if(getsockopt(fd, SOL_SOCKET, SO_TYPE, &sock_type, &len) < 0 || sock_type != type)
+			continue;
+		len = sizeof(listening);
+		if(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0 || !listening)
+			continue;
+		len = sizeof(addr);
+		memset(&addr, 0, sizeof(addr));
+		if(getsockname(fd, (struct sockaddr *)&addr, &len) < 0 || addr.sun_family != AF_UNIX
+				|| strncmp(addr.sun_path, path, sizeof(addr.sun_path)) != 0)
+			continue;
+
+		if(label_server_socket(fd) != SECURITY_SERVER_SUCCESS)
+			return SECURITY_SERVER_ERROR_SOCKET;
+		if((flags = fcntl(fd, F_GETFL, 0)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+		{
+			SEC_SVR_DBG("%s", "Cannot go to nonblocking mode");
+			return SECURITY_SERVER_ERROR_SOCKET;
+		}
+		SEC_SVR_DBG("Using passed socket %d for %s", fd, path);
+		*sockfd = fd;
+		fds[i] = -1;
+		return SECURITY_SERVER_SUCCESS;
+	}
+	return SECURITY_SERVER_ERROR_SOCKET;
+}
+
+/* Create the stream listening socket */
+int create_new_socket(int *sockfd)
+{
+	return create_server_socket(sockfd, get_config()->sock_path, SOCK_STREAM);
+}
+
 /* Authenticate peer that it's really security server.
  * Check UID that is root
  */
@@ -313,7 +449,7 @@ int authenticate_server(int sockfd)
 	}
 
 	/* Security server must run as root */
-	if(cr.uid != 0)
+	if(cr.uid != get_config()->privileged_uid)
 	{
 		retval = SECURITY_SERVER_ERROR_AUTHENTICATION_FAILED;
 		SEC_SVR_DBG("Peer is not root: uid=%d", cr.uid);
@@ -345,14 +481,14 @@ error:
 }
 
 /* Create a socket and connect to Security Server */
-int connect_to_server(int *fd)
+static int connect_to_server_path(int *fd, const char *path, int type)
 {
 	struct sockaddr_un clientaddr;
 	int client_len = 0, localsockfd, ret, flags;
 	*fd = -1;
 
 	/* Create a socket */
-	localsockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	localsockfd = socket(AF_UNIX, type, 0);
 	if(localsockfd < 0)
 	{
 		SEC_SVR_DBG("%s", "Error on socket()");
@@ -370,8 +506,7 @@ int connect_to_server(int *fd)
 
 	bzero(&clientaddr, sizeof(clientaddr));
 	clientaddr.sun_family = AF_UNIX;
-	strncpy(clientaddr.sun_path, SECURITY_SERVER_SOCK_PATH, strlen(SECURITY_SERVER_SOCK_PATH));
-	clientaddr.sun_path[strlen(SECURITY_SERVER_SOCK_PATH)] = 0;
+	strncpy(clientaddr.sun_path, path, sizeof(clientaddr.sun_path) - 1);
 	client_len = sizeof(clientaddr);
 
 	ret = connect(localsockfd, (struct sockaddr*)&clientaddr, client_len);
@@ -380,7 +515,7 @@ int connect_to_server(int *fd)
 		if(errno == EINPROGRESS)
 		{
 			SEC_SVR_DBG("%s", "Connection is in progress");
-			ret = check_socket_poll(localsockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
+			ret = check_socket_poll(localsockfd, POLLOUT, client_poll_timeout());
 			if(ret == SECURITY_SERVER_ERROR_POLL)
 			{
 				SEC_SVR_DBG("%s", "poll() error");
@@ -391,7 +526,7 @@ int connect_to_server(int *fd)
 			{
 				SEC_SVR_DBG("%s", "poll() timeout");
 				close(localsockfd);
-				return SECURITY_SERVER_ERROR_SOCKET;
+				return client_poll_error(ret, SECURITY_SERVER_ERROR_SOCKET);
 			}
 			ret = connect(localsockfd, (struct sockaddr*)&clientaddr, client_len);
 			if(ret < 0)
@@ -401,6 +536,13 @@ int connect_to_server(int *fd)
 				return SECURITY_SERVER_ERROR_SOCKET;
 			}
 		}
+		else if(errno == EAGAIN)
+		{
+			/* Accept queue is full */
+			SEC_SVR_DBG("%s", "Server is busy");
+			close(localsockfd);
+			return SECURITY_SERVER_ERROR_SERVER_BUSY;
+		}
 		else
 		{
 			SEC_SVR_DBG("%s", "Connection failed");
@@ -417,41 +559,123 @@ int connect_to_server(int *fd)
 		SEC_SVR_DBG("Authentication failed. %d", ret);
 		return ret;
 	}
+
+	/* Tell the server how long this call waits for it */
+	if(client_deadline != 0)
+	{
+		ret = send_deadline(localsockfd, client_deadline);
+		if(ret != SECURITY_SERVER_SUCCESS)
+		{
+			close(localsockfd);
+			return ret;
+		}
+	}
 	*fd = localsockfd;
 	return SECURITY_SERVER_SUCCESS;
 }
 
-/* Accept a new client connection */
-int accept_client(int server_sockfd)
+/* Connect to the listening socket of a request class *
+ * Servers without class sockets serve everything on the app class socket, *
+ * so that is tried when the class socket can't be connected */
+int connect_to_server_class(int *fd, int sock_class, int type)
+{
+	int retval;
+
+	retval = connect_to_server_path(fd, get_sock_path(sock_class, type), type);
+	if(retval == SECURITY_SERVER_ERROR_SOCKET && sock_class != SECURITY_SERVER_SOCK_CLASS_APP)
+	{
+		SEC_SVR_DBG("Cannot connect to class %d socket. Trying app socket", sock_class);
+		retval = connect_to_server_path(fd, get_sock_path(SECURITY_SERVER_SOCK_CLASS_APP, type), type);
+	}
+	return retval;
+}
+
+int connect_to_server_type(int *fd, int type)
+{
+	return connect_to_server_class(fd, SECURITY_SERVER_SOCK_CLASS_APP, type);
+}
+
+/* Connect to the server with the transport chosen at build time */
+int connect_to_server(int *fd)
+{
+	return connect_to_server_type(fd, SECURITY_SERVER_CLIENT_SOCK_TYPE);
+}
+
+/* Accept a new client connection *
+ * event_fds are polled together with the listeners. When only they are *
+ * readable, SECURITY_SERVER_ERROR_TIMEOUT is returned and the caller handles *
+ * the events. Accepted sockets are close-on-exec. *listener is the index of *
+ * the listener accepted from last time, and is set to the one used now */
+int accept_client(const int *server_sockfds, int num_sockfds, const int *event_fds, int num_event_fds,
+		int *listener)
 {
 	/* Call poll() to wait for socket connection */
-	int retval, localsockfd;
+	int retval, localsockfd, i, j, num_fds = num_sockfds;
 	struct sockaddr_un clientaddr;
+	struct pollfd fds[SECURITY_SERVER_MAX_LISTENERS + SECURITY_SERVER_MAX_EVENT_FDS];
 	unsigned int client_len;
 
 	client_len = sizeof(clientaddr);
 
 	/* Check poll */
-	retval = check_socket_poll(server_sockfd, POLLIN, SECURITY_SERVER_ACCEPT_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
+	for(i = 0; i < num_sockfds; i++)
+	{
+		fds[i].fd = server_sockfds[i];
+		fds[i].events = POLLIN;
+		fds[i].revents = 0;
+	}
+	for(i = 0; i < num_event_fds && i < SECURITY_SERVER_MAX_EVENT_FDS; i++)
+	{
+		fds[num_fds].fd = event_fds[i];
+		fds[num_fds].events = POLLIN;
+		fds[num_fds].revents = 0;
+		num_fds++;
+	}
+	do
+	{
+		retval = poll(fds, num_fds, SECURITY_SERVER_ACCEPT_TIMEOUT_MILISECOND);
+	} while(retval < 0 && errno == EINTR);
+	if(retval < 0)
 	{
 		SEC_SVR_DBG("%s", "Error on polling");
 		return SECURITY_SERVER_ERROR_SOCKET;
 	}
 
 	/* Timed out */
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
+	if(retval == 0)
 	{
 		/*SEC_SVR_DBG("%s", "accept() timeout");*/
 		return SECURITY_SERVER_ERROR_TIMEOUT;
 	}
 
-	localsockfd = accept(server_sockfd,
+	/* Round robin from the last listener, so a flooded one can't starve others */
+	for(j = 0; j < num_sockfds; j++)
+	{
+		i = (*listener + 1 + j) % num_sockfds;
+		if(fds[i].revents & POLLIN)
+			break;
+	}
+	if(j == num_sockfds)
+	{
+		for(i = num_sockfds; i < num_fds; i++)
+		{
+			if(fds[i].revents & POLLIN)
+				return SECURITY_SERVER_ERROR_TIMEOUT;
+		}
+		SEC_SVR_DBG("%s", "Error on polling");
+		return SECURITY_SERVER_ERROR_SOCKET;
+	}
+	*listener = i;
+
+	localsockfd = accept4(server_sockfds[i],
 			(struct sockaddr *)&clientaddr,
-			&client_len);
+			&client_len, SOCK_CLOEXEC);
 
 	if(localsockfd < 0)
 	{
+		/* Someone else took it */
+		if(errno == EAGAIN || errno == EWOULDBLOCK)
+			return SECURITY_SERVER_ERROR_TIMEOUT;
 		SEC_SVR_DBG("Cannot accept client. errno=%d", errno);
 		return SECURITY_SERVER_ERROR_SOCKET;
 	}
@@ -461,53 +685,222 @@ int accept_client(int server_sockfd)
 /* Minimal check of request packet */
 int validate_header(basic_header hdr)
 {
-	if(hdr.version != SECURITY_SERVER_MSG_VERSION)
+	if(hdr.version != SECURITY_SERVER_MSG_VERSION &&
+			hdr.version != SECURITY_SERVER_MSG_VERSION_2)
 		return SECURITY_SERVER_ERROR_BAD_REQUEST;
 
 	return SECURITY_SERVER_SUCCESS;
 }
 
-/* Send generic response packet to client
+/* Start an outgoing message */
+void init_msg_builder(msg_builder *msg)
+{
+	msg->iovcnt = 0;
+	msg->len = 0;
+	msg->nfds = 0;
+}
+
+/* Append a field to the message. Data is not copied, so it must stay valid *
+ * until the message is sent */
+void append_msg(msg_builder *msg, const void *data, int len)
+{
+	if(msg->len < 0 || len <= 0)
+		return;
+	if(msg->iovcnt >= SECURITY_SERVER_MSG_MAX_IOV)
+	{
+		SEC_SVR_DBG("%s", "Too many message fields");
+		msg->len = -1;
+		return;
+	}
+	msg->iov[msg->iovcnt].iov_base = (void *)data;
+	msg->iov[msg->iovcnt].iov_len = len;
+	msg->iovcnt++;
+	msg->len += len;
+}
+
+/* Attach file descriptors to the message. They are passed with SCM_RIGHTS *
+ * along with the first byte of the message */
+void append_msg_fds(msg_builder *msg, const int *fds, int nfds)
+{
+	if(msg->len < 0 || nfds <= 0)
+		return;
+	if(msg->nfds + nfds > SECURITY_SERVER_MSG_MAX_FDS)
+	{
+		SEC_SVR_DBG("%s", "Too many file descriptors");
+		msg->len = -1;
+		return;
+	}
+	memcpy(msg->fds + msg->nfds, fds, sizeof(int) * nfds);
+	msg->nfds += nfds;
+}
+
+/* Send whole message with one sendmsg() *
+ * Socket is polled only when its buffer is full */
+int send_msg(int sockfd, msg_builder *msg)
+{
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * SECURITY_SERVER_MSG_MAX_FDS)];
+	} control;
+	struct iovec *iov = msg->iov;
+	int iovcnt = msg->iovcnt, retval;
+
+	if(msg->len < 0)
+		return SECURITY_SERVER_ERROR_INPUT_PARAM;
+
+	memset(&mh, 0, sizeof(mh));
+	if(msg->nfds > 0)
+	{
+		memset(&control, 0, sizeof(control));
+		mh.msg_control = control.buf;
+		mh.msg_controllen = CMSG_SPACE(sizeof(int) * msg->nfds);
+		cmsg = CMSG_FIRSTHDR(&mh);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * msg->nfds);
+		memcpy(CMSG_DATA(cmsg), msg->fds, sizeof(int) * msg->nfds);
+	}
+	while(iovcnt > 0)
+	{
+		mh.msg_iov = iov;
+		mh.msg_iovlen = iovcnt;
+		retval = sendmsg(sockfd, &mh, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if(retval < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				SEC_SVR_DBG("Error on sendmsg(): %d. errno=%d, sockfd=%d", retval, errno, sockfd);
+				return SECURITY_SERVER_ERROR_SEND_FAILED;
+			}
+
+			/* Socket buffer is full. Wait until it drains */
+			retval = check_socket_poll(sockfd, POLLOUT, client_poll_timeout());
+			if(retval == SECURITY_SERVER_ERROR_POLL)
+			{
+				SEC_SVR_DBG("%s", "poll() error");
+				return SECURITY_SERVER_ERROR_SEND_FAILED;
+			}
+			if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
+			{
+				SEC_SVR_DBG("%s", "poll() timeout");
+				return client_poll_error(retval, SECURITY_SERVER_ERROR_SEND_FAILED);
+			}
+			continue;
+		}
+
+		/* Descriptors went with the first chunk */
+		mh.msg_control = NULL;
+		mh.msg_controllen = 0;
+
+		/* Skip what has been sent */
+		while(iovcnt > 0 && retval >= (int)iov->iov_len)
+		{
+			retval -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (unsigned char *)iov->iov_base + retval;
+			iov->iov_len -= retval;
+		}
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Send a response packet to client
  *
- * Generic Response Packet Format
+ * The header follows the framing of the request. v2 responses carry the
+ * request ID, and a connection may have several v2 requests in flight, so
+ * writing the response is serialized on the connection.
+ *
+ * v2 Response Packet Format
  0                   1                   2                   3
  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
 |---------------------------------------------------------------|
-| version=0x01  |  Message ID   |Message Length (without header)|
+| version=0x02  |  Message ID   |             flags             |
+|---------------------------------------------------------------|
+|                          Request ID                           |
+|---------------------------------------------------------------|
+|                Message Length (without header)                |
+|---------------------------------------------------------------|
+|  return code  |                    padding                    |
+|---------------------------------------------------------------|
+|                       payload (variable)                      |
 |---------------------------------------------------------------|
-|  return code  |
------------------
 */
-int send_generic_response (int sockfd, unsigned char msgid, unsigned char return_code)
+int send_response(request_context *req, unsigned char msgid, unsigned char return_code,
+	const void *data, unsigned int data_len)
+{
+	return send_response_fds(req, msgid, return_code, data, data_len, NULL, 0);
+}
+
+/* Send a response packet with file descriptors attached */
+int send_response_fds(request_context *req, unsigned char msgid, unsigned char return_code,
+	const void *data, unsigned int data_len, const int *fds, int nfds)
 {
 	response_header hdr;
-	int size;
+	response_header_v2 hdr_v2;
+	msg_builder msg;
+	int ret;
 
-	/* Assemble header */
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = msgid;
-	hdr.basic_hdr.msg_len = 0;
-	hdr.return_code = return_code;
+	init_msg_builder(&msg);
 
-	/* Check poll */
-	size = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(size == SECURITY_SERVER_ERROR_POLL)
+	/* Assemble header */
+	if(req->version == SECURITY_SERVER_MSG_VERSION_2)
 	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
+		memset(&hdr_v2, 0, sizeof(hdr_v2));
+		hdr_v2.basic_hdr.version = SECURITY_SERVER_MSG_VERSION_2;
+		hdr_v2.basic_hdr.msg_id = msgid;
+		hdr_v2.basic_hdr.request_id = req->request_id;
+		hdr_v2.basic_hdr.msg_len = data_len;
+		hdr_v2.return_code = return_code;
+		append_msg(&msg, &hdr_v2, sizeof(hdr_v2));
 	}
-	if(size == SECURITY_SERVER_ERROR_TIMEOUT)
+	else
 	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-	/* Send to client */
-	size = write(sockfd, &hdr, sizeof(hdr));
+		if(data_len > 0xffff)
+		{
+			SEC_SVR_DBG("Response is too big for v1 header: %d", data_len);
+			return SECURITY_SERVER_ERROR_INPUT_PARAM;
+		}
+		memset(&hdr, 0, sizeof(hdr));
+		hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
+		hdr.basic_hdr.msg_id = msgid;
+		hdr.basic_hdr.msg_len = (unsigned short)data_len;
+		hdr.return_code = return_code;
+		append_msg(&msg, &hdr, sizeof(hdr));
+	}
+	append_msg(&msg, data, data_len);
+	append_msg_fds(&msg, fds, nfds);
+
+	/* Send to client. Pipelined responses must never be interleaved */
+	if(req->send_mutex != NULL)
+		pthread_mutex_lock(req->send_mutex);
+	ret = send_msg(req->sockfd, &msg);
+	if(req->send_mutex != NULL)
+		pthread_mutex_unlock(req->send_mutex);
+	return ret;
+}
 
-	if(size < sizeof(hdr))
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	return SECURITY_SERVER_SUCCESS;
+/* Send generic response packet to client
+ *
+ * Generic Response Packet Format
+ 0                   1                   2                   3
+ 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+|---------------------------------------------------------------|
+| version=0x01  |  Message ID   |Message Length (without header)|
+|---------------------------------------------------------------|
+|  return code  |
+-----------------
+*/
+int send_generic_response (request_context *req, unsigned char msgid, unsigned char return_code)
+{
+	return send_response(req, msgid, return_code, NULL, 0);
 }
 
 /* Send cookie response to client
@@ -523,43 +916,11 @@ int send_generic_response (int sockfd, unsigned char msgid, unsigned char return
  *  |                 cookie (20 bytes)                             |
  *  |---------------------------------------------------------------|
 */
-int send_cookie(int sockfd, unsigned char *cookie)
+int send_cookie(request_context *req, unsigned char *cookie)
 {
-	response_header hdr;
-	unsigned char msg[SECURITY_SERVER_COOKIE_LEN + sizeof(hdr)];
-	int ret;
-
-	/* Assemble header */
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = SECURITY_SERVER_MSG_TYPE_COOKIE_RESPONSE;
-	hdr.basic_hdr.msg_len = SECURITY_SERVER_COOKIE_LEN;
-	hdr.return_code = SECURITY_SERVER_RETURN_CODE_SUCCESS;
-
-	memcpy(msg, &hdr, sizeof(hdr));
-	memcpy(msg + sizeof(hdr), cookie, SECURITY_SERVER_COOKIE_LEN);
-
-	/* Check poll */
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-	ret = write(sockfd, msg, sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN);
-	if(ret <  sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN)
-	{
-		/* Error on writing */
-		SEC_SVR_DBG("Error on write: %d", ret);
-		ret = SECURITY_SERVER_ERROR_SEND_FAILED;
-		return ret;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	return send_response(req, SECURITY_SERVER_MSG_TYPE_COOKIE_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS,
+			cookie, SECURITY_SERVER_COOKIE_LEN);
 }
 
 /* Send Object name response *
@@ -574,42 +935,11 @@ int send_cookie(int sockfd, unsigned char *cookie)
  * |                 object name                                   |
  * |---------------------------------------------------------------|
 */
-int send_object_name(int sockfd, char *obj)
+int send_object_name(request_context *req, char *obj)
 {
-	response_header hdr;
-	unsigned char msg[strlen(obj) + sizeof(hdr)];
-	int ret;
-
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = 0x06;
-	hdr.basic_hdr.msg_len = strlen(obj);
-	hdr.return_code = SECURITY_SERVER_RETURN_CODE_SUCCESS;
-
-	memcpy(msg, &hdr, sizeof(hdr));
-	memcpy(msg + sizeof(hdr), obj, strlen(obj));
-
-	/* Check poll */
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-	ret = write(sockfd, msg, sizeof(hdr) + strlen(obj));
-	if(ret <  sizeof(hdr) + strlen(obj))
-	{
-		/* Error on writing */
-		SEC_SVR_DBG("Error on write: %d", ret);
-		ret = SECURITY_SERVER_ERROR_SEND_FAILED;
-		return ret;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	return send_response(req, SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS,
+			obj, strlen(obj));
 }
 
 /* Send GID response to client
@@ -625,45 +955,11 @@ int send_object_name(int sockfd, char *obj)
  * |gid(last word) |
  * |---------------|
 */
-int send_gid(int sockfd, int gid)
+int send_gid(request_context *req, int gid)
 {
-	response_header hdr;
-	unsigned char msg[sizeof(gid) + sizeof(hdr)];
-	int ret;
-
-	/* Assemble header */
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GID_RESPONSE;
-	hdr.basic_hdr.msg_len = sizeof(gid);
-	hdr.return_code = SECURITY_SERVER_RETURN_CODE_SUCCESS;
-
-	/* Perpare packet */
-	memcpy(msg, &hdr, sizeof(hdr));
-	memcpy(msg + sizeof(hdr), &gid, sizeof(gid));
-
-	/* Check poll */
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-	/* Send it */
-	ret = write(sockfd, msg, sizeof(hdr) + sizeof(gid));
-	if(ret <  sizeof(hdr) + sizeof(gid))
-	{
-		/* Error on writing */
-		SEC_SVR_DBG("Error on write(): %d", ret);
-		ret = SECURITY_SERVER_ERROR_SEND_FAILED;
-		return ret;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	return send_response(req, SECURITY_SERVER_MSG_TYPE_GID_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS,
+			&gid, sizeof(gid));
 }
 
 /* Send PID response to client
@@ -679,45 +975,11 @@ int send_gid(int sockfd, int gid)
  * |pid(last word) |
  * |---------------|
 */
-int send_pid(int sockfd, int pid)
+int send_pid(request_context *req, int pid)
 {
-	response_header hdr;
-	unsigned char msg[sizeof(pid) + sizeof(hdr)];
-	int ret;
-
-	/* Assemble header */
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = SECURITY_SERVER_MSG_TYPE_PID_RESPONSE;
-	hdr.basic_hdr.msg_len = sizeof(pid);
-	hdr.return_code = SECURITY_SERVER_RETURN_CODE_SUCCESS;
-
-	/* Perpare packet */
-	memcpy(msg, &hdr, sizeof(hdr));
-	memcpy(msg + sizeof(hdr), &pid, sizeof(pid));
-
-	/* Check poll */
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-	/* Send it */
-	ret = write(sockfd, msg, sizeof(hdr) + sizeof(pid));
-	if(ret <  sizeof(hdr) + sizeof(pid))
-	{
-		/* Error on writing */
-		SEC_SVR_DBG("Error on write(): %d", ret);
-		ret = SECURITY_SERVER_ERROR_SEND_FAILED;
-		return ret;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	return send_response(req, SECURITY_SERVER_MSG_TYPE_PID_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS,
+			&pid, sizeof(pid));
 }
 
 /* Send Check password response to client
@@ -737,58 +999,51 @@ int send_pid(int sockfd, int pid)
  * |expire_in_days |
  * |----------------
  */
-int send_pwd_response(const int sockfd,
+int send_pwd_response(request_context *req,
 	const unsigned char msg_id,
 	const unsigned char return_code,
 	const unsigned int current_attempts,
 	const unsigned int max_attempts,
 	const unsigned int expire_time)
 {
-	response_header hdr;
-	unsigned int expire_secs;
-	unsigned char msg[sizeof(hdr) + sizeof(current_attempts) + sizeof(max_attempts) + sizeof(expire_secs)];
-	int ret, ptr = 0;
+	unsigned int msg[3];
 
+	/* Perpare packet */
+	msg[0] = current_attempts;
+	msg[1] = max_attempts;
+	msg[2] = expire_time;
 
-	/* Assemble header */
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = msg_id;
-	hdr.basic_hdr.msg_len = sizeof(unsigned int) * 3;
-	hdr.return_code = return_code;
+	return send_response(req, msg_id, return_code, msg, sizeof(msg));
+}
 
-	/* Perpare packet */
-	memcpy(msg, &hdr, sizeof(hdr));
-	ptr += sizeof(hdr);
-	memcpy(msg + ptr, &current_attempts, sizeof(current_attempts));
-	ptr += sizeof(current_attempts);
-	memcpy(msg + ptr, &max_attempts, sizeof(max_attempts));
-	ptr += sizeof(max_attempts);
-	memcpy(msg + ptr, &expire_time, sizeof(expire_time));
-	ptr += sizeof(expire_time);
+/* Send deadline of the request that follows on this connection *
+ * There is no response. The server drops the request unanswered when it *
+ * can't start on it before the deadline
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x23 |       Message Length = 8      |
+ * |---------------------------------------------------------------|
+ * |         deadline (CLOCK_MONOTONIC microseconds, 64 bit)       |
+ * |                                                               |
+ * |---------------------------------------------------------------|
+ */
+int send_deadline(int sock_fd, unsigned long long deadline)
+{
+	basic_header hdr;
+	msg_builder msg;
 
-	/* Check poll */
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "Server: poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "Server: poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_DEADLINE;
+	hdr.msg_len = sizeof(deadline);
 
-	/* Send it */
-	ret = write(sockfd, msg, ptr);
-	if(ret <  ptr)
-	{
-		/* Error on writing */
-		SEC_SVR_DBG("Server: ERROR on write(): %d", ret);
-		ret = SECURITY_SERVER_ERROR_SEND_FAILED;
-		return ret;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &deadline, sizeof(deadline));
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send cookie request packet to security server *
@@ -802,35 +1057,157 @@ int send_pwd_response(const int sockfd,
 int send_cookie_request(int sock_fd)
 {
 	basic_header hdr;
-	int retval;
+	msg_builder msg;
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_COOKIE_REQUEST;
 	hdr.msg_len = 0;
 
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	return send_msg(sock_fd, &msg);
+}
+
+/* Send shared-memory channel request packet to security server *
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x1d |       Message Length = 0      |
+ * |---------------------------------------------------------------|
+ */
+int send_shm_channel_request(int sock_fd)
+{
+	basic_header hdr;
+	msg_builder msg;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_REQUEST;
+	hdr.msg_len = 0;
 
 	/* Send to server */
-	retval = write(sock_fd, &hdr, sizeof(hdr));
-	if(retval < sizeof(hdr))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	return send_msg(sock_fd, &msg);
+}
+
+/* Send revocation subscription request packet to security server *
+ * The connection is kept open and revocation events follow the response
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x29 |       Message Length = 0      |
+ * |---------------------------------------------------------------|
+ */
+int send_subscribe_revocation_request(int sock_fd)
+{
+	basic_header hdr;
+	msg_builder msg;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_REQUEST;
+	hdr.msg_len = 0;
+
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	return send_msg(sock_fd, &msg);
+}
+
+/* Send handoff request packet to the running security server *
+ * Sent by a new server process taking over
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x24 |       Message Length = 0      |
+ * |---------------------------------------------------------------|
+ */
+int send_handoff_request(int sock_fd)
+{
+	basic_header hdr;
+	msg_builder msg;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_HANDOFF_REQUEST;
+	hdr.msg_len = 0;
+
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	return send_msg(sock_fd, &msg);
+}
+
+/* Send a cookie to the server taking over. One follows another after the *
+ * handoff response
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x26 |   Message Length = variable   |
+ * |---------------------------------------------------------------|
+ * |                                                               |
+ * |                       cookie (20 bytes)                       |
+ * |                                                               |
+ * |---------------------------------------------------------------|
+ * |                              pid                              |
+ * |---------------------------------------------------------------|
+ * |                           path_len                            |
+ * |---------------------------------------------------------------|
+ * |                        permission_len                         |
+ * |---------------------------------------------------------------|
+ * |                           label_len                           |
+ * |---------------------------------------------------------------|
+ * |                                                               |
+ * |                    start time (8 bytes)                       |
+ * |                                                               |
+ * |---------------------------------------------------------------|
+ * |                     path (path_len bytes)                     |
+ * |---------------------------------------------------------------|
+ * |              permissions (permission_len integers)            |
+ * |---------------------------------------------------------------|
+ * |        SMACK label (label_len bytes, no null terminator)      |
+ * |---------------------------------------------------------------|
+ */
+int send_cookie_record(int sock_fd, const cookie_snapshot_entry *cookie)
+{
+	basic_header hdr;
+	msg_builder msg;
+	int lens[4], total;
+
+	lens[0] = cookie->pid;
+	lens[1] = cookie->path_len;
+	lens[2] = cookie->permission_len;
+	lens[3] = cookie->label_len;
+	total = SECURITY_SERVER_COOKIE_LEN + sizeof(lens) + sizeof(cookie->start_time)
+		+ lens[1] + lens[2] * sizeof(int) + lens[3];
+	if(total > 0xffff)
+	{
+		SEC_SVR_DBG("Cookie of pid %d is too big to send: %d", cookie->pid, total);
+		return SECURITY_SERVER_ERROR_INPUT_PARAM;
 	}
-	return SECURITY_SERVER_SUCCESS;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_COOKIE_RECORD;
+	hdr.msg_len = (unsigned short)total;
+
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, cookie->cookie, SECURITY_SERVER_COOKIE_LEN);
+	append_msg(&msg, lens, sizeof(lens));
+	append_msg(&msg, &cookie->start_time, sizeof(cookie->start_time));
+	append_msg(&msg, cookie->path, lens[1]);
+	append_msg(&msg, cookie->permissions, lens[2] * sizeof(int));
+	append_msg(&msg, cookie->smack_label, lens[3]);
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send GID request message to security server
@@ -848,62 +1225,23 @@ int send_cookie_request(int sock_fd)
 int send_gid_request(int sock_fd, const char* object)
 {
 	basic_header hdr;
-	int retval = 0, send_len = 0;
-	unsigned char *buf = NULL;
+	msg_builder msg;
 
 	if(strlen(object) > SECURITY_SERVER_MAX_OBJ_NAME)
 	{
 		/* Object name is too big*/
-		SEC_SVR_DBG("Object name is too big %dbytes", strlen(object));
+		SEC_SVR_DBG("Object name is too big %dbytes", (int)strlen(object));
 		return SECURITY_SERVER_ERROR_INPUT_PARAM;
 	}
 
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GID_REQUEST;
-	hdr.msg_len = strlen(object);
-
-	send_len = sizeof(hdr) + strlen(object);
-
-	buf = malloc(send_len);
-	if(buf == NULL)
-	{
-		SEC_SVR_DBG("%s", "out of memory");
-		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-	}
-
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf + sizeof(hdr), object, strlen(object));
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		retval = SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-
-	retval = write(sock_fd, buf, send_len);
-	if(retval < send_len)
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d. errno=%d, sockfd=%d", retval, errno, sock_fd);
-		retval = SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	else
-		retval = SECURITY_SERVER_SUCCESS;
-
-error:
-	if(buf != NULL)
-		free(buf);
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GID_REQUEST;
+	hdr.msg_len = strlen(object);
 
-	return retval;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, object, strlen(object));
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send object name request message to security server *
@@ -919,39 +1257,18 @@ error:
 int send_object_name_request(int sock_fd, int gid)
 {
 	basic_header hdr;
-	int retval;
-	unsigned char buf[sizeof(hdr) + sizeof(gid)];
+	msg_builder msg;
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_REQUEST;
 	hdr.msg_len = sizeof(gid);
 
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf + sizeof(hdr), &gid, sizeof(gid));
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
 	/* Send to server */
-	retval = write(sock_fd, buf, sizeof(buf));
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &gid, sizeof(gid));
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send privilege check request message to security server *
@@ -973,40 +1290,19 @@ int send_object_name_request(int sock_fd, int gid)
 int send_privilege_check_request(int sock_fd, const char*cookie, int gid)
 {
 	basic_header hdr;
-	int retval;
-	unsigned char buf[sizeof(hdr) + sizeof(gid) + SECURITY_SERVER_COOKIE_LEN];
+	msg_builder msg;
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_REQUEST;
 	hdr.msg_len = sizeof(gid) + SECURITY_SERVER_COOKIE_LEN;
 
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf + sizeof(hdr), cookie, SECURITY_SERVER_COOKIE_LEN);
-	memcpy(buf + sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN, &gid, sizeof(gid));
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
 	/* Send to server */
-	retval = write(sock_fd, buf, sizeof(buf));
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, cookie, SECURITY_SERVER_COOKIE_LEN);
+	append_msg(&msg, &gid, sizeof(gid));
+	return send_msg(sock_fd, &msg);
 }
 
 int send_privilege_check_new_request(int sock_fd,
@@ -1015,9 +1311,8 @@ int send_privilege_check_new_request(int sock_fd,
                                      const char *access_rights)
 {
 	basic_header hdr;
-	int retval;
+	msg_builder msg;
         int olen, alen;
-        int size;
 
         olen = strlen(object);
         alen = strlen(access_rights);
@@ -1026,46 +1321,20 @@ int send_privilege_check_new_request(int sock_fd,
                 return SECURITY_SERVER_ERROR_INPUT_PARAM;
         }
 
-	unsigned char buf[sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN +
-                          2*sizeof(int) + MAX_OBJECT_LABEL_LEN + MAX_MODE_STR_LEN];
-
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_REQUEST;
 	hdr.msg_len = SECURITY_SERVER_COOKIE_LEN + 2*sizeof(int) + olen + alen;
 
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf + sizeof(hdr), cookie, SECURITY_SERVER_COOKIE_LEN);
-        memcpy(buf + sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN, &olen, sizeof(int));
-        memcpy(buf + sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN + sizeof(int),
-               &alen, sizeof(int));
-	memcpy(buf + sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN + 2*sizeof(int), object, olen);
-	memcpy(buf + sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN + 2*sizeof(int) + olen,
-               access_rights, alen);
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-        size = sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN + 2*sizeof(int) + olen + alen;
 	/* Send to server */
-	retval = write(sock_fd, buf, size);
-	if(retval < size)
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, cookie, SECURITY_SERVER_COOKIE_LEN);
+	append_msg(&msg, &olen, sizeof(int));
+	append_msg(&msg, &alen, sizeof(int));
+	append_msg(&msg, object, olen);
+	append_msg(&msg, access_rights, alen);
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send PID check request message to security server *
@@ -1085,42 +1354,49 @@ int send_privilege_check_new_request(int sock_fd,
 int send_pid_request(int sock_fd, const char*cookie)
 {
 	basic_header hdr;
-	int retval;
-	unsigned char buf[sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN];
+	msg_builder msg;
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_PID_REQUEST;
 	hdr.msg_len = SECURITY_SERVER_COOKIE_LEN;
 
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf + sizeof(hdr), cookie, SECURITY_SERVER_COOKIE_LEN);
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, cookie, SECURITY_SERVER_COOKIE_LEN);
+	return send_msg(sock_fd, &msg);
+}
 
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
+
+/* Send cookie preparation request message to security server *
+ * Sent by the application launcher for a process it has just spawned
+ *
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x27 |       Message Length = 4      |
+ * |---------------------------------------------------------------|
+ * |                              PID                              |
+ * |---------------------------------------------------------------|
+ */
+int send_prepare_cookie_request(int sock_fd, int pid)
+{
+	basic_header hdr;
+	msg_builder msg;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_REQUEST;
+	hdr.msg_len = sizeof(pid);
 
 	/* Send to server */
-	retval = write(sock_fd, buf, sizeof(buf));
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &pid, sizeof(pid));
+	return send_msg(sock_fd, &msg);
 }
 
-
 /* Send debug tool launch request message to security server *
  *
  * Message format
@@ -1154,6 +1430,7 @@ int send_pid_request(int sock_fd, const char*cookie)
 int send_launch_tool_request(int sock_fd, int argc, const char **argv)
 {
 	basic_header hdr;
+	msg_builder msg;
 	int retval, total_length = 0, ptr, i, tempnum;
 	unsigned char *buf = NULL;
 
@@ -1180,7 +1457,8 @@ int send_launch_tool_request(int sock_fd, int argc, const char **argv)
 		return SECURITY_SERVER_ERROR_INPUT_PARAM;
 	}
 
-	buf = malloc(total_length);
+	/* Number of arguments is not fixed, so the body is assembled in a buffer */
+	buf = malloc(total_length - sizeof(hdr));
 	if(buf == NULL)
 	{
 		SEC_SVR_DBG("%s", "Error: failed to malloc()");
@@ -1191,10 +1469,8 @@ int send_launch_tool_request(int sock_fd, int argc, const char **argv)
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_TOOL_REQUEST;
 	hdr.msg_len = (unsigned short)total_length;
-	memcpy(buf, &hdr, sizeof(hdr));
-	ptr = sizeof(hdr);
-	memcpy(buf + ptr, &argc, sizeof(int));
-	ptr += sizeof(hdr);
+	memcpy(buf, &argc, sizeof(int));
+	ptr = sizeof(int);
 
 	/* Assemple each argv length and value */
 	for(i=0;i<argc;i++)
@@ -1206,36 +1482,13 @@ int send_launch_tool_request(int sock_fd, int argc, const char **argv)
 		ptr += tempnum;
 	}
 
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-
 	/* Send to server */
-	retval = write(sock_fd, buf, total_length);
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-	retval = SECURITY_SERVER_SUCCESS;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, buf, ptr);
+	retval = send_msg(sock_fd, &msg);
 
-error:
-	if(buf != NULL)
-		free(buf);
+	free(buf);
 	return retval;
 }
 
@@ -1250,41 +1503,16 @@ error:
 int send_valid_pwd_request(int sock_fd)
 {
 	basic_header hdr;
-	int retval;
+	msg_builder msg;
 
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_VALID_PWD_REQUEST;
 	hdr.msg_len = 0;
 
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-
 	/* Send to server */
-	retval = write(sock_fd, &hdr, sizeof(hdr));
-	if(retval < sizeof(hdr))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-	retval = SECURITY_SERVER_SUCCESS;
-
-error:
-	return retval;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send password set request message to security server *
@@ -1314,8 +1542,9 @@ int send_set_pwd_request(int sock_fd,
 			const unsigned int valid_period_in_days)
 {
 	basic_header hdr;
-	int retval, total_length = 0, ptr;
-	unsigned char *buf = NULL, cur_pwd_len, new_pwd_len;
+	msg_builder msg;
+	int total_length = 0;
+	unsigned char cur_pwd_len, new_pwd_len;
 
 	if(cur_pwd == NULL)
 		cur_pwd_len = 0;
@@ -1326,65 +1555,22 @@ int send_set_pwd_request(int sock_fd,
 	total_length += sizeof(hdr) + sizeof(char) + sizeof(char) + cur_pwd_len
 		+ new_pwd_len + sizeof(unsigned int) + sizeof(unsigned int);
 
-	buf = malloc(total_length);
-	if(buf == NULL)
-	{
-		SEC_SVR_DBG("%s", "Error: failed to malloc()");
-		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-	}
-
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SET_PWD_REQUEST;
 	hdr.msg_len = (unsigned short)total_length;
-	memcpy(buf, &hdr, sizeof(hdr));
-	ptr = sizeof(hdr);
-	memcpy(buf + ptr, &cur_pwd_len, sizeof(char));
-	ptr += sizeof(char);
-	memcpy(buf + ptr, &new_pwd_len, sizeof(char));
-	ptr += sizeof(char);
-	if(cur_pwd != NULL)
-	{
-		memcpy(buf + ptr, cur_pwd, cur_pwd_len);
-		ptr += cur_pwd_len;
-	}
-	memcpy(buf + ptr, new_pwd, new_pwd_len);
-	ptr += new_pwd_len;
-	memcpy(buf + ptr, &max_challenge, sizeof(unsigned int));
-	ptr += sizeof(unsigned int);
-	memcpy(buf + ptr, &valid_period_in_days, sizeof(unsigned int));
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
 
 	/* Send to server */
-	retval = write(sock_fd, buf, total_length);
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-	retval = SECURITY_SERVER_SUCCESS;
-
-error:
-	if(buf != NULL)
-		free(buf);
-	return retval;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &cur_pwd_len, sizeof(char));
+	append_msg(&msg, &new_pwd_len, sizeof(char));
+	if(cur_pwd != NULL)
+		append_msg(&msg, cur_pwd, cur_pwd_len);
+	append_msg(&msg, new_pwd, new_pwd_len);
+	append_msg(&msg, &max_challenge, sizeof(unsigned int));
+	append_msg(&msg, &valid_period_in_days, sizeof(unsigned int));
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send password validity change request message to security server *
@@ -1400,57 +1586,21 @@ error:
 int send_set_pwd_validity_request(int sock_fd, const unsigned int valid_period_in_days)
 {
     basic_header hdr;
-    int retval, total_length = 0, ptr;
-    unsigned char *buf = NULL;
+    msg_builder msg;
+    int total_length = 0;
 
     total_length = sizeof(hdr) + sizeof(unsigned int);
 
-    buf = malloc(total_length);
-    if(buf == NULL)
-    {
-        SEC_SVR_DBG("%s", "Error: failed to malloc()");
-        return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-    }
-
     /* Assemble header */
     hdr.version = SECURITY_SERVER_MSG_VERSION;
     hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_REQUEST;
     hdr.msg_len = (unsigned short)total_length;
-    memcpy(buf, &hdr, sizeof(hdr));
-    ptr = sizeof(hdr);
-    memcpy(buf + ptr, &valid_period_in_days, sizeof(unsigned int));
-
-    /* Check poll */
-    retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-    if(retval == SECURITY_SERVER_ERROR_POLL)
-    {
-        SEC_SVR_DBG("%s", "poll() error");
-        retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-        goto error;
-
-    }
-    if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-    {
-        SEC_SVR_DBG("%s", "poll() timeout");
-        retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-        goto error;
-    }
 
     /* Send to server */
-    retval = write(sock_fd, buf, total_length);
-    if(retval < sizeof(buf))
-    {
-        /* Write error */
-        SEC_SVR_DBG("Error on write(): %d", retval);
-        retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-        goto error;
-    }
-    retval = SECURITY_SERVER_SUCCESS;
-
-error:
-    if(buf != NULL)
-        free(buf);
-    return retval;
+    init_msg_builder(&msg);
+    append_msg(&msg, &hdr, sizeof(hdr));
+    append_msg(&msg, &valid_period_in_days, sizeof(unsigned int));
+    return send_msg(sock_fd, &msg);
 }
 
 /* Send password max challenge request message to security server *
@@ -1466,57 +1616,21 @@ error:
 int send_set_pwd_max_challenge_request(int sock_fd, const unsigned int max_challenge)
 {
     basic_header hdr;
-    int retval, total_length = 0, ptr;
-    unsigned char *buf = NULL;
+    msg_builder msg;
+    int total_length = 0;
 
     total_length = sizeof(hdr) + sizeof(unsigned int);
 
-    buf = malloc(total_length);
-    if(buf == NULL)
-    {
-        SEC_SVR_DBG("%s", "Error: failed to malloc()");
-        return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-    }
-
     /* Assemble header */
     hdr.version = SECURITY_SERVER_MSG_VERSION;
     hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_REQUEST;
     hdr.msg_len = (unsigned short)total_length;
-    memcpy(buf, &hdr, sizeof(hdr));
-    ptr = sizeof(hdr);
-    memcpy(buf + ptr, &max_challenge, sizeof(unsigned int));
-
-    /* Check poll */
-    retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-    if(retval == SECURITY_SERVER_ERROR_POLL)
-    {
-        SEC_SVR_DBG("%s", "poll() error");
-        retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-        goto error;
-
-    }
-    if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-    {
-        SEC_SVR_DBG("%s", "poll() timeout");
-        retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-        goto error;
-    }
 
     /* Send to server */
-    retval = write(sock_fd, buf, total_length);
-    if(retval < sizeof(buf))
-    {
-        /* Write error */
-        SEC_SVR_DBG("Error on write(): %d", retval);
-        retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-        goto error;
-    }
-    retval = SECURITY_SERVER_SUCCESS;
-
-error:
-    if(buf != NULL)
-        free(buf);
-    return retval;
+    init_msg_builder(&msg);
+    append_msg(&msg, &hdr, sizeof(hdr));
+    append_msg(&msg, &max_challenge, sizeof(unsigned int));
+    return send_msg(sock_fd, &msg);
 }
 
 /* Send password reset request message to security server *
@@ -1543,66 +1657,28 @@ int send_reset_pwd_request(int sock_fd,
 			const unsigned int valid_period_in_days)
 {
 	basic_header hdr;
-	int retval, total_length = 0, ptr;
-	unsigned char *buf = NULL, new_pwd_len;
+	msg_builder msg;
+	int total_length = 0;
+	unsigned char new_pwd_len;
 
 	new_pwd_len = strlen(new_pwd);
 
 	total_length += sizeof(hdr) + sizeof(char) + new_pwd_len + sizeof(unsigned int) +
 		sizeof(unsigned int);
 
-	buf = malloc(total_length);
-	if(buf == NULL)
-	{
-		SEC_SVR_DBG("%s", "Error: failed to malloc()");
-		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-	}
-
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_RESET_PWD_REQUEST;
 	hdr.msg_len = (unsigned short)total_length;
-	memcpy(buf, &hdr, sizeof(hdr));
-	ptr = sizeof(hdr);
-	memcpy(buf + ptr, &new_pwd_len, sizeof(char));
-	ptr += sizeof(char);
-	memcpy(buf + ptr, new_pwd, new_pwd_len);
-	ptr += new_pwd_len;
-	memcpy(buf + ptr, &max_challenge, sizeof(unsigned int));
-	ptr += sizeof(unsigned int);
-	memcpy(buf + ptr, &valid_period_in_days, sizeof(unsigned int));
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
 
 	/* Send to server */
-	retval = write(sock_fd, buf, total_length);
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-	retval = SECURITY_SERVER_SUCCESS;
-
-error:
-	if(buf != NULL)
-		free(buf);
-	return retval;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &new_pwd_len, sizeof(char));
+	append_msg(&msg, new_pwd, new_pwd_len);
+	append_msg(&msg, &max_challenge, sizeof(unsigned int));
+	append_msg(&msg, &valid_period_in_days, sizeof(unsigned int));
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send password check request message to security server *
@@ -1620,62 +1696,25 @@ error:
 int send_chk_pwd_request(int sock_fd, const char*challenge)
 {
 	basic_header hdr;
-	int retval, total_length = 0, ptr;
-	unsigned char *buf = NULL, challenge_len;
+	msg_builder msg;
+	int total_length = 0;
+	unsigned char challenge_len;
 
 	challenge_len = strlen(challenge);
 
 	total_length += sizeof(hdr) + sizeof(char) + challenge_len;
 
-	buf = malloc(total_length);
-	if(buf == NULL)
-	{
-		SEC_SVR_DBG("%s", "Error: failed to malloc()");
-		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-	}
-
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_CHK_PWD_REQUEST;
 	hdr.msg_len = (unsigned short)total_length;
-	memcpy(buf, &hdr, sizeof(hdr));
-	ptr = sizeof(hdr);
-	memcpy(buf + ptr, &challenge_len, sizeof(char));
-	ptr += sizeof(char);
-	memcpy(buf + ptr, challenge, challenge_len);
-	ptr += sizeof(char);
-
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
 
 	/* Send to server */
-	retval = write(sock_fd, buf, total_length);
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-	}
-	retval = SECURITY_SERVER_SUCCESS;
-
-error:
-	if(buf != NULL)
-		free(buf);
-	return retval;
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &challenge_len, sizeof(char));
+	append_msg(&msg, challenge, challenge_len);
+	return send_msg(sock_fd, &msg);
 }
 
 /* Send password history set request message to security server *
@@ -1691,9 +1730,9 @@ error:
 int send_set_pwd_history_request(int sock_fd, int num)
 {
 	basic_header hdr;
-	int retval, total_length = 0, ptr;
+	msg_builder msg;
+	int total_length = 0;
 	unsigned char history;
-	unsigned char buf[sizeof(hdr) + sizeof(history)];
 
 	total_length = sizeof(hdr) + sizeof(char);
 	history = (unsigned char) num;
@@ -1702,63 +1741,167 @@ int send_set_pwd_history_request(int sock_fd, int num)
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_REQUEST;
 	hdr.msg_len = (unsigned short)total_length;
-	memcpy(buf, &hdr, sizeof(hdr));
-	ptr = sizeof(hdr);
-	memcpy(buf + ptr, &history, sizeof(char));
-	ptr += sizeof(char);
 
-	/* Check poll */
-	retval = check_socket_poll(sock_fd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &history, sizeof(char));
+	return send_msg(sock_fd, &msg);
+}
+
+/* Initialize receive buffer of a client connection */
+void init_recv_buffer(recv_buffer *rbuf, int sockfd, int type)
+{
+	rbuf->sockfd = sockfd;
+	rbuf->seqpacket = (type == SOCK_SEQPACKET);
+	rbuf->start = 0;
+	rbuf->end = 0;
+}
+
+/* Receive one message of a SOCK_SEQPACKET connection *
+ * A message is always one datagram, so it must fit in the buffer */
+int fill_recv_buffer_seqpacket(recv_buffer *rbuf)
+{
+	struct msghdr mh;
+	struct iovec iov;
+	int retval;
+
+	iov.iov_base = rbuf->data;
+	iov.iov_len = SECURITY_SERVER_RECV_BUFFER_LEN;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+
+	do
+	{
+		retval = recvmsg(rbuf->sockfd, &mh, 0);
+	} while(retval < 0 && errno == EINTR);
+	if(retval < 0)
+	{
+		SEC_SVR_DBG("recvmsg failed: %d", errno);
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+	}
+	if(mh.msg_flags & MSG_TRUNC)
+	{
+		SEC_SVR_DBG("%s", "Message is too big for SOCK_SEQPACKET transport");
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+	}
+	rbuf->start = 0;
+	rbuf->end = retval;
+	return retval;
+}
+
+/* Pull whatever is available on the socket into the buffer */
+int fill_recv_buffer(recv_buffer *rbuf)
+{
+	int retval;
+
+	/* Move unconsumed bytes to the front */
+	if(rbuf->start > 0)
+	{
+		memmove(rbuf->data, rbuf->data + rbuf->start, rbuf->end - rbuf->start);
+		rbuf->end -= rbuf->start;
+		rbuf->start = 0;
+	}
+
+	retval = check_socket_poll(rbuf->sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
 	if(retval == SECURITY_SERVER_ERROR_POLL)
 	{
 		SEC_SVR_DBG("%s", "poll() error");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
-
+		return SECURITY_SERVER_ERROR_SOCKET;
 	}
 	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
 	{
 		SEC_SVR_DBG("%s", "poll() timeout");
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
+		return SECURITY_SERVER_ERROR_TIMEOUT;
+	}
+
+	if(rbuf->seqpacket)
+		return fill_recv_buffer_seqpacket(rbuf);
+
+	do
+	{
+		retval = read(rbuf->sockfd, rbuf->data + rbuf->end, SECURITY_SERVER_RECV_BUFFER_LEN - rbuf->end);
+	} while(retval < 0 && errno == EINTR);
+	if(retval < 0)
+	{
+		SEC_SVR_DBG("read failed: %d", errno);
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
+	rbuf->end += retval;
+	return retval;
+}
+
+/* Read len bytes through the receive buffer *
+ * Returns number of bytes read like read(). Less than len means the peer *
+ * closed the connection */
+int recv_buffered(recv_buffer *rbuf, void *buf, int len)
+{
+	int retval, copied = 0, avail;
+
+	while(copied < len)
+	{
+		avail = rbuf->end - rbuf->start;
+		if(avail > 0)
+		{
+			if(avail > len - copied)
+				avail = len - copied;
+			memcpy((unsigned char *)buf + copied, rbuf->data + rbuf->start, avail);
+			rbuf->start += avail;
+			copied += avail;
+			continue;
+		}
+
+		/* Message boundary. The rest of this message does not exist */
+		if(rbuf->seqpacket)
+			break;
+
+		if(len - copied >= SECURITY_SERVER_RECV_BUFFER_LEN)
+		{
+			/* Too big to be buffered. Read directly */
+			retval = check_socket_poll(rbuf->sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
+			if(retval != SECURITY_SERVER_SUCCESS)
+				return SECURITY_SERVER_ERROR_RECV_FAILED;
+			retval = read(rbuf->sockfd, (unsigned char *)buf + copied, len - copied);
+			if(retval < 0 && errno == EINTR)
+				continue;
+			if(retval < 0)
+				return SECURITY_SERVER_ERROR_RECV_FAILED;
+			if(retval == 0)
+				break;
+			copied += retval;
+			continue;
+		}
 
-	/* Send to server */
-	retval = write(sock_fd, buf, ptr);
-	if(retval < sizeof(buf))
-	{
-		/* Write error */
-		SEC_SVR_DBG("Error on write(): %d", retval);
-		retval =  SECURITY_SERVER_ERROR_SEND_FAILED;
-		goto error;
+		retval = fill_recv_buffer(rbuf);
+		if(retval < 0)
+			return retval;
+		if(retval == 0)
+			break;
 	}
-	retval = SECURITY_SERVER_SUCCESS;
-
-error:
-	return retval;
+	return copied;
 }
 
 /* Receive request header */
-int recv_hdr(int client_sockfd, basic_header *basic_hdr)
+int recv_hdr(recv_buffer *rbuf, basic_header *basic_hdr)
 {
 	int retval;
 
-	/* Check poll */
-	retval = check_socket_poll(client_sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SOCKET;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
+	/* Each datagram is a whole request. Drop what the previous one left */
+	if(rbuf->seqpacket)
 	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_TIMEOUT;
+		rbuf->start = 0;
+		rbuf->end = 0;
+		retval = fill_recv_buffer(rbuf);
+		if(retval < 0)
+			return retval;
 	}
 
-	/* Receive request header first */
-	retval = read(client_sockfd, basic_hdr, sizeof(basic_header));
-	if(retval < sizeof(basic_header))
+	/* Receive request header first. Usually the whole request comes with it */
+	retval = recv_buffered(rbuf, basic_hdr, sizeof(basic_header));
+	if(retval == SECURITY_SERVER_ERROR_SOCKET || retval == SECURITY_SERVER_ERROR_TIMEOUT)
+		return retval;
+	if(retval < (int)sizeof(basic_header))
 	{
 		SEC_SVR_DBG("read failed. closing socket %d", retval);
 		return SECURITY_SERVER_ERROR_RECV_FAILED;
@@ -1769,19 +1912,57 @@ int recv_hdr(int client_sockfd, basic_header *basic_hdr)
 	return retval;
 }
 
+/* Receive rest of the v2 request header *
+ * basic_hdr is the first 4 bytes already read by recv_hdr() */
+int recv_hdr_v2(recv_buffer *rbuf, const basic_header *basic_hdr, basic_header_v2 *hdr)
+{
+	int retval, len = sizeof(basic_header_v2) - sizeof(basic_header);
+
+	memcpy(hdr, basic_hdr, sizeof(basic_header));
+	retval = recv_buffered(rbuf, (unsigned char *)hdr + sizeof(basic_header), len);
+	if(retval < len)
+	{
+		SEC_SVR_DBG("Cannot read v2 header: %d", retval);
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+	}
+
+	if(hdr->msg_len > SECURITY_SERVER_MAX_MSG_LEN)
+	{
+		SEC_SVR_DBG("Message is too big: %u", hdr->msg_len);
+		return SECURITY_SERVER_ERROR_BAD_REQUEST;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Read next field of the request body *
+ * v1 body is read through the receive buffer, v2 body has been read with *
+ * the header. Returns number of bytes read like read() */
+int recv_request_data(request_context *req, void *buf, int len)
+{
+	if(req->payload == NULL)
+		return recv_buffered(req->rbuf, buf, len);
+
+	if(len < 0)
+		return -1;
+	if(len > req->msg_len - req->offset)
+		len = req->msg_len - req->offset;
+	memcpy(buf, req->payload + req->offset, len);
+	req->offset += len;
+	return len;
+}
 
 /* Receive check privilege request packet body */
-int recv_check_privilege_request(int sockfd, unsigned char *requested_cookie, int *requested_privilege)
+int recv_check_privilege_request(request_context *req, unsigned char *requested_cookie, int *requested_privilege)
 {
 	int retval;
-	retval = read(sockfd, requested_cookie, SECURITY_SERVER_COOKIE_LEN);
+	retval = recv_request_data(req, requested_cookie, SECURITY_SERVER_COOKIE_LEN);
 	if(retval < SECURITY_SERVER_COOKIE_LEN)
 	{
 		SEC_SVR_DBG("Received cookie size is too small: %d", retval);
 		return SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
 
-	retval = read(sockfd, requested_privilege, sizeof(int));
+	retval = recv_request_data(req, requested_privilege, sizeof(int));
 	if(retval < sizeof(int))
 	{
 		SEC_SVR_DBG("privilege size is too small: %d", retval);
@@ -1791,7 +1972,7 @@ int recv_check_privilege_request(int sockfd, unsigned char *requested_cookie, in
 }
 
 /* Receive check privilege request packet body (new mode)*/
-int recv_check_privilege_new_request(int sockfd,
+int recv_check_privilege_new_request(request_context *req,
                                      unsigned char *requested_cookie,
                                      char *object_label,
                                      char *access_rights)
@@ -1799,28 +1980,28 @@ int recv_check_privilege_new_request(int sockfd,
 	int retval;
         int olen, alen;
 
-	retval = read(sockfd, requested_cookie, SECURITY_SERVER_COOKIE_LEN);
+	retval = recv_request_data(req, requested_cookie, SECURITY_SERVER_COOKIE_LEN);
 	if(retval < SECURITY_SERVER_COOKIE_LEN)
 	{
 		SEC_SVR_DBG("Received cookie size is too small: %d", retval);
 		return SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
 
-	retval = read(sockfd, &olen, sizeof(int));
+	retval = recv_request_data(req, &olen, sizeof(int));
 	if(retval < sizeof(int) || olen < 0 || olen > MAX_OBJECT_LABEL_LEN)
 	{
 		SEC_SVR_DBG("error reading object_label len: %d", retval);
 		return SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
 
-	retval = read(sockfd, &alen, sizeof(int));
-	if(retval < sizeof(int) || alen < 0 || olen > MAX_MODE_STR_LEN)
+	retval = recv_request_data(req, &alen, sizeof(int));
+	if(retval < sizeof(int) || alen < 0 || alen > MAX_MODE_STR_LEN)
 	{
 		SEC_SVR_DBG("error reading access_rights len: %d", retval);
 		return SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
 
-	retval = read(sockfd, object_label, olen);
+	retval = recv_request_data(req, object_label, olen);
 	if(retval < olen)
 	{
 		SEC_SVR_DBG("error reading object_label: %d", retval);
@@ -1828,7 +2009,7 @@ int recv_check_privilege_new_request(int sockfd,
 	}
         object_label[olen] = '\0';
 
-	retval = read(sockfd, access_rights, olen);
+	retval = recv_request_data(req, access_rights, alen);
 	if(retval < alen)
 	{
 		SEC_SVR_DBG("error reading access_rights: %d", retval);
@@ -1840,10 +2021,10 @@ int recv_check_privilege_new_request(int sockfd,
 }
 
 /* Receive pid request packet body */
-int recv_pid_request(int sockfd, unsigned char *requested_cookie)
+int recv_pid_request(request_context *req, unsigned char *requested_cookie)
 {
 	int retval;
-	retval = read(sockfd, requested_cookie, SECURITY_SERVER_COOKIE_LEN);
+	retval = recv_request_data(req, requested_cookie, SECURITY_SERVER_COOKIE_LEN);
 	if(retval < SECURITY_SERVER_COOKIE_LEN)
 	{
 		SEC_SVR_DBG("Received cookie size is too small: %d", retval);
@@ -1852,8 +2033,153 @@ int recv_pid_request(int sockfd, unsigned char *requested_cookie)
 	return SECURITY_SERVER_SUCCESS;
 }
 
+int recv_prepare_cookie_request(request_context *req, int *pid)
+{
+	int retval;
+	retval = recv_request_data(req, pid, sizeof(int));
+	if(retval < (int)sizeof(int))
+	{
+		SEC_SVR_DBG("Received PID size is too small: %d", retval);
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Receive one revocation event. Blocks until it comes *
+ * Any error means events may have been lost */
+int recv_revocation_event(int sockfd, revocation_event *event)
+{
+	int received = 0, ret;
+
+	while(received < (int)sizeof(revocation_event))
+	{
+		ret = recv(sockfd, (unsigned char *)event + received,
+				sizeof(revocation_event) - received, 0);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+		{
+			SEC_SVR_DBG("Revocation stream closed: %d, errno=%d", ret, errno);
+			return SECURITY_SERVER_ERROR_RECV_FAILED;
+		}
+		received += ret;
+	}
+	if(event->hdr.msg_id != SECURITY_SERVER_MSG_TYPE_REVOCATION_EVENT
+			|| event->hdr.msg_len != sizeof(revocation_event) - sizeof(basic_header))
+	{
+		SEC_SVR_DBG("Unexpected message: %d", event->hdr.msg_id);
+		return SECURITY_SERVER_ERROR_BAD_RESPONSE;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Receive a cookie sent by send_cookie_record() *
+ * Returned item is not linked to any list */
+int recv_cookie_record(recv_buffer *rbuf, cookie_list **cookie)
+{
+	basic_header hdr;
+	cookie_list *added = NULL;
+	int retval, lens[4];
+
+	*cookie = NULL;
+	retval = recv_hdr(rbuf, &hdr);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
+	if(hdr.msg_id != SECURITY_SERVER_MSG_TYPE_COOKIE_RECORD
+			|| hdr.msg_len < SECURITY_SERVER_COOKIE_LEN + sizeof(lens) + sizeof(added->start_time))
+	{
+		SEC_SVR_DBG("Unexpected message: %d", hdr.msg_id);
+		return SECURITY_SERVER_ERROR_BAD_RESPONSE;
+	}
+
+	added = calloc(1, sizeof(cookie_list));
+	if(added == NULL)
+		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+	retval = SECURITY_SERVER_ERROR_RECV_FAILED;
+	if(recv_buffered(rbuf, added->cookie, SECURITY_SERVER_COOKIE_LEN) < SECURITY_SERVER_COOKIE_LEN
+			|| recv_buffered(rbuf, lens, sizeof(lens)) < (int)sizeof(lens)
+			|| recv_buffered(rbuf, &added->start_time, sizeof(added->start_time))
+				< (int)sizeof(added->start_time))
+		goto error;
+
+	if(lens[1] < 0 || lens[2] < 0 || lens[3] < 0 || hdr.msg_len != SECURITY_SERVER_COOKIE_LEN
+			+ sizeof(lens) + sizeof(added->start_time) + lens[1] + lens[2] * sizeof(int) + lens[3])
+	{
+		SEC_SVR_DBG("%s", "Bad cookie record");
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+	added->pid = lens[0];
+	added->path_len = lens[1];
+	added->permission_len = lens[2];
+	added->path = malloc(lens[1] + 1);
+	added->permissions = malloc(lens[2] * sizeof(int) + 1);
+	added->smack_label = lens[3] > 0 ? calloc(1, lens[3] + 1) : NULL;
+	if(added->path == NULL || added->permissions == NULL || (lens[3] > 0 && added->smack_label == NULL))
+	{
+		retval = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+		goto error;
+	}
+	if(recv_buffered(rbuf, added->path, lens[1]) < lens[1]
+			|| recv_buffered(rbuf, added->permissions, lens[2] * sizeof(int)) < lens[2] * (int)sizeof(int)
+			|| recv_buffered(rbuf, added->smack_label, lens[3]) < lens[3])
+		goto error;
+
+	*cookie = added;
+	return SECURITY_SERVER_SUCCESS;
+
+error:
+	free(added->path);
+	free(added->permissions);
+	free(added->smack_label);
+	free(added);
+	return retval;
+}
+
+/* Receive deadline packet body */
+int recv_deadline(request_context *req, unsigned long long *deadline)
+{
+	int retval;
+
+	if(req->msg_len != sizeof(*deadline))
+	{
+		SEC_SVR_DBG("Bad deadline length: %d", req->msg_len);
+		return SECURITY_SERVER_ERROR_BAD_REQUEST;
+	}
+	retval = recv_request_data(req, deadline, sizeof(*deadline));
+	if(retval < (int)sizeof(*deadline))
+	{
+		SEC_SVR_DBG("Received deadline size is too small: %d", retval);
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Look for a deadline at the head of a connection without consuming it, *
+ * so a queued connection can be dropped before a worker reads it */
+int peek_deadline(int sockfd, unsigned long long *deadline)
+{
+	unsigned char buf[sizeof(basic_header) + sizeof(*deadline)];
+	basic_header hdr;
+	int retval;
+
+	do
+	{
+		retval = recv(sockfd, buf, sizeof(buf), MSG_PEEK | MSG_DONTWAIT);
+	} while(retval < 0 && errno == EINTR);
+	if(retval < (int)sizeof(buf))
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if(hdr.version != SECURITY_SERVER_MSG_VERSION || hdr.msg_id != SECURITY_SERVER_MSG_TYPE_DEADLINE
+			|| hdr.msg_len != sizeof(*deadline))
+		return SECURITY_SERVER_ERROR_RECV_FAILED;
+	memcpy(deadline, buf + sizeof(hdr), sizeof(*deadline));
+	return SECURITY_SERVER_SUCCESS;
+}
+
 /* Receive pid request packet body */
-int recv_launch_tool_request(int sockfd, int argc, char *argv[])
+int recv_launch_tool_request(request_context *req, int argc, char *argv[])
 {
 	int retval, i, argv_len;
 
@@ -1862,7 +2188,7 @@ int recv_launch_tool_request(int sockfd, int argc, char *argv[])
 
 	for(i=1;i<argc;i++)
 	{
-		retval = read(sockfd, &argv_len, sizeof(int));
+		retval = recv_request_data(req, &argv_len, sizeof(int));
 		if(retval < sizeof(int))
 		{
 			SEC_SVR_DBG("Error: argv length recieve failed: %d", retval);
@@ -1879,7 +2205,7 @@ int recv_launch_tool_request(int sockfd, int argc, char *argv[])
 		}
 
 		memset(argv[i], 0x00, argv_len + 1);
-		retval = read(sockfd, argv[i], argv_len);
+		retval = recv_request_data(req, argv[i], argv_len);
 		if(retval < argv_len)
 		{
 			SEC_SVR_DBG("Error: argv recieve failed: %d", retval);
@@ -1891,12 +2217,31 @@ int recv_launch_tool_request(int sockfd, int argc, char *argv[])
 	return SECURITY_SERVER_SUCCESS;
 }
 
-int recv_generic_response(int sockfd, response_header *hdr)
+/* Receive response header and body together *
+ * Both are read with one readv(). The server writes a response at once, so *
+ * another read is needed only if it has been split. Returns body length */
+int recv_response(int sockfd, response_header *hdr, void *body, int max_body_len)
 {
-	int retval;
+	return recv_response_fds(sockfd, hdr, body, max_body_len, NULL, NULL);
+}
+
+/* Receive response and file descriptors passed with it *
+ * fds must have room for SECURITY_SERVER_MSG_MAX_FDS descriptors. On success *
+ * *nfds is set to the number received and the caller owns them */
+int recv_response_fds(int sockfd, response_header *hdr, void *body, int max_body_len,
+	int *fds, int *nfds)
+{
+	struct iovec iov[2];
+	struct msghdr mh;
+	struct cmsghdr *cmsg;
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * SECURITY_SERVER_MSG_MAX_FDS)];
+	} control;
+	int retval, received, body_len, num_fds = 0, i;
 
 	/* Check poll */
-	retval = check_socket_poll(sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
+	retval = check_socket_poll(sockfd, POLLIN, client_poll_timeout());
 	if(retval == SECURITY_SERVER_ERROR_POLL)
 	{
 		SEC_SVR_DBG("%s", "Client: poll() error");
@@ -1905,17 +2250,97 @@ int recv_generic_response(int sockfd, response_header *hdr)
 	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
 	{
 		SEC_SVR_DBG("%s", "Client: poll() timeout");
-		return SECURITY_SERVER_ERROR_RECV_FAILED;
+		return client_poll_error(retval, SECURITY_SERVER_ERROR_RECV_FAILED);
+	}
+
+	iov[0].iov_base = hdr;
+	iov[0].iov_len = sizeof(response_header);
+	iov[1].iov_base = body;
+	iov[1].iov_len = max_body_len;
+	memset(&mh, 0, sizeof(mh));
+	mh.msg_iov = iov;
+	mh.msg_iovlen = max_body_len > 0 ? 2 : 1;
+	if(fds != NULL)
+	{
+		mh.msg_control = control.buf;
+		mh.msg_controllen = sizeof(control.buf);
+	}
+	do
+	{
+		received = recvmsg(sockfd, &mh, MSG_CMSG_CLOEXEC);
+	} while(received < 0 && errno == EINTR);
+
+	if(received >= 0 && fds != NULL)
+	{
+		for(cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg))
+		{
+			if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+				continue;
+			num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * num_fds);
+		}
+		if(mh.msg_flags & MSG_CTRUNC)
+		{
+			SEC_SVR_DBG("%s", "Client: Too many file descriptors");
+			retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+			goto error;
+		}
 	}
 
-	/* Receive response */
-	retval = read(sockfd, hdr, sizeof(response_header));
-	if(retval < sizeof(hdr) )
+	if(received < (int)sizeof(response_header))
 	{
 		/* Error on socket */
-		SEC_SVR_DBG("Client: Receive failed %d", retval);
-		return  SECURITY_SERVER_ERROR_RECV_FAILED;
+		SEC_SVR_DBG("Client: Receive failed %d", received);
+		retval = SECURITY_SERVER_ERROR_RECV_FAILED;
+		goto error;
+	}
+	received -= sizeof(response_header);
+
+	body_len = hdr->basic_hdr.msg_len;
+	if(body_len > max_body_len)
+	{
+		SEC_SVR_DBG("Client: Response is too big: %d", body_len);
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+
+	/* Rest of the body */
+	while(received < body_len)
+	{
+		retval = check_socket_poll(sockfd, POLLIN, client_poll_timeout());
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			retval = client_poll_error(retval, SECURITY_SERVER_ERROR_RECV_FAILED);
+			goto error;
+		}
+		retval = read(sockfd, (unsigned char *)body + received, body_len - received);
+		if(retval < 0 && errno == EINTR)
+			continue;
+		if(retval <= 0)
+		{
+			SEC_SVR_DBG("Client: Receive failed %d", retval);
+			retval = SECURITY_SERVER_ERROR_RECV_FAILED;
+			goto error;
+		}
+		received += retval;
 	}
+	if(nfds != NULL)
+		*nfds = num_fds;
+	return body_len;
+
+error:
+	for(i = 0; i < num_fds; i++)
+		close(fds[i]);
+	return retval;
+}
+
+int recv_generic_response(int sockfd, response_header *hdr)
+{
+	int retval;
+
+	retval = recv_response(sockfd, hdr, NULL, 0);
+	if(retval < 0)
+		return retval;
 
 	if(hdr->return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
 	{
@@ -1929,11 +2354,12 @@ int recv_get_gid_response(int sockfd, response_header *hdr, int *gid)
 {
 	int retval;
 
-	retval = recv_generic_response(sockfd, hdr);
-	if(retval != SECURITY_SERVER_SUCCESS)
+	retval = recv_response(sockfd, hdr, gid, sizeof(int));
+	if(retval < 0)
+		return retval;
+	if(hdr->return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
 		return return_code_to_error_code(hdr->return_code);
 
-	retval = read(sockfd, gid, sizeof(int));
 	if(retval < sizeof(int))
 	{
 		/* Error on socket */
@@ -1946,62 +2372,25 @@ int recv_get_gid_response(int sockfd, response_header *hdr, int *gid)
 int recv_get_object_name(int sockfd, response_header *hdr, char *object, int max_object_size)
 {
 	int retval;
-	char *local_obj_name = NULL;
-
-	/* Check poll */
-	retval = check_socket_poll(sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_RECV_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_RECV_FAILED;
-	}
+	char local_obj_name[SECURITY_SERVER_MAX_OBJ_NAME];
 
 	/* Read response */
-	retval = read(sockfd, hdr, sizeof(response_header));
-	if(retval < sizeof(hdr) )
+	retval = recv_response(sockfd, hdr, local_obj_name, sizeof(local_obj_name));
+	if(retval < 0)
 	{
-		/* Error on socket */
 		SEC_SVR_DBG("cannot recv respons: %d", retval);
-		return SECURITY_SERVER_ERROR_RECV_FAILED;
+		return retval;
 	}
 
 	if(hdr->return_code == SECURITY_SERVER_RETURN_CODE_SUCCESS)
 	{
-		if(max_object_size < hdr->basic_hdr.msg_len)
+		if(max_object_size < retval)
 		{
-			SEC_SVR_DBG("Object name is too small need %d bytes, but %d bytes", hdr->basic_hdr.msg_len, max_object_size);
+			SEC_SVR_DBG("Object name is too small need %d bytes, but %d bytes", retval, max_object_size);
 			return SECURITY_SERVER_ERROR_BUFFER_TOO_SMALL;
 		}
-		if(hdr->basic_hdr.msg_len > SECURITY_SERVER_MAX_OBJ_NAME)
-		{
-			SEC_SVR_DBG("Received object name is too big. %d", hdr->basic_hdr.msg_len);
-			return SECURITY_SERVER_ERROR_BAD_RESPONSE;
-		}
-
-		local_obj_name = malloc(hdr->basic_hdr.msg_len + 1);
-		if(local_obj_name == NULL)
-		{
-			SEC_SVR_DBG("%s", "Out of memory error");
-			return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-		}
-
-		retval = read(sockfd, local_obj_name, hdr->basic_hdr.msg_len);
-		if(retval < (hdr->basic_hdr.msg_len))
-		{
-			/* Error on socket */
-			SEC_SVR_DBG("read() failed: %d", retval);
-			if(local_obj_name != NULL)
-				free(local_obj_name);
-			return SECURITY_SERVER_ERROR_RECV_FAILED;
-		}
-		memcpy(object, local_obj_name, hdr->basic_hdr.msg_len);
-		object[hdr->basic_hdr.msg_len] = 0;
-		retval = SECURITY_SERVER_SUCCESS;
+		memcpy(object, local_obj_name, retval);
+		object[retval] = 0;
 	}
 	else
 	{
@@ -2010,8 +2399,6 @@ int recv_get_object_name(int sockfd, response_header *hdr, char *object, int max
 		return retval;
 	}
 
-	if(local_obj_name != NULL)
-		free(local_obj_name);
 	return SECURITY_SERVER_SUCCESS;
 }
 
@@ -2019,11 +2406,12 @@ int recv_cookie(int sockfd, response_header *hdr, char *cookie)
 {
 	int retval;
 
-	retval = recv_generic_response(sockfd, hdr);
-	if(retval != SECURITY_SERVER_SUCCESS)
+	retval = recv_response(sockfd, hdr, cookie, SECURITY_SERVER_COOKIE_LEN);
+	if(retval < 0)
+		return retval;
+	if(hdr->return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
 		return return_code_to_error_code(hdr->return_code);
 
-	retval = read(sockfd, cookie, SECURITY_SERVER_COOKIE_LEN);
 	if(retval < SECURITY_SERVER_COOKIE_LEN)
 	{
 		/* Error on socket */
@@ -2065,11 +2453,12 @@ int recv_pid_response(int sockfd, response_header *hdr, int *pid)
 {
 	int retval;
 
-	retval = recv_generic_response(sockfd, hdr);
-	if(retval != SECURITY_SERVER_SUCCESS)
+	retval = recv_response(sockfd, hdr, pid, sizeof(int));
+	if(retval < 0)
+		return retval;
+	if(hdr->return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
 		return return_code_to_error_code(hdr->return_code);
 
-	retval = read(sockfd, pid, sizeof(int));
 	if(retval < sizeof(int))
 	{
 		/* Error on socket */
@@ -2084,12 +2473,16 @@ int recv_pwd_response(int sockfd, response_header *hdr,
 	unsigned int *max_attempts,
 	unsigned int *valid_secs)
 {
-	int retval;
+	int retval, body_len;
+	unsigned int body[3];
 	*current_attempts = 0;
 	*max_attempts = 0;
 	*valid_secs = 0;
 
-	retval = recv_generic_response(sockfd, hdr);
+	body_len = recv_response(sockfd, hdr, body, sizeof(body));
+	if(body_len < 0)
+		return body_len;
+	retval = return_code_to_error_code(hdr->return_code);
 
 	switch(retval)
 	{
@@ -2103,30 +2496,19 @@ int recv_pwd_response(int sockfd, response_header *hdr,
 		case SECURITY_SERVER_SUCCESS:
 			break;
 		default:
-			return return_code_to_error_code(hdr->return_code);
+			return retval;
 	}
 
-	retval = read(sockfd, current_attempts, sizeof(unsigned int));
-	if(retval < sizeof(unsigned int))
-	{
-		/* Error on socket */
-		SEC_SVR_DBG("Client: Receive failed %d", retval);
-		return  SECURITY_SERVER_ERROR_RECV_FAILED;
-	}
-	retval = read(sockfd, max_attempts, sizeof(unsigned int));
-	if(retval < sizeof(unsigned int))
-	{
-		/* Error on socket */
-		SEC_SVR_DBG("Client: Receive failed %d", retval);
-		return  SECURITY_SERVER_ERROR_RECV_FAILED;
-	}
-	retval = read(sockfd, valid_secs, sizeof(unsigned int));
-	if(retval < sizeof(unsigned int))
+	if(body_len < sizeof(body))
 	{
 		/* Error on socket */
-		SEC_SVR_DBG("Client: Receive failed %d", retval);
+		SEC_SVR_DBG("Client: Receive failed %d", body_len);
 		return  SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
+	*current_attempts = body[0];
+	*max_attempts = body[1];
+	*valid_secs = body[2];
+	return retval;
 }
 
 /* Authenticate client application *
@@ -2167,7 +2549,7 @@ int search_middleware_cmdline(char *cmdline)
 	char middleware[SECURITY_SERVER_MAX_PATH_LEN];
 
 	/* Open the list file */
-	fp = fopen(SECURITY_SERVER_MIDDLEWARE_LIST_PATH, "r");
+	fp = fopen(get_config()->middleware_list_path, "r");
 	if(fp == NULL)
 	{
 		/* error on file */
@@ -2213,7 +2595,7 @@ int authenticate_client_middleware(int sockfd, int *pid)
 	}
 
 	/* All middlewares will run as root */
-	if(cr.uid != 0)
+	if(cr.uid != get_config()->privileged_uid)
 	{
 		retval = SECURITY_SERVER_ERROR_AUTHENTICATION_FAILED;
 		SEC_SVR_DBG("Non root process has called API: %d", cr.uid);
@@ -2293,6 +2675,130 @@ error:
 	return retval;
 }
 
+/* Copy an entry into the ring and publish it */
+static int shm_ring_push(shm_ring_index *idx, void *ring, int entry_size, const void *entry)
+{
+	unsigned int tail = idx->tail;
+	unsigned int head = __atomic_load_n(&idx->head, __ATOMIC_ACQUIRE);
+
+	if(tail - head >= SECURITY_SERVER_SHM_RING_SIZE)
+		return SECURITY_SERVER_ERROR_BUFFER_TOO_SMALL;
+
+	memcpy((unsigned char *)ring + (tail & (SECURITY_SERVER_SHM_RING_SIZE - 1)) * entry_size,
+			entry, entry_size);
+	/* Sequentially consistent so that it is ordered before the load of *
+	 * 'waiting' in shm_ring_notify() */
+	__atomic_store_n(&idx->tail, tail + 1, __ATOMIC_SEQ_CST);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Copy the oldest entry out of the ring *
+ * The peer can write the shared memory at any time, so the entry is copied *
+ * before it is looked at, and a bogus index is reported instead of used. *
+ * Returns 1 if an entry has been taken, 0 if the ring is empty */
+static int shm_ring_pop(shm_ring_index *idx, const void *ring, int entry_size, void *entry)
+{
+	unsigned int head = idx->head;
+	unsigned int tail = __atomic_load_n(&idx->tail, __ATOMIC_ACQUIRE);
+
+	if(head == tail)
+		return 0;
+	if(tail - head > SECURITY_SERVER_SHM_RING_SIZE)
+	{
+		SEC_SVR_DBG("Corrupted ring index: head=%u, tail=%u", head, tail);
+		return SECURITY_SERVER_ERROR_BAD_REQUEST;
+	}
+
+	memcpy(entry, (const unsigned char *)ring + (head & (SECURITY_SERVER_SHM_RING_SIZE - 1)) * entry_size,
+			entry_size);
+	__atomic_store_n(&idx->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int shm_push_request(shm_channel *ch, const shm_request_entry *entry)
+{
+	return shm_ring_push(&ch->req_idx, ch->req, sizeof(shm_request_entry), entry);
+}
+
+int shm_pop_request(shm_channel *ch, shm_request_entry *entry)
+{
+	return shm_ring_pop(&ch->req_idx, ch->req, sizeof(shm_request_entry), entry);
+}
+
+int shm_push_response(shm_channel *ch, const shm_response_entry *entry)
+{
+	return shm_ring_push(&ch->resp_idx, ch->resp, sizeof(shm_response_entry), entry);
+}
+
+int shm_pop_response(shm_channel *ch, shm_response_entry *entry)
+{
+	return shm_ring_pop(&ch->resp_idx, ch->resp, sizeof(shm_response_entry), entry);
+}
+
+/* Wake up the consumer if it sleeps on the doorbell *
+ * Called once after a batch of entries has been pushed */
+void shm_ring_notify(shm_ring_index *idx, int efd)
+{
+	uint64_t one = 1;
+	int retval;
+
+	if(__atomic_load_n(&idx->waiting, __ATOMIC_SEQ_CST) == 0)
+		return;
+	do
+	{
+		retval = write(efd, &one, sizeof(one));
+	} while(retval < 0 && errno == EINTR);
+}
+
+/* Sleep on the doorbell until the ring has entries *
+ * 'waiting' is set before the ring is checked for the last time, so either *
+ * the producer sees it and rings, or the check sees the new entry. *
+ * If ctl_sockfd is given, any event on it ends the wait with ERROR_SOCKET */
+int shm_ring_wait(shm_ring_index *idx, int efd, int ctl_sockfd, int timeout)
+{
+	struct pollfd fds[2];
+	uint64_t count;
+	int nfds = 1, retval;
+
+	__atomic_store_n(&idx->waiting, 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&idx->tail, __ATOMIC_SEQ_CST) != idx->head)
+	{
+		__atomic_store_n(&idx->waiting, 0, __ATOMIC_RELAXED);
+		return SECURITY_SERVER_SUCCESS;
+	}
+
+	fds[0].fd = efd;
+	fds[0].events = POLLIN;
+	fds[0].revents = 0;
+	if(ctl_sockfd >= 0)
+	{
+		fds[1].fd = ctl_sockfd;
+		fds[1].events = POLLIN;
+		fds[1].revents = 0;
+		nfds = 2;
+	}
+	do
+	{
+		retval = poll(fds, nfds, timeout);
+	} while(retval < 0 && errno == EINTR);
+	__atomic_store_n(&idx->waiting, 0, __ATOMIC_RELAXED);
+
+	if(retval < 0)
+	{
+		SEC_SVR_DBG("poll() error. errno=%d", errno);
+		return SECURITY_SERVER_ERROR_POLL;
+	}
+	if(retval == 0)
+		return SECURITY_SERVER_ERROR_TIMEOUT;
+
+	/* Doorbell is non-blocking. Reset the counter */
+	if(fds[0].revents & POLLIN)
+		retval = read(efd, &count, sizeof(count));
+	if(nfds == 2 && fds[1].revents != 0)
+		return SECURITY_SERVER_ERROR_SOCKET;
+	return SECURITY_SERVER_SUCCESS;
+}
+
 int free_argv(char **argv, int argc)
 {
 	int i;
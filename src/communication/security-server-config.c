@@ -0,0 +1,246 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "security-server-common.h"
+#include "security-server-config.h"
+
+static security_server_config config;
+static pthread_once_t config_once = PTHREAD_ONCE_INIT;
+static int config_loaded = 0;
+
+static int set_path(char *dest, int size, const char *root, const char *path)
+{
+	if(snprintf(dest, size, "%s%s", root, path) >= size)
+	{
+		SEC_SVR_DBG("Path too long: %s%s", root, path);
+		return SECURITY_SERVER_ERROR_INPUT_PARAM;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Default paths, under root directory if it's given */
+static int set_defaults(security_server_config *conf, const char *root)
+{
+	int retval = SECURITY_SERVER_SUCCESS;
+
+	memset(conf, 0, sizeof(security_server_config));
+	retval |= set_path(conf->sock_path, sizeof(conf->sock_path), root, SECURITY_SERVER_SOCK_PATH);
+	retval |= set_path(conf->seqpacket_sock_path, sizeof(conf->seqpacket_sock_path), root,
+			SECURITY_SERVER_SEQPACKET_SOCK_PATH);
+	retval |= set_path(conf->mw_sock_path, sizeof(conf->mw_sock_path), root,
+			SECURITY_SERVER_MIDDLEWARE_SOCK_PATH);
+	retval |= set_path(conf->mw_seqpacket_sock_path, sizeof(conf->mw_seqpacket_sock_path), root,
+			SECURITY_SERVER_MIDDLEWARE_SEQPACKET_SOCK_PATH);
+	retval |= set_path(conf->pwd_sock_path, sizeof(conf->pwd_sock_path), root,
+			SECURITY_SERVER_PASSWORD_SOCK_PATH);
+	retval |= set_path(conf->pwd_seqpacket_sock_path, sizeof(conf->pwd_seqpacket_sock_path), root,
+			SECURITY_SERVER_PASSWORD_SEQPACKET_SOCK_PATH);
+	retval |= set_path(conf->default_cookie_path, sizeof(conf->default_cookie_path), root,
+			SECURITY_SERVER_DEFAULT_COOKIE_PATH);
+	retval |= set_path(conf->middleware_list_path, sizeof(conf->middleware_list_path), root,
+			SECURITY_SERVER_MIDDLEWARE_LIST_PATH);
+	retval |= set_path(conf->data_directory_path, sizeof(conf->data_directory_path), root,
+			SECURITY_SERVER_DATA_DIRECTORY_PATH);
+	retval |= set_path(conf->group_file_path, sizeof(conf->group_file_path), root,
+			SECURITY_SERVER_GROUP_FILE_PATH);
+	retval |= set_path(conf->proc_path, sizeof(conf->proc_path), "", SECURITY_SERVER_PROC_PATH);
+	retval |= set_path(conf->smack_label, sizeof(conf->smack_label), "", "_");
+	conf->privileged_uid = 0;
+	conf->smack_stub = 0;
+	return retval == SECURITY_SERVER_SUCCESS ? retval : SECURITY_SERVER_ERROR_INPUT_PARAM;
+}
+
+/* Split "key = value" line. Returns 0 for empty and comment lines */
+static int parse_line(char *line, char **key, char **value)
+{
+	char *p;
+
+	p = strchr(line, '#');
+	if(p != NULL)
+		*p = 0;
+	for(p = line + strlen(line); p > line && isspace((unsigned char)p[-1]); p--)
+		*(p - 1) = 0;
+	while(isspace((unsigned char)*line))
+		line++;
+	if(*line == 0)
+		return 0;
+
+	p = strchr(line, '=');
+	if(p == NULL)
+		return SECURITY_SERVER_ERROR_INPUT_PARAM;
+	*key = line;
+	*value = p + 1;
+	for(*p = 0; p > line && isspace((unsigned char)p[-1]); p--)
+		*(p - 1) = 0;
+	while(isspace((unsigned char)**value))
+		(*value)++;
+	return 1;
+}
+
+static int apply_option(security_server_config *conf, const char *key, const char *value)
+{
+	if(strcmp(key, "root") == 0)
+		return SECURITY_SERVER_SUCCESS;	/* Already applied */
+	if(strcmp(key, "socket") == 0)
+		return set_path(conf->sock_path, sizeof(conf->sock_path), "", value);
+	if(strcmp(key, "seqpacket_socket") == 0)
+		return set_path(conf->seqpacket_sock_path, sizeof(conf->seqpacket_sock_path), "", value);
+	if(strcmp(key, "mw_socket") == 0)
+		return set_path(conf->mw_sock_path, sizeof(conf->mw_sock_path), "", value);
+	if(strcmp(key, "mw_seqpacket_socket") == 0)
+		return set_path(conf->mw_seqpacket_sock_path, sizeof(conf->mw_seqpacket_sock_path), "", value);
+	if(strcmp(key, "pwd_socket") == 0)
+		return set_path(conf->pwd_sock_path, sizeof(conf->pwd_sock_path), "", value);
+	if(strcmp(key, "pwd_seqpacket_socket") == 0)
+		return set_path(conf->pwd_seqpacket_sock_path, sizeof(conf->pwd_seqpacket_sock_path), "", value);
+	if(strcmp(key, "default_cookie") == 0)
+		return set_path(conf->default_cookie_path, sizeof(conf->default_cookie_path), "", value);
+	if(strcmp(key, "mw_list") == 0)
+		return set_path(conf->middleware_list_path, sizeof(conf->middleware_list_path), "", value);
+	if(strcmp(key, "data_dir") == 0)
+		return set_path(conf->data_directory_path, sizeof(conf->data_directory_path), "", value);
+	if(strcmp(key, "group_file") == 0)
+		return set_path(conf->group_file_path, sizeof(conf->group_file_path), "", value);
+	if(strcmp(key, "proc") == 0)
+		return set_path(conf->proc_path, sizeof(conf->proc_path), "", value);
+	if(strcmp(key, "smack_label") == 0)
+		return set_path(conf->smack_label, sizeof(conf->smack_label), "", value);
+	if(strcmp(key, "smack_rules") == 0)
+		return set_path(conf->smack_rules_path, sizeof(conf->smack_rules_path), "", value);
+	if(strcmp(key, "cookie_store") == 0)
+		return set_path(conf->cookie_store_path, sizeof(conf->cookie_store_path), "", value);
+	if(strcmp(key, "privileged_uid") == 0)
+	{
+		if(strcmp(value, "self") == 0)
+			conf->privileged_uid = getuid();
+		else if(isdigit((unsigned char)*value))
+			conf->privileged_uid = (uid_t)strtoul(value, NULL, 10);
+		else
+			return SECURITY_SERVER_ERROR_INPUT_PARAM;
+		return SECURITY_SERVER_SUCCESS;
+	}
+	if(strcmp(key, "smack") == 0)
+	{
+		if(strcmp(value, "stub") == 0)
+			conf->smack_stub = 1;
+		else if(strcmp(value, "real") == 0)
+			conf->smack_stub = 0;
+		else
+			return SECURITY_SERVER_ERROR_INPUT_PARAM;
+		return SECURITY_SERVER_SUCCESS;
+	}
+	return SECURITY_SERVER_ERROR_INPUT_PARAM;
+}
+
+/* Load config file. Must be called before any thread uses the config */
+int load_config(const char *filename)
+{
+	security_server_config conf;
+	char line[SECURITY_SERVER_MAX_CONFIG_PATH + 32], *key, *value;
+	char root[SECURITY_SERVER_MAX_CONFIG_PATH] = "";
+	int retval = SECURITY_SERVER_SUCCESS, lineno;
+	FILE *fp;
+
+	fp = fopen(filename, "r");
+	if(fp == NULL)
+	{
+		SEC_SVR_DBG("Cannot open config file %s", filename);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+
+	/* Root changes defaults, so it's looked up first */
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		if(parse_line(line, &key, &value) > 0 && strcmp(key, "root") == 0)
+			snprintf(root, sizeof(root), "%s", value);
+	}
+	retval = set_defaults(&conf, root);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		goto error;
+
+	rewind(fp);
+	for(lineno = 1; fgets(line, sizeof(line), fp) != NULL; lineno++)
+	{
+		retval = parse_line(line, &key, &value);
+		if(retval == 0)
+			continue;
+		if(retval > 0)
+			retval = apply_option(&conf, key, value);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("Bad config at %s:%d", filename, lineno);
+			goto error;
+		}
+	}
+	retval = SECURITY_SERVER_SUCCESS;
+	memcpy(&config, &conf, sizeof(config));
+	config_loaded = 1;
+
+error:
+	fclose(fp);
+	return retval;
+}
+
+static void init_config(void)
+{
+	const char *filename;
+
+	if(config_loaded)
+		return;
+	set_defaults(&config, "");
+	/* Whoever starts a setuid program linking the client library sets its *
+	 * environment. Don't let it move the sockets or privileged_uid there */
+	filename = secure_getenv(SECURITY_SERVER_CONFIG_ENV);
+	if(filename != NULL && load_config(filename) != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Ignoring config %s", filename);
+	}
+}
+
+const security_server_config *get_config(void)
+{
+	pthread_once(&config_once, init_config);
+	return &config;
+}
+
+/* Listening socket of a class and transport */
+const char *get_sock_path(int sock_class, int type)
+{
+	const security_server_config *conf = get_config();
+
+	switch(sock_class)
+	{
+		case SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE:
+			return type == SOCK_SEQPACKET ? conf->mw_seqpacket_sock_path : conf->mw_sock_path;
+		case SECURITY_SERVER_SOCK_CLASS_PASSWORD:
+			return type == SOCK_SEQPACKET ? conf->pwd_seqpacket_sock_path : conf->pwd_sock_path;
+		default:
+			return type == SOCK_SEQPACKET ? conf->seqpacket_sock_path : conf->sock_path;
+	}
+}
@@ -0,0 +1,172 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/xattr.h>
+#include <sys/smack.h>
+
+#include "security-server-common.h"
+#include "security-server-config.h"
+#include "security-server-smack.h"
+
+#define STUB_MAX_LABEL		256
+
+/* Rules of the stub backend */
+typedef struct _stub_rule
+{
+	char	subject[STUB_MAX_LABEL];
+	char	object[STUB_MAX_LABEL];
+	char	access[8];
+	struct _stub_rule *next;
+} stub_rule;
+
+static stub_rule *stub_rules = NULL;
+static int stub_allow_all = 1;
+static pthread_once_t stub_once = PTHREAD_ONCE_INIT;
+
+static void load_stub_rules(void)
+{
+	const security_server_config *conf = get_config();
+	char line[STUB_MAX_LABEL * 2 + 16];
+	stub_rule *rule;
+	FILE *fp;
+
+	if(conf->smack_rules_path[0] == 0)
+		return;
+	stub_allow_all = 0;
+	fp = fopen(conf->smack_rules_path, "r");
+	if(fp == NULL)
+	{
+		SEC_SVR_DBG("Cannot open SMACK stub rules %s. Denying all", conf->smack_rules_path);
+		return;
+	}
+	while(fgets(line, sizeof(line), fp) != NULL)
+	{
+		rule = malloc(sizeof(stub_rule));
+		if(rule == NULL)
+			break;
+		if(sscanf(line, "%255s %255s %7s", rule->subject, rule->object, rule->access) != 3
+				|| rule->subject[0] == '#')
+		{
+			free(rule);
+			continue;
+		}
+		rule->next = stub_rules;
+		stub_rules = rule;
+	}
+	fclose(fp);
+}
+
+/* Every requested right must be given by one rule */
+static int stub_have_access(const char *subject, const char *object, const char *access_rights)
+{
+	const stub_rule *rule;
+	const char *p;
+
+	pthread_once(&stub_once, load_stub_rules);
+	if(stub_allow_all || strcmp(subject, object) == 0)
+		return 1;
+	for(rule = stub_rules; rule != NULL; rule = rule->next)
+	{
+		if(strcmp(rule->subject, subject) != 0 || strcmp(rule->object, object) != 0)
+			continue;
+		for(p = access_rights; *p != 0 && strchr(rule->access, *p) != NULL; p++);
+		if(*p == 0)
+			return 1;
+	}
+	return 0;
+}
+
+int label_from_socket(int sockfd, char **label)
+{
+	const security_server_config *conf = get_config();
+
+	if(!conf->smack_stub)
+		return smack_new_label_from_socket(sockfd, label);
+
+	*label = strdup(conf->smack_label);
+	return *label == NULL ? -1 : 0;
+}
+
+/* Label of a process which isn't connected. Read from its attr/current in *
+ * proc fs, which is what the peer label of its socket would be */
+int label_from_process(int pid, char **label)
+{
+	const security_server_config *conf = get_config();
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH + 32], buf[STUB_MAX_LABEL];
+	FILE *fp;
+	int len;
+
+	if(conf->smack_stub)
+	{
+		*label = strdup(conf->smack_label);
+		return *label == NULL ? -1 : 0;
+	}
+
+	*label = NULL;
+	snprintf(path, sizeof(path), "%s/%d/attr/current", conf->proc_path, pid);
+	fp = fopen(path, "re");
+	if(fp == NULL)
+		return -1;
+	len = fread(buf, 1, sizeof(buf) - 1, fp);
+	fclose(fp);
+	while(len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == 0))
+		len--;
+	if(len <= 0)
+		return -1;
+	buf[len] = 0;
+	*label = strdup(buf);
+	return *label == NULL ? -1 : 0;
+}
+
+int label_have_access(const char *subject, const char *object, const char *access_rights)
+{
+	if(!get_config()->smack_stub)
+		return smack_have_access(subject, object, access_rights);
+	if(subject == NULL || object == NULL || access_rights == NULL)
+		return -1;
+	return stub_have_access(subject, object, access_rights);
+}
+
+/* Let any label connect to the server socket and get answers */
+int label_server_socket(int sockfd)
+{
+	if(get_config()->smack_stub)
+		return SECURITY_SERVER_SUCCESS;
+
+	if((fsetxattr(sockfd, "security.SMACK64IPOUT", "@", 2, 0)) < 0)
+	{
+		SEC_SVR_DBG("%s", "SMACK labeling failed");
+		if(errno != EOPNOTSUPP)
+			return SECURITY_SERVER_ERROR_SOCKET;
+	}
+	if((fsetxattr(sockfd, "security.SMACK64IPIN", "*", 2, 0)) < 0)
+	{
+		SEC_SVR_DBG("%s", "SMACK labeling failed");
+		if(errno != EOPNOTSUPP)
+			return SECURITY_SERVER_ERROR_SOCKET;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
@@ -0,0 +1,289 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "security-server-cookie.h"
+#include "security-server-common.h"
+#include "security-server-comm.h"
+#include "security-server-stats.h"
+#include "security-server-channel.h"
+
+extern cookie_list *c_list;
+extern pthread_mutex_t cookie_mutex;
+
+/* Server side of a shared-memory channel *
+ * The control socket is the connection the channel has been requested on. *
+ * The client closes it to end the channel */
+struct security_server_channel {
+	int ctl_sockfd;
+	int req_efd;				/* Request doorbell, rung by client */
+	int resp_efd;				/* Response doorbell, rung by server */
+	shm_channel *shm;
+};
+
+static pthread_mutex_t channel_count_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int channel_count = 0;
+
+void free_channel(struct security_server_channel *ch)
+{
+	if(ch->shm != NULL && ch->shm != MAP_FAILED)
+		munmap(ch->shm, sizeof(shm_channel));
+	if(ch->ctl_sockfd >= 0)
+		close(ch->ctl_sockfd);
+	if(ch->req_efd >= 0)
+		close(ch->req_efd);
+	if(ch->resp_efd >= 0)
+		close(ch->resp_efd);
+	free(ch);
+}
+
+/* Check a batch of requests under one lock of the cookie list */
+void check_channel_requests(shm_request_entry *entries, shm_response_entry *resp, int num)
+{
+	cookie_list *search_result;
+	int i;
+
+	stats_lock(&cookie_mutex);
+	for(i = 0; i < num; i++)
+	{
+		resp[i].request_id = entries[i].request_id;
+		switch(entries[i].msg_id)
+		{
+			case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_REQUEST:
+				if(entries[i].privilege < 1)
+				{
+					SEC_SVR_DBG("Requiring bad privilege [%d]", entries[i].privilege);
+					resp[i].return_code = SECURITY_SERVER_RETURN_CODE_BAD_REQUEST;
+					continue;
+				}
+				search_result = search_cookie(c_list, entries[i].cookie, entries[i].privilege);
+				break;
+
+			case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_REQUEST:
+				entries[i].object[MAX_OBJECT_LABEL_LEN] = 0;
+				entries[i].access_rights[MAX_MODE_STR_LEN] = 0;
+				search_result = search_cookie_new(c_list, entries[i].cookie,
+						entries[i].object, entries[i].access_rights);
+				break;
+
+			default:
+				SEC_SVR_DBG("Unknown channel msg ID :%d", entries[i].msg_id);
+				resp[i].return_code = SECURITY_SERVER_RETURN_CODE_BAD_REQUEST;
+				continue;
+		}
+		if(search_result != NULL)
+			resp[i].return_code = SECURITY_SERVER_RETURN_CODE_ACCESS_GRANTED;
+		else
+			resp[i].return_code = SECURITY_SERVER_RETURN_CODE_ACCESS_DENIED;
+	}
+	stats_unlock(&cookie_mutex);
+}
+
+/* Serve one channel until the client closes the control socket *
+ * Whatever is in the request ring is drained and answered as one batch, *
+ * and the client is woken up once per batch */
+void *security_server_channel_thread(void *param)
+{
+	struct security_server_channel *ch = param;
+	shm_request_entry entries[SECURITY_SERVER_SHM_RING_SIZE];
+	shm_response_entry resp[SECURITY_SERVER_SHM_RING_SIZE];
+	unsigned long long start;
+	int num, i, retval;
+
+	while(1)
+	{
+		start = stats_clock();
+		for(num = 0; num < SECURITY_SERVER_SHM_RING_SIZE; num++)
+		{
+			retval = shm_pop_request(ch->shm, &entries[num]);
+			if(retval <= 0)
+				break;
+		}
+		if(retval < 0)
+			goto error;
+
+		if(num > 0)
+		{
+			check_channel_requests(entries, resp, num);
+			for(i = 0; i < num; i++)
+			{
+				stats_record_request(entries[i].msg_id, start);
+				/* Client never has more requests in flight than the ring holds */
+				retval = shm_push_response(ch->shm, &resp[i]);
+				if(retval != SECURITY_SERVER_SUCCESS)
+				{
+					SEC_SVR_DBG("%s", "Response ring overrun. Closing channel");
+					goto error;
+				}
+			}
+			shm_ring_notify(&ch->shm->resp_idx, ch->resp_efd);
+			continue;
+		}
+
+		retval = shm_ring_wait(&ch->shm->req_idx, ch->req_efd, ch->ctl_sockfd, -1);
+		if(retval != SECURITY_SERVER_SUCCESS)
+			break;
+	}
+
+error:
+	SEC_SVR_DBG("%s", "Shared-memory channel closed");
+	free_channel(ch);
+	pthread_mutex_lock(&channel_count_mutex);
+	channel_count--;
+	pthread_mutex_unlock(&channel_count_mutex);
+	pthread_detach(pthread_self());
+	pthread_exit(NULL);
+}
+
+/* Set up a shared-memory channel for a middleware daemon
+ *
+ * The ring memory is a sealed memfd, so the client cannot shrink it under
+ * the server. The response carries no body. The memfd, the request doorbell
+ * and the response doorbell are passed in this order with SCM_RIGHTS.
+ * Privilege checks are authenticated once, here, for the whole channel */
+int process_shm_channel_request(request_context *req)
+{
+	struct security_server_channel *ch = NULL;
+	pthread_t thread;
+	int retval, client_pid, memfd = -1, fds[3], counted = 0;
+
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("%s", "Client Authentication Failed");
+		retval = send_generic_response(req,
+				SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+		}
+		goto error;
+	}
+
+	pthread_mutex_lock(&channel_count_mutex);
+	if(channel_count < SECURITY_SERVER_MAX_SHM_CHANNELS)
+	{
+		channel_count++;
+		counted = 1;
+	}
+	pthread_mutex_unlock(&channel_count_mutex);
+	if(!counted)
+	{
+		SEC_SVR_DBG("%s", "Too many shared-memory channels");
+		retval = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto server_error;
+	}
+
+	ch = malloc(sizeof(struct security_server_channel));
+	if(ch == NULL)
+	{
+		SEC_SVR_DBG("%s", "Out of memory");
+		retval = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+		goto server_error;
+	}
+	ch->shm = NULL;
+	ch->req_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ch->resp_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	/* Connection thread closes its own descriptor when it returns */
+	ch->ctl_sockfd = fcntl(req->sockfd, F_DUPFD_CLOEXEC, 0);
+	memfd = memfd_create("security-server-channel", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(ch->req_efd < 0 || ch->resp_efd < 0 || ch->ctl_sockfd < 0 || memfd < 0)
+	{
+		SEC_SVR_DBG("Cannot create channel descriptors. errno=%d", errno);
+		retval = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto server_error;
+	}
+
+	if(ftruncate(memfd, sizeof(shm_channel)) < 0 ||
+			fcntl(memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+	{
+		SEC_SVR_DBG("Cannot size channel memory. errno=%d", errno);
+		retval = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto server_error;
+	}
+	ch->shm = mmap(NULL, sizeof(shm_channel), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+	if(ch->shm == MAP_FAILED)
+	{
+		SEC_SVR_DBG("mmap() failed. errno=%d", errno);
+		retval = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto server_error;
+	}
+	ch->shm->magic = SECURITY_SERVER_SHM_MAGIC;
+	ch->shm->ring_size = SECURITY_SERVER_SHM_RING_SIZE;
+
+	fds[0] = memfd;
+	fds[1] = ch->req_efd;
+	fds[2] = ch->resp_efd;
+	retval = send_response_fds(req, SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS, NULL, 0, fds, 3);
+	close(memfd);
+	memfd = -1;
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("ERROR: Cannot send channel response: %d", retval);
+		goto free_error;
+	}
+
+	/* Thread owns the channel from now on. If it cannot be started, *
+	 * closing the control socket tells the client */
+	retval = pthread_create(&thread, NULL, security_server_channel_thread, ch);
+	if(retval != 0)
+	{
+		SEC_SVR_DBG("Cannot create channel thread: %d", retval);
+		retval = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto free_error;
+	}
+	SEC_SVR_DBG("Shared-memory channel opened for pid:%d", client_pid);
+	return SECURITY_SERVER_SUCCESS;
+
+server_error:
+	if(send_generic_response(req, SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR) != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("%s", "ERROR: Cannot send generic response");
+	}
+free_error:
+	if(ch != NULL)
+		free_channel(ch);
+	if(memfd >= 0)
+		close(memfd);
+	if(counted)
+	{
+		pthread_mutex_lock(&channel_count_mutex);
+		channel_count--;
+		pthread_mutex_unlock(&channel_count_mutex);
+	}
+error:
+	return retval;
+}
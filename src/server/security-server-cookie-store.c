@@ -0,0 +1,253 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "security-server-common.h"
+#include "security-server-cookie.h"
+#include "security-server-cookie-store.h"
+
+#define STORE_SIZE	(sizeof(cookie_store_header) \
+		+ sizeof(cookie_store_record) * SECURITY_SERVER_STORE_RECORDS)
+
+static cookie_store_header *store = NULL;
+static cookie_store_record *records = NULL;
+
+/* Free records, used from the top */
+static int free_slots[SECURITY_SERVER_STORE_RECORDS];
+static int num_free = 0;
+
+static void clear_records(void)
+{
+	int i;
+
+	memset(records, 0, sizeof(cookie_store_record) * SECURITY_SERVER_STORE_RECORDS);
+	for(i = 0; i < SECURITY_SERVER_STORE_RECORDS; i++)
+		free_slots[i] = SECURITY_SERVER_STORE_RECORDS - 1 - i;
+	num_free = SECURITY_SERVER_STORE_RECORDS;
+}
+
+/* Read ID of the current boot. Returns 0 on success */
+static int read_boot_id(char *boot_id)
+{
+	int fd, len;
+
+	memset(boot_id, 0, SECURITY_SERVER_STORE_BOOT_ID_LEN);
+	fd = open("/proc/sys/kernel/random/boot_id", O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return -1;
+	len = read(fd, boot_id, SECURITY_SERVER_STORE_BOOT_ID_LEN - 1);
+	close(fd);
+	if(len <= 0)
+		return -1;
+	if(boot_id[len - 1] == '\n')
+		boot_id[len - 1] = 0;
+	return 0;
+}
+
+/* Map the store file, creating it if needed. A file of another layout or *
+ * boot is cleared. cookie_store_load() or cookie_store_reset() must follow */
+int cookie_store_open(const char *path)
+{
+	struct stat st;
+	void *map;
+	char boot_id[SECURITY_SERVER_STORE_BOOT_ID_LEN];
+	int fd, retval = SECURITY_SERVER_ERROR_FILE_OPERATION;
+
+	/* Don't follow a link planted in the place of the store */
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+	if(fd < 0)
+	{
+		SEC_SVR_DBG("Cannot open cookie store %s: %d", path, errno);
+		return retval;
+	}
+	if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+	{
+		SEC_SVR_DBG("Cookie store %s is not a regular file", path);
+		goto error;
+	}
+	if(st.st_size != (off_t)STORE_SIZE && ftruncate(fd, STORE_SIZE) < 0)
+	{
+		SEC_SVR_DBG("Cannot size cookie store: %d", errno);
+		goto error;
+	}
+	map = mmap(NULL, STORE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+	{
+		SEC_SVR_DBG("Cannot map cookie store: %d", errno);
+		goto error;
+	}
+
+	store = map;
+	records = (cookie_store_record *)(store + 1);
+	if(store->magic != SECURITY_SERVER_STORE_MAGIC || store->version != SECURITY_SERVER_STORE_VERSION
+			|| store->record_size != sizeof(cookie_store_record)
+			|| store->num_records != SECURITY_SERVER_STORE_RECORDS)
+	{
+		SEC_SVR_DBG("%s", "Initializing cookie store");
+		store->magic = SECURITY_SERVER_STORE_MAGIC;
+		store->version = SECURITY_SERVER_STORE_VERSION;
+		store->record_size = sizeof(cookie_store_record);
+		store->num_records = SECURITY_SERVER_STORE_RECORDS;
+		memset(store->boot_id, 0, SECURITY_SERVER_STORE_BOOT_ID_LEN);
+		clear_records();
+	}
+
+	/* Same PID and start time in another boot is another process. Without *
+	 * a boot ID, nothing in the store can be trusted */
+	if(read_boot_id(boot_id) != 0)
+	{
+		SEC_SVR_DBG("%s", "Cannot read boot ID. Clearing cookie store");
+		clear_records();
+	}
+	else if(memcmp(store->boot_id, boot_id, SECURITY_SERVER_STORE_BOOT_ID_LEN) != 0)
+	{
+		SEC_SVR_DBG("%s", "Cookie store is from another boot. Clearing it");
+		clear_records();
+		memcpy(store->boot_id, boot_id, SECURITY_SERVER_STORE_BOOT_ID_LEN);
+	}
+	retval = SECURITY_SERVER_SUCCESS;
+error:
+	close(fd);
+	return retval;
+}
+
+/* Append cookies of the store to the list. Ones of processes that have *
+ * gone or don't fit are removed. Returns number of cookies restored */
+int cookie_store_load(cookie_list *c_list)
+{
+	cookie_store_record *rec;
+	cookie_list *cookie;
+	int i, restored = 0;
+
+	if(store == NULL)
+		return 0;
+
+	num_free = 0;
+	for(i = SECURITY_SERVER_STORE_RECORDS - 1; i >= 0; i--)
+	{
+		rec = &records[i];
+		if(!rec->in_use)
+		{
+			free_slots[num_free++] = i;
+			continue;
+		}
+		if(rec->path_len < 0 || rec->path_len > SECURITY_SERVER_STORE_MAX_PATH
+				|| rec->permission_len < 0 || rec->permission_len > SECURITY_SERVER_STORE_MAX_GROUPS
+				|| rec->label_len < 0 || rec->label_len >= SECURITY_SERVER_STORE_MAX_LABEL)
+		{
+			SEC_SVR_DBG("Bad cookie store record %d", i);
+			goto drop;
+		}
+
+		cookie = calloc(1, sizeof(cookie_list));
+		if(cookie == NULL)
+			goto drop;
+		memcpy(cookie->cookie, rec->cookie, SECURITY_SERVER_COOKIE_LEN);
+		cookie->pid = rec->pid;
+		cookie->start_time = rec->start_time;
+		cookie->path_len = rec->path_len;
+		cookie->permission_len = rec->permission_len;
+		cookie->path = malloc(rec->path_len + 1);
+		cookie->permissions = malloc(sizeof(int) * rec->permission_len + 1);
+		if(rec->label_len > 0)
+			cookie->smack_label = strndup(rec->smack_label, rec->label_len);
+		if(cookie->path == NULL || cookie->permissions == NULL
+				|| (rec->label_len > 0 && cookie->smack_label == NULL))
+		{
+			free_cookie_item(cookie);
+			goto drop;
+		}
+		memcpy(cookie->path, rec->path, rec->path_len);
+		memcpy(cookie->permissions, rec->permissions, sizeof(int) * rec->permission_len);
+		cookie->store_record = i + 1;
+
+		/* Removes the record if the process has gone */
+		if(restore_cookie_item(cookie, c_list) != NULL)
+			restored++;
+		continue;
+drop:
+		rec->in_use = 0;
+		free_slots[num_free++] = i;
+	}
+	SEC_SVR_DBG("%d cookies restored from the store", restored);
+	return restored;
+}
+
+/* Forget all stored cookies */
+void cookie_store_reset(void)
+{
+	if(store == NULL)
+		return;
+	clear_records();
+}
+
+void cookie_store_add(cookie_list *cookie)
+{
+	cookie_store_record *rec;
+	int label_len, slot;
+
+	if(store == NULL || cookie->store_record != 0)
+		return;
+
+	label_len = cookie->smack_label != NULL ? strlen(cookie->smack_label) : 0;
+	if(num_free == 0 || cookie->path_len > SECURITY_SERVER_STORE_MAX_PATH
+			|| cookie->permission_len > SECURITY_SERVER_STORE_MAX_GROUPS
+			|| label_len >= SECURITY_SERVER_STORE_MAX_LABEL)
+	{
+		SEC_SVR_DBG("Cookie of PID %d is not stored", cookie->pid);
+		return;
+	}
+
+	slot = free_slots[--num_free];
+	rec = &records[slot];
+	memcpy(rec->cookie, cookie->cookie, SECURITY_SERVER_COOKIE_LEN);
+	rec->pid = cookie->pid;
+	rec->start_time = cookie->start_time;
+	rec->path_len = cookie->path_len;
+	rec->permission_len = cookie->permission_len;
+	rec->label_len = label_len;
+	if(cookie->path_len > 0)
+		memcpy(rec->path, cookie->path, cookie->path_len);
+	if(cookie->permission_len > 0)
+		memcpy(rec->permissions, cookie->permissions, sizeof(int) * cookie->permission_len);
+	if(label_len > 0)
+		memcpy(rec->smack_label, cookie->smack_label, label_len);
+	/* A crash before this leaves the record free */
+	__atomic_store_n(&rec->in_use, 1, __ATOMIC_RELEASE);
+	cookie->store_record = slot + 1;
+}
+
+void cookie_store_remove(cookie_list *cookie)
+{
+	if(store == NULL || cookie->store_record == 0)
+		return;
+
+	__atomic_store_n(&records[cookie->store_record - 1].in_use, 0, __ATOMIC_RELEASE);
+	free_slots[num_free++] = cookie->store_record - 1;
+	cookie->store_record = 0;
+}
@@ -29,6 +29,17 @@
 #include <sys/smack.h>
 
 #include "security-server-cookie.h"
+#include "security-server-cookie-store.h"
+#include "security-server-comm.h"
+#include "security-server-config.h"
+#include "security-server-smack.h"
+#include "security-server-revoke.h"
+#include "security-server-stats.h"
+#include "security-server-probes.h"
+
+/* Sequence number of the last cookie added. Cookies are appended only, so *
+ * it increases along the list. Guarded by cookie_mutex */
+static unsigned int last_cookie_seq = 0;
 
 /* Delete useless cookie item *
  * then connect prev and next */
@@ -61,6 +72,9 @@ cookie_list *delete_cookie_item(cookie_list *cookie)
 		return retval;
 	}
 
+	cookie_store_remove(cookie);
+	revoke_notify(cookie);
+
 	/* Reconnect cookie item */
 	if(cookie->next != NULL)
 	{
@@ -77,9 +91,77 @@ cookie_list *delete_cookie_item(cookie_list *cookie)
 	return retval;
 }
 
+/* Start time of a process in clock ticks after boot, the 22nd field of *
+ * /proc/<pid>/stat. A reused pid has another one, so the pair identifies *
+ * a process. Returns SECURITY_SERVER_ERROR_NO_SUCH_OBJECT if it's gone */
+int read_start_time_from_proc(pid_t pid, unsigned long long *start_time)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH + 16], buf[512], *p;
+	int fd, len, i;
+
+	snprintf(path, sizeof(path), "%s/%d/stat", get_config()->proc_path, pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+	{
+		if(errno == ENOENT || errno == ESRCH)
+			return SECURITY_SERVER_ERROR_NO_SUCH_OBJECT;
+		SEC_SVR_DBG("Cannot open %s: %d", path, errno);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if(len <= 0)
+		return len < 0 && errno == ESRCH ? SECURITY_SERVER_ERROR_NO_SUCH_OBJECT
+			: SECURITY_SERVER_ERROR_FILE_OPERATION;
+	buf[len] = 0;
+
+	/* Command name may have spaces and parentheses. State is the 3rd field */
+	p = strrchr(buf, ')');
+	for(i = 3; p != NULL && i <= 22; i++)
+		p = strchr(p + 1, ' ');
+	if(p == NULL)
+	{
+		SEC_SVR_DBG("Bad stat of PID %d", pid);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	*start_time = strtoull(p + 1, NULL, 10);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Whether the process of the cookie still runs. Returns 1 if it does, 0 if *
+ * it has gone or its pid has been reused, negative on error */
+static int cookie_process_alive(const cookie_list *cookie)
+{
+	unsigned long long start = stats_clock(), start_time;
+	int ret;
+
+	ret = read_start_time_from_proc(cookie->pid, &start_time);
+	stats_record(SECURITY_SERVER_STAT_PROC_READ, start);
+	if(ret == SECURITY_SERVER_ERROR_NO_SUCH_OBJECT)
+		return 0;
+	if(ret != SECURITY_SERVER_SUCCESS)
+		return ret;
+	return start_time == cookie->start_time;
+}
+
+/* Identity check of a cookie found by its PID. garbage_collection() only *
+ * sees whether the PID exists, so the cookie of a process whose PID has *
+ * been reused is caught here by its start time and deleted. Lookups by *
+ * cookie value don't call it, reap_cookies() does. Returns 0 if it's *
+ * deleted */
+static int check_cookie_identity(cookie_list *cookie)
+{
+	if(cookie->pid == 0 || cookie_process_alive(cookie) != 0)
+		return 1;
+	SEC_SVR_DBG("PID %d has been reused. deleting the old cookie.", cookie->pid);
+	SEC_SVR_PROBE1(cookie__gc, cookie->pid);
+	delete_cookie_item(cookie);
+	return 0;
+}
+
 cookie_list * garbage_collection(cookie_list *cookie)
 {
-	char path[17];
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH + 16];
 	cookie_list *retval = NULL;
 	struct stat statbuf;
 	int ret;
@@ -91,8 +173,7 @@ cookie_list * garbage_collection(cookie_list *cookie)
 			return cookie;
 
 		/* Try to find the PID directory from proc fs */
-		snprintf(path, sizeof(path), "/proc/%d", cookie->pid);
-		path[16] = 0;
+		snprintf(path, sizeof(path), "%s/%d", get_config()->proc_path, cookie->pid);
 		ret = stat(path, &statbuf);
 		if(ret != 0)
 		{
@@ -100,6 +181,7 @@ cookie_list * garbage_collection(cookie_list *cookie)
 			if(errno == ENOENT)
 			{
 				SEC_SVR_DBG("Garbage found. PID:%d, deleting...", cookie->pid);
+				SEC_SVR_PROBE1(cookie__gc, cookie->pid);
 				cookie = delete_cookie_item(cookie);
 				continue;
 			}
@@ -121,12 +203,31 @@ cookie_list * garbage_collection(cookie_list *cookie)
 	return retval;
 }
 
+/* Delete the cookie of every process that has gone or whose PID has been *
+ * reused. Lookups collect only the garbage on their way, so revocation *
+ * subscribers would hear of an exit much later without it. Caller must *
+ * hold cookie_mutex */
+void reap_cookies(cookie_list *c_list)
+{
+	cookie_list *current = c_list->next, *next;
+
+	while(current != NULL)
+	{
+		current = garbage_collection(current);
+		if(current == NULL)
+			break;
+		next = current->next;
+		check_cookie_identity(current);
+		current = next;
+	}
+}
+
 /* Search existing cookie from the cookie list for the client process *
- * At the same time, it collects garbage cookie which PID is no longer exist and delete them */
+ * At the same time, it collects garbage cookie which PID is no longer exist and delete them. *
+ * A cookie left by an earlier process of the same PID is deleted too */
 cookie_list *search_existing_cookie(int pid, const cookie_list *c_list)
 {
-	cookie_list *current =(cookie_list *)c_list, *cookie = NULL;
-	char *cmdline = NULL, *debug_cmdline = NULL;
+	cookie_list *current =(cookie_list *)c_list;
 
 	/* Search from the list */
 	while(current != NULL)
@@ -139,56 +240,15 @@ cookie_list *search_existing_cookie(int pid, const cookie_list *c_list)
 		/* PID must be same */
 		if(current->pid == pid)
 		{
-			/* Found cookie for the pid. Check the cookie is reused by dirrent executable */
-			/* Check the path of the process */
-			cmdline = (char*)read_cmdline_from_proc(pid);
-			if(cmdline == NULL)
-			{
-				SEC_SVR_DBG("%s", "cannot read cmdline");
+			/* There is one cookie for a PID */
+			if(!check_cookie_identity(current))
 				return NULL;
-			}
-			/* Check the path is different */
-			if(strncmp(cmdline, current->path, current->path_len) != 0 || strlen(cmdline) != current->path_len)
-			{
-				SEC_SVR_DBG("pid [%d] has been reused by %s. deleting the old cookie.", pid, cmdline);
-				debug_cmdline = malloc(current->path_len + 1);
-				if(debug_cmdline == NULL)
-				{
-					SEC_SVR_DBG("%s", "out of memory error");
-					return NULL;
-				}
-				strncpy(debug_cmdline, current->path, current->path_len);
-				debug_cmdline[current->path_len] = 0;
-				SEC_SVR_DBG("[%s] --> [%s]", cmdline, debug_cmdline);
-				if(debug_cmdline != NULL)
-				{
-					free(debug_cmdline);
-					debug_cmdline = NULL;
-				}
-				/* Okay. delete current cookie */
-				current = delete_cookie_item(current);
-				if(cmdline != NULL)
-				{
-					free(cmdline);
-					cmdline = NULL;
-				}
-				continue;
-			}
-			else
-			{
-				SEC_SVR_DBG("%s", "cookie found");
-				cookie = current;
-			}
-
-			if(cmdline != NULL)
-			{
-				free(cmdline);
-				cmdline = NULL;
-			}
+			SEC_SVR_DBG("%s", "cookie found");
+			return current;
 		}
 		current = current->next;
 	}
-	return cookie;
+	return NULL;
 }
 
 /* Search existing cookie from the cookie list for matching pid *
@@ -209,7 +269,8 @@ cookie_list *search_cookie_from_pid(cookie_list *c_list, int pid)
 		if(current->pid == pid)
 		{
 			SEC_SVR_DBG("%s", "cookie has been found");
-			retval = current;
+			if(check_cookie_identity(current))
+				retval = current;
 			goto finish;
 		}
 		current = current->next;
@@ -285,15 +346,16 @@ cookie_list *search_cookie_new(const cookie_list *c_list,
 		if(memcmp(current->cookie, cookie, SECURITY_SERVER_COOKIE_LEN) == 0)
 		{
 			SEC_SVR_DBG("%s", "cookie has been found");
-
-                                ret = smack_have_access(current->smack_label, object, access_rights);
-          SEC_SVR_DBG("smack_have_access, subject >%s< object >%s< access >%s< ===> %d",
-                    current->smack_label, object, access_rights, ret);
-                                if (ret == 1)
-                                {
-                                        retval = current;
-                                        goto finish;
-                                }
+			ret = label_have_access(current->smack_label, object, access_rights);
+			SEC_SVR_DBG("smack_have_access, subject >%s< object >%s< access >%s< ===> %d",
+					current->smack_label, object, access_rights, ret);
+			SEC_SVR_PROBE5(smack__access, current->pid, current->smack_label,
+					object, access_rights, ret);
+			if (ret == 1)
+			{
+				retval = current;
+				goto finish;
+			}
 		}
 		current = current->next;
 	}
@@ -321,50 +383,36 @@ int generate_random_cookie(unsigned char *cookie, int size)
 			ret = SECURITY_SERVER_ERROR_FILE_OPERATION;
 			goto error;
 		}
-		close(fd);
 		ret = SECURITY_SERVER_SUCCESS;
 error:
+	/* Closed only here. By now, another thread may own the same fd number */
 	if(fd > 0)
 		close(fd);
 	return ret;
 }
 
-/* Create a cookie item from PID */
-cookie_list *create_cookie_item(int pid, int sockfd, cookie_list *c_list)
+/* Read supplementary groups of the PID from proc fs - /proc/[PID]/status *
+ * Returns the number of groups, or negative on error */
+static int read_groups_from_proc(int pid, int **groups)
 {
-	int ret, tempint;
-	cookie_list *added = NULL, *current = NULL;
-	char path[24], *cmdline = NULL;
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH + 32];
 	char *buf = NULL, inputed, *tempptr = NULL;
 	char delim[] = ": ", *token = NULL;
-	int *permissions = NULL, perm_num = 1, cnt, i, *tempperm = NULL;
-        char *smack_label = NULL;
+	int *permissions = NULL, perm_num = 1, cnt, i, tempint, *tempperm = NULL;
+	int ret = SECURITY_SERVER_ERROR_FILE_OPERATION;
 	FILE *fp = NULL;
 
-	current = search_existing_cookie(pid, c_list);
-	if(current != NULL)
-	{
-		/* There is a cookie for this process already */
-		added = current;
-		SEC_SVR_DBG("%s", "Existing cookie found");
-		goto error;
-	}
-
-	/* Read command line of the PID from proc fs */
-	cmdline = (char *)read_cmdline_from_proc(pid);
-	if(cmdline == NULL)
-	{
-		SEC_SVR_DBG("Error on reading /proc/%d/cmdline", pid);
-		goto error;
-	}
-
 	/*
 	 * modified by security part
 	 *  - get gid from /etc/group
 	 */
-	/* Read group info of the PID from proc fs - /proc/[PID]/status */
-	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	snprintf(path, sizeof(path), "%s/%d/status", get_config()->proc_path, pid);
 	fp = fopen(path, "r");
+	if(fp == NULL)
+	{
+		SEC_SVR_DBG("Error on opening %s", path);
+		goto error;
+	}
 
 	/* Find the line which starts with 'Groups:' */
 	i = 0;
@@ -445,6 +493,142 @@ cookie_list *create_cookie_item(int pid, int sockfd, cookie_list *c_list)
 		}
 	}
 out_of_while:
+	*groups = permissions;
+	permissions = NULL;
+	ret = perm_num;
+
+error:
+	if(fp != NULL)
+		fclose(fp);
+	if(buf != NULL)
+		free(buf);
+	if(permissions != NULL)
+		free(permissions);
+	return ret;
+}
+
+/* Whether the process still has the label and groups of its cookie. *
+ * They are taken when the cookie is created, and an exec may change both *
+ * while the PID and start time stay. Returns 1 if they match, 0 if not, *
+ * negative on error */
+static int cookie_matches_process(const cookie_list *cookie, int sockfd)
+{
+	char *smack_label = NULL;
+	int *groups = NULL, num, ret;
+	unsigned long long start = stats_clock();
+
+	if(sockfd >= 0)
+		ret = label_from_socket(sockfd, &smack_label);
+	else
+		ret = label_from_process(cookie->pid, &smack_label);
+	if(ret != 0)
+	{
+		SEC_SVR_DBG("Error checking peer label: %d", ret);
+		ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+		goto error;
+	}
+	num = read_groups_from_proc(cookie->pid, &groups);
+	if(num < 0)
+	{
+		ret = num;
+		goto error;
+	}
+
+	ret = num == cookie->permission_len
+		&& (num == 0 || memcmp(groups, cookie->permissions, num * sizeof(int)) == 0)
+		&& (cookie->smack_label == NULL ? smack_label == NULL
+			: smack_label != NULL && strcmp(smack_label, cookie->smack_label) == 0);
+
+error:
+	stats_record(SECURITY_SERVER_STAT_PROC_READ, start);
+	free(smack_label);
+	free(groups);
+	return ret;
+}
+
+/* First request of the process for a prepared cookie. Its label and groups *
+ * have been checked, and its command line is taken again since the *
+ * launcher may have prepared it before the exec */
+static void confirm_provisional_cookie(cookie_list *cookie)
+{
+	char *cmdline;
+	int len;
+	unsigned long long start = stats_clock();
+
+	cookie->provisional = 0;
+	cmdline = (char *)read_cmdline_from_proc(cookie->pid);
+	stats_record(SECURITY_SERVER_STAT_PROC_READ, start);
+	if(cmdline == NULL)
+	{
+		SEC_SVR_DBG("Error on reading /proc/%d/cmdline", cookie->pid);
+		return;
+	}
+	len = strlen(cmdline);
+	if(len != cookie->path_len || memcmp(cookie->path, cmdline, len) != 0)
+	{
+		free(cookie->path);
+		cookie->path = cmdline;
+		cookie->path_len = len;
+			cookie_store_remove(cookie);
+		cookie_store_add(cookie);
+		return;
+	}
+	free(cmdline);
+}
+
+/* Create a cookie item from PID *
+ * sockfd is the connection of the process. It's -1 when the cookie is *
+ * prepared before the process asks, and the label is read from proc fs then */
+cookie_list *create_cookie_item(int pid, int sockfd, cookie_list *c_list)
+{
+	int ret;
+	cookie_list *added = NULL, *current = NULL;
+	char *cmdline = NULL;
+	int *permissions = NULL, perm_num;
+        char *smack_label = NULL;
+	unsigned long long start, start_time;
+
+	current = search_existing_cookie(pid, c_list);
+	if(current != NULL)
+	{
+		ret = cookie_matches_process(current, sockfd);
+		if(ret < 0)
+			goto error;
+		if(ret == 1)
+		{
+			/* There is a cookie for this process already */
+			added = current;
+			SEC_SVR_DBG("%s", "Existing cookie found");
+			if(current->provisional && sockfd >= 0)
+				confirm_provisional_cookie(current);
+			goto error;
+		}
+		/* Privileges of the old image must not pass to the new one */
+		SEC_SVR_DBG("PID %d has changed its label or groups. Issuing a new cookie", pid);
+		delete_cookie_item(current);
+	}
+
+	start = stats_clock();
+
+	/* Identity of the process, checked instead of the command line later */
+	if(read_start_time_from_proc(pid, &start_time) != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Error on reading /proc/%d/stat", pid);
+		goto error;
+	}
+
+	/* Read command line of the PID from proc fs */
+	cmdline = (char *)read_cmdline_from_proc(pid);
+	if(cmdline == NULL)
+	{
+		SEC_SVR_DBG("Error on reading /proc/%d/cmdline", pid);
+		goto error;
+	}
+
+	perm_num = read_groups_from_proc(pid, &permissions);
+	if(perm_num < 0)
+		goto error;
+	stats_record(SECURITY_SERVER_STAT_PROC_READ, start);
 		
 	/* Each group ID is stored in each line of the file */
 //	while(fgets(permline, sizeof(permline), fp) != NULL)
@@ -485,7 +669,14 @@ out_of_while:
 	}
 
         /* Check SMACK label */
-        ret = smack_new_label_from_socket(sockfd, &smack_label);
+        if(sockfd >= 0)
+                ret = label_from_socket(sockfd, &smack_label);
+        else
+        {
+                start = stats_clock();
+                ret = label_from_process(pid, &smack_label);
+                stats_record(SECURITY_SERVER_STAT_PROC_READ, start);
+        }
         if (ret != 0)
 	{
 		SEC_SVR_DBG("Error checking peer label: %d", ret);
@@ -500,19 +691,20 @@ out_of_while:
 
 	added->permission_len = perm_num;
 	added->pid = pid;
+	added->start_time = start_time;
 	added->permissions = permissions;
 	added->smack_label = smack_label;
+	added->store_record = 0;
+	added->provisional = sockfd < 0;
+	added->seq = ++last_cookie_seq;
 	added->prev = current;
 	current->next = added;
 	added->next = NULL;
+	cookie_store_add(added);
 
 error:
 	if(cmdline != NULL)
 		free(cmdline);
-	if(fp != NULL)
-		fclose(fp);
-	if(buf != NULL)
-		free(buf);
 
 	if(added == NULL && permissions != NULL)
 		free(permissions);
@@ -520,26 +712,52 @@ error:
 	return added;
 }
 
+/* Append a cookie handed over by the previous server process, or found in *
+ * the cookie store. It's kept only if its process still runs, otherwise *
+ * it's freed. Returns the cookie if it's added */
+cookie_list *restore_cookie_item(cookie_list *cookie, cookie_list *c_list)
+{
+	cookie_list *current = c_list;
+
+	if(cookie->pid == 0 || cookie_process_alive(cookie) != 1)
+	{
+		SEC_SVR_DBG("PID %d has gone. Dropping its cookie", cookie->pid);
+		cookie_store_remove(cookie);
+		cookie->prev = cookie->next = NULL;
+		free_cookie_item(cookie);
+		return NULL;
+	}
+
+	while(current->next != NULL)
+		current = current->next;
+	cookie->prev = current;
+	cookie->next = NULL;
+	current->next = cookie;
+	cookie->seq = ++last_cookie_seq;
+	cookie_store_add(cookie);
+	return cookie;
+}
+
 /* Check stored default cookie, if it's not exist make a new one and store it */
 int check_stored_cookie(unsigned char *cookie, int size)
 {
 	int fd, ret;
 
 	/* First, check the default cookie is stored */
-	fd = open(SECURITY_SERVER_DEFAULT_COOKIE_PATH, O_RDONLY);
+	fd = open(get_config()->default_cookie_path, O_RDONLY);
 	if(fd < 0)
 	{
 		if(errno != ENOENT)
 		{
 			SEC_SVR_DBG("Cannot open default cookie. errno=%d", errno);
 			ret = SECURITY_SERVER_ERROR_FILE_OPERATION;
-			unlink(SECURITY_SERVER_DEFAULT_COOKIE_PATH);
+			unlink(get_config()->default_cookie_path);
 		}
 
 		ret = generate_random_cookie(cookie, size);
 
 		/* Save cookie to disk */
-		fd = open(SECURITY_SERVER_DEFAULT_COOKIE_PATH, O_WRONLY | O_CREAT, 0600);
+		fd = open(get_config()->default_cookie_path, O_WRONLY | O_CREAT, 0600);
 		if (fd < 0)
 		{
 			SEC_SVR_DBG("Cannot open default cookie errno=%d", errno);
@@ -602,10 +820,89 @@ cookie_list *create_default_cookie(void)
 	first->path_len = 0;
 	first->permission_len = 0;
 	first->pid = 0;
+	first->start_time = 0;
 	first->path = NULL;
 	first->permissions = NULL;
         first->smack_label = NULL;
+	first->store_record = 0;
+	first->provisional = 0;
+	first->seq = ++last_cookie_seq;
 	first->prev = NULL;
 	first->next = NULL;
 	return first;
 }
+
+/* Copy cookies from 'first' on into one allocation. At most 'max' cookies *
+ * are copied. Caller must hold cookie_mutex */
+cookie_snapshot *copy_cookies(const cookie_list *first, int max)
+{
+	const cookie_list *current;
+	cookie_snapshot *snapshot;
+	cookie_snapshot_entry *entry;
+	int *perm_data;
+	char *path_data;
+	int num = 0, num_perms = 0, path_size = 0;
+
+	for(current = first; current != NULL && num < max; current = current->next)
+	{
+		num_perms += current->permission_len;
+		path_size += current->path_len;
+		if(current->smack_label != NULL)
+			path_size += strlen(current->smack_label);
+		num++;
+	}
+
+	snapshot = malloc(sizeof(cookie_snapshot) + num * sizeof(cookie_snapshot_entry)
+			+ num_perms * sizeof(int) + path_size);
+	if(snapshot == NULL)
+	{
+		SEC_SVR_DBG("%s", "Out of memory");
+		return NULL;
+	}
+	snapshot->num = num;
+	snapshot->entries = (cookie_snapshot_entry *)(snapshot + 1);
+
+	/* Permissions go first to keep them aligned */
+	perm_data = (int *)(snapshot->entries + num);
+	path_data = (char *)(perm_data + num_perms);
+
+	for(current = first, entry = snapshot->entries; entry < snapshot->entries + num;
+			current = current->next, entry++)
+	{
+		memcpy(entry->cookie, current->cookie, SECURITY_SERVER_COOKIE_LEN);
+		entry->pid = current->pid;
+		entry->seq = current->seq;
+		entry->start_time = current->start_time;
+		entry->path_len = current->path_len;
+		entry->permission_len = current->permission_len;
+		entry->label_len = current->smack_label != NULL ? strlen(current->smack_label) : 0;
+
+		entry->permissions = perm_data;
+		if(current->permission_len > 0)
+			memcpy(perm_data, current->permissions, current->permission_len * sizeof(int));
+		perm_data += current->permission_len;
+
+		entry->path = path_data;
+		if(current->path_len > 0)
+			memcpy(path_data, current->path, current->path_len);
+		path_data += current->path_len;
+
+		entry->smack_label = path_data;
+		if(entry->label_len > 0)
+			memcpy(path_data, current->smack_label, entry->label_len);
+		path_data += entry->label_len;
+	}
+	return snapshot;
+}
+
+/* Snapshot of a single cookie. Caller must hold cookie_mutex */
+cookie_snapshot *snapshot_cookie(const cookie_list *cookie)
+{
+	return copy_cookies(cookie, 1);
+}
+
+/* Doesn't need cookie_mutex */
+void release_cookie_snapshot(cookie_snapshot *snapshot)
+{
+	free(snapshot);
+}
@@ -0,0 +1,210 @@
+/*
+ *  security-server
+ *
+ *  Copyright (c) 2000 - 2012 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "security-server-common.h"
+#include "security-server-config.h"
+#include "security-server-group.h"
+
+/* Object name is actually name of a Group ID *
+ * This function opens /etc/group file and search group ID and
+ * returns the string */
+int search_object_name(int gid, char *obj, int obj_size)
+{
+	FILE *fp = NULL;
+	char *linebuf = NULL, *token = NULL, *token2, *tempstr = NULL;
+	int ret = 0, tmp_gid, bufsize;
+	fp = fopen(get_config()->group_file_path, "r");
+	if(fp == NULL)
+	{
+		/* cannot open /etc/group */
+		SEC_SVR_DBG("%s", "Cannot open /etc/group");
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+
+	linebuf = malloc(128);
+	bufsize = 128;
+	if(linebuf == NULL)
+	{
+		ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+		SEC_SVR_DBG("%s", "cannot malloc()");
+		goto error;
+	}
+
+	bzero(linebuf, bufsize);
+	ret = SECURITY_SERVER_ERROR_NO_SUCH_OBJECT;
+	while(fgets(linebuf, bufsize, fp) != NULL)
+	{
+		while(linebuf[bufsize -2] != 0)
+		{
+			linebuf[bufsize -1] = (char) fgetc(fp);
+			tempstr = realloc(linebuf, bufsize + 128);
+			if(tempstr == NULL)
+			{
+				ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+				goto error;
+			}
+			linebuf = tempstr;
+			bzero(linebuf + bufsize, 128);
+			fgets(linebuf + bufsize, 128, fp);
+			bufsize += 128;
+		}
+
+		token = strtok(linebuf, ":");	/* group name */
+		if(token == NULL)
+		{
+			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
+			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+			goto error;
+		}
+		token2 = strtok(NULL, ":");	/* group password */
+		if(token2== NULL)
+		{
+			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
+			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+			goto error;
+		}
+		token2 = strtok(NULL, ":");	/* gid */
+		if(token2 == NULL)
+		{
+			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
+			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+			goto error;
+		}
+
+		errno = 0;
+		tmp_gid = strtoul(token2, 0, 10);
+		if (errno != 0)
+		{
+			SEC_SVR_DBG("cannot change string to integer [%s]", token2);
+			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+			goto error;
+		}
+
+		if(tmp_gid == gid)
+		{
+			/* We found it */
+			/* Leave room for the terminator */
+			if(strlen(token) >= obj_size)
+			{
+				ret = SECURITY_SERVER_ERROR_BUFFER_TOO_SMALL;
+				SEC_SVR_DBG("buffer is too small. %d --> %d", obj_size, (int)strlen(token));
+				goto error;
+			}
+			memcpy(obj, token, strlen(token) + 1);
+			ret = SECURITY_SERVER_SUCCESS;
+			break;
+		}
+		bzero(linebuf, bufsize);
+	}
+
+error:
+	if(linebuf != NULL)
+		free(linebuf);
+	if(fp != NULL)
+		fclose(fp);
+	return ret;
+}
+
+/* Search GID from group name *
+ * This function opens /etc/group and search group name by given gid */
+int search_gid(const char *obj)
+{
+	FILE *fp = NULL;
+	char *linebuf = NULL, *token = NULL, *token2, *tempstr = NULL;
+	int ret = SECURITY_SERVER_ERROR_NO_SUCH_OBJECT, tmp_gid, bufsize;
+
+	SEC_SVR_DBG("Searching for object %s", obj);
+
+	fp = fopen(get_config()->group_file_path, "r");
+	if(fp == NULL)
+	{
+		/* cannot open /etc/group */
+		SEC_SVR_DBG("%s", "cannot open /etc/group");
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+
+	linebuf = malloc(128);
+	bufsize = 128;
+	if(linebuf == NULL)
+	{
+		ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+		SEC_SVR_DBG("%s", "Out Of Memory");
+		goto error;
+	}
+
+	bzero(linebuf, bufsize);
+	while(fgets(linebuf, bufsize, fp) != NULL)
+	{
+		while(linebuf[bufsize -2] != 0 )
+		{
+			linebuf[bufsize -1] = (char) fgetc(fp);
+			tempstr = realloc(linebuf, bufsize + 128);
+			if(tempstr == NULL)
+			{
+				ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+				goto error;
+			}
+			linebuf = tempstr;
+			bzero(linebuf + bufsize, 128);
+			fgets(linebuf + bufsize, 128, fp);
+			bufsize += 128;
+		}
+
+		token = strtok(linebuf, ":");	/* group name */
+		token2 = strtok(NULL, ":");	/* group password */
+		token2 = strtok(NULL, ":");	/* gid */
+		if(token2 == NULL)
+		{
+			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
+			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+			goto error;
+		}
+		errno = 0;
+		tmp_gid = strtoul(token2, 0, 10);
+		if ( errno != 0 )
+		{
+			SEC_SVR_DBG("cannot change string to integer [%s]", token2);
+			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
+			goto error;
+		}
+
+		if(strcmp(obj, token) == 0)
+		{
+			/* We found it */
+			ret = tmp_gid;
+			SEC_SVR_DBG("GID of %s is found: %d", obj, ret);
+			break;
+		}
+		bzero(linebuf, bufsize);
+	}
+
+error:
+	if(linebuf != NULL)
+		free(linebuf);
+	if(fp != NULL)
+		fclose(fp);
+	return ret;
+}
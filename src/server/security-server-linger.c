@@ -0,0 +1,311 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+#include "security-server-stats.h"
+#include "security-server-linger.h"
+
+/* Entries of a list wait for the same time, so each list is ordered by *
+ * deadline */
+typedef struct linger_entry
+{
+	int			sockfd;
+	unsigned long long	start;		/* stats_clock() */
+	unsigned long long	deadline;
+	parked_conn		conn;		/* Parked connections only */
+	struct linger_list	*list;
+	struct linger_entry	*prev;
+	struct linger_entry	*next;
+} linger_entry;
+
+typedef struct linger_list
+{
+	linger_entry	*head;
+	linger_entry	*tail;
+	int		count;
+	int		max;
+	int		timeout;	/* Milliseconds */
+} linger_list;
+
+static pthread_mutex_t linger_mutex = PTHREAD_MUTEX_INITIALIZER;
+static linger_list closing = { NULL, NULL, 0, SECURITY_SERVER_LINGER_MAX,
+	SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND };
+static linger_list parked = { NULL, NULL, 0, SECURITY_SERVER_PARKED_MAX,
+	SECURITY_SERVER_IDLE_TIMEOUT_MILISECOND };
+static int epoll_fd = -1;
+static int timer_fd = -1;
+
+/* Caller holds linger_mutex */
+static void arm_timer(void)
+{
+	struct itimerspec its;
+	unsigned long long deadline = 0;
+
+	if(closing.head != NULL)
+		deadline = closing.head->deadline;
+	if(parked.head != NULL && (deadline == 0 || parked.head->deadline < deadline))
+		deadline = parked.head->deadline;
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000000ULL;
+	its.it_value.tv_nsec = (deadline % 1000000ULL) * 1000;
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+/* Take the entry out of its list and the epoll set. Caller holds *
+ * linger_mutex */
+static void unlink_entry(linger_entry *entry)
+{
+	linger_list *list = entry->list;
+
+	if(entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		list->head = entry->next;
+	if(entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		list->tail = entry->prev;
+	list->count--;
+
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, entry->sockfd, NULL);
+}
+
+/* Caller holds linger_mutex */
+static void release_entry(linger_entry *entry)
+{
+	unlink_entry(entry);
+	close(entry->sockfd);
+	if(entry->list == &closing)
+		stats_record(SECURITY_SERVER_STAT_LINGER, entry->start);
+	free(entry);
+}
+
+/* Append a socket to the list and the epoll set. Caller holds linger_mutex */
+static int add_entry(linger_list *list, linger_entry *entry, unsigned int events)
+{
+	struct epoll_event ev;
+
+	entry->start = stats_clock();
+	entry->deadline = entry->start + list->timeout * 1000ULL;
+	entry->list = list;
+	entry->next = NULL;
+
+	if(list->count >= list->max)
+		release_entry(list->head);
+
+	entry->prev = list->tail;
+	if(list->tail != NULL)
+		list->tail->next = entry;
+	else
+		list->head = entry;
+	list->tail = entry;
+	list->count++;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = entry;
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, entry->sockfd, &ev) < 0)
+	{
+		SEC_SVR_DBG("epoll_ctl() failed: %d", errno);
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+	}
+	if(entry == list->head)
+		arm_timer();
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Create the epoll set. Its fd becomes readable when linger_process() has *
+ * something to do */
+int linger_init(int *event_fd)
+{
+	struct epoll_event ev;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(epoll_fd < 0)
+	{
+		SEC_SVR_DBG("epoll_create1() failed: %d", errno);
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+	}
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timer_fd < 0)
+	{
+		SEC_SVR_DBG("timerfd_create() failed: %d", errno);
+		goto error;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;	/* Timer */
+	if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) < 0)
+	{
+		SEC_SVR_DBG("epoll_ctl() failed: %d", errno);
+		goto error;
+	}
+	*event_fd = epoll_fd;
+	return SECURITY_SERVER_SUCCESS;
+
+error:
+	if(timer_fd >= 0)
+		close(timer_fd);
+	close(epoll_fd);
+	timer_fd = epoll_fd = -1;
+	return SECURITY_SERVER_ERROR_SERVER_ERROR;
+}
+
+/* Hand a client socket over. Called by workers instead of *
+ * safe_server_sock_close(), which is still used before linger_init() */
+void linger_close(int sockfd)
+{
+	linger_entry *entry;
+
+	if(epoll_fd < 0)
+	{
+		safe_server_sock_close(sockfd);
+		return;
+	}
+
+	entry = malloc(sizeof(linger_entry));
+	if(entry == NULL)
+	{
+		SEC_SVR_DBG("%s", "Out of memory. Closing without linger");
+		close(sockfd);
+		return;
+	}
+	entry->sockfd = sockfd;
+
+	pthread_mutex_lock(&linger_mutex);
+	if(add_entry(&closing, entry, EPOLLRDHUP) != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("%s", "Closing without linger");
+		release_entry(entry);
+	}
+	pthread_mutex_unlock(&linger_mutex);
+}
+
+/* Park an idle connection until its next request. The socket is owned by *
+ * the set on success. Fails without linger_init(), and the worker keeps *
+ * the connection then */
+int linger_park(const parked_conn *conn)
+{
+	linger_entry *entry;
+	int ret;
+
+	if(epoll_fd < 0)
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+
+	entry = malloc(sizeof(linger_entry));
+	if(entry == NULL)
+	{
+		SEC_SVR_DBG("%s", "Out of memory");
+		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+	}
+	entry->sockfd = conn->sockfd;
+	entry->conn = *conn;
+
+	pthread_mutex_lock(&linger_mutex);
+	ret = add_entry(&parked, entry, EPOLLIN | EPOLLRDHUP);
+	if(ret != SECURITY_SERVER_SUCCESS)
+	{
+		unlink_entry(entry);
+		free(entry);
+	}
+	pthread_mutex_unlock(&linger_mutex);
+	return ret;
+}
+
+/* Close hung up and expired sockets, and return parked connections that *
+ * have a request in 'ready'. Doesn't block. Entries are released only here *
+ * and by linger_close() and linger_park() under the mutex, so the pointers *
+ * in the returned events stay valid while it's held. Returns the number of *
+ * ready connections. Ones that don't fit stay parked and wake the accept *
+ * loop again */
+int linger_process(parked_conn *ready, int max)
+{
+	struct epoll_event events[32];
+	unsigned long long now, expirations;
+	linger_entry *entry;
+	int i, num_events, num_ready = 0, ret;
+	char c;
+
+	if(epoll_fd < 0)
+		return 0;
+
+	pthread_mutex_lock(&linger_mutex);
+	do
+	{
+		num_events = epoll_wait(epoll_fd, events, 32, 0);
+		for(i = 0; i < num_events; i++)
+		{
+			entry = (linger_entry *)events[i].data.ptr;
+			if(entry == NULL)
+			{
+				while(read(timer_fd, &expirations, sizeof(expirations)) > 0);
+				continue;
+			}
+			if(entry->list == &closing)
+			{
+				release_entry(entry);
+				continue;
+			}
+
+			/* Parked connection has a request, or has hung up */
+			ret = recv(entry->sockfd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+			if(ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				continue;
+			if(ret <= 0)
+			{
+				release_entry(entry);
+				continue;
+			}
+			if(num_ready < max)
+			{
+				ready[num_ready++] = entry->conn;
+				unlink_entry(entry);
+				free(entry);
+			}
+		}
+	} while(num_events == 32 && num_ready < max);
+
+	now = stats_clock();
+	while(closing.head != NULL && closing.head->deadline <= now)
+	{
+		SEC_SVR_DBG("Client did not close socket %d in time", closing.head->sockfd);
+		release_entry(closing.head);
+	}
+	while(parked.head != NULL && parked.head->deadline <= now)
+	{
+		SEC_SVR_DBG("Idle connection %d timed out", parked.head->sockfd);
+		release_entry(parked.head);
+	}
+	arm_timer();
+	pthread_mutex_unlock(&linger_mutex);
+	return num_ready;
+}
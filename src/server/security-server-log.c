@@ -0,0 +1,488 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "security-server-common.h"
+#include "security-server-log.h"
+
+#ifdef SECURITY_SERVER_DEBUG_DLOG
+#define LOG_EMIT(FMT, ARG ...) SLOGD(FMT, ##ARG)
+#else
+#define LOG_EMIT(FMT, ARG ...) fprintf(stderr, FMT"\n", ##ARG)
+#endif
+
+#define LOG_MSG_LEN		512
+
+/* Argument classes of printf conversions */
+#define LOG_ARG_NONE		0	/* %% */
+#define LOG_ARG_INT		1
+#define LOG_ARG_LONG		2
+#define LOG_ARG_LLONG		3
+#define LOG_ARG_DOUBLE		4
+#define LOG_ARG_PTR		5
+#define LOG_ARG_STR		6
+#define LOG_ARG_BAD		7	/* '*', %n, long double, ... not supported */
+
+/* Ring states */
+#define LOG_RING_FREE		0
+#define LOG_RING_OWNED		1
+#define LOG_RING_ORPHANED	2	/* Owner thread exited, drained and freed by the logger */
+
+typedef union
+{
+	long long	i;
+	double		d;
+	const void	*p;
+	int		s;	/* Offset in str, -1 for NULL */
+} log_arg;
+
+typedef struct
+{
+	const log_site	*site;
+	int		nargs;		/* -1 if arguments could not be captured */
+	int		str_len;
+	log_arg		args[SECURITY_SERVER_LOG_MAX_ARGS];
+	char		str[SECURITY_SERVER_LOG_STR_LEN];
+} log_record;
+
+/* Single producer (owner thread), single consumer (logger thread) */
+typedef struct
+{
+	unsigned int	head;		/* Next record to be drained */
+	unsigned int	tail;		/* Next record to be written */
+	int		state;
+	unsigned int	dropped;	/* Records lost because the ring was full */
+	log_record	records[SECURITY_SERVER_LOG_RING_SIZE];
+} log_ring;
+
+int security_server_log_level = SECURITY_SERVER_LOG_DEBUG;
+
+/* Rings are allocated once, before any thread can use them, so claiming *
+ * one is a compare-and-swap and logging never calls malloc() */
+static log_ring *rings = NULL;
+static int num_rings_used = 0;		/* High water mark */
+static int log_efd = -1;
+static int logger_waiting = 0;
+static pthread_key_t ring_key;
+
+static __thread log_ring *my_ring = NULL;
+static __thread int in_log = 0;
+
+/* Parse a conversion specification at fmt ('%' already skipped) *
+ * Returns pointer to the char after it, and the argument class */
+static const char *parse_spec(const char *fmt, int *arg_class)
+{
+	int longs = 0;
+
+	while(*fmt != 0 && strchr("-+ #0", *fmt) != NULL)
+		fmt++;
+	while((*fmt >= '0' && *fmt <= '9') || *fmt == '.')
+		fmt++;
+	if(*fmt == '*')
+	{
+		*arg_class = LOG_ARG_BAD;
+		return fmt;
+	}
+	while(*fmt != 0 && strchr("hlzjtL", *fmt) != NULL)
+	{
+		if(*fmt == 'l')
+			longs++;
+		else if(*fmt == 'z' || *fmt == 'j' || *fmt == 't')
+			longs = 2;
+		else if(*fmt == 'L')
+			longs = 3;
+		fmt++;
+	}
+
+	switch(*fmt)
+	{
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+			*arg_class = longs == 0 ? LOG_ARG_INT : longs == 1 ? LOG_ARG_LONG : LOG_ARG_LLONG;
+			break;
+		case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+			*arg_class = longs == 3 ? LOG_ARG_BAD : LOG_ARG_DOUBLE;
+			break;
+		case 'p':
+			*arg_class = LOG_ARG_PTR;
+			break;
+		case 's':
+			*arg_class = LOG_ARG_STR;
+			break;
+		case '%':
+			*arg_class = LOG_ARG_NONE;
+			break;
+		default:
+			*arg_class = LOG_ARG_BAD;
+			return fmt;
+	}
+	return fmt + 1;
+}
+
+/* Copy arguments into the record. Strings are copied, truncated if needed */
+static void capture_args(log_record *rec, const char *fmt, va_list ap)
+{
+	int arg_class, len;
+	const char *str;
+
+	rec->nargs = 0;
+	rec->str_len = 0;
+	while((fmt = strchr(fmt, '%')) != NULL)
+	{
+		fmt = parse_spec(fmt + 1, &arg_class);
+		if(arg_class == LOG_ARG_NONE)
+			continue;
+		if(arg_class == LOG_ARG_BAD || rec->nargs >= SECURITY_SERVER_LOG_MAX_ARGS)
+		{
+			rec->nargs = -1;
+			return;
+		}
+		switch(arg_class)
+		{
+			case LOG_ARG_INT:
+				rec->args[rec->nargs].i = va_arg(ap, int);
+				break;
+			case LOG_ARG_LONG:
+				rec->args[rec->nargs].i = va_arg(ap, long);
+				break;
+			case LOG_ARG_LLONG:
+				rec->args[rec->nargs].i = va_arg(ap, long long);
+				break;
+			case LOG_ARG_DOUBLE:
+				rec->args[rec->nargs].d = va_arg(ap, double);
+				break;
+			case LOG_ARG_PTR:
+				rec->args[rec->nargs].p = va_arg(ap, void *);
+				break;
+			case LOG_ARG_STR:
+				str = va_arg(ap, const char *);
+				if(str == NULL)
+				{
+					rec->args[rec->nargs].s = -1;
+					break;
+				}
+				len = strnlen(str, SECURITY_SERVER_LOG_STR_LEN - 1 - rec->str_len);
+				memcpy(rec->str + rec->str_len, str, len);
+				rec->args[rec->nargs].s = rec->str_len;
+				rec->str_len += len;
+				rec->str[rec->str_len++] = 0;
+				break;
+		}
+		rec->nargs++;
+	}
+}
+
+/* Format a captured record the way printf() would have done */
+static void format_record(const log_record *rec, char *out, int outlen)
+{
+	const char *fmt = rec->site->fmt, *start;
+	char spec[32];
+	int arg_class, n = 0, ptr = 0, len;
+	const log_arg *arg;
+
+	if(rec->nargs < 0)
+	{
+		snprintf(out, outlen, "[unsupported log format] %s", fmt);
+		return;
+	}
+
+	while(*fmt != 0 && ptr < outlen - 1)
+	{
+		if(*fmt != '%')
+		{
+			out[ptr++] = *fmt++;
+			continue;
+		}
+		start = fmt;
+		fmt = parse_spec(fmt + 1, &arg_class);
+		if(arg_class == LOG_ARG_NONE)
+		{
+			out[ptr++] = '%';
+			continue;
+		}
+		len = fmt - start;
+		if(len >= (int)sizeof(spec) || n >= rec->nargs)
+			break;
+		memcpy(spec, start, len);
+		spec[len] = 0;
+		arg = &rec->args[n++];
+
+		switch(arg_class)
+		{
+			case LOG_ARG_INT:
+				len = snprintf(out + ptr, outlen - ptr, spec, (int)arg->i);
+				break;
+			case LOG_ARG_LONG:
+				len = snprintf(out + ptr, outlen - ptr, spec, (long)arg->i);
+				break;
+			case LOG_ARG_LLONG:
+				len = snprintf(out + ptr, outlen - ptr, spec, arg->i);
+				break;
+			case LOG_ARG_DOUBLE:
+				len = snprintf(out + ptr, outlen - ptr, spec, arg->d);
+				break;
+			case LOG_ARG_PTR:
+				len = snprintf(out + ptr, outlen - ptr, spec, arg->p);
+				break;
+			case LOG_ARG_STR:
+				len = snprintf(out + ptr, outlen - ptr, spec,
+						arg->s < 0 ? "(null)" : rec->str + arg->s);
+				break;
+			default:
+				len = 0;
+		}
+		if(len < 0)
+			break;
+		ptr += len;
+		if(ptr >= outlen)
+			ptr = outlen - 1;
+	}
+	out[ptr] = 0;
+}
+
+static void emit_record(const log_record *rec)
+{
+	char msg[LOG_MSG_LEN];
+	const char *file = strrchr(rec->site->file, '/');
+
+	format_record(rec, msg, sizeof(msg));
+	LOG_EMIT("%s: %s(%d) > %s", file != NULL ? file + 1 : rec->site->file,
+			rec->site->func, rec->site->line, msg);
+}
+
+static void release_ring(void *data)
+{
+	log_ring *ring = data;
+
+	__atomic_store_n(&ring->state, LOG_RING_ORPHANED, __ATOMIC_RELEASE);
+}
+
+static log_ring *claim_ring(void)
+{
+	int i, expected;
+
+	for(i = 0; i < SECURITY_SERVER_LOG_RINGS; i++)
+	{
+		expected = LOG_RING_FREE;
+		if(!__atomic_compare_exchange_n(&rings[i].state, &expected, LOG_RING_OWNED,
+					0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			continue;
+
+		/* Raise the high water mark so the logger looks at this ring */
+		expected = __atomic_load_n(&num_rings_used, __ATOMIC_RELAXED);
+		while(expected <= i && !__atomic_compare_exchange_n(&num_rings_used, &expected, i + 1,
+					1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+		/* Handed back to the logger when this thread exits */
+		pthread_setspecific(ring_key, &rings[i]);
+		return &rings[i];
+	}
+	return NULL;
+}
+
+/* Log a record *
+ * Records are formatted synchronously before log_init(), when all rings are *
+ * taken, or if a signal handler logs while its thread is in the middle of *
+ * writing a record */
+void security_server_log(const log_site *site, ...)
+{
+	log_record *rec, sync_rec;
+	log_ring *ring;
+	unsigned int tail;
+	va_list ap;
+
+	va_start(ap, site);
+	if(in_log || __atomic_load_n(&rings, __ATOMIC_ACQUIRE) == NULL)
+		goto sync;
+	in_log = 1;
+	if(my_ring == NULL)
+		my_ring = claim_ring();
+	ring = my_ring;
+	if(ring == NULL)
+	{
+		in_log = 0;
+		goto sync;
+	}
+
+	tail = ring->tail;
+	if(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) >= SECURITY_SERVER_LOG_RING_SIZE)
+	{
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		in_log = 0;
+		va_end(ap);
+		return;
+	}
+	rec = &ring->records[tail & (SECURITY_SERVER_LOG_RING_SIZE - 1)];
+	rec->site = site;
+	capture_args(rec, site->fmt, ap);
+	va_end(ap);
+
+	/* Publish, then wake the logger only if it sleeps. Same ordering as *
+	 * shm_ring_notify(): either we see it waiting, or it sees the record */
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&logger_waiting, __ATOMIC_SEQ_CST) &&
+			__atomic_exchange_n(&logger_waiting, 0, __ATOMIC_SEQ_CST))
+	{
+		/* Logger wakes up on its timeout anyway if this fails */
+		eventfd_write(log_efd, 1);
+	}
+	in_log = 0;
+	return;
+
+sync:
+	sync_rec.site = site;
+	capture_args(&sync_rec, site->fmt, ap);
+	va_end(ap);
+	emit_record(&sync_rec);
+}
+
+/* Emit all records in the rings. Returns number of records emitted */
+static int drain_rings(void)
+{
+	int i, num, total = 0, expected;
+	unsigned int head, tail, dropped;
+	log_ring *ring;
+
+	num = __atomic_load_n(&num_rings_used, __ATOMIC_ACQUIRE);
+	for(i = 0; i < num; i++)
+	{
+		ring = &rings[i];
+		if(__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE) == LOG_RING_FREE)
+			continue;
+
+		head = ring->head;
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		for(; head != tail; head++, total++)
+			emit_record(&ring->records[head & (SECURITY_SERVER_LOG_RING_SIZE - 1)]);
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+		dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+		if(dropped > 0)
+			LOG_EMIT("%u log records dropped", dropped);
+
+		/* The owner has gone, and won't write any more */
+		expected = LOG_RING_ORPHANED;
+		if(head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE))
+			__atomic_compare_exchange_n(&ring->state, &expected, LOG_RING_FREE,
+					0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+	}
+	return total;
+}
+
+static int rings_empty(void)
+{
+	int i, num;
+
+	num = __atomic_load_n(&num_rings_used, __ATOMIC_ACQUIRE);
+	for(i = 0; i < num; i++)
+	{
+		if(__atomic_load_n(&rings[i].tail, __ATOMIC_SEQ_CST) != rings[i].head)
+			return 0;
+	}
+	return 1;
+}
+
+static void *security_server_log_thread(void *param)
+{
+	struct pollfd pfd;
+	uint64_t count;
+
+	pfd.fd = log_efd;
+	pfd.events = POLLIN;
+	while(1)
+	{
+		drain_rings();
+
+		/* Set 'waiting' before looking at the rings for the last time */
+		__atomic_store_n(&logger_waiting, 1, __ATOMIC_SEQ_CST);
+		if(!rings_empty())
+		{
+			__atomic_store_n(&logger_waiting, 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		/* Orphaned rings are reclaimed on the next drain even if nobody logs */
+		if(poll(&pfd, 1, SECURITY_SERVER_IDLE_TIMEOUT_MILISECOND) > 0)
+		{
+			if(read(log_efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+				LOG_EMIT("Logger: read() failed: %d", errno);
+		}
+		__atomic_store_n(&logger_waiting, 0, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/* Start the logger thread. Until this is called, logging is synchronous */
+int log_init(void)
+{
+	pthread_t thread;
+	log_ring *pool;
+	int retval;
+
+	if(pthread_key_create(&ring_key, release_ring) != 0)
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+
+	log_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(log_efd < 0)
+	{
+		LOG_EMIT("Logger: eventfd() failed: %d", errno);
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+	}
+
+	/* Pages of a ring are touched only when a thread logs through it */
+	pool = calloc(SECURITY_SERVER_LOG_RINGS, sizeof(log_ring));
+	if(pool == NULL)
+	{
+		close(log_efd);
+		log_efd = -1;
+		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+	}
+
+	retval = pthread_create(&thread, NULL, security_server_log_thread, NULL);
+	if(retval != 0)
+	{
+		LOG_EMIT("Logger: cannot create thread: %d", retval);
+		free(pool);
+		close(log_efd);
+		log_efd = -1;
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+	}
+	pthread_detach(thread);
+	__atomic_store_n(&rings, pool, __ATOMIC_RELEASE);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+int log_set_level(int level)
+{
+	if(level < SECURITY_SERVER_LOG_NONE || level > SECURITY_SERVER_LOG_DEBUG)
+		return SECURITY_SERVER_ERROR_INPUT_PARAM;
+	__atomic_store_n(&security_server_log_level, level, __ATOMIC_RELAXED);
+	return SECURITY_SERVER_SUCCESS;
+}
@@ -25,14 +25,33 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <signal.h>
 #include <pthread.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 
 #include "security-server-cookie.h"
+#include "security-server-cookie-store.h"
 #include "security-server-common.h"
 #include "security-server-password.h"
 #include "security-server-comm.h"
+#include "security-server-channel.h"
+#include "security-server-revoke.h"
+#include "security-server-stats.h"
+#include "security-server-log.h"
+#include "security-server-probes.h"
+#include "security-server-config.h"
+#include "security-server-group.h"
+#include "security-server-linger.h"
+
+extern char **environ;
 
 /* Set cookie as a global variable */
 cookie_list *c_list;
@@ -41,9 +60,69 @@ int thread_status[SECURITY_SERVER_NUM_THREADS];
 struct security_server_thread_param {
 	int client_sockfd;
 	int server_sockfd;
+	int sock_type;
+	int sock_class;
 	int thread_status;
 };
 
+/* Thread slots are split by socket class. The accept loop stops listening *
+ * to a class while all of its workers are busy, and workers write to *
+ * slot_event_fd when they leave, so it starts again */
+static const int class_threads[SECURITY_SERVER_NUM_SOCK_CLASSES] = {
+	SECURITY_SERVER_APP_THREADS,
+	SECURITY_SERVER_MIDDLEWARE_THREADS,
+	SECURITY_SERVER_PASSWORD_THREADS
+};
+static const int class_backlog[SECURITY_SERVER_NUM_SOCK_CLASSES] = {
+	SECURITY_SERVER_APP_BACKLOG,
+	SECURITY_SERVER_MIDDLEWARE_BACKLOG,
+	SECURITY_SERVER_PASSWORD_BACKLOG
+};
+static const int class_queue[SECURITY_SERVER_NUM_SOCK_CLASSES] = {
+	SECURITY_SERVER_APP_QUEUE,
+	SECURITY_SERVER_MIDDLEWARE_QUEUE,
+	SECURITY_SERVER_PASSWORD_QUEUE
+};
+int class_busy[SECURITY_SERVER_NUM_SOCK_CLASSES];
+int class_first_slot[SECURITY_SERVER_NUM_SOCK_CLASSES];
+int slot_event_fd = -1;
+pthread_t threads[SECURITY_SERVER_NUM_THREADS];
+struct security_server_thread_param param[SECURITY_SERVER_NUM_THREADS];
+
+/* Listening sockets, in get_sock_path() order of class and transport */
+int listen_sockfd[SECURITY_SERVER_MAX_LISTENERS];
+
+/* Restart handoff. The accept loop stops listening when it leaves *
+ * HANDOFF_NONE, confirms it with HANDOFF_STOPPED, and exits at HANDOFF_DONE */
+enum
+{
+	HANDOFF_NONE,
+	HANDOFF_DRAINING,
+	HANDOFF_STOPPED,
+	HANDOFF_DONE
+};
+int handoff_state = HANDOFF_NONE;
+
+/* Accepted connections waiting for a worker of their class. Owned by the *
+ * accept loop */
+typedef struct
+{
+	int			client_sockfd;
+	int			server_sockfd;
+	int			sock_type;
+	unsigned long long	accepted;	/* stats_clock() */
+} pending_conn;
+
+typedef struct
+{
+	pending_conn	conns[SECURITY_SERVER_MAX_QUEUE];
+	int		head;
+	int		count;
+} pending_queue;
+
+pending_queue queues[SECURITY_SERVER_NUM_SOCK_CLASSES];
+int queue_timer_fd = -1;
+
 /************************************************************************************************/
 /* Just for test. This code must be removed on release */
 #include "security-server-util.h"
@@ -85,247 +164,88 @@ void print_cookie(cookie_list *list)
 }
 #endif
 
-/* Object name is actually name of a Group ID *
- * This function opens /etc/group file and search group ID and
- * returns the string */
-int search_object_name(int gid, char *obj, int obj_size)
-{
-	FILE *fp = NULL;
-	char *linebuf = NULL, *token = NULL, *token2, *tempstr = NULL;
-	int ret = 0, tmp_gid, bufsize;
-	fp = fopen("/etc/group", "r");
-	if(fp == NULL)
-	{
-		/* cannot open /etc/group */
-		SEC_SVR_DBG("%s", "Cannot open /etc/group");
-		return SECURITY_SERVER_ERROR_FILE_OPERATION;
-	}
-
-	linebuf = malloc(128);
-	bufsize = 128;
-	if(linebuf == NULL)
-	{
-		ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-		SEC_SVR_DBG("%s", "cannot malloc()");
-		goto error;
-	}
-
-	bzero(linebuf, bufsize);
-	ret = SECURITY_SERVER_ERROR_NO_SUCH_OBJECT;
-	while(fgets(linebuf, bufsize, fp) != NULL)
-	{
-		while(linebuf[bufsize -2] != 0)
-		{
-			linebuf[bufsize -1] = (char) fgetc(fp);
-			tempstr = realloc(linebuf, bufsize + 128);
-			if(tempstr == NULL)
-			{
-				ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-				goto error;
-			}
-			linebuf = tempstr;
-			bzero(linebuf + bufsize, 128);
-			fgets(linebuf + bufsize, 128, fp);
-			bufsize += 128;
-		}
-
-		token = strtok(linebuf, ":");	/* group name */
-		if(token == NULL)
-		{
-			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
-			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
-			goto error;
-		}
-		token2 = strtok(NULL, ":");	/* group password */
-		if(token2== NULL)
-		{
-			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
-			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
-			goto error;
-		}
-		token2 = strtok(NULL, ":");	/* gid */
-		if(token2 == NULL)
-		{
-			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
-			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
-			goto error;
-		}
-
-		errno = 0;
-		tmp_gid = strtoul(token2, 0, 10);
-		if (errno != 0)
-		{
-			SEC_SVR_DBG("cannot change string to integer [%s]", token2);
-			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
-			goto error;
-		}
-
-		if(tmp_gid == gid)
-		{
-			/* We found it */
-			if(strlen(token) > obj_size)
-			{
-				ret = SECURITY_SERVER_ERROR_BUFFER_TOO_SMALL;
-				SEC_SVR_DBG("buffer is too small. %d --> %d", obj_size, strlen(token));
-				goto error;
-			}
-			strncpy(obj, token, strlen(token));
-			obj[strlen(token)] = 0;
-			ret = SECURITY_SERVER_SUCCESS;
-			break;
-		}
-		bzero(linebuf, bufsize);
-	}
-
-error:
-	if(linebuf != NULL)
-		free(linebuf);
-	if(fp != NULL)
-		fclose(fp);
-	return ret;
-}
-
-/* Search GID from group name *
- * This function opens /etc/group and search group name by given gid */
-int search_gid(const char *obj)
+/* Reap dead children. SIGCHLD is blocked in all threads and delivered to *
+ * signal_fd, so it's called from the accept loop instead of a handler *
+ * interrupting whichever thread happens to run. A tool runs in its own *
+ * session, so when the leader dies, the rest of its group is killed too */
+static void reap_children(int signal_fd)
 {
-	FILE *fp = NULL;
-	char *linebuf = NULL, *token = NULL, *token2, *tempstr = NULL;
-	int ret = SECURITY_SERVER_ERROR_NO_SUCH_OBJECT, tmp_gid, bufsize;
-
-	SEC_SVR_DBG("Searching for object %s", obj);
-
-	fp = fopen("/etc/group", "r");
-	if(fp == NULL)
-	{
-		/* cannot open /etc/group */
-		SEC_SVR_DBG("%s", "cannot open /etc/group");
-		return SECURITY_SERVER_ERROR_FILE_OPERATION;
-	}
+	struct signalfd_siginfo fdsi;
+	siginfo_t info;
+	pid_t child_pgid;
 
-	linebuf = malloc(128);
-	bufsize = 128;
-	if(linebuf == NULL)
-	{
-		ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-		SEC_SVR_DBG("%s", "Out Of Memory");
-		goto error;
-	}
+	/* Drain the queue. Pending SIGCHLDs are merged anyway */
+	while(read(signal_fd, &fdsi, sizeof(fdsi)) == sizeof(fdsi));
 
-	bzero(linebuf, bufsize);
-	while(fgets(linebuf, bufsize, fp) != NULL)
+	while(1)
 	{
-		while(linebuf[bufsize -2] != 0 )
-		{
-			linebuf[bufsize -1] = (char) fgetc(fp);
-			tempstr = realloc(linebuf, bufsize + 128);
-			if(tempstr == NULL)
-			{
-				ret = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-				goto error;
-			}
-			linebuf = tempstr;
-			bzero(linebuf + bufsize, 128);
-			fgets(linebuf + bufsize, 128, fp);
-			bufsize += 128;
-		}
-
-		token = strtok(linebuf, ":");	/* group name */
-		token2 = strtok(NULL, ":");	/* group password */
-		token2 = strtok(NULL, ":");	/* gid */
-		if(token2 == NULL)
-		{
-			SEC_SVR_DBG("/etc/group is not valid. cannot find gid: [%s]", linebuf);
-			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
-			goto error;
-		}
-		errno = 0;
-		tmp_gid = strtoul(token2, 0, 10);
-		if ( errno != 0 )
-		{
-			SEC_SVR_DBG("cannot change string to integer [%s]", token2);
-			ret = SECURITY_SERVER_ERROR_SERVER_ERROR;
-			goto error;
-		}
-
-		if(strcmp(obj, token) == 0)
-		{
-			/* We found it */
-			ret = tmp_gid;
-			SEC_SVR_DBG("GID of %s is found: %d", obj, ret);
+		/* Peek first, group is gone after the child is reaped */
+		memset(&info, 0, sizeof(info));
+		if(waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0 || info.si_pid == 0)
 			break;
-		}
-		bzero(linebuf, bufsize);
+		child_pgid = getpgid(info.si_pid);
+		SEC_SVR_DBG("Child reaped: dead_pid=%d, pgid=%d", info.si_pid, child_pgid);
+		waitpid(info.si_pid, NULL, WNOHANG);
+		if(info.si_pid == child_pgid)
+			killpg(child_pgid, SIGKILL);
 	}
-
-error:
-	if(linebuf != NULL)
-		free(linebuf);
-	if(fp != NULL)
-		fclose(fp);
-	return ret;
 }
 
-/* Signal handler for processes */
-static void security_server_sig_child(int signo, siginfo_t *info, void *data)
+/* Execute a debugging tool by posix_spawn() *
+ * The child shares the address space until execve(), so the server's *
+ * memory is not copied. Server sockets are all close-on-exec */
+int execute_debug_tool(int argc, char *const *argv)
 {
-	int status;
-	pid_t child_pid;
-	pid_t child_pgid;
-
-	child_pgid = getpgid(info->si_pid);
-	SEC_SVR_DBG("Signal handler: dead_pid=%d, pgid=%d",info->si_pid,child_pgid);
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	pid_t pid;
+	short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+	int ret;
 
-	while ((child_pid = waitpid(-1, &status, WNOHANG)) > 0) {
-		if(child_pid == child_pgid)
-			killpg(child_pgid,SIGKILL);
-	}
-
-	return;
-}
-
-/* Execute a debugging tool by fork() and execve() */
-int execute_debug_tool(int argc, char *const *argv, int server_sockfd, int client_sockfd)
-{
-	int ret, i;
 	SEC_SVR_DBG("%s", "Executing tool");
 
-	ret = fork();
-	if(ret == 0)
+	ret = posix_spawnattr_init(&attr);
+	if(ret != 0)
 	{
-		close(client_sockfd);
-		close(server_sockfd);
-		setsid();
-
-		for(i=0;i<_NSIG;i++)
-			signal(i, SIG_DFL);
-
-		ret = execv(argv[0], argv);
-		if(ret == -1)
-		{
-			SEC_SVR_DBG("Error:Failed to execute [%d]", errno);
-			exit(-1);
-		}
+		SEC_SVR_DBG("Error: Failed to init spawn attributes [%d]", ret);
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
 	}
-	if(ret < 0)
+#ifdef POSIX_SPAWN_SETSID
+	flags |= POSIX_SPAWN_SETSID;
+#else
+	flags |= POSIX_SPAWN_SETPGROUP;
+	posix_spawnattr_setpgroup(&attr, 0);
+#endif
+	/* All signals default and unblocked, as the old fork() path did */
+	sigfillset(&sigs);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+	posix_spawnattr_setflags(&attr, flags);
+
+	ret = posix_spawn(&pid, argv[0], NULL, &attr, argv, environ);
+	posix_spawnattr_destroy(&attr);
+	if(ret != 0)
 	{
-		SEC_SVR_DBG("Error: Failed to fork [%d]", errno);
+		SEC_SVR_DBG("Error: Failed to spawn [%d]", ret);
 		return SECURITY_SERVER_ERROR_SERVER_ERROR;
 	}
+	SEC_SVR_DBG("Tool spawned: pid=%d", pid);
 	return SECURITY_SERVER_SUCCESS;
 }
 
-int process_cookie_request(int sockfd)
+int process_cookie_request(request_context *req)
 {
 	int retval, client_pid, client_uid;
 	cookie_list *created_cookie = NULL;
+	unsigned char cookie[SECURITY_SERVER_COOKIE_LEN];
 
 	/* Authenticate client */
-	retval = authenticate_client_application(sockfd, &client_pid, &client_uid);
+	retval = authenticate_client_application(req->sockfd, &client_pid, &client_uid);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -344,13 +264,23 @@ int process_cookie_request(int sockfd)
 			SEC_SVR_DBG("%s", "Cannot read default cookie");
 			goto error;
 		}
+		memcpy(cookie, created_cookie->cookie, SECURITY_SERVER_COOKIE_LEN);
 	}
 	else
 	{
-		/* Create a new cookie. or find existing one */
-		pthread_mutex_lock(&cookie_mutex);
-		created_cookie = create_cookie_item(client_pid, sockfd, c_list);
-		pthread_mutex_unlock(&cookie_mutex);
+		/* Create a new cookie. or find existing one *
+		 * Another thread may collect it as soon as the lock is released, *
+		 * so it's copied before that */
+		stats_lock(&cookie_mutex);
+		created_cookie = create_cookie_item(client_pid, req->sockfd, c_list);
+		if(created_cookie != NULL)
+		{
+			memcpy(cookie, created_cookie->cookie, SECURITY_SERVER_COOKIE_LEN);
+			SEC_SVR_DBG("Server: Cookie created for client PID %d LABEL >%s<",
+					created_cookie->pid,
+					(created_cookie->smack_label)?(created_cookie->smack_label):"NULL");
+		}
+		stats_unlock(&cookie_mutex);
 		if(created_cookie == NULL)
 		{
 			SEC_SVR_DBG("%s","Cannot create a cookie");
@@ -358,14 +288,11 @@ int process_cookie_request(int sockfd)
 		}
 	}
 	/* send cookie as response */
-	retval = send_cookie(sockfd, created_cookie->cookie);
+	retval = send_cookie(req, cookie);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
 	}
-        SEC_SVR_DBG("Server: Cookie created for client PID %d LABEL >%s<",
-                    created_cookie->pid,
-                    (created_cookie->smack_label)?(created_cookie->smack_label):"NULL");
 
 	SEC_SVR_DBG("%s", "Server: Cookie has been sent to client");
 
@@ -373,18 +300,18 @@ error:
 	return retval;
 }
 
-int process_check_privilege_request(int sockfd)
+int process_check_privilege_request(request_context *req)
 {
 	/* Authenticate client */
 	int retval, client_pid, requested_privilege;
 	unsigned char requested_cookie[SECURITY_SERVER_COOKIE_LEN];
 	cookie_list *search_result = NULL;
 
-	retval = authenticate_client_middleware(sockfd, &client_pid);
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -394,12 +321,12 @@ int process_check_privilege_request(int sockfd)
 		goto error;;
 	}
 
-	retval = recv_check_privilege_request(sockfd,
+	retval = recv_check_privilege_request(req,
 				requested_cookie, &requested_privilege);
 	if(retval == SECURITY_SERVER_ERROR_RECV_FAILED)
 	{
 		SEC_SVR_DBG("%s", "Receiving request failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -412,7 +339,7 @@ int process_check_privilege_request(int sockfd)
 	if(requested_privilege < 1)
 	{
 		SEC_SVR_DBG("Requiring bad privilege [%d]", requested_privilege);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -423,15 +350,15 @@ int process_check_privilege_request(int sockfd)
 	}
 
 	/* Search cookie list */
-	pthread_mutex_lock(&cookie_mutex);
+	stats_lock(&cookie_mutex);
 	search_result = search_cookie(c_list, requested_cookie, requested_privilege);
-	pthread_mutex_unlock(&cookie_mutex);
+	stats_unlock(&cookie_mutex);
 	if(search_result != NULL)
 	{
 		/* We found */
 		SEC_SVR_DBG("We found the cookie with %d privilege and pid:%d", requested_privilege, client_pid);
 		SEC_SVR_DBG("%s", "Cookie comparison succeeded. Access granted.");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_ACCESS_GRANTED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -443,7 +370,7 @@ int process_check_privilege_request(int sockfd)
 	{
 		/* It's not exist */
 		SEC_SVR_DBG("Could not find the cookie with %d privilege", requested_privilege);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_ACCESS_DENIED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -455,7 +382,7 @@ error:
 	return retval;
 }
 
-int process_check_privilege_new_request(int sockfd)
+int process_check_privilege_new_request(request_context *req)
 {
 	/* Authenticate client */
 	int retval, client_pid, requested_privilege;
@@ -464,11 +391,11 @@ int process_check_privilege_new_request(int sockfd)
         char object_label[MAX_OBJECT_LABEL_LEN+1];
         char access_rights[MAX_MODE_STR_LEN+1];
 
-	retval = authenticate_client_middleware(sockfd, &client_pid);
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(sockfd, 
+		retval = send_generic_response(req, 
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -479,11 +406,11 @@ int process_check_privilege_new_request(int sockfd)
 	}
 
         retval = recv_check_privilege_new_request(
-                     sockfd, requested_cookie, object_label, access_rights);
+                     req, requested_cookie, object_label, access_rights);
 	if(retval == SECURITY_SERVER_ERROR_RECV_FAILED)
 	{
 		SEC_SVR_DBG("%s", "Receiving request failed");
-		retval = send_generic_response(sockfd, 
+		retval = send_generic_response(req, 
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -494,16 +421,16 @@ int process_check_privilege_new_request(int sockfd)
 	}
 
 	/* Search cookie list */
-	pthread_mutex_lock(&cookie_mutex);
+	stats_lock(&cookie_mutex);
 	search_result = search_cookie_new(c_list, requested_cookie, object_label, access_rights);
-	pthread_mutex_unlock(&cookie_mutex);
+	stats_unlock(&cookie_mutex);
 
 	if(search_result != NULL)
     {
 		/* We found */
 		SEC_SVR_DBG("We found the cookie with %s rights and pid:%d", access_rights, client_pid);
 		SEC_SVR_DBG("%s", "Cookie comparison succeeded. Access granted.");
-		retval = send_generic_response(sockfd, 
+		retval = send_generic_response(req, 
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_RESPONSE, 
 				SECURITY_SERVER_RETURN_CODE_ACCESS_GRANTED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -515,7 +442,7 @@ int process_check_privilege_new_request(int sockfd)
 	{
 		/* It's not exist */
 		SEC_SVR_DBG("Could not find the cookie with %s rights", access_rights);
-		retval = send_generic_response(sockfd, 
+		retval = send_generic_response(req, 
 				SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_RESPONSE, 
 				SECURITY_SERVER_RETURN_CODE_ACCESS_DENIED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -529,17 +456,17 @@ error:
 
 }
 
-int process_object_name_request(int sockfd)
+int process_object_name_request(request_context *req)
 {
 	int retval, client_pid, requested_privilege;
 	char object_name[SECURITY_SERVER_MAX_OBJ_NAME];
 
 	/* Authenticate client */
-	retval = authenticate_client_middleware(sockfd, &client_pid);
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -550,11 +477,11 @@ int process_object_name_request(int sockfd)
 	}
 
 	/* Receive GID */
-	retval = read(sockfd, &requested_privilege, sizeof(requested_privilege));
+	retval = recv_request_data(req, &requested_privilege, sizeof(requested_privilege));
 	if (retval < sizeof(requested_privilege))
 	{
 		SEC_SVR_DBG("%s", "Receiving request failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -572,7 +499,7 @@ int process_object_name_request(int sockfd)
 	{
 		/* It's not exist */
 		SEC_SVR_DBG("There is no such object for gid [%d]", requested_privilege);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_NO_SUCH_OBJECT);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -585,7 +512,7 @@ int process_object_name_request(int sockfd)
 	{
 		/* Error occurred */
 		SEC_SVR_DBG("Error on searching object name [%d]", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -597,7 +524,7 @@ int process_object_name_request(int sockfd)
 
 	/* We found */
 	SEC_SVR_DBG("We found object: %s", object_name);
-	retval = send_object_name(sockfd, object_name);
+	retval = send_object_name(req, object_name);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
@@ -607,16 +534,16 @@ error:
 	return retval;
 }
 
-int process_gid_request(int sockfd, int msg_len)
+int process_gid_request(request_context *req)
 {
-	int retval, client_pid;
+	int retval, client_pid, msg_len = (int)req->msg_len;
 	char object_name[SECURITY_SERVER_MAX_OBJ_NAME];
 	/* Authenticate client as middleware daemon */
-	retval = authenticate_client_middleware(sockfd, &client_pid);
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client authentication failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -630,7 +557,7 @@ int process_gid_request(int sockfd, int msg_len)
 	{
 		/* Too big ojbect name */
 		SEC_SVR_DBG("%s", "Object name is too big");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -641,11 +568,11 @@ int process_gid_request(int sockfd, int msg_len)
 	}
 
 	/* Receive group name */
-	retval = read(sockfd, object_name, msg_len);
+	retval = recv_request_data(req, object_name, msg_len);
 	if (retval < msg_len )
 	{
 		SEC_SVR_DBG("%s", "Failed to read object name");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -662,7 +589,7 @@ int process_gid_request(int sockfd, int msg_len)
 	{
 		/* Not exist */
 		SEC_SVR_DBG("The object [%s] is not exist", object_name);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_NO_SUCH_OBJECT);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -676,7 +603,7 @@ int process_gid_request(int sockfd, int msg_len)
 	{
 		/* Error occurred */
 		SEC_SVR_DBG("Cannot send the response. %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -687,7 +614,7 @@ int process_gid_request(int sockfd, int msg_len)
 		goto error;
 	}
 	/* We found */
-	retval = send_gid(sockfd, retval);
+	retval = send_gid(req, retval);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("ERROR: Cannot gid response: %d", retval);
@@ -696,18 +623,18 @@ error:
 	return retval;
 }
 
-int process_pid_request(int sockfd)
+int process_pid_request(request_context *req)
 {
-	int retval, client_pid;
+	int retval, client_pid, found_pid = 0;
 	unsigned char requested_cookie[SECURITY_SERVER_COOKIE_LEN];
 	cookie_list *search_result = NULL;
 
 	/* Authenticate client */
-	retval = authenticate_client_middleware(sockfd, &client_pid);
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_PID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -717,11 +644,11 @@ int process_pid_request(int sockfd)
 		goto error;
 	}
 
-	retval = recv_pid_request(sockfd, requested_cookie);
+	retval = recv_pid_request(req, requested_cookie);
 	if(retval == SECURITY_SERVER_ERROR_RECV_FAILED)
 	{
 		SEC_SVR_DBG("%s", "Receiving request failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_PID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -732,15 +659,17 @@ int process_pid_request(int sockfd)
 	}
 
 	/* Search cookie list */
-	pthread_mutex_lock(&cookie_mutex);
+	stats_lock(&cookie_mutex);
 	search_result = search_cookie(c_list, requested_cookie, 0);
-	pthread_mutex_unlock(&cookie_mutex);
+	if(search_result != NULL)
+		found_pid = search_result->pid;
+	stats_unlock(&cookie_mutex);
 	if(search_result != NULL)
 	{
 		/* We found */
-		SEC_SVR_DBG("We found the cookie and pid:%d", search_result->pid);
+		SEC_SVR_DBG("We found the cookie and pid:%d", found_pid);
 		SEC_SVR_DBG("%s", "Cookie comparison succeeded. Access granted.");
-		retval = send_pid(sockfd, search_result->pid);
+		retval = send_pid(req, found_pid);
 
 		if(retval != SECURITY_SERVER_SUCCESS)
 		{
@@ -751,7 +680,7 @@ int process_pid_request(int sockfd)
 	{
 		/* It's not exist */
 		SEC_SVR_DBG("%s", "Could not find the cookie");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_PID_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_NO_SUCH_COOKIE);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -763,17 +692,88 @@ error:
 	return retval;
 }
 
-int process_tool_request(int client_sockfd, int server_sockfd)
+/* Cookie of a process the launcher has just spawned. The launcher is answered *
+ * first and the cookie is created after that, so neither the launcher nor the *
+ * application waits for /proc parsing. The application's own cookie request *
+ * finds it then. If this fails, that request creates it as before */
+int process_prepare_cookie_request(request_context *req)
+{
+	int retval, client_pid, pid;
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH + 16];
+	cookie_list *created_cookie;
+	struct stat statbuf;
+
+	/* Authenticate client */
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("%s", "Client Authentication Failed");
+		retval = send_generic_response(req,
+				SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+		}
+		goto error;
+	}
+
+	retval = recv_prepare_cookie_request(req, &pid);
+	if(retval != SECURITY_SERVER_SUCCESS || pid <= 0)
+	{
+		SEC_SVR_DBG("Receiving request failed: %d, pid=%d", retval, pid);
+		retval = send_generic_response(req,
+				SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+		}
+		goto error;
+	}
+
+	retval = send_generic_response(req,
+			SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+	}
+
+	/* Root processes get the default cookie. Directory of the process is *
+	 * owned by its effective UID, or by root if it's not dumpable */
+	snprintf(path, sizeof(path), "%s/%d", get_config()->proc_path, pid);
+	if(stat(path, &statbuf) != 0 || statbuf.st_uid == 0)
+	{
+		SEC_SVR_DBG("No cookie to prepare for PID %d", pid);
+		goto error;
+	}
+
+	stats_lock(&cookie_mutex);
+	created_cookie = create_cookie_item(pid, -1, c_list);
+	stats_unlock(&cookie_mutex);
+	if(created_cookie == NULL)
+	{
+		SEC_SVR_DBG("Cannot prepare a cookie for PID %d", pid);
+		goto error;
+	}
+	SEC_SVR_DBG("Cookie prepared for PID %d by launcher PID %d", pid, client_pid);
+
+error:
+	return retval;
+}
+
+int process_tool_request(request_context *req)
 {
 	int retval, argcnum;
 	char **recved_argv = NULL;
 
 	/* Authenticate client */
-	retval = authenticate_developer_shell(client_sockfd);
+	retval = authenticate_developer_shell(req->sockfd);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -785,11 +785,11 @@ int process_tool_request(int client_sockfd, int server_sockfd)
 
 	/* Receive Total number of argv */
 	argcnum = 0;
-	retval = read(client_sockfd, &argcnum, sizeof(int));
+	retval = recv_request_data(req, &argcnum, sizeof(int));
 	if(retval < sizeof(int))
 	{
 		SEC_SVR_DBG("Error: argc recieve failed: %d", retval);
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -803,7 +803,7 @@ int process_tool_request(int client_sockfd, int server_sockfd)
 	if(recved_argv == NULL)
 	{
 		SEC_SVR_DBG("Error: malloc() failed: %d", retval);
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -814,12 +814,12 @@ int process_tool_request(int client_sockfd, int server_sockfd)
 	}
 	memset(recved_argv, 0, sizeof(char *) * argcnum);
 
-	retval = recv_launch_tool_request(client_sockfd, argcnum -1, recved_argv);
+	retval = recv_launch_tool_request(req, argcnum -1, recved_argv);
 	if(retval == SECURITY_SERVER_ERROR_RECV_FAILED)
 	{
 		SEC_SVR_DBG("%s", "Receiving request failed");
 		recved_argv = NULL;
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -831,7 +831,7 @@ int process_tool_request(int client_sockfd, int server_sockfd)
 	if(argcnum < 2)
 	{
 		SEC_SVR_DBG("Error: Too small number of argv [%d]", argcnum);
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -841,11 +841,11 @@ int process_tool_request(int client_sockfd, int server_sockfd)
 		goto error;
 	}
 	/* Execute the command */
-	retval = execute_debug_tool(argcnum, recved_argv, server_sockfd, client_sockfd);
+	retval = execute_debug_tool(argcnum, recved_argv);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("Error: Cannot execute debug tool [%d]", retval);
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -856,7 +856,7 @@ int process_tool_request(int client_sockfd, int server_sockfd)
 	else
 	{
 		SEC_SVR_DBG("%s", "Tool has been executed");
-		retval = send_generic_response(client_sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SUCCESS);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -875,127 +875,334 @@ error:
 	return retval;
 }
 
-void *security_server_thread(void *param)
+/* Change log level of the daemon. Only root can do it */
+int process_log_level_request(request_context *req)
 {
-	int client_sockfd = -1, client_uid, client_pid;
-	int server_sockfd, retval, argcnum;
-	basic_header basic_hdr;
-	struct security_server_thread_param *my_param;
+	int retval, client_pid, client_uid = -1;
+	unsigned char level;
 
-	my_param = (struct security_server_thread_param *) param;
-	client_sockfd = my_param->client_sockfd;
-	server_sockfd = my_param->server_sockfd;
+	/* Authenticate client */
+	retval = authenticate_client_application(req->sockfd, &client_pid, &client_uid);
+	if(retval != SECURITY_SERVER_SUCCESS || client_uid != get_config()->privileged_uid)
+	{
+		SEC_SVR_DBG("Client Authentication Failed: %d, uid=%d", retval, client_uid);
+		retval = send_generic_response(req,
+				SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+		}
+		goto error;
+	}
 
-	/* Receive request header */
-	retval = recv_hdr(client_sockfd, &basic_hdr);
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT || retval == SECURITY_SERVER_ERROR_RECV_FAILED
-		|| retval == SECURITY_SERVER_ERROR_SOCKET)
+	retval = recv_request_data(req, &level, sizeof(level));
+	if(retval < (int)sizeof(level) || log_set_level(level) != SECURITY_SERVER_SUCCESS)
 	{
-		SEC_SVR_DBG("Receiving header error [%d]",retval);
-		close(client_sockfd);
-		client_sockfd = -1;
-		goto error;;
+		SEC_SVR_DBG("Bad log level request: %d", retval);
+		retval = send_generic_response(req,
+				SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+		}
+		goto error;
 	}
 
+	retval = send_generic_response(req,
+			SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
-		/* Response */
-		SEC_SVR_DBG("Receiving header error [%d]",retval);
-		retval = send_generic_response(client_sockfd,
+		SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+	}
+error:
+	return retval;
+}
+
+/* Hand the listening sockets and cookies to a new server process *
+ * Other workers are drained first, so no cookie is created after they are *
+ * sent. Only the server UID can take over
+ *
+ * Response is the number of cookies with the listening sockets passed by *
+ * SCM_RIGHTS, followed by a cookie record for each */
+int process_handoff_request(request_context *req)
+{
+	int retval, client_pid, client_uid = -1, count = 0, busy, waited, i;
+	int expected = HANDOFF_NONE;
+	unsigned char return_code = SECURITY_SERVER_RETURN_CODE_SERVER_ERROR;
+	cookie_snapshot *snapshot;
+	struct pollfd poll_fd;
+
+	/* Authenticate client */
+	retval = authenticate_client_application(req->sockfd, &client_pid, &client_uid);
+	if(retval != SECURITY_SERVER_SUCCESS || client_uid != get_config()->privileged_uid)
+	{
+		SEC_SVR_DBG("Client Authentication Failed: %d, uid=%d", retval, client_uid);
+		return_code = SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED;
+		goto error;
+	}
+	if(!__atomic_compare_exchange_n(&handoff_state, &expected, HANDOFF_DRAINING, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	{
+		SEC_SVR_DBG("%s", "Handoff is in progress already");
+		return_code = SECURITY_SERVER_RETURN_CODE_BUSY;
+		goto error;
+	}
+	SEC_SVR_DBG("Handing off to PID %d", client_pid);
+
+	/* Stop accepting, then wait for every worker but this one */
+	eventfd_write(slot_event_fd, 1);
+	for(waited = 0; ; waited += 10)
+	{
+		for(i = 0, busy = 0; i < SECURITY_SERVER_NUM_SOCK_CLASSES; i++)
+			busy += __atomic_load_n(&class_busy[i], __ATOMIC_ACQUIRE);
+		if(busy <= 1 && __atomic_load_n(&handoff_state, __ATOMIC_ACQUIRE) == HANDOFF_STOPPED)
+			break;
+		if(waited >= SECURITY_SERVER_HANDOFF_DRAIN_MILISECOND)
+		{
+			SEC_SVR_DBG("%d workers are still busy. Aborting handoff", busy - 1);
+			goto abort;
+		}
+		usleep(10000);
+	}
+
+	/* Send from a copy. The new process may be slow to read, and the *
+	 * reaper and shared-memory channels still look up cookies */
+	/* Default cookie is the first one, which the new process has */
+	stats_lock(&cookie_mutex);
+	snapshot = copy_cookies(c_list->next, 0x7fffffff);
+	stats_unlock(&cookie_mutex);
+	if(snapshot == NULL)
+		goto abort;
+
+	count = snapshot->num;
+	retval = send_response_fds(req, SECURITY_SERVER_MSG_TYPE_HANDOFF_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS, &count, sizeof(count),
+			listen_sockfd, SECURITY_SERVER_MAX_LISTENERS);
+	for(i = 0; retval == SECURITY_SERVER_SUCCESS && i < snapshot->num; i++)
+		retval = send_cookie_record(req->sockfd, &snapshot->entries[i]);
+	release_cookie_snapshot(snapshot);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Cannot send cookies: %d. Aborting handoff", retval);
+		goto abort;
+	}
+
+	SEC_SVR_DBG("%d cookies have been handed off", count);
+
+	/* The new process hangs up after reading the last record. Exiting before *
+	 * that would let its poll() see the hang up ahead of unread records */
+	poll_fd.fd = req->sockfd;
+	poll_fd.events = POLLIN;
+	while(poll(&poll_fd, 1, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND) < 0 && errno == EINTR);
+
+	__atomic_store_n(&handoff_state, HANDOFF_DONE, __ATOMIC_RELEASE);
+	eventfd_write(slot_event_fd, 1);
+	return SECURITY_SERVER_SUCCESS;
+
+abort:
+	/* Keep serving. The new process gives up */
+	__atomic_store_n(&handoff_state, HANDOFF_NONE, __ATOMIC_RELEASE);
+	eventfd_write(slot_event_fd, 1);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
+error:
+	retval = send_generic_response(req, SECURITY_SERVER_MSG_TYPE_HANDOFF_RESPONSE, return_code);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+	}
+	return retval;
+}
+
+/* Whether a message may come on a listener of the class. Middleware and *
+ * password sockets are open to everyone, so they take only their own *
+ * messages. The application socket takes everything, as it always has */
+static int msg_allowed_on_class(int sock_class, unsigned char msg_id)
+{
+	switch(sock_class)
+	{
+		case SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE:
+			switch(msg_id)
+			{
+				case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_PID_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_GET_STATS_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_HANDOFF_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_PID_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_COOKIE_REQUEST:
+					return 1;
+				default:
+					return 0;
+			}
+		case SECURITY_SERVER_SOCK_CLASS_PASSWORD:
+			switch(msg_id)
+			{
+				case SECURITY_SERVER_MSG_TYPE_VALID_PWD_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SET_PWD_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_RESET_PWD_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_CHK_PWD_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_REQUEST:
+				case SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_REQUEST:
+					return 1;
+				default:
+					return 0;
+			}
+		default:
+			return 1;
+	}
+}
+
+/* Process one request. Request header has been already received */
+int process_request(request_context *req)
+{
+	int retval = SECURITY_SERVER_SUCCESS, client_uid, client_pid;
+	unsigned long long start = stats_clock();
+
+	SEC_SVR_PROBE2(handler__start, req->msg_id, req->request_id);
+
+	/* Client has given up. Don't spend /proc reads and SMACK checks on it */
+	if(req->deadline != 0 && start >= req->deadline)
+	{
+		SEC_SVR_DBG("Request %d expired %llu us ago", req->msg_id, start - req->deadline);
+		stats_record(SECURITY_SERVER_STAT_EXPIRED, req->deadline);
+		return SECURITY_SERVER_ERROR_TIMEOUT;
+	}
+
+	if(!msg_allowed_on_class(req->sock_class, req->msg_id))
+	{
+		SEC_SVR_DBG("Msg ID %d is not served on class %d socket", req->msg_id, req->sock_class);
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
 		{
 			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
-			goto error;
 		}
-		safe_server_sock_close(client_sockfd);
-		client_sockfd = -1;
-		goto error;
+		goto out;
 	}
 
 	/* Act different for request message ID */
-	switch(basic_hdr.msg_id)
+	switch(req->msg_id)
 	{
 		case SECURITY_SERVER_MSG_TYPE_COOKIE_REQUEST:
 			SEC_SVR_DBG("%s", "Cookie request received");
-			process_cookie_request(client_sockfd);
+			process_cookie_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_REQUEST:
 			SEC_SVR_DBG("%s", "Privilege check received");
-			process_check_privilege_request(client_sockfd);
+			process_check_privilege_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_REQUEST:
 			SEC_SVR_DBG("%s", "Privilege check (new mode) received");
-			process_check_privilege_new_request(client_sockfd);
+			process_check_privilege_new_request(req);
+			break;
+
+		case SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_REQUEST:
+			SEC_SVR_DBG("%s", "Shared-memory channel request received");
+			process_shm_channel_request(req);
+			break;
+
+		case SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_REQUEST:
+			SEC_SVR_DBG("%s", "Revocation subscription received");
+			process_subscribe_revocation_request(req);
+			break;
+
+		case SECURITY_SERVER_MSG_TYPE_GET_STATS_REQUEST:
+			SEC_SVR_DBG("%s", "Stats request received");
+			process_stats_request(req);
+			break;
+
+		case SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_REQUEST:
+			SEC_SVR_DBG("%s", "Log level request received");
+			process_log_level_request(req);
+			break;
+
+		case SECURITY_SERVER_MSG_TYPE_HANDOFF_REQUEST:
+			SEC_SVR_DBG("%s", "Handoff request received");
+			process_handoff_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_REQUEST:
 			SEC_SVR_DBG("%s", "Get object name request received");
-			process_object_name_request(client_sockfd);
+			process_object_name_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_GID_REQUEST:
 			SEC_SVR_DBG("%s", "Get GID received");
-			process_gid_request(client_sockfd, (int)basic_hdr.msg_len);
+			process_gid_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_PID_REQUEST:
 			SEC_SVR_DBG("%s", "pid request received");
-			process_pid_request(client_sockfd);
+			process_pid_request(req);
+			break;
+
+		case SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_REQUEST:
+			SEC_SVR_DBG("%s", "prepare cookie request received");
+			process_prepare_cookie_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_TOOL_REQUEST:
 			SEC_SVR_DBG("%s", "launch tool request received");
-			process_tool_request(client_sockfd, server_sockfd);
+			process_tool_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_VALID_PWD_REQUEST:
 			SEC_SVR_DBG("%s", "Server: validate password request received");
-			process_valid_pwd_request(client_sockfd);
+			process_valid_pwd_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_SET_PWD_REQUEST:
 			SEC_SVR_DBG("%s", "Server: set password request received");
-			process_set_pwd_request(client_sockfd);
+			process_set_pwd_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_RESET_PWD_REQUEST:
 			SEC_SVR_DBG("%s", "Server: reset password request received");
-			process_reset_pwd_request(client_sockfd);
+			process_reset_pwd_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_CHK_PWD_REQUEST:
 			SEC_SVR_DBG("%s", "Server: check password request received");
-			process_chk_pwd_request(client_sockfd);
+			process_chk_pwd_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_REQUEST:
 			SEC_SVR_DBG("%s", "Server: set password histroy request received");
-			process_set_pwd_history_request(client_sockfd);
+			process_set_pwd_history_request(req);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_REQUEST:
 		    SEC_SVR_DBG("%s", "Server: set password max challenge request received");
-		    process_set_pwd_max_challenge_request(client_sockfd);
+		    process_set_pwd_max_challenge_request(req);
 		    break;
 
         case SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_REQUEST:
             SEC_SVR_DBG("%s", "Server: set password validity request received");
-            process_set_pwd_validity_request(client_sockfd);
+            process_set_pwd_validity_request(req);
             break;
 
 /************************************************************************************************/
 /* Just for test. This code must be removed on release */
 		case SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_REQUEST:
 			SEC_SVR_DBG("%s", "all cookie info request received -- NEED TO BE DELETED ON RELEASE");
-			retval = authenticate_client_application(client_sockfd, &client_pid, &client_uid);
+			retval = authenticate_client_application(req->sockfd, &client_pid, &client_uid);
 			if(retval != SECURITY_SERVER_SUCCESS)
 			{
 				SEC_SVR_DBG("%s", "Client Authentication Failed");
-				retval = send_generic_response(client_sockfd,
+				retval = send_generic_response(req,
 						SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 						SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 				if(retval != SECURITY_SERVER_SUCCESS)
@@ -1004,7 +1211,7 @@ void *security_server_thread(void *param)
 				}
 				break;
 			}
-			retval = util_process_all_cookie(client_sockfd, c_list);
+			retval = util_process_all_cookie(req, c_list);
 			if(retval != SECURITY_SERVER_SUCCESS)
 			{
 				SEC_SVR_DBG("ERROR: Cannot send all cookie info: %d", retval);
@@ -1016,7 +1223,7 @@ void *security_server_thread(void *param)
 			if(retval != SECURITY_SERVER_SUCCESS)
 			{
 				SEC_SVR_DBG("%s", "Client Authentication Failed");
-				retval = send_generic_response(client_sockfd,
+				retval = send_generic_response(req,
 						SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 						SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 				if(retval != SECURITY_SERVER_SUCCESS)
@@ -1025,7 +1232,7 @@ void *security_server_thread(void *param)
 				}
 				break;
 			}
-			util_process_cookie_from_pid(client_sockfd, c_list);
+			util_process_cookie_from_pid(req, c_list);
 			break;
 
 		case SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_COOKIE_REQUEST:
@@ -1033,7 +1240,7 @@ void *security_server_thread(void *param)
 			if(retval != SECURITY_SERVER_SUCCESS)
 			{
 				SEC_SVR_DBG("%s", "Client Authentication Failed");
-				retval = send_generic_response(client_sockfd,
+				retval = send_generic_response(req,
 						SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 						SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 				if(retval != SECURITY_SERVER_SUCCESS)
@@ -1042,15 +1249,15 @@ void *security_server_thread(void *param)
 				}
 				break;
 			}
-			util_process_cookie_from_cookie(client_sockfd, c_list);
+			util_process_cookie_from_cookie(req, c_list);
 			break;
 /************************************************************************************************/
 
 
 		default:
-			SEC_SVR_DBG("Unknown msg ID :%d", basic_hdr.msg_id);
+			SEC_SVR_DBG("Unknown msg ID :%d", req->msg_id);
 			/* Unknown message ID */
-			retval = send_generic_response(client_sockfd,
+			retval = send_generic_response(req,
 			SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -1060,56 +1267,685 @@ void *security_server_thread(void *param)
 			break;
 	}
 
-	if(client_sockfd > 0)
-	{
-		safe_server_sock_close(client_sockfd);
-		client_sockfd = -1;
-	}
-
-error:
-	if(client_sockfd > 0)
-		close(client_sockfd);
-	thread_status[my_param->thread_status] = 0;
-	pthread_detach(pthread_self());
-	pthread_exit(NULL);
+out:
+	stats_record_request(req->msg_id, start);
+	SEC_SVR_PROBE3(handler__end, req->msg_id, req->request_id, stats_clock() - start);
+	return retval;
 }
 
+/* v2 connection. Requests are read in order and processed by the shared
+ * pipeline pool, so a slow request does not hold the ones behind it.
+ * Responses may be sent out of order and are matched by the request ID */
+struct security_server_connection {
+	int sockfd;
+	int server_sockfd;
+	int in_flight;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	pthread_mutex_t send_mutex;
+};
 
+struct security_server_pipelined_request {
+	request_context req;
+	struct security_server_connection *conn;
+};
 
-int main(int argc, char* argv[])
+void free_pipelined_request(struct security_server_pipelined_request *preq)
 {
-	int server_sockfd = 0, retval, client_sockfd = -1, args[2], rc;
-	struct sigaction act, dummy;
-	pthread_t threads[SECURITY_SERVER_NUM_THREADS];
-	struct security_server_thread_param param[SECURITY_SERVER_NUM_THREADS];
+	struct security_server_connection *conn = preq->conn;
 
-	SEC_SVR_DBG("%s", "Starting Security Server");
+	if(preq->req.payload != NULL)
+		free(preq->req.payload);
+	free(preq);
 
-	/* security server must be executed by root */
-	if(getuid() != 0)
-	{
-		fprintf(stderr, "%s\n", "You are not root. exiting...");
+	pthread_mutex_lock(&conn->mutex);
+	conn->in_flight--;
+	pthread_cond_signal(&conn->cond);
+	pthread_mutex_unlock(&conn->mutex);
+}
+
+/* Pipeline pool. A fixed number of threads serve the requests of every v2 *
+ * connection from one bounded queue. The connection thread serves a *
+ * request by itself when the queue is full */
+static struct security_server_pipelined_request *pipeline_queue[SECURITY_SERVER_PIPELINE_QUEUE];
+static int pipeline_head, pipeline_count;
+static pthread_mutex_t pipeline_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pipeline_cond = PTHREAD_COND_INITIALIZER;
+static int pipeline_threads;
+
+void *security_server_request_thread(void *param)
+{
+	struct security_server_pipelined_request *preq;
+
+	while(1)
+	{
+		pthread_mutex_lock(&pipeline_mutex);
+		while(pipeline_count == 0)
+			pthread_cond_wait(&pipeline_cond, &pipeline_mutex);
+		preq = pipeline_queue[pipeline_head];
+		pipeline_head = (pipeline_head + 1) % SECURITY_SERVER_PIPELINE_QUEUE;
+		pipeline_count--;
+		pthread_mutex_unlock(&pipeline_mutex);
+
+		process_request(&preq->req);
+		free_pipelined_request(preq);
+	}
+	return NULL;
+}
+
+void pipeline_init(void)
+{
+	pthread_t worker;
+	int i;
+
+	for(i = 0; i < SECURITY_SERVER_PIPELINE_THREADS; i++)
+	{
+		if(pthread_create(&worker, NULL, security_server_request_thread, NULL) != 0)
+		{
+			SEC_SVR_DBG("Cannot create pipeline thread %d", i);
+			break;
+		}
+		pthread_detach(worker);
+	}
+	pipeline_threads = i;
+}
+
+/* Returns SECURITY_SERVER_ERROR_SERVER_BUSY if the queue is full */
+int pipeline_submit(struct security_server_pipelined_request *preq)
+{
+	int retval = SECURITY_SERVER_ERROR_SERVER_BUSY;
+
+	pthread_mutex_lock(&pipeline_mutex);
+	if(pipeline_threads > 0 && pipeline_count < SECURITY_SERVER_PIPELINE_QUEUE)
+	{
+		pipeline_queue[(pipeline_head + pipeline_count) % SECURITY_SERVER_PIPELINE_QUEUE] = preq;
+		pipeline_count++;
+		pthread_cond_signal(&pipeline_cond);
+		retval = SECURITY_SERVER_SUCCESS;
+	}
+	pthread_mutex_unlock(&pipeline_mutex);
+	return retval;
+}
+
+/* Serve requests while they come. Returns SECURITY_SERVER_ERROR_TIMEOUT *
+ * when the connection is idle with every response sent */
+int process_pipelined_requests(recv_buffer *rbuf, int server_sockfd, int sock_class,
+		basic_header *basic_hdr)
+{
+	struct security_server_connection conn;
+	struct security_server_pipelined_request *preq;
+	basic_header_v2 hdr;
+	unsigned long long deadline = 0;
+	int retval, client_sockfd = rbuf->sockfd, idle = 0;
+
+	conn.sockfd = client_sockfd;
+	conn.server_sockfd = server_sockfd;
+	conn.in_flight = 0;
+	pthread_mutex_init(&conn.mutex, NULL);
+	pthread_cond_init(&conn.cond, NULL);
+	pthread_mutex_init(&conn.send_mutex, NULL);
+
+	while(1)
+	{
+		retval = recv_hdr_v2(rbuf, basic_hdr, &hdr);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("Receiving v2 header error [%d]", retval);
+			break;
+		}
+		SEC_SVR_PROBE5(request__header, client_sockfd, hdr.version, hdr.msg_id,
+				hdr.request_id, hdr.msg_len);
+
+		preq = malloc(sizeof(struct security_server_pipelined_request));
+		if(preq == NULL)
+		{
+			SEC_SVR_DBG("%s", "Out of memory");
+			retval = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+			break;
+		}
+		memset(preq, 0, sizeof(struct security_server_pipelined_request));
+		preq->conn = &conn;
+		preq->req.sockfd = client_sockfd;
+		preq->req.server_sockfd = server_sockfd;
+		preq->req.sock_class = sock_class;
+		preq->req.version = hdr.version;
+		preq->req.msg_id = hdr.msg_id;
+		preq->req.request_id = hdr.request_id;
+		preq->req.msg_len = hdr.msg_len;
+		preq->req.send_mutex = &conn.send_mutex;
+
+		/* Whole body is read here, so the next header can be read right away */
+		if(hdr.msg_len > 0)
+		{
+			preq->req.payload = malloc(hdr.msg_len);
+			if(preq->req.payload == NULL)
+			{
+				SEC_SVR_DBG("%s", "Out of memory");
+				free(preq);
+				retval = SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+				break;
+			}
+			retval = recv_buffered(rbuf, preq->req.payload, hdr.msg_len);
+			if(retval < (int)hdr.msg_len)
+			{
+				SEC_SVR_DBG("Receiving request body error [%d]", retval);
+				free(preq->req.payload);
+				free(preq);
+				break;
+			}
+		}
+
+		/* Deadline applies to the request that follows */
+		if(hdr.msg_id == SECURITY_SERVER_MSG_TYPE_DEADLINE)
+		{
+			retval = recv_deadline(&preq->req, &deadline);
+			free(preq->req.payload);
+			free(preq);
+			if(retval != SECURITY_SERVER_SUCCESS)
+				break;
+			goto next;
+		}
+		preq->req.deadline = deadline;
+		deadline = 0;
+
+		/* Limit requests in flight on this connection */
+		pthread_mutex_lock(&conn.mutex);
+		while(conn.in_flight >= SECURITY_SERVER_MAX_PIPELINED_REQUESTS)
+			pthread_cond_wait(&conn.cond, &conn.mutex);
+		conn.in_flight++;
+		pthread_mutex_unlock(&conn.mutex);
+
+		if(pipeline_submit(preq) != SECURITY_SERVER_SUCCESS)
+		{
+			/* Pool is full. Serve it here */
+			process_request(&preq->req);
+			free_pipelined_request(preq);
+		}
+
+next:
+		/* Go idle unless next request has been already received */
+		if(rbuf->seqpacket || rbuf->start == rbuf->end)
+		{
+			retval = check_socket_poll(client_sockfd, POLLIN, 0);
+			if(retval != SECURITY_SERVER_SUCCESS)
+			{
+				idle = (retval == SECURITY_SERVER_ERROR_TIMEOUT);
+				break;
+			}
+		}
+		retval = recv_hdr(rbuf, basic_hdr);
+		if(retval != SECURITY_SERVER_SUCCESS || basic_hdr->version != SECURITY_SERVER_MSG_VERSION_2)
+		{
+			SEC_SVR_DBG("Receiving header error [%d]", retval);
+			break;
+		}
+	}
+
+	/* Workers still write to the socket. Wait for them before closing */
+	pthread_mutex_lock(&conn.mutex);
+	while(conn.in_flight > 0)
+		pthread_cond_wait(&conn.cond, &conn.mutex);
+	pthread_mutex_unlock(&conn.mutex);
+
+	pthread_mutex_destroy(&conn.send_mutex);
+	pthread_cond_destroy(&conn.cond);
+	pthread_mutex_destroy(&conn.mutex);
+	if(idle)
+		return SECURITY_SERVER_ERROR_TIMEOUT;
+	return retval == SECURITY_SERVER_ERROR_TIMEOUT ? SECURITY_SERVER_ERROR_RECV_FAILED : retval;
+}
+
+/* Reap cookies of exited processes while middleware is subscribed to *
+ * revocations, so their events don't wait for the next lookup */
+void *security_server_reaper_thread(void *param)
+{
+	while(1)
+	{
+		revoke_wait_subscribers(SECURITY_SERVER_REAPER_MILISECOND);
+		stats_lock(&cookie_mutex);
+		reap_cookies(c_list);
+		stats_unlock(&cookie_mutex);
+	}
+	return NULL;
+}
+
+void *security_server_thread(void *param)
+{
+	int client_sockfd = -1;
+	int server_sockfd, retval;
+	basic_header basic_hdr;
+	request_context req;
+	recv_buffer rbuf;
+	struct security_server_thread_param *my_param;
+	parked_conn parked;
+	int slot, sock_class;
+
+	my_param = (struct security_server_thread_param *) param;
+	slot = my_param->thread_status;
+	sock_class = my_param->sock_class;
+	client_sockfd = my_param->client_sockfd;
+	server_sockfd = my_param->server_sockfd;
+
+	init_recv_buffer(&rbuf, client_sockfd, my_param->sock_type);
+	memset(&req, 0, sizeof(req));
+	req.sockfd = client_sockfd;
+	req.rbuf = &rbuf;
+	req.server_sockfd = server_sockfd;
+	req.sock_class = sock_class;
+	req.version = SECURITY_SERVER_MSG_VERSION;
+
+	/* Receive request header. Deadline of the request may come first */
+	retval = recv_hdr(&rbuf, &basic_hdr);
+	if(retval == SECURITY_SERVER_SUCCESS && basic_hdr.version == SECURITY_SERVER_MSG_VERSION
+			&& basic_hdr.msg_id == SECURITY_SERVER_MSG_TYPE_DEADLINE)
+	{
+		req.msg_len = basic_hdr.msg_len;
+		retval = recv_deadline(&req, &req.deadline);
+		if(retval == SECURITY_SERVER_SUCCESS)
+			retval = recv_hdr(&rbuf, &basic_hdr);
+	}
+	if(retval == SECURITY_SERVER_ERROR_TIMEOUT || retval == SECURITY_SERVER_ERROR_RECV_FAILED
+		|| retval == SECURITY_SERVER_ERROR_SOCKET)
+	{
+		SEC_SVR_DBG("Receiving header error [%d]",retval);
+		close(client_sockfd);
+		client_sockfd = -1;
+		goto error;;
+	}
+
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Response */
+		SEC_SVR_DBG("Receiving header error [%d]",retval);
+		retval = send_generic_response(&req,
+				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+			goto error;
+		}
+		linger_close(client_sockfd);
+		client_sockfd = -1;
 		goto error;
 	}
 
-	for(retval = 0 ; retval < SECURITY_SERVER_NUM_THREADS; retval++)
-		thread_status[retval] = 0;
-	int initiate_try();
+	if(basic_hdr.version == SECURITY_SERVER_MSG_VERSION_2)
+	{
+		while(process_pipelined_requests(&rbuf, server_sockfd, sock_class, &basic_hdr) == SECURITY_SERVER_ERROR_TIMEOUT)
+		{
+			/* Idle connection waits in the accept loop, not in a worker */
+			parked.sockfd = client_sockfd;
+			parked.server_sockfd = server_sockfd;
+			parked.sock_type = my_param->sock_type;
+			parked.sock_class = sock_class;
+			if(linger_park(&parked) == SECURITY_SERVER_SUCCESS)
+			{
+				client_sockfd = -1;
+				goto error;
+			}
+			if(check_socket_poll(client_sockfd, POLLIN, SECURITY_SERVER_IDLE_TIMEOUT_MILISECOND)
+					!= SECURITY_SERVER_SUCCESS
+					|| recv_hdr(&rbuf, &basic_hdr) != SECURITY_SERVER_SUCCESS
+					|| basic_hdr.version != SECURITY_SERVER_MSG_VERSION_2)
+				break;
+		}
+	}
+	else
+	{
+		req.msg_id = basic_hdr.msg_id;
+		req.msg_len = basic_hdr.msg_len;
+		SEC_SVR_PROBE5(request__header, client_sockfd, basic_hdr.version, basic_hdr.msg_id,
+				0, basic_hdr.msg_len);
+		process_request(&req);
+
+		/* Channel keeps the connection. Don't wait for the client to close it */
+		if(req.msg_id == SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_REQUEST)
+		{
+			close(client_sockfd);
+			client_sockfd = -1;
+		}
+	}
+
+	if(client_sockfd > 0)
+	{
+		linger_close(client_sockfd);
+		client_sockfd = -1;
+	}
+
+error:
+	if(client_sockfd > 0)
+		close(client_sockfd);
+	/* Releases my_param to the accept loop */
+	__atomic_store_n(&thread_status[slot], 0, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&class_busy[sock_class], 1, __ATOMIC_RELEASE);
+	if(slot_event_fd >= 0)
+		eventfd_write(slot_event_fd, 1);
+	pthread_detach(pthread_self());
+	pthread_exit(NULL);
+}
+
+
+
+/* Answer busy without reading the request, so it's safe to retry. The *
+ * response is a few bytes on a fresh socket, so it never blocks */
+static void shed_conn(int client_sockfd, unsigned long long accepted)
+{
+	response_header hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.basic_hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE;
+	hdr.basic_hdr.msg_len = 0;
+	hdr.return_code = SECURITY_SERVER_RETURN_CODE_BUSY;
+	if(send(client_sockfd, &hdr, sizeof(hdr), MSG_DONTWAIT | MSG_NOSIGNAL) != sizeof(hdr))
+	{
+		SEC_SVR_DBG("Cannot send busy response: %d", errno);
+	}
+	stats_record(SECURITY_SERVER_STAT_SHED, accepted);
+	linger_close(client_sockfd);
+}
+
+/* Start a worker in a free slot of the class. Caller has checked there is one */
+static void start_worker(int client_sockfd, int server_sockfd, int sock_type, int sock_class,
+		unsigned long long accepted)
+{
+	int slot, rc;
+
+	slot = class_first_slot[sock_class];
+	while(__atomic_load_n(&thread_status[slot], __ATOMIC_ACQUIRE) != 0)
+	{
+		slot++;
+		if(slot >= class_first_slot[sock_class] + class_threads[sock_class])
+			slot = class_first_slot[sock_class];
+	}
+	thread_status[slot] = 1;
+	__atomic_add_fetch(&class_busy[sock_class], 1, __ATOMIC_RELAXED);
+	param[slot].client_sockfd = client_sockfd;
+	param[slot].server_sockfd = server_sockfd;
+	param[slot].sock_type = sock_type;
+	param[slot].sock_class = sock_class;
+	param[slot].thread_status = slot;
+	SEC_SVR_DBG("Server: Creating a new thread: %d", slot);
+	rc = pthread_create(&threads[slot], NULL, security_server_thread, (void *)&param[slot]);
+	if(rc)
+	{
+		SEC_SVR_DBG("Error: Server: Cannot create thread:%d", rc);
+		thread_status[slot] = 0;
+		__atomic_sub_fetch(&class_busy[sock_class], 1, __ATOMIC_RELAXED);
+		shed_conn(client_sockfd, accepted);
+		return;
+	}
+	stats_record(SECURITY_SERVER_STAT_THREAD_SLOT, accepted);
+}
 
-	/* Create and bind a Unix domain socket */
-	retval = create_new_socket(&server_sockfd);
+/* Wake the accept loop when the oldest queued connection expires */
+static void arm_queue_timer(void)
+{
+	struct itimerspec its;
+	unsigned long long deadline = 0, head_deadline;
+	int i;
+
+	for(i = 0; i < SECURITY_SERVER_NUM_SOCK_CLASSES; i++)
+	{
+		if(queues[i].count == 0)
+			continue;
+		head_deadline = queues[i].conns[queues[i].head].accepted
+			+ SECURITY_SERVER_QUEUE_TIMEOUT_MILISECOND * 1000ULL;
+		if(deadline == 0 || head_deadline < deadline)
+			deadline = head_deadline;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = deadline / 1000000ULL;
+	its.it_value.tv_nsec = (deadline % 1000000ULL) * 1000;
+	timerfd_settime(queue_timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void enqueue_conn(int sock_class, int client_sockfd, int server_sockfd, int sock_type,
+		unsigned long long accepted)
+{
+	pending_queue *queue = &queues[sock_class];
+	pending_conn *conn;
+
+	conn = &queue->conns[(queue->head + queue->count) % SECURITY_SERVER_MAX_QUEUE];
+	conn->client_sockfd = client_sockfd;
+	conn->server_sockfd = server_sockfd;
+	conn->sock_type = sock_type;
+	conn->accepted = accepted;
+	queue->count++;
+	if(queue->count == 1)
+		arm_queue_timer();
+}
+
+/* Hand queued connections to workers that became free, and shed the ones *
+ * that waited too long. The client gives up after *
+ * SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND anyway, or at the deadline it *
+ * sent, and then the connection is just closed */
+static void dispatch_queued(void)
+{
+	pending_queue *queue;
+	pending_conn *conn;
+	unsigned long long now, deadline;
+	int i, waiting = 0;
+
+	now = stats_clock();
+	for(i = 0; i < SECURITY_SERVER_NUM_SOCK_CLASSES; i++)
+	{
+		queue = &queues[i];
+		while(queue->count > 0)
+		{
+			conn = &queue->conns[queue->head];
+			if(now - conn->accepted >= SECURITY_SERVER_QUEUE_TIMEOUT_MILISECOND * 1000ULL
+					|| __atomic_load_n(&handoff_state, __ATOMIC_ACQUIRE) != HANDOFF_NONE)
+			{
+				/* Retried on the new server while handing off */
+				SEC_SVR_DBG("Connection %d waited too long", conn->client_sockfd);
+				shed_conn(conn->client_sockfd, conn->accepted);
+			}
+			else if(peek_deadline(conn->client_sockfd, &deadline) == SECURITY_SERVER_SUCCESS
+					&& now >= deadline)
+			{
+				/* Nobody waits for the answer any more */
+				SEC_SVR_DBG("Connection %d expired in queue", conn->client_sockfd);
+				stats_record(SECURITY_SERVER_STAT_EXPIRED, deadline);
+				close(conn->client_sockfd);
+			}
+			else if(__atomic_load_n(&class_busy[i], __ATOMIC_ACQUIRE) < class_threads[i])
+				start_worker(conn->client_sockfd, conn->server_sockfd, conn->sock_type, i, conn->accepted);
+			else
+				break;
+			queue->head = (queue->head + 1) % SECURITY_SERVER_MAX_QUEUE;
+			queue->count--;
+		}
+		waiting += queue->count;
+	}
+	if(waiting > 0)
+		arm_queue_timer();
+}
+
+/* Admission of a connection with a request to read. Queued connections go *
+ * first */
+static void admit_conn(int client_sockfd, int server_sockfd, int sock_type, int sock_class,
+		unsigned long long accepted)
+{
+	if(queues[sock_class].count == 0
+			&& __atomic_load_n(&class_busy[sock_class], __ATOMIC_ACQUIRE) < class_threads[sock_class])
+	{
+		start_worker(client_sockfd, server_sockfd, sock_type, sock_class, accepted);
+	}
+	else if(queues[sock_class].count < class_queue[sock_class])
+	{
+		enqueue_conn(sock_class, client_sockfd, server_sockfd, sock_type, accepted);
+	}
+	else
+	{
+		SEC_SVR_DBG("Class %d queue is full", sock_class);
+		shed_conn(client_sockfd, accepted);
+	}
+}
+
+/* Take over the listening sockets and cookies of the running server *
+ * Returns SECURITY_SERVER_ERROR_SOCKET if there is no server to take over. *
+ * Passed sockets are stored to fds */
+static int receive_handoff(int *fds, int *num_fds)
+{
+	response_header hdr;
+	recv_buffer rbuf;
+	cookie_list *cookie;
+	int sockfd = -1, retval, count = 0, restored = 0, i;
+
+	*num_fds = 0;
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE, SOCK_STREAM);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
-		SEC_SVR_DBG("%s", "cannot create socket. exiting...");
+		SEC_SVR_DBG("No server to take over: %d", retval);
+		return SECURITY_SERVER_ERROR_SOCKET;
+	}
+
+	retval = send_handoff_request(sockfd);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Send failed: %d", retval);
+		goto error;
+	}
+	retval = recv_response_fds(sockfd, &hdr, &count, sizeof(count), fds, num_fds);
+	if(retval < 0)
+		goto error;
+	retval = return_code_to_error_code(hdr.return_code);
+	if(hdr.basic_hdr.msg_id != SECURITY_SERVER_MSG_TYPE_HANDOFF_RESPONSE)
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Handoff refused: %d", retval);
+		goto error;
+	}
+
+	/* The old server doesn't create cookies any more, so they're all here, *
+	 * and replace the ones it has stored */
+	cookie_store_reset();
+	init_recv_buffer(&rbuf, sockfd, SOCK_STREAM);
+	for(i = 0; i < count; i++)
+	{
+		retval = recv_cookie_record(&rbuf, &cookie);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("Cannot receive cookie %d of %d: %d", i, count, retval);
+			goto error;
+		}
+		if(restore_cookie_item(cookie, c_list) != NULL)
+			restored++;
+	}
+	SEC_SVR_DBG("Took over %d sockets and %d of %d cookies", *num_fds, restored, count);
+	retval = SECURITY_SERVER_SUCCESS;
+
+error:
+	close(sockfd);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		for(i = 0; i < *num_fds; i++)
+			close(fds[i]);
+		*num_fds = 0;
+	}
+	return retval;
+}
+
+int main(int argc, char* argv[])
+{
+	int server_socktype[SECURITY_SERVER_MAX_LISTENERS];
+	int server_class[SECURITY_SERVER_MAX_LISTENERS];
+	int retval, client_sockfd = -1, args[2], listener = 0, i, signal_fd = -1;
+	int listen_fds[SECURITY_SERVER_MAX_LISTEN_FDS], num_listen_fds, opt, upgrade = 0, handoff;
+	int handed_off = 0, num_ready;
+	parked_conn ready[SECURITY_SERVER_NUM_THREADS];
+	pthread_t reaper;
+	eventfd_t slot_events;
+	int event_fds[SECURITY_SERVER_MAX_EVENT_FDS], num_event_fds = 0;
+	unsigned long long expirations;
+	struct sigaction act, dummy;
+	sigset_t sigchld_mask;
+
+	SEC_SVR_DBG("%s", "Starting Security Server");
+
+	/* Stream and message boundary preserving transport for each class */
+	for(i = 0; i < SECURITY_SERVER_MAX_LISTENERS; i++)
+	{
+		listen_sockfd[i] = -1;
+		server_class[i] = i / 2;
+		server_socktype[i] = (i % 2) ? SOCK_SEQPACKET : SOCK_STREAM;
+	}
+
+	/* Paths and privileged UID can be changed for testing. With -u, the *
+	 * running server hands over its sockets and cookies */
+	while((opt = getopt(argc, argv, "c:u")) != -1)
+	{
+		switch(opt)
+		{
+			case 'c':
+				if(load_config(optarg) != SECURITY_SERVER_SUCCESS)
+				{
+					fprintf(stderr, "Cannot load config %s. exiting...\n", optarg);
+					goto error;
+				}
+				break;
+			case 'u':
+				upgrade = 1;
+				break;
+			default:
+				goto usage;
+		}
+	}
+	if(optind != argc)
+	{
+usage:
+		fprintf(stderr, "Usage: %s [-c config file] [-u]\n", argv[0]);
 		goto error;
 	}
 
-	if(listen(server_sockfd, 5) < 0)
+	/* security server must be executed by root */
+	if(getuid() != get_config()->privileged_uid)
 	{
-		SEC_SVR_DBG("%s", "listen() failed. exiting...");
+		fprintf(stderr, "%s\n", "You are not root. exiting...");
 		goto error;
 	}
 
+	/* Block SIGCHLD before any thread is created, so every thread inherits *
+	 * the mask and children are reaped only through signal_fd */
+	sigemptyset(&sigchld_mask);
+	sigaddset(&sigchld_mask, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &sigchld_mask, NULL);
+	signal_fd = signalfd(-1, &sigchld_mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(signal_fd < 0)
+	{
+		SEC_SVR_DBG("signalfd() failed: %d. Children are reaped by kernel", errno);
+		pthread_sigmask(SIG_UNBLOCK, &sigchld_mask, NULL);
+		memset(&act, 0, sizeof(act));
+		act.sa_handler = SIG_IGN;
+		sigemptyset(&act.sa_mask);
+		act.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT;
+		if(sigaction(SIGCHLD, &act, &dummy) < 0)
+		{
+			SEC_SVR_DBG("%s", "cannot change session");
+		}
+	}
+
+	/* Logging is synchronous until this succeeds */
+	retval = log_init();
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("Cannot start logger thread: %d", retval);
+	}
+
+	for(retval = 0 ; retval < SECURITY_SERVER_NUM_THREADS; retval++)
+		thread_status[retval] = 0;
+	for(i = 0, retval = 0; i < SECURITY_SERVER_NUM_SOCK_CLASSES; i++)
+	{
+		class_busy[i] = 0;
+		queues[i].head = queues[i].count = 0;
+		class_first_slot[i] = retval;
+		retval += class_threads[i];
+	}
+	int initiate_try();
+
 	/* Create a default cookie --> Cookie for root process */
 	c_list = create_default_cookie();
 	if(c_list == NULL)
@@ -1118,57 +1954,152 @@ int main(int argc, char* argv[])
 		goto error;
 	}
 
-	/* Init signal handler */
-	act.sa_handler = NULL;
-	act.sa_sigaction = security_server_sig_child;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_NOCLDSTOP | SA_SIGINFO;
+	pthread_mutex_init(&cookie_mutex, NULL);
 
-	if (sigaction(SIGCHLD, &act, &dummy) < 0)
+	/* Cookies survive a crash in the store, if there is one */
+	if(get_config()->cookie_store_path[0] != 0
+			&& cookie_store_open(get_config()->cookie_store_path) != SECURITY_SERVER_SUCCESS)
 	{
-		SEC_SVR_DBG("%s", "cannot change session");
+		SEC_SVR_DBG("%s", "Cannot open cookie store. Cookies are in memory only");
 	}
 
-	pthread_mutex_init(&cookie_mutex, NULL);
+	/* Sockets come from the init system, or from the server we replace */
+	num_listen_fds = get_listen_fds(listen_fds, SECURITY_SERVER_MAX_LISTEN_FDS);
+	if(upgrade && num_listen_fds == 0)
+	{
+		retval = receive_handoff(listen_fds, &num_listen_fds);
+		if(retval != SECURITY_SERVER_SUCCESS && retval != SECURITY_SERVER_ERROR_SOCKET)
+		{
+			SEC_SVR_DBG("Handoff failed: %d. exiting...", retval);
+			goto error;
+		}
+		handed_off = (retval == SECURITY_SERVER_SUCCESS);
+	}
+	if(!handed_off)
+		cookie_store_load(c_list);
+
+	/* Sleeps until someone subscribes. Without it, revocations come *
+	 * from lookups only */
+	if(pthread_create(&reaper, NULL, security_server_reaper_thread, NULL) != 0)
+	{
+		SEC_SVR_DBG("%s", "Cannot create reaper thread");
+	}
+	else
+		pthread_detach(reaper);
+	pipeline_init();
+
+	/* Create and bind Unix domain sockets. Ones passed to us are used as *
+	 * they are, with the connections queued on them */
+	for(i = 0; i < SECURITY_SERVER_MAX_LISTENERS; i++)
+	{
+		retval = adopt_server_socket(&listen_sockfd[i], listen_fds, num_listen_fds,
+				get_sock_path(server_class[i], server_socktype[i]), server_socktype[i]);
+		if(retval != SECURITY_SERVER_SUCCESS)
+			retval = create_server_socket(&listen_sockfd[i],
+					get_sock_path(server_class[i], server_socktype[i]), server_socktype[i]);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("cannot create socket %s. exiting...",
+					get_sock_path(server_class[i], server_socktype[i]));
+			goto error;
+		}
+		if(listen(listen_sockfd[i], class_backlog[server_class[i]]) < 0)
+		{
+			SEC_SVR_DBG("%s", "listen() failed. exiting...");
+			goto error;
+		}
+	}
+	for(i = 0; i < num_listen_fds; i++)
+	{
+		if(listen_fds[i] >= 0)
+		{
+			SEC_SVR_DBG("Passed socket %d is not ours. Closing", listen_fds[i]);
+			close(listen_fds[i]);
+		}
+	}
+
+	if(signal_fd >= 0)
+		event_fds[num_event_fds++] = signal_fd;
+	/* Workers fall back to closing by themselves without it */
+	if(linger_init(&event_fds[num_event_fds]) == SECURITY_SERVER_SUCCESS)
+		num_event_fds++;
+	slot_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(slot_event_fd < 0)
+	{
+		SEC_SVR_DBG("%s", "eventfd() failed. exiting...");
+		goto error;
+	}
+	event_fds[num_event_fds++] = slot_event_fd;
+	queue_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(queue_timer_fd < 0)
+	{
+		SEC_SVR_DBG("%s", "timerfd_create() failed. exiting...");
+		goto error;
+	}
+	event_fds[num_event_fds++] = queue_timer_fd;
 
 	while(1)
 	{
-		/* Accept a new client */
-		if(client_sockfd < 0)
-			client_sockfd = accept_client(server_sockfd);
+		/* Accept a new client. Connections are left to the new server *
+		 * while handing off */
+		client_sockfd = accept_client(listen_sockfd,
+				__atomic_load_n(&handoff_state, __ATOMIC_ACQUIRE) == HANDOFF_NONE
+				? SECURITY_SERVER_MAX_LISTENERS : 0,
+				event_fds, num_event_fds, &listener);
+		if(signal_fd >= 0)
+			reap_children(signal_fd);
+		num_ready = linger_process(ready, SECURITY_SERVER_NUM_THREADS);
+		eventfd_read(slot_event_fd, &slot_events);
+		while(read(queue_timer_fd, &expirations, sizeof(expirations)) > 0);
+		dispatch_queued();
+
+		/* Workers started so far are seen by the handoff once it's stopped */
+		handoff = HANDOFF_DRAINING;
+		__atomic_compare_exchange_n(&handoff_state, &handoff, HANDOFF_STOPPED, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		if(handoff == HANDOFF_DONE)
+		{
+			SEC_SVR_DBG("%s", "Handed off. exiting...");
+			exit(0);
+		}
+
+		/* Parked connections with their next request */
+		for(i = 0; i < num_ready; i++)
+		{
+			if(handoff != HANDOFF_NONE)
+				shed_conn(ready[i].sockfd, stats_clock());
+			else
+				admit_conn(ready[i].sockfd, ready[i].server_sockfd, ready[i].sock_type,
+						ready[i].sock_class, stats_clock());
+		}
 
 		if(client_sockfd == SECURITY_SERVER_ERROR_TIMEOUT)
 			continue;
 		if(client_sockfd < 0)
 			goto error;
-		SEC_SVR_DBG("Server: new connection has been accepted: %d", client_sockfd);
-		retval = 0;
-		while(1)
+		if(handoff != HANDOFF_NONE)
 		{
-			if(thread_status[retval] == 0)
-			{
-				thread_status[retval] = 1;
-				param[retval].client_sockfd = client_sockfd;
-				param[retval].server_sockfd = server_sockfd;
-				param[retval].thread_status= retval;
-				SEC_SVR_DBG("Server: Creating a new thread: %d", retval);
-				rc =pthread_create(&threads[retval], NULL, security_server_thread, (void *)&param[retval]);
-				if (rc)
-				{
-					SEC_SVR_DBG("Error: Server: Cannot create thread:%d", rc);
-					goto error;
-				}
-				break;
-			}
-			retval++;
-			if(retval >= SECURITY_SERVER_NUM_THREADS)
-				retval = 0;
+			/* Accepted just before the handoff. Retried on the new server */
+			shed_conn(client_sockfd, stats_clock());
+			continue;
 		}
-		client_sockfd = -1;
+		SEC_SVR_DBG("Server: new connection has been accepted: %d", client_sockfd);
+		SEC_SVR_PROBE2(request__accept, client_sockfd, listener);
+		admit_conn(client_sockfd, listen_sockfd[listener], server_socktype[listener],
+				server_class[listener], stats_clock());
 	}
 error:
-	if(server_sockfd > 0)
-		close(server_sockfd);
+	for(i = 0; i < SECURITY_SERVER_MAX_LISTENERS; i++)
+	{
+		if(listen_sockfd[i] > 0)
+			close(listen_sockfd[i]);
+	}
+	if(signal_fd >= 0)
+		close(signal_fd);
+	if(slot_event_fd >= 0)
+		close(slot_event_fd);
+	if(queue_timer_fd >= 0)
+		close(queue_timer_fd);
 	pthread_exit(NULL);
 	return 0;
 }
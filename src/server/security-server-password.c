@@ -30,6 +30,8 @@
 #include <openssl/sha.h>
 
 #include "security-server-password.h"
+#include "security-server-probes.h"
+#include "security-server-config.h"
 
 struct timeval prev_try;
 
@@ -70,12 +72,24 @@ int dir_filter(const struct dirent *entry)
 		return (1);
 }
 
+/* Path of a file in the password data directory. The directory is *
+ * configurable, so the path may not fit in the 255 bytes */
+static int data_file_path(char *path, const char *name)
+{
+	if(snprintf(path, 255, "%s/%s", get_config()->data_directory_path, name) >= 255)
+	{
+		SEC_SVR_DBG("Server ERROR: Path of %s is too long", name);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
 int get_pwd_path(char *path)
 {
 	int retval;
 	struct dirent **mydirent;
 	int num;
-	num = scandir(SECURITY_SERVER_DATA_DIRECTORY_PATH, &mydirent, &dir_filter, alphasort);
+	num = scandir(get_config()->data_directory_path, &mydirent, &dir_filter, alphasort);
 	if(num < 0)
 	{
 		SEC_SVR_DBG("Server: [Error] Cannot scan password directory. errno: %d", errno);
@@ -87,7 +101,14 @@ int get_pwd_path(char *path)
 		return SECURITY_SERVER_ERROR_NO_PASSWORD;
 	}
 
-	snprintf(path, 255, "%s/%s", SECURITY_SERVER_DATA_DIRECTORY_PATH, mydirent[num-1]->d_name);
+	retval = data_file_path(path, mydirent[num-1]->d_name);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		while (num--)
+			free(mydirent[num]);
+		free(mydirent);
+		return retval;
+	}
 	retval = validate_pwd_file(mydirent[num-1]->d_name);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
@@ -102,13 +123,13 @@ int get_pwd_path(char *path)
 	return SECURITY_SERVER_SUCCESS;
 }
 
-int load_password(unsigned char *cur_pwd, unsigned int *max_attempt, unsigned int *expire_time)
+static int read_password_file(unsigned char *cur_pwd, unsigned int *max_attempt, unsigned int *expire_time)
 {
 	int retval, fd;
 	char pwd_path[255];
 
 	/* Create directory */
-	retval = mkdir(SECURITY_SERVER_DATA_DIRECTORY_PATH, 0700);
+	retval = mkdir(get_config()->data_directory_path, 0700);
 	if(retval != 0)
 	{
 		if(errno != EEXIST)
@@ -187,13 +208,24 @@ int load_password(unsigned char *cur_pwd, unsigned int *max_attempt, unsigned in
 	return SECURITY_SERVER_SUCCESS;
 }
 
-int get_current_attempt(int increase)
+int load_password(unsigned char *cur_pwd, unsigned int *max_attempt, unsigned int *expire_time)
+{
+	int retval;
+
+	SEC_SVR_PROBE2(password__io__start, "password", 0);
+	retval = read_password_file(cur_pwd, max_attempt, expire_time);
+	SEC_SVR_PROBE3(password__io__end, "password", 0, retval);
+	return retval;
+}
+
+static int update_attempt_file(int increase)
 {
 	int retval, fd, attempt;
 	char path[255];
 
-	snprintf(path, 255, "%s/%s", SECURITY_SERVER_DATA_DIRECTORY_PATH,
-		SECURITY_SERVER_ATTEMPT_FILE_NAME);
+	retval = data_file_path(path, SECURITY_SERVER_ATTEMPT_FILE_NAME);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
 
 	/* Open current attempt file as read mode */
 	fd = open(path, O_RDONLY | O_NONBLOCK );
@@ -265,14 +297,25 @@ int get_current_attempt(int increase)
 	return attempt;
 }
 
-int reset_attempt(void)
+int get_current_attempt(int increase)
+{
+	int retval;
+
+	SEC_SVR_PROBE2(password__io__start, "attempts", increase > 0);
+	retval = update_attempt_file(increase);
+	SEC_SVR_PROBE3(password__io__end, "attempts", increase > 0, retval);
+	return retval;
+}
+
+static int reset_attempt_file(void)
 {
 	int fd, retval;
 	char path[255];
 	unsigned int attempt = 0;
 
-	snprintf(path, 255, "%s/%s", SECURITY_SERVER_DATA_DIRECTORY_PATH,
-		SECURITY_SERVER_ATTEMPT_FILE_NAME);
+	retval = data_file_path(path, SECURITY_SERVER_ATTEMPT_FILE_NAME);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
 
 	/* Open the file again with write mode */
 	fd = open(path, O_WRONLY | O_NONBLOCK, 0600);
@@ -299,13 +342,21 @@ int reset_attempt(void)
 	return SECURITY_SERVER_SUCCESS;
 }
 
+int reset_attempt(void)
+{
+	int retval;
+
+	SEC_SVR_PROBE2(password__io__start, "attempts", 1);
+	retval = reset_attempt_file();
+	SEC_SVR_PROBE3(password__io__end, "attempts", 1, retval);
+	return retval;
+}
+
 /* Compare current password Stored password is hashed by SHA-256 Algorithm */
 int check_password(const unsigned char *cur_pwd, const unsigned char *requested_pwd,
 			const unsigned int max_attempts, const unsigned int expire_time,
 			int *current_attempt)
 {
-	unsigned int current_time;
-
 	if(max_attempts != 0)
 	{
 		*current_attempt = get_current_attempt(1);
@@ -330,7 +381,7 @@ int check_password(const unsigned char *cur_pwd, const unsigned char *requested_
 
     if(expire_time == 0)
     {
-        SEC_SVR_DBG("Server: Password has been expired: %d, %d", current_time, expire_time);
+        SEC_SVR_DBG("Server: Password has been expired: %d", expire_time);
         return SECURITY_SERVER_ERROR_PASSWORD_EXPIRED;
     }
 
@@ -343,8 +394,9 @@ int set_history(int num)
 	int fd, retval;
 	char path[255];
 
-	snprintf(path, 255, "%s/%s", SECURITY_SERVER_DATA_DIRECTORY_PATH,
-		SECURITY_SERVER_HISTORY_FILE_NAME);
+	retval = data_file_path(path, SECURITY_SERVER_HISTORY_FILE_NAME);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
 
 	/* Open the file again with write mode */
 	fd = open(path, O_WRONLY | O_NONBLOCK, 0600);
@@ -390,8 +442,9 @@ int get_history_num(void)
 	int fd, retval, history;
 	char path[255];
 
-	snprintf(path, 255, "%s/%s", SECURITY_SERVER_DATA_DIRECTORY_PATH,
-		SECURITY_SERVER_HISTORY_FILE_NAME);
+	retval = data_file_path(path, SECURITY_SERVER_HISTORY_FILE_NAME);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
 
 	/* Load password file */
 	fd = open(path, O_RDONLY | O_NONBLOCK );
@@ -434,7 +487,7 @@ int check_history(const unsigned char *requested_pwd)
 	if(history_count <= 0)
 		return SECURITY_SERVER_SUCCESS;
 
-	num = scandir(SECURITY_SERVER_DATA_DIRECTORY_PATH, &mydirent, &dir_filter, alphasort);
+	num = scandir(get_config()->data_directory_path, &mydirent, &dir_filter, alphasort);
 	if(num < 0)
 	{
 		SEC_SVR_DBG("Server: [Error] Cannot scan password directory. errno: %d", errno);
@@ -450,7 +503,9 @@ int check_history(const unsigned char *requested_pwd)
 	file_count = 2;
 	while((num--))
 	{
-		snprintf(path, 255, "%s/%s", SECURITY_SERVER_DATA_DIRECTORY_PATH, mydirent[num]->d_name);
+		retval = data_file_path(path, mydirent[num]->d_name);
+		if(retval != SECURITY_SERVER_SUCCESS)
+			return retval;
 		SEC_SVR_DBG("Password file path: %s", path);
 		if(history_count > 0)
 		{
@@ -516,15 +571,18 @@ int check_history(const unsigned char *requested_pwd)
  * |              Expiration time in seconds (4 bytes)             |
  * |---------------------------------------------------------------|
  */
-int set_password(const unsigned char *requested_new_pwd, const unsigned int attempts,
+static int write_password_file(const unsigned char *requested_new_pwd, const unsigned int attempts,
 			const unsigned int expire_time)
 {
 	int retval, fd;
-	char pwd_path[255];
+	char pwd_path[255], pwd_name[16];
 
 	/* New file created */
 	retval = time(NULL);
-	snprintf(pwd_path, 255, "%s/%d.pwd", SECURITY_SERVER_DATA_DIRECTORY_PATH, retval);
+	snprintf(pwd_name, sizeof(pwd_name), "%d.pwd", retval);
+	retval = data_file_path(pwd_path, pwd_name);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		return retval;
 
 	/* Save new password as current password */
 	fd = open(pwd_path, O_WRONLY | O_NONBLOCK | O_CREAT, 0600);
@@ -567,6 +625,17 @@ int set_password(const unsigned char *requested_new_pwd, const unsigned int atte
 	return SECURITY_SERVER_SUCCESS;
 }
 
+int set_password(const unsigned char *requested_new_pwd, const unsigned int attempts,
+			const unsigned int expire_time)
+{
+	int retval;
+
+	SEC_SVR_PROBE2(password__io__start, "password", 1);
+	retval = write_password_file(requested_new_pwd, attempts, expire_time);
+	SEC_SVR_PROBE3(password__io__end, "password", 1, retval);
+	return retval;
+}
+
 int check_retry(const struct timeval cur_try)
 {
 	int retval, interval_sec, interval_usec;
@@ -584,7 +653,7 @@ int check_retry(const struct timeval cur_try)
 	return SECURITY_SERVER_ERROR_PASSWORD_RETRY_TIMER;
 }
 
-int process_valid_pwd_request(int sockfd)
+int process_valid_pwd_request(request_context *req)
 {
 	struct timeval cur_try;
 	int retval, current_attempts, password_set;
@@ -612,7 +681,7 @@ int process_valid_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Server: Retry timeout occurred");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_RETRY_TIMER);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -625,7 +694,7 @@ int process_valid_pwd_request(int sockfd)
 	if(password_set == SECURITY_SERVER_ERROR_SERVER_ERROR)
 	{
 		SEC_SVR_DBG("%s", "Server: Responding error because we cannot provide password service");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -639,7 +708,7 @@ int process_valid_pwd_request(int sockfd)
 	if(current_attempts < 0)
 	{
 		SEC_SVR_DBG("Server ERROR: Cannot get attempts: %d", current_attempts);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -651,7 +720,7 @@ int process_valid_pwd_request(int sockfd)
 	/* There is no password */
 	if(password_set == SECURITY_SERVER_ERROR_NO_PASSWORD)
 	{
-		retval = send_pwd_response(sockfd,
+		retval = send_pwd_response(req,
 				SECURITY_SERVER_MSG_TYPE_VALID_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_NO_PASSWORD,
 				0, 0, 0);
@@ -663,7 +732,7 @@ int process_valid_pwd_request(int sockfd)
 	}
 	if(password_set == SECURITY_SERVER_SUCCESS)
 	{
-		retval = send_pwd_response(sockfd,
+		retval = send_pwd_response(req,
 				SECURITY_SERVER_MSG_TYPE_VALID_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_EXIST,
 				current_attempts, max_attempt, expire_time);
@@ -674,7 +743,7 @@ int process_valid_pwd_request(int sockfd)
 		goto error;
 	}
 	SEC_SVR_DBG("Server ERROR: Unknown error: %d", retval);
-	retval = send_generic_response(sockfd,
+	retval = send_generic_response(req,
 			SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 	if(retval != SECURITY_SERVER_SUCCESS)
@@ -685,7 +754,7 @@ error:
 	return retval;
 }
 
-int process_set_pwd_request(int sockfd)
+int process_set_pwd_request(request_context *req)
 {
 	struct timeval cur_try;
 	int retval, password_set, current_attempt;
@@ -723,7 +792,7 @@ int process_set_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Server: Retry timeout occurred");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_RETRY_TIMER);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -737,7 +806,7 @@ int process_set_pwd_request(int sockfd)
 	if(password_set == SECURITY_SERVER_ERROR_SERVER_ERROR)
 	{
 		SEC_SVR_DBG("%s", "Server: Responding error because we cannot provide password service");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -748,11 +817,11 @@ int process_set_pwd_request(int sockfd)
 	}
 
 	/* Receive size of pwds */
-	retval = read(sockfd, &cur_pwd_len, sizeof(char));
+	retval = recv_request_data(req, &cur_pwd_len, sizeof(char));
 	if(retval < sizeof(char) || cur_pwd_len > SECURITY_SERVER_MAX_PASSWORD_LEN)
 	{
 		SEC_SVR_DBG("Server Error: current password length recieve failed: %d, %d", retval, cur_pwd_len);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -761,11 +830,11 @@ int process_set_pwd_request(int sockfd)
 		}
 		goto error;
 	}
-	retval = read(sockfd, &new_pwd_len, sizeof(char));
+	retval = recv_request_data(req, &new_pwd_len, sizeof(char));
 	if(retval < sizeof(char)  || new_pwd_len > SECURITY_SERVER_MAX_PASSWORD_LEN)
 	{
 		SEC_SVR_DBG("Server Error: new password length recieve failed: %d, %d", retval, new_pwd_len);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -780,11 +849,11 @@ int process_set_pwd_request(int sockfd)
 	{
 		/* Check wheter current password is exist */
 		if(password_set == SECURITY_SERVER_SUCCESS)
-		retval = read(sockfd, requested_cur_pwd, cur_pwd_len);
+		retval = recv_request_data(req, requested_cur_pwd, cur_pwd_len);
 		if(retval < cur_pwd_len)
 		{
 			SEC_SVR_DBG("Server Error: current password recieve failed: %d", retval);
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -800,7 +869,7 @@ int process_set_pwd_request(int sockfd)
 		if(password_set == SECURITY_SERVER_SUCCESS)
 		{
 			SEC_SVR_DBG("Server Error: password is already set: %d", retval);
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_EXIST);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -812,11 +881,11 @@ int process_set_pwd_request(int sockfd)
 	}
 
 	/* Receive new password */
-	retval = read(sockfd, requested_new_pwd, new_pwd_len);
+	retval = recv_request_data(req, requested_new_pwd, new_pwd_len);
 	if(retval < new_pwd_len)
 	{
 		SEC_SVR_DBG("Server Error:  new password recieve failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -828,11 +897,11 @@ int process_set_pwd_request(int sockfd)
 	requested_new_pwd[new_pwd_len] = 0;
 
 	/* Receive max attempt */
-	retval = read(sockfd, &received_attempts, sizeof(unsigned int));
+	retval = recv_request_data(req, &received_attempts, sizeof(unsigned int));
 	if(retval < sizeof(unsigned int))
 	{
 		SEC_SVR_DBG("Sever Error:  Max attempt receive failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -843,11 +912,11 @@ int process_set_pwd_request(int sockfd)
 	}
 
 	/* Receive valid period  */
-	retval = read(sockfd, &valid_days, sizeof(unsigned int));
+	retval = recv_request_data(req, &valid_days, sizeof(unsigned int));
 	if(retval < sizeof(unsigned int))
 	{
 		SEC_SVR_DBG("Sever Error:  Max attempt receive failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -873,7 +942,7 @@ int process_set_pwd_request(int sockfd)
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_MISMATCH)
 		{
 			SEC_SVR_DBG("%s", "Server: Wrong password");
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_MISMATCH);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -885,7 +954,7 @@ int process_set_pwd_request(int sockfd)
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_MAX_ATTEMPTS_EXCEEDED)
 		{
 			SEC_SVR_DBG("%s", "Server: Too many challange");
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_MAX_ATTEMPTS_EXCEEDED);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -897,7 +966,7 @@ int process_set_pwd_request(int sockfd)
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_EXPIRED)
 		{
 			SEC_SVR_DBG("%s", "Server: Password expired");
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_EXPIRED);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -909,7 +978,7 @@ int process_set_pwd_request(int sockfd)
 		if(retval != SECURITY_SERVER_SUCCESS)
 		{
 			SEC_SVR_DBG("Error: Password check failed: %d", retval);
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -921,7 +990,7 @@ int process_set_pwd_request(int sockfd)
 		retval = check_history(hashed_new_pw);
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_REUSED)
 		{
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_REUSED);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -935,7 +1004,7 @@ int process_set_pwd_request(int sockfd)
 	{
 		/* Client ask to set with current password, but there is no password now */
 		SEC_SVR_DBG("%s", "Server: There is no current password. But try to set with current password");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_MISMATCH);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -956,7 +1025,7 @@ int process_set_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("Server Error: Password set failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -971,7 +1040,7 @@ int process_set_pwd_request(int sockfd)
 
 	/* All done. send response */
 	SEC_SVR_DBG("%s", "Server: Password has been successfully modified");
-	retval = send_generic_response(sockfd,
+	retval = send_generic_response(req,
 			SECURITY_SERVER_MSG_TYPE_SET_PWD_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_SUCCESS);
 	if(retval != SECURITY_SERVER_SUCCESS)
@@ -982,7 +1051,7 @@ error:
 	return retval;
 }
 
-int process_reset_pwd_request(int sockfd)
+int process_reset_pwd_request(request_context *req)
 {
 	int retval, password_set;
 	char new_pwd_len;
@@ -1016,7 +1085,7 @@ int process_reset_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Server: Retry timeout occurred");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_RETRY_TIMER);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1030,7 +1099,7 @@ int process_reset_pwd_request(int sockfd)
 	if(password_set == SECURITY_SERVER_ERROR_SERVER_ERROR)
 	{
 		SEC_SVR_DBG("%s", "Server: Responding error because we cannot provide password service");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_GENERIC_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1041,11 +1110,11 @@ int process_reset_pwd_request(int sockfd)
 	}
 
 	/* Receive size of pwd */
-	retval = read(sockfd, &new_pwd_len, sizeof(char));
+	retval = recv_request_data(req, &new_pwd_len, sizeof(char));
 	if(retval < sizeof(char)  || new_pwd_len > SECURITY_SERVER_MAX_PASSWORD_LEN)
 	{
 		SEC_SVR_DBG("Server Error: new password length recieve failed: %d, %d", retval, new_pwd_len);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1056,11 +1125,11 @@ int process_reset_pwd_request(int sockfd)
 	}
 
 	/* Receive new password */
-	retval = read(sockfd, requested_new_pwd, new_pwd_len);
+	retval = recv_request_data(req, requested_new_pwd, new_pwd_len);
 	if(retval < new_pwd_len)
 	{
 		SEC_SVR_DBG("Server Error:  new password recieve failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1072,11 +1141,11 @@ int process_reset_pwd_request(int sockfd)
 	requested_new_pwd[new_pwd_len] = 0;
 
 	/* Receive max attempt */
-	retval = read(sockfd, &received_attempts, sizeof(unsigned int));
+	retval = recv_request_data(req, &received_attempts, sizeof(unsigned int));
 	if(retval < sizeof(unsigned int))
 	{
 		SEC_SVR_DBG("Sever Error:  Max attempt receive failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1087,11 +1156,11 @@ int process_reset_pwd_request(int sockfd)
 	}
 
 	/* Receive valid period  */
-	retval = read(sockfd, &valid_days, sizeof(unsigned int));
+	retval = recv_request_data(req, &valid_days, sizeof(unsigned int));
 	if(retval < sizeof(unsigned int))
 	{
 		SEC_SVR_DBG("Sever Error:  Max attempt receive failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1116,7 +1185,7 @@ int process_reset_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("Server Error: Password set failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1129,7 +1198,7 @@ int process_reset_pwd_request(int sockfd)
 
 	/* All done. send response */
 	SEC_SVR_DBG("%s", "Server: Password has been successfully modified");
-	retval = send_generic_response(sockfd,
+	retval = send_generic_response(req,
 			SECURITY_SERVER_MSG_TYPE_RESET_PWD_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_SUCCESS);
 	if(retval != SECURITY_SERVER_SUCCESS)
@@ -1140,9 +1209,9 @@ error:
 	return retval;
 }
 
-int process_chk_pwd_request(int sockfd)
+int process_chk_pwd_request(request_context *req)
 {
-	int retval, password_set, current_attempt;
+	int retval, password_set, current_attempt = 0;
 	unsigned int max_attempt, expire_time;
 	char requested_challenge[SECURITY_SERVER_MAX_PASSWORD_LEN+1];
 	char challenge_len;
@@ -1159,7 +1228,7 @@ int process_chk_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Client Authentication Failed");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_TOOL_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1175,7 +1244,7 @@ int process_chk_pwd_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Server: Retry timeout occurred");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_RETRY_TIMER);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1190,7 +1259,7 @@ int process_chk_pwd_request(int sockfd)
 	if(password_set == SECURITY_SERVER_ERROR_SERVER_ERROR)
 	{
 		SEC_SVR_DBG("%s", "ServerERROR: Responding error because we cannot provide password service");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1201,11 +1270,11 @@ int process_chk_pwd_request(int sockfd)
 	}
 
 	/* Receive size of challenge */
-	retval = read(sockfd, &challenge_len, sizeof(char));
+	retval = recv_request_data(req, &challenge_len, sizeof(char));
 	if(retval < sizeof(char) || challenge_len > SECURITY_SERVER_MAX_PASSWORD_LEN)
 	{
 		SEC_SVR_DBG("Server ERROR: challenge length recieve failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1217,11 +1286,11 @@ int process_chk_pwd_request(int sockfd)
 	/* Receive challenge */
 	if(challenge_len > 0)
 	{
-		retval = read(sockfd, requested_challenge, challenge_len);
+		retval = recv_request_data(req, requested_challenge, challenge_len);
 		if(retval < challenge_len)
 		{
 			SEC_SVR_DBG("Server ERROR: current password recieve failed: %d", retval);
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -1235,7 +1304,7 @@ int process_chk_pwd_request(int sockfd)
 	else
 	{
 		SEC_SVR_DBG("Error: Challenge length too short: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1257,7 +1326,7 @@ int process_chk_pwd_request(int sockfd)
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_MISMATCH)
 		{
 			SEC_SVR_DBG("%s", "Server: Wrong password");
-			retval = send_pwd_response(sockfd,
+			retval = send_pwd_response(req,
 					SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_MISMATCH,
 					current_attempt, max_attempt, expire_time);
@@ -1270,7 +1339,7 @@ int process_chk_pwd_request(int sockfd)
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_MAX_ATTEMPTS_EXCEEDED)
 		{
 			SEC_SVR_DBG("%s", "Server: Too many trial");
-			retval = send_pwd_response(sockfd,
+			retval = send_pwd_response(req,
 					SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_MAX_ATTEMPTS_EXCEEDED,
 					current_attempt, max_attempt, expire_time);
@@ -1283,7 +1352,7 @@ int process_chk_pwd_request(int sockfd)
 		if(retval == SECURITY_SERVER_ERROR_PASSWORD_EXPIRED)
 		{
 			SEC_SVR_DBG("%s", "Server: Password expired");
-			retval = send_pwd_response(sockfd,
+			retval = send_pwd_response(req,
 					SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_PASSWORD_EXPIRED,
 					current_attempt, max_attempt, 0);
@@ -1296,7 +1365,7 @@ int process_chk_pwd_request(int sockfd)
 		if(retval != SECURITY_SERVER_SUCCESS)
 		{
 			SEC_SVR_DBG("Server ERROR: Password check failed: %d", retval);
-			retval = send_generic_response(sockfd,
+			retval = send_generic_response(req,
 					SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 					SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 			if(retval != SECURITY_SERVER_SUCCESS)
@@ -1308,7 +1377,7 @@ int process_chk_pwd_request(int sockfd)
 
 		/* Password matched */
 		SEC_SVR_DBG("%s", "Server: Password matched");
-		retval = send_pwd_response(sockfd,
+		retval = send_pwd_response(req,
 				SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SUCCESS,
 				current_attempt, max_attempt, expire_time);
@@ -1323,7 +1392,7 @@ int process_chk_pwd_request(int sockfd)
 	/* There is no password */
 
 	SEC_SVR_DBG("%s", "Server: There is no password to be checked");
-	retval = send_generic_response(sockfd,
+	retval = send_generic_response(req,
 			SECURITY_SERVER_MSG_TYPE_CHK_PWD_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_NO_PASSWORD);
 	if(retval != SECURITY_SERVER_SUCCESS)
@@ -1334,7 +1403,7 @@ error:
 	return retval;
 }
 
-int process_set_pwd_history_request(int sockfd)
+int process_set_pwd_history_request(request_context *req)
 {
 	int retval;
 	char history_num;
@@ -1362,7 +1431,7 @@ int process_set_pwd_history_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("%s", "Server: Retry timeout occurred");
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_PASSWORD_RETRY_TIMER);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1373,11 +1442,11 @@ int process_set_pwd_history_request(int sockfd)
 	}
 
 	/* Receive size of pwds */
-	retval = read(sockfd, &history_num, sizeof(char));
+	retval = recv_request_data(req, &history_num, sizeof(char));
 	if(retval < sizeof(char) || history_num > SECURITY_SERVER_MAX_PASSWORD_HISTORY || history_num < 0 )
 	{
 		SEC_SVR_DBG("Server Error: History number recieve failed: %d, %d", retval, history_num);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1391,7 +1460,7 @@ int process_set_pwd_history_request(int sockfd)
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		SEC_SVR_DBG("Server Error: History number set failed: %d", retval);
-		retval = send_generic_response(sockfd,
+		retval = send_generic_response(req,
 				SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_RESPONSE,
 				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
 		if(retval != SECURITY_SERVER_SUCCESS)
@@ -1400,7 +1469,7 @@ int process_set_pwd_history_request(int sockfd)
 		}
 	}
 	SEC_SVR_DBG("Server History has been set to %d", history_num);
-	retval = send_generic_response(sockfd,
+	retval = send_generic_response(req,
 			SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_SUCCESS);
 	if(retval != SECURITY_SERVER_SUCCESS)
@@ -1412,7 +1481,7 @@ error:
 }
 
 
-int process_set_pwd_max_challenge_request(int sockfd)
+int process_set_pwd_max_challenge_request(request_context *req)
 {
     unsigned int max_challenge, current_challenge, current_validity;
     unsigned char cur_pwd[SECURITY_SERVER_HASHED_PWD_LEN];
@@ -1421,11 +1490,11 @@ int process_set_pwd_max_challenge_request(int sockfd)
     // TODO here we should probably check if the peer has rights to change
     // this value (max challenge) for current password
 
-    retval = read(sockfd, &max_challenge, sizeof(unsigned int));
+    retval = recv_request_data(req, &max_challenge, sizeof(unsigned int));
     if(retval < sizeof(unsigned int))
     {
         SEC_SVR_DBG("Server Error: recieve failed: %d", retval);
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1443,7 +1512,7 @@ int process_set_pwd_max_challenge_request(int sockfd)
     if(retval == SECURITY_SERVER_ERROR_NO_PASSWORD)
     {
         SEC_SVR_DBG("%s", "Server: can't read current password");
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_NO_PASSWORD);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1455,7 +1524,7 @@ int process_set_pwd_max_challenge_request(int sockfd)
     else if(retval != SECURITY_SERVER_SUCCESS)
     {
         SEC_SVR_DBG("%s", "Server: can't read current password");
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1470,7 +1539,7 @@ int process_set_pwd_max_challenge_request(int sockfd)
     if(retval != SECURITY_SERVER_SUCCESS)
     {
         SEC_SVR_DBG("Server Error: Password set failed: %d", retval);
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1480,7 +1549,7 @@ int process_set_pwd_max_challenge_request(int sockfd)
         goto error;
     }
 
-    retval = send_generic_response(sockfd,
+    retval = send_generic_response(req,
             SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_RESPONSE,
             SECURITY_SERVER_RETURN_CODE_SUCCESS);
     if(retval != SECURITY_SERVER_SUCCESS)
@@ -1492,7 +1561,7 @@ error:
     return retval;
 }
 
-int process_set_pwd_validity_request(int sockfd)
+int process_set_pwd_validity_request(request_context *req)
 {
     unsigned int current_challenge, current_validity, validity;
     unsigned char cur_pwd[SECURITY_SERVER_HASHED_PWD_LEN];
@@ -1501,11 +1570,11 @@ int process_set_pwd_validity_request(int sockfd)
     // TODO here we should probably check if the peer has rights to change
     // this value (validity) for current password
 
-    retval = read(sockfd, &validity, sizeof(unsigned int));
+    retval = recv_request_data(req, &validity, sizeof(unsigned int));
     if(retval < sizeof(unsigned int))
     {
         SEC_SVR_DBG("Server Error: recieve failed: %d", retval);
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1529,7 +1598,7 @@ int process_set_pwd_validity_request(int sockfd)
     if(retval == SECURITY_SERVER_ERROR_NO_PASSWORD)
     {
         SEC_SVR_DBG("%s", "Server: can't read current password");
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_NO_PASSWORD);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1541,7 +1610,7 @@ int process_set_pwd_validity_request(int sockfd)
     else if(retval != SECURITY_SERVER_SUCCESS)
     {
         SEC_SVR_DBG("%s", "Server: can't read current password");
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1556,7 +1625,7 @@ int process_set_pwd_validity_request(int sockfd)
     if(retval != SECURITY_SERVER_SUCCESS)
     {
         SEC_SVR_DBG("Server Error: Password set failed: %d", retval);
-        retval = send_generic_response(sockfd,
+        retval = send_generic_response(req,
                 SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_RESPONSE,
                 SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
         if(retval != SECURITY_SERVER_SUCCESS)
@@ -1566,7 +1635,7 @@ int process_set_pwd_validity_request(int sockfd)
         goto error;
     }
 
-    retval = send_generic_response(sockfd,
+    retval = send_generic_response(req,
             SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_RESPONSE,
             SECURITY_SERVER_RETURN_CODE_SUCCESS);
     if(retval != SECURITY_SERVER_SUCCESS)
@@ -0,0 +1,207 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+#include "security-server-revoke.h"
+
+/* Subscribed connection. The ID tells it from a later one which got the *
+ * same descriptor number */
+typedef struct
+{
+	int sockfd;
+	unsigned int id;
+} revoke_subscriber;
+
+/* Guarded by subscriber_mutex, which is taken under cookie_mutex. *
+ * num_subscribers is also read without it to skip the lock when it's 0 */
+static pthread_mutex_t subscriber_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t subscriber_cond = PTHREAD_COND_INITIALIZER;
+static revoke_subscriber subscribers[SECURITY_SERVER_MAX_SUBSCRIBERS];
+static int num_subscribers = 0;
+static unsigned int next_subscriber_id = 0;
+
+/* Caller must hold subscriber_mutex */
+static void remove_subscriber(int i)
+{
+	close(subscribers[i].sockfd);
+	subscribers[i] = subscribers[num_subscribers - 1];
+	__atomic_store_n(&num_subscribers, num_subscribers - 1, __ATOMIC_RELEASE);
+}
+
+/* Push (cookie, PID) of a cookie being deleted to every subscriber. *
+ * Called by delete_cookie_item() under cookie_mutex */
+void revoke_notify(const cookie_list *cookie)
+{
+	revocation_event event;
+	int i;
+
+	if(__atomic_load_n(&num_subscribers, __ATOMIC_ACQUIRE) == 0)
+		return;
+
+	memset(&event, 0, sizeof(event));
+	event.hdr.version = SECURITY_SERVER_MSG_VERSION;
+	event.hdr.msg_id = SECURITY_SERVER_MSG_TYPE_REVOCATION_EVENT;
+	event.hdr.msg_len = sizeof(event) - sizeof(basic_header);
+	memcpy(event.cookie, cookie->cookie, SECURITY_SERVER_COOKIE_LEN);
+	event.pid = cookie->pid;
+
+	pthread_mutex_lock(&subscriber_mutex);
+	for(i = 0; i < num_subscribers; )
+	{
+		if(send(subscribers[i].sockfd, &event, sizeof(event), MSG_DONTWAIT | MSG_NOSIGNAL)
+				== sizeof(event))
+		{
+			i++;
+			continue;
+		}
+		/* A partial write breaks the stream too */
+		SEC_SVR_DBG("Revocation subscriber %u is gone or behind. errno=%d",
+				subscribers[i].id, errno);
+		remove_subscriber(i);
+	}
+	pthread_mutex_unlock(&subscriber_mutex);
+}
+
+/* Wait 'timeout' milliseconds between reaper rounds, or until someone *
+ * subscribes while nobody is. Subscribers never write, so a readable one *
+ * has hung up. It's dropped here, as there may be no event to find it out */
+void revoke_wait_subscribers(int timeout)
+{
+	struct pollfd fds[SECURITY_SERVER_MAX_SUBSCRIBERS];
+	unsigned int ids[SECURITY_SERVER_MAX_SUBSCRIBERS];
+	nfds_t num, i;
+	int j;
+
+	pthread_mutex_lock(&subscriber_mutex);
+	while(num_subscribers == 0)
+		pthread_cond_wait(&subscriber_cond, &subscriber_mutex);
+	num = num_subscribers;
+	for(i = 0; i < num; i++)
+	{
+		fds[i].fd = subscribers[i].sockfd;
+		fds[i].events = POLLIN;
+		ids[i] = subscribers[i].id;
+	}
+	pthread_mutex_unlock(&subscriber_mutex);
+
+	/* A descriptor may be closed and reused meanwhile. Only its ID counts */
+	if(poll(fds, num, timeout) <= 0)
+		return;
+
+	pthread_mutex_lock(&subscriber_mutex);
+	for(i = 0; i < num; i++)
+	{
+		if(fds[i].revents == 0)
+			continue;
+		for(j = 0; j < num_subscribers && subscribers[j].id != ids[i]; j++);
+		if(j < num_subscribers)
+		{
+			SEC_SVR_DBG("Revocation subscriber %u has hung up", ids[i]);
+			remove_subscriber(j);
+		}
+	}
+	pthread_mutex_unlock(&subscriber_mutex);
+}
+
+/* Subscribe a middleware daemon to cookie revocations
+ *
+ * The response carries no body. The connection is kept, and events of *
+ * cookies deleted after the subscriber is added follow on it. It's added *
+ * before the response is sent and under the same lock, so the response *
+ * comes before any event and no deletion after it is missed */
+int process_subscribe_revocation_request(request_context *req)
+{
+	int retval, client_pid, sockfd = -1;
+	unsigned char return_code = SECURITY_SERVER_RETURN_CODE_SERVER_ERROR;
+
+	retval = authenticate_client_middleware(req->sockfd, &client_pid);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("%s", "Client Authentication Failed");
+		return_code = SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED;
+		goto error;
+	}
+
+	/* Events are v1 messages. Pipelined responses can't share the stream */
+	if(req->version != SECURITY_SERVER_MSG_VERSION)
+	{
+		SEC_SVR_DBG("Revocation stream over protocol version %d", req->version);
+		return_code = SECURITY_SERVER_RETURN_CODE_BAD_REQUEST;
+		goto error;
+	}
+
+	/* Connection thread lingers on its own descriptor when it returns */
+	sockfd = fcntl(req->sockfd, F_DUPFD_CLOEXEC, 0);
+	if(sockfd < 0)
+	{
+		SEC_SVR_DBG("Cannot duplicate subscriber socket. errno=%d", errno);
+		goto error;
+	}
+
+	pthread_mutex_lock(&subscriber_mutex);
+	if(num_subscribers >= SECURITY_SERVER_MAX_SUBSCRIBERS)
+	{
+		pthread_mutex_unlock(&subscriber_mutex);
+		SEC_SVR_DBG("%s", "Too many revocation subscribers");
+		goto error;
+	}
+	subscribers[num_subscribers].sockfd = sockfd;
+	subscribers[num_subscribers].id = next_subscriber_id++;
+	__atomic_store_n(&num_subscribers, num_subscribers + 1, __ATOMIC_RELEASE);
+
+	retval = send_generic_response(req, SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("ERROR: Cannot send subscribe response: %d", retval);
+		remove_subscriber(num_subscribers - 1);
+		pthread_mutex_unlock(&subscriber_mutex);
+		return retval;
+	}
+	pthread_cond_signal(&subscriber_cond);
+	pthread_mutex_unlock(&subscriber_mutex);
+	SEC_SVR_DBG("Revocation subscriber added for pid:%d", client_pid);
+	return SECURITY_SERVER_SUCCESS;
+
+error:
+	if(sockfd >= 0)
+		close(sockfd);
+	retval = send_generic_response(req, SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_RESPONSE,
+			return_code);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("ERROR: Cannot send generic response: %d", retval);
+	}
+	return retval;
+}
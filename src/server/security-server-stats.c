@@ -0,0 +1,216 @@
+/*
+ * security-server
+ *
+ *  Copyright (c) 2000 - 2011 Samsung Electronics Co., Ltd All Rights Reserved
+ *
+ *  Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+#include "security-server-stats.h"
+#include "security-server-probes.h"
+
+/* Counters are split into shards, and each thread sticks to one. Updates *
+ * are relaxed atomic adds, so no lock is taken on the request path and *
+ * threads rarely share a cache line. Readers sum up all shards */
+typedef struct
+{
+	unsigned int count;
+	unsigned int max_usec;
+	unsigned long long total_usec;
+	unsigned int buckets[SECURITY_SERVER_STATS_BUCKETS];
+} stats_row;
+
+static stats_row stats[SECURITY_SERVER_STATS_SHARDS][SECURITY_SERVER_NUM_STATS];
+static unsigned int next_shard = 0;
+static __thread int my_shard = -1;
+
+unsigned long long stats_clock(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int stats_bucket(unsigned int usec)
+{
+	int msb, bucket;
+
+	if(usec < 4)
+		return usec;
+	msb = 31 - __builtin_clz(usec);
+	bucket = (msb - 1) * 4 + ((usec >> (msb - 2)) & 3);
+	if(bucket >= SECURITY_SERVER_STATS_BUCKETS)
+		bucket = SECURITY_SERVER_STATS_BUCKETS - 1;
+	return bucket;
+}
+
+/* Record time elapsed since 'start' */
+void stats_record(int stat, unsigned long long start)
+{
+	unsigned long long elapsed = stats_clock() - start;
+	unsigned int usec = elapsed > 0xffffffffULL ? 0xffffffff : (unsigned int)elapsed;
+	unsigned int max;
+	stats_row *row;
+
+	if(my_shard < 0)
+		my_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) % SECURITY_SERVER_STATS_SHARDS;
+	row = &stats[my_shard][stat];
+
+	__atomic_fetch_add(&row->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&row->total_usec, usec, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&row->buckets[stats_bucket(usec)], 1, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&row->max_usec, __ATOMIC_RELAXED);
+	while(usec > max && !__atomic_compare_exchange_n(&row->max_usec, &max, usec,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_record_request(unsigned char msg_id, unsigned long long start)
+{
+	if((msg_id & 1) && msg_id < SECURITY_SERVER_STATS_MSG_ROWS * 2)
+		stats_record(msg_id >> 1, start);
+	else
+		stats_record(SECURITY_SERVER_STAT_OTHER_MSG, start);
+}
+
+/* Lock and record the time waited. Uncontended lock is neither timed nor *
+ * recorded, so the row counts only the waits */
+void stats_lock(pthread_mutex_t *mutex)
+{
+	unsigned long long start;
+
+	if(pthread_mutex_trylock(mutex) == 0)
+	{
+		SEC_SVR_PROBE1(cookie__lock, 0);
+		return;
+	}
+	start = stats_clock();
+	pthread_mutex_lock(mutex);
+	stats_record(SECURITY_SERVER_STAT_COOKIE_MUTEX, start);
+	SEC_SVR_PROBE1(cookie__lock, stats_clock() - start);
+}
+
+void stats_unlock(pthread_mutex_t *mutex)
+{
+	SEC_SVR_PROBE(cookie__unlock);
+	pthread_mutex_unlock(mutex);
+}
+
+/* Get stats response *
+ * Only rows with any count are sent. Stat ID is the message ID for *
+ * request rows, and 0x100 + (row - 0x40) for the others *
+ * packet format
+ *  0                   1                   2                   3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x20 |       Message Length          |
+ * |---------------------------------------------------------------|
+ * |  return code  |            # of rows (32bit)                  |
+ * |---------------------------------------------------------------|
+ * |   cont'd...   |          # of buckets per row (32bit)         |
+ * |---------------------------------------------------------------|
+ * |   cont'd...   |              1st stat ID (32bit)              |
+ * |---------------------------------------------------------------|
+ * |   cont'd...   |                 1st count (32bit)             |
+ * |---------------------------------------------------------------|
+ * |   cont'd...   |            1st max latency (32bit, us)        |
+ * |---------------------------------------------------------------|
+ * |   cont'd...   |                                               |
+ * |----------------   1st total latency (64bit, us)               |
+ * |                                                               |
+ * |---------------------------------------------------------------|
+ * |                      1st bucket_1 (32bit)                     |
+ * |---------------------------------------------------------------|
+ * |                              ...                              |
+ * |---------------------------------------------------------------|
+ * |                      2nd stat ID (32bit)                      |
+ * |---------------------------------------------------------------|
+ * |                              ...                              |
+ */
+int process_stats_request(request_context *req)
+{
+	unsigned char *buf = NULL;
+	stats_row sum;
+	unsigned int num = 0, id, i, shard, b;
+	int ptr = 2 * sizeof(int), ret, client_pid, client_uid, row_size;
+
+	ret = authenticate_client_application(req->sockfd, &client_pid, &client_uid);
+	if(ret != SECURITY_SERVER_SUCCESS)
+	{
+		SEC_SVR_DBG("%s", "Client Authentication Failed");
+		ret = send_generic_response(req, SECURITY_SERVER_MSG_TYPE_GET_STATS_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_AUTHENTICATION_FAILED);
+		if(ret != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", ret);
+		}
+		return ret;
+	}
+
+	row_size = 3 * sizeof(int) + sizeof(unsigned long long) + sizeof(sum.buckets);
+	buf = malloc(ptr + row_size * SECURITY_SERVER_NUM_STATS);
+	if(buf == NULL)
+	{
+		SEC_SVR_DBG("%s", "Out of memory");
+		return send_generic_response(req, SECURITY_SERVER_MSG_TYPE_GET_STATS_RESPONSE,
+				SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
+	}
+
+	for(i = 0; i < SECURITY_SERVER_NUM_STATS; i++)
+	{
+		memset(&sum, 0, sizeof(sum));
+		for(shard = 0; shard < SECURITY_SERVER_STATS_SHARDS; shard++)
+		{
+			sum.count += __atomic_load_n(&stats[shard][i].count, __ATOMIC_RELAXED);
+			sum.total_usec += __atomic_load_n(&stats[shard][i].total_usec, __ATOMIC_RELAXED);
+			if(stats[shard][i].max_usec > sum.max_usec)
+				sum.max_usec = stats[shard][i].max_usec;
+			for(b = 0; b < SECURITY_SERVER_STATS_BUCKETS; b++)
+				sum.buckets[b] += __atomic_load_n(&stats[shard][i].buckets[b], __ATOMIC_RELAXED);
+		}
+		if(sum.count == 0)
+			continue;
+
+		id = i < SECURITY_SERVER_STATS_MSG_ROWS ? (i << 1) | 1 : 0x100 + i - SECURITY_SERVER_STATS_MSG_ROWS;
+		memcpy(buf + ptr, &id, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(buf + ptr, &sum.count, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(buf + ptr, &sum.max_usec, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(buf + ptr, &sum.total_usec, sizeof(unsigned long long));
+		ptr += sizeof(unsigned long long);
+		memcpy(buf + ptr, sum.buckets, sizeof(sum.buckets));
+		ptr += sizeof(sum.buckets);
+		num++;
+	}
+	memcpy(buf, &num, sizeof(int));
+	b = SECURITY_SERVER_STATS_BUCKETS;
+	memcpy(buf + sizeof(int), &b, sizeof(int));
+
+	ret = send_response(req, SECURITY_SERVER_MSG_TYPE_GET_STATS_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS, buf, ptr);
+	free(buf);
+	return ret;
+}
@@ -29,22 +29,73 @@
 #include <sys/un.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
+#include <pthread.h>
 
 #include "security-server-common.h"
 #include "security-server-cookie.h"
 #include "security-server-comm.h"
+#include "security-server-stats.h"
 #include "security-server-util.h"
 #include "security-server.h"
 
 
+extern pthread_mutex_t cookie_mutex;
+
+/* More cookies than a page can hold, so that a window taken after the *
+ * cursor never ends the dump early */
+#define COOKIE_PAGE_WINDOW	(SECURITY_SERVER_COOKIE_PAGE_LEN / (3 * sizeof(int) + SECURITY_SERVER_COOKIE_LEN) + 1)
+
+/* Size of one cookie entry in cookie info responses */
+int cookie_info_size(int path_len, int permission_len)
+{
+	return sizeof(int) + sizeof(int) + SECURITY_SERVER_COOKIE_LEN + sizeof(int) + path_len + (permission_len * sizeof(int));
+}
+
+/* Serialize one cookie entry with given cmdline and permission lengths. *
+ * Lengths may be shorter than the cookie's own, then the entry is clipped */
+int put_cookie_info(const cookie_snapshot_entry *list, unsigned char *buf, int path_len, int permission_len)
+{
+	int ptr = 0, tempnum, i;
+
+	tempnum = path_len;
+	memcpy(buf+ptr, &tempnum, sizeof(int));
+	ptr += sizeof(int);
+	tempnum = permission_len;
+	memcpy(buf+ptr, &tempnum, sizeof(int));
+	ptr += sizeof(int);
+	memcpy(buf+ptr, list->cookie, SECURITY_SERVER_COOKIE_LEN);
+	ptr += SECURITY_SERVER_COOKIE_LEN;
+	tempnum = list->pid;
+	memcpy(buf+ptr, &tempnum, sizeof(int));
+	ptr += sizeof(int);
+	memcpy(buf+ptr, list->path, path_len);
+	ptr += path_len;
+
+	for(i=0;i<permission_len;i++)
+	{
+		tempnum = list->permissions[i];
+		memcpy(buf+ptr, &tempnum, sizeof(int));
+		ptr += sizeof(int);
+	}
+	return ptr;
+}
+
 /* Get all cookie info response *
+ * Cookies are sent in pages. A page holds the cookies after the requested *
+ * cursor, as many as fit in SECURITY_SERVER_COOKIE_PAGE_LEN bytes, and *
+ * tells the cursor to ask for next. 0 means the dump is complete. *
+ * Cursor is the sequence number of the last cookie sent, so cookies added *
+ * or deleted between pages don't make the dump skip or repeat others. *
  * packet format
  *  0                   1                   2                   3
  *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 
  * |---------------------------------------------------------------|
  * | version=0x01  |MessageID=0x52 |       Message Length          |
  * |---------------------------------------------------------------|
- * |  return code  |             tot # of cooks (32bit)            |
+ * |  return code  |        # of cooks in this page (32bit)        |
+ * |---------------------------------------------------------------|
+ * |   cont'd...   |              next cursor (32bit)              |
  * |---------------------------------------------------------------|
  * |   cont'd...   |            1st cmdline_len (32bit)            |
  * |---------------------------------------------------------------|
@@ -67,119 +118,46 @@
  * |---------------------------------------------------------------|
  * |                      2nd cmdline_len  (32bit)                 |
  * |---------------------------------------------------------------|
- * |                     2nd permission_len (32bit)                |
- * |---------------------------------------------------------------|
- * |                                                               |
- * |                        2nd cookie                             |
- * |                                                               |
- * |---------------------------------------------------------------|
- * |                         2nd PID (32 bit)                      |
- * |---------------------------------------------------------------|
- * |                     2nd cmdline (string)                      |
- * |---------------------------------------------------------------|
- * |                           2st perm_1                          |
- * |---------------------------------------------------------------|
- * |                           2st perm_2                          |
- * |---------------------------------------------------------------|
  * |                              ...                              |
- * |---------------------------------------------------------------|
- * |                                                               |
- * |                             ...                               |
- * |                                                               |
  * |                                                               |
  */
- unsigned char * get_all_cookie_info(cookie_list *list, int *size)
+int get_cookie_info_page(const cookie_snapshot *snapshot, unsigned char *buf, int buf_len)
 {
-	cookie_list *current = list;
-	int ptr, total_num, total_size, tempnum, i;
-	unsigned char *buf = NULL, *tempptr = NULL;
-	response_header hdr;
-
-	total_size = sizeof(hdr) + sizeof(int);
+	const cookie_snapshot_entry *current;
+	unsigned int index, num = 0, next = 0;
+	int ptr = 2 * sizeof(int), size, path_len, permission_len;
 
-	buf = malloc(total_size); /* header size */
-	ptr = sizeof(hdr) + sizeof(int);
-	total_num = 0;  /* Total # of cookies initial value */
-
-	while(current != NULL)
+	for(index = 0; index < (unsigned int)snapshot->num; index++)
 	{
-		current = garbage_collection(current);
-		if(current == NULL)
-			break;
-
-		total_num++;
-		total_size += sizeof(int) + sizeof(int) + SECURITY_SERVER_COOKIE_LEN + sizeof(int) + current->path_len + (current->permission_len * sizeof(int));
-		tempptr = realloc(buf, total_size);
-		if(tempptr == NULL)
+		current = &snapshot->entries[index];
+		path_len = current->path_len;
+		permission_len = current->permission_len;
+		size = cookie_info_size(path_len, permission_len);
+		if(ptr + size > buf_len)
 		{
-			SEC_SVR_DBG("%s", "Out of memory");
-			return NULL;
-		}
-		buf = tempptr;
+			if(num > 0)
+			{
+				/* Rest goes to the next page */
+				next = snapshot->entries[index - 1].seq;
+				break;
+			}
 
-		tempnum = current->path_len;
-		memcpy(buf+ptr, &tempnum, sizeof(int));
-		ptr += sizeof(int);
-		tempnum = current->permission_len;
-		memcpy(buf+ptr, &tempnum, sizeof(int));
-		ptr += sizeof(int);
-		memcpy(buf+ptr, current->cookie, SECURITY_SERVER_COOKIE_LEN);
-		ptr += SECURITY_SERVER_COOKIE_LEN;
-		tempnum = current->pid;
-		memcpy(buf+ptr, &tempnum, sizeof(int));
-		ptr += sizeof(int);
-		memcpy(buf+ptr, current->path, current->path_len);
-		ptr += current->path_len;
-
-		for(i=0;i<current->permission_len;i++)
-		{
-			tempnum = current->permissions[i];
-			memcpy(buf+ptr, &tempnum, sizeof(int));
-			ptr += sizeof(int);
+			/* Cookie alone doesn't fit. Clip it rather than stall the dump */
+			SEC_SVR_DBG("Cookie info too big. Clipping: pid=%d, size=%d", current->pid, size);
+			path_len = buf_len - ptr - cookie_info_size(0, 0);
+			if(path_len > current->path_len)
+				path_len = current->path_len;
+			permission_len = (buf_len - ptr - cookie_info_size(path_len, 0)) / sizeof(int);
+			if(permission_len > current->permission_len)
+				permission_len = current->permission_len;
 		}
-		current = current->next;
+		ptr += put_cookie_info(current, buf + ptr, path_len, permission_len);
+		num++;
 	}
 
-	if(total_size > 65530)
-	{
-		SEC_SVR_DBG("Packet too big. message length overflow: %d", total_size);
-		free(buf);
-		return  NULL;
-	}
-
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_RESPONSE;
-	hdr.basic_hdr.msg_len =(unsigned short)( total_size - sizeof(hdr));
-	hdr.return_code = SECURITY_SERVER_RETURN_CODE_SUCCESS;
-	memcpy(buf, &hdr, sizeof(hdr));
-	tempnum = total_num;
-	memcpy(buf + sizeof(hdr), &tempnum, sizeof(int));
-	*size = total_size;
-	return buf;
-}
-
-int send_all_cookie_info(const unsigned char *buf, int size, int sockfd)
-{
-	int ret;
-	/* Check poll */
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
-	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
-	/* Send to client */
-	ret = write(sockfd, buf, size);
-
-	if(ret < size)
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	return SECURITY_SERVER_SUCCESS;
+	memcpy(buf, &num, sizeof(int));
+	memcpy(buf + sizeof(int), &next, sizeof(int));
+	return ptr;
 }
 
 /* Get one cookie info response *
@@ -209,90 +187,122 @@ int send_all_cookie_info(const unsigned char *buf, int size, int sockfd)
  * |                              ...                              |
  * |---------------------------------------------------------------|
 */
-int send_one_cookie_info(const cookie_list *list, int sockfd)
+int send_one_cookie_info(const cookie_snapshot_entry *list, request_context *req)
 {
 	unsigned char *buf = NULL;
-	response_header hdr;
-	int total_size, ptr = 0, tempnum, ret, i;
+	int total_size, ret;
 
-	total_size = sizeof(hdr) + sizeof(int) + sizeof(int) + SECURITY_SERVER_COOKIE_LEN + sizeof(int) + list->path_len + (list->permission_len * sizeof(int));
+	total_size = cookie_info_size(list->path_len, list->permission_len);
 	buf = malloc(total_size);
 	if(buf == NULL)
 	{
 		SEC_SVR_DBG("%s", "Out of memory");
 		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
 	}
+	put_cookie_info(list, buf, list->path_len, list->permission_len);
 
-	hdr.basic_hdr.version = SECURITY_SERVER_MSG_VERSION;
-	hdr.basic_hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE;
-	hdr.basic_hdr.msg_len =sizeof(int) + sizeof(int) + SECURITY_SERVER_COOKIE_LEN + sizeof(int) + list->path_len + (list->permission_len * sizeof(int));
-	hdr.return_code = SECURITY_SERVER_RETURN_CODE_SUCCESS;
-	memcpy(buf, &hdr, sizeof(hdr));
-	ptr += sizeof(hdr);
+	ret = send_response(req, SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS, buf, total_size);
+	free(buf);
+	return ret;
+}
 
-	tempnum = list->path_len;
-	memcpy(buf+ptr, &tempnum, sizeof(int));
-	ptr += sizeof(int);
-	tempnum = list->permission_len;
-	memcpy(buf+ptr, &tempnum, sizeof(int));
-	ptr += sizeof(int);
-	memcpy(buf+ptr, list->cookie, SECURITY_SERVER_COOKIE_LEN);
-	ptr += SECURITY_SERVER_COOKIE_LEN;
-	tempnum = list->pid;
-	memcpy(buf+ptr, &tempnum, sizeof(int));
-	ptr += sizeof(int);
-	memcpy(buf+ptr, list->path, list->path_len);
-	ptr += list->path_len;
+/* Send cookie info from a snapshot taken with search_func *
+ * Lookups collect garbage, so they are done under cookie_mutex. *
+ * The found cookie is copied and the lock released before sending */
+int send_cookie_info_from_search(request_context *req, cookie_list *list,
+	cookie_list *(*search_func)(cookie_list *list, const void *key), const void *key)
+{
+	cookie_list *result = NULL;
+	cookie_snapshot *snapshot = NULL;
+	int ret, return_code = SECURITY_SERVER_RETURN_CODE_NO_SUCH_COOKIE;
 
-	for(i=0;i<list->permission_len;i++)
+	stats_lock(&cookie_mutex);
+	result = search_func(list, key);
+	if(result != NULL)
 	{
-		tempnum = list->permissions[i];
-		memcpy(buf+ptr, &tempnum, sizeof(int));
-		ptr += sizeof(int);
+		snapshot = snapshot_cookie(result);
+		if(snapshot == NULL)
+			return_code = SECURITY_SERVER_RETURN_CODE_SERVER_ERROR;
 	}
+	stats_unlock(&cookie_mutex);
 
-	ret = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(ret == SECURITY_SERVER_ERROR_POLL)
+	if(snapshot == NULL)
 	{
-		SEC_SVR_DBG("%s", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
+		ret = send_generic_response(req, SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE,
+			return_code);
+		if(ret != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", ret);
+		}
 	}
-	if(ret == SECURITY_SERVER_ERROR_TIMEOUT)
+	else
 	{
-		SEC_SVR_DBG("%s", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
+		ret = send_one_cookie_info(&snapshot->entries[0], req);
+		if(ret != SECURITY_SERVER_SUCCESS)
+		{
+			SEC_SVR_DBG("ERROR: Cannot send cookie info response: %d", ret);
+		}
+		release_cookie_snapshot(snapshot);
 	}
+	return ret;
+}
 
-	/* Send to client */
-	ret = write(sockfd, buf, total_size);
+cookie_list *search_by_pid(cookie_list *list, const void *key)
+{
+	return search_cookie_from_pid(list, *(const int *)key);
+}
 
-	if(ret < total_size)
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	return SECURITY_SERVER_SUCCESS;
+cookie_list *search_by_cookie(cookie_list *list, const void *key)
+{
+	return search_cookie(list, key, 0);
 }
 
-int util_process_all_cookie(int sockfd, cookie_list* list)
+/* Request may carry the cursor to start after. Without it the dump starts *
+ * at the first cookie. Only the cookies that may fit in the page are *
+ * copied under the cookie lock, and the page is built from the copy */
+int util_process_all_cookie(request_context *req, cookie_list* list)
 {
-	unsigned char *buf = NULL;
+	unsigned char buf[SECURITY_SERVER_COOKIE_PAGE_LEN];
+	unsigned int cursor = 0;
+	cookie_list *current;
+	cookie_snapshot *snapshot;
 	int ret;
-	buf = get_all_cookie_info(list, &ret);
-	if(buf == NULL)
+
+	if(req->msg_len >= sizeof(int))
 	{
-		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+		ret = recv_request_data(req, &cursor, sizeof(int));
+		if(ret < (int)sizeof(int))
+		{
+			SEC_SVR_DBG("Received cursor size is too small: %d", ret);
+			return SECURITY_SERVER_ERROR_RECV_FAILED;
+		}
 	}
 
-	ret = send_all_cookie_info(buf, ret, sockfd);
+	stats_lock(&cookie_mutex);
+	current = list;
+	while(current != NULL && current->seq <= cursor)
+		current = current->next;
+	snapshot = copy_cookies(current, COOKIE_PAGE_WINDOW);
+	stats_unlock(&cookie_mutex);
+	if(snapshot == NULL)
+	{
+		return send_generic_response(req, SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SERVER_ERROR);
+	}
 
-	if(buf != NULL)
-		free(buf);
-	return ret;
+	ret = get_cookie_info_page(snapshot, buf, sizeof(buf));
+	release_cookie_snapshot(snapshot);
+
+	return send_response(req, SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_RESPONSE,
+			SECURITY_SERVER_RETURN_CODE_SUCCESS, buf, ret);
 }
-int util_process_cookie_from_pid(int sockfd, cookie_list* list)
+
+int util_process_cookie_from_pid(request_context *req, cookie_list* list)
 {
 	int pid, ret;
-	cookie_list *result = NULL;
 
-	ret = read(sockfd, &pid, sizeof(int));
+	ret = recv_request_data(req, &pid, sizeof(int));
 	if(ret < sizeof(int))
 	{
 		SEC_SVR_DBG("Received cookie size is too small: %d", ret);
@@ -301,65 +311,27 @@ int util_process_cookie_from_pid(int sockfd, cookie_list* list)
 	if(pid == 0)
 	{
 		SEC_SVR_DBG("%s", "ERROR: Default cookie is not allowed to be retrieved");
-		ret = send_generic_response(sockfd, SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE,
+		ret = send_generic_response(req, SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE,
 			SECURITY_SERVER_RETURN_CODE_BAD_REQUEST);
 		if(ret != SECURITY_SERVER_SUCCESS)
 		{
 			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", ret);
 		}
+		return ret;
 	}
-	result = search_cookie_from_pid(list, pid);
-	if(result == NULL)
-	{
-		ret = send_generic_response(sockfd, SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE,
-			SECURITY_SERVER_RETURN_CODE_NO_SUCH_COOKIE);
-		if(ret != SECURITY_SERVER_SUCCESS)
-		{
-			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", ret);
-		}
-	}
-	else
-	{
-		ret = send_one_cookie_info(result, sockfd);
-		if(ret != SECURITY_SERVER_SUCCESS)
-		{
-			SEC_SVR_DBG("ERROR: Cannot send cookie info response: %d", ret);
-		}
-	}
-	
-	return ret;
+	return send_cookie_info_from_search(req, list, search_by_pid, &pid);
 }
 
-int util_process_cookie_from_cookie(int sockfd, cookie_list* list)
+int util_process_cookie_from_cookie(request_context *req, cookie_list* list)
 {
 	unsigned char cookie[SECURITY_SERVER_COOKIE_LEN];
 	int ret;
-	cookie_list *result = NULL;
 
-	ret = read(sockfd, cookie, SECURITY_SERVER_COOKIE_LEN);
+	ret = recv_request_data(req, cookie, SECURITY_SERVER_COOKIE_LEN);
 	if(ret < SECURITY_SERVER_COOKIE_LEN)
 	{
 		SEC_SVR_DBG("Received cookie size is too small: %d", ret);
 		return SECURITY_SERVER_ERROR_RECV_FAILED;
 	}
-	result = search_cookie(list, cookie, 0);
-	if(result == NULL)
-	{
-		ret = send_generic_response(sockfd, SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_RESPONSE,
-			SECURITY_SERVER_RETURN_CODE_NO_SUCH_COOKIE);
-		if(ret != SECURITY_SERVER_SUCCESS)
-		{
-			SEC_SVR_DBG("ERROR: Cannot send generic response: %d", ret);
-		}
-	}
-	else
-	{
-		ret = send_one_cookie_info(result, sockfd);
-		if(ret != SECURITY_SERVER_SUCCESS)
-		{
-			SEC_SVR_DBG("ERROR: Cannot send cookie info response: %d", ret);
-		}
-	}
-	
-	return ret;
+	return send_cookie_info_from_search(req, list, search_by_cookie, cookie);
 }
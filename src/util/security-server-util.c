@@ -47,12 +47,16 @@
 	printf("%s [Options]\n", cmdline);
 	printf("%s\n", "[Options]");
 	printf("%s\n", "-a:\tList all active cookies ");
+	printf("%s\n", "-t:\tShow request counts and latencies");
+	printf("%s\n", "-l [level]:\tSet log level of security server. 0: none, 1: error, 2: info, 3: debug");
 	printf("%s\n", "-f [filename]:\tList a specific cookie information from file");
 	printf("%s\n", "\tThe file must contain binary form of cookie");
 	printf("%s\n", "-p [pid]:\tList a specific cookie information for a process by PID");
 	printf("%s\n", "-s [base64 encoded cookie]:\tList a specific cookie information for a process by given base64 encoded cookie value");
 	printf("%s\n", "Example:");
 	printf("%s -a\n", cmdline);
+	printf("%s -t\n", cmdline);
+	printf("%s -l 0\n", cmdline);
 	printf("%s -f /tmp/mycookie.bin\n", cmdline);
 	printf("%s -p 2115\n", cmdline);
 	printf("%s -s asC34fddaxd6NDVDA43GFD345TfCADF==\n", cmdline);
@@ -87,70 +91,48 @@ void printperm(const unsigned char *data, int num)
  * Message format
  *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
  * |---------------------------------------------------------------|
- * | version=0x01  |MessageID=0x51 |       Message Length = 0      |
+ * | version=0x01  |MessageID=0x51 |       Message Length = 4      |
+ * |---------------------------------------------------------------|
+ * |                        cursor (32bit)                         |
  * |---------------------------------------------------------------|
  */
-int send_all_cookie_info_request(int sockfd)
+int send_all_cookie_info_request(int sockfd, unsigned int cursor)
 {
 
 	basic_header hdr;
+	msg_builder msg;
 	int retval;
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_REQUEST;
-	hdr.msg_len = 0;
-
-	/* Check poll */
-	retval = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		printf("Error: %s\n", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		printf("Error: %s\n", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
+	hdr.msg_len = sizeof(cursor);
 
 	/* Send to server */
-	retval = write(sockfd, &hdr, sizeof(hdr));
-	if(retval < sizeof(hdr))
-	{
-		/* Write error */
-		printf("Error on write(): %d\n", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;	
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &cursor, sizeof(cursor));
+	retval = send_msg(sockfd, &msg);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		printf("Error on sending request: %d\n", retval);
+	return retval;
 }
 
-int recv_all_cookie_info(int sockfd)
+/* Receive and print one page of cookies. *index is the number of cookies *
+ * printed so far, *cursor is set to the next page, 0 if this is the last */
+int recv_all_cookie_info(int sockfd, int *index, unsigned int *cursor)
 {
-	int retval, total_cookie, ptr = 0, i, cmdline_len, perm_len, recved_pid;
+	int retval, page_cookie, ptr, i, cmdline_len, perm_len, recved_pid;
 	response_header hdr;
-	unsigned char *buf = NULL;
-
-	/* Check poll */
-	retval = check_socket_poll(sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		printf("Error: %s\n", "poll() error");
-		return SECURITY_SERVER_ERROR_RECV_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		printf("Error: %s\n", "poll() timeout");
-		return SECURITY_SERVER_ERROR_RECV_FAILED;
-	}
+	unsigned char buf[SECURITY_SERVER_COOKIE_PAGE_LEN];
 
 	/* Receive response */
-	retval = read(sockfd, &hdr, sizeof(response_header));
-	if(retval < sizeof(hdr) )
+	retval = recv_response(sockfd, &hdr, buf, sizeof(buf));
+	if(retval < 0)
 	{
 		/* Error on socket */
 		printf("Error: Receive failed %d\n", retval);
-		return  SECURITY_SERVER_ERROR_RECV_FAILED;
+		return retval;
 	}
 
 	if(hdr.return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
@@ -165,40 +147,41 @@ int recv_all_cookie_info(int sockfd)
 		return SECURITY_SERVER_ERROR_BAD_RESPONSE;
 	}
 
-	buf = malloc(hdr.basic_hdr.msg_len);
-	if(buf == NULL)
+	if(retval < 2 * (int)sizeof(int))
 	{
-		printf("Error: Out of memory\n");
-		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
-	}
-
-	retval = read(sockfd, buf, hdr.basic_hdr.msg_len);
-	if(retval < hdr.basic_hdr.msg_len)
-	{
-		printf("Error: receiving too small amount. %d, %d\n", retval,  hdr.basic_hdr.msg_len);
-		printhex(buf, retval);
-		if(buf != NULL)
-			free(buf);
+		printf("Error: receiving too small amount. %d\n", retval);
 		return SECURITY_SERVER_ERROR_BAD_RESPONSE;
 	}
 
-	memcpy(&total_cookie, buf, sizeof(int));
-	if(total_cookie == 0)
+	memcpy(&page_cookie, buf, sizeof(int));
+	memcpy(cursor, buf + sizeof(int), sizeof(int));
+	if(page_cookie == 0 && *index == 0)
 	{
 		printf("There is no cookie available\n");
-		if(buf != NULL)
-			free(buf);
 		return SECURITY_SERVER_SUCCESS;
 	}
-	ptr = sizeof(int);
-	printf("--------------------------------\n");
-	for(i=0;i<total_cookie;i++)
+	ptr = 2 * sizeof(int);
+	if(*index == 0)
+		printf("--------------------------------\n");
+	for(i=0;i<page_cookie;i++)
 	{
-		printf("%dth cookie:\n", i+1);
+		if(ptr + 2 * (int)sizeof(int) > retval)
+		{
+			printf("Error: malformed cookie page. %d, %d\n", ptr, retval);
+			return SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		}
 		memcpy(&cmdline_len, buf+ptr, sizeof(int));
 		ptr += sizeof(int);
 		memcpy(&perm_len, buf+ptr, sizeof(int));
 		ptr+= sizeof(int);
+		if(cmdline_len < 0 || perm_len < 0 || ptr + SECURITY_SERVER_COOKIE_LEN + (int)sizeof(int)
+				+ cmdline_len + perm_len * (int)sizeof(int) > retval)
+		{
+			printf("Error: malformed cookie page. %d, %d\n", ptr, retval);
+			return SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		}
+
+		printf("%dth cookie:\n", ++(*index));
 
 		printf("%s\n", "Cookie:");
 		printhex(buf + ptr, SECURITY_SERVER_COOKIE_LEN);
@@ -217,16 +200,14 @@ int recv_all_cookie_info(int sockfd)
 
 			printf("%s\n", "cmdline:");
 			printstr(buf + ptr, cmdline_len);
-			ptr += cmdline_len;
 
 			printf("%s\n", "Permissions (gids):");
-			printperm(buf + ptr, perm_len);
-			ptr += (perm_len * sizeof(int));
+			printperm(buf + ptr + cmdline_len, perm_len);
 		}
+		/* Skip the whole entry. Default cookie has them too */
+		ptr += cmdline_len + (perm_len * sizeof(int));
 		printf("--------------------------------\n");
 	}
-	if(buf != NULL)
-		free(buf);
 	return SECURITY_SERVER_SUCCESS;
 }
 
@@ -246,40 +227,22 @@ int send_cookie_info_request_from_cookie(int sockfd, const unsigned char *cookie
 {
 
 	basic_header hdr;
+	msg_builder msg;
 	int retval;
-	int size = sizeof(hdr) + SECURITY_SERVER_COOKIE_LEN;
-	unsigned char buf[size];
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_COOKIE_REQUEST;
 	hdr.msg_len = SECURITY_SERVER_COOKIE_LEN;
 
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf + sizeof(hdr), cookie, SECURITY_SERVER_COOKIE_LEN);
-
-	/* Check poll */
-	retval = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		printf("Error: %s\n", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		printf("Error: %s\n", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-
 	/* Send to server */
-	retval = write(sockfd, buf, size);
-	if(retval < size)
-	{
-		/* Write error */
-		printf("Error on write(): %d\n", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;	
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, cookie, SECURITY_SERVER_COOKIE_LEN);
+	retval = send_msg(sockfd, &msg);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		printf("Error on sending request: %d\n", retval);
+	return retval;
 }
 
 /* Send cookie information request from pid packet to security server *
@@ -295,39 +258,22 @@ int send_cookie_info_request_from_cookie(int sockfd, const unsigned char *cookie
 int send_cookie_info_request_from_pid(int sockfd, int pid)
 {
 	basic_header hdr;
+	msg_builder msg;
 	int retval;
-	int size = sizeof(hdr) + sizeof(int);
-	unsigned char buf[size];
 
 	/* Assemble header */
 	hdr.version = SECURITY_SERVER_MSG_VERSION;
 	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_PID_REQUEST;
 	hdr.msg_len = SECURITY_SERVER_COOKIE_LEN;
-	memcpy(buf, &hdr, sizeof(hdr));
-	memcpy(buf+sizeof(hdr), &pid, sizeof(int));
-
-	/* Check poll */
-	retval = check_socket_poll(sockfd, POLLOUT, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND);
-	if(retval == SECURITY_SERVER_ERROR_POLL)
-	{
-		printf("Error: %s\n", "poll() error");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	if(retval == SECURITY_SERVER_ERROR_TIMEOUT)
-	{
-		printf("Error: %s\n", "poll() timeout");
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
 
 	/* Send to server */
-	retval = write(sockfd, buf, size);
-	if(retval < size)
-	{
-		/* Write error */
-		printf("Error on write(): %d\n", retval);
-		return SECURITY_SERVER_ERROR_SEND_FAILED;
-	}
-	return SECURITY_SERVER_SUCCESS;	
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &pid, sizeof(int));
+	retval = send_msg(sockfd, &msg);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		printf("Error on sending request: %d\n", retval);
+	return retval;
 }
 
 int recv_cookie_info_response(sockfd)
@@ -421,10 +367,225 @@ int recv_cookie_info_response(sockfd)
 }
 
 void util_send_all_cookie_info_request(void)
+{
+	int sockfd = -1, retval, index = 0;
+	unsigned int cursor = 0;
+
+	/* One page per connection, until the server says it was the last */
+	do
+	{
+		retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE, SOCK_STREAM);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			/* Error on socket */
+			printf("Error: %s\n", "connection failed");
+			goto error;
+		}
+
+		/* make request packet */
+		retval = send_all_cookie_info_request(sockfd, cursor);
+		if(retval != SECURITY_SERVER_SUCCESS)
+		{
+			/* Error on socket */
+			SEC_SVR_DBG("Error: send request failed: %d", retval);
+			goto error;
+		}
+		retval = recv_all_cookie_info(sockfd, &index, &cursor);
+		if(retval <0)
+		{
+			printf("Error: Error receiving cookie list: %d\n", retval);
+			goto error;
+		}
+		close(sockfd);
+		sockfd = -1;
+	} while(cursor != 0);
+
+error:
+	if(sockfd > 0)
+	{
+		close(sockfd);
+	}
+	return;
+}
+
+/* Send stats request packet to security server *
+ * 
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x1f |       Message Length = 0      |
+ * |---------------------------------------------------------------|
+ */
+int send_stats_request(int sockfd)
+{
+	basic_header hdr;
+	msg_builder msg;
+	int retval;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_GET_STATS_REQUEST;
+	hdr.msg_len = 0;
+
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	retval = send_msg(sockfd, &msg);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		printf("Error on sending request: %d\n", retval);
+	return retval;
+}
+
+const char *stat_name(unsigned int id)
+{
+	switch(id)
+	{
+		case SECURITY_SERVER_MSG_TYPE_COOKIE_REQUEST: return "cookie";
+		case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_REQUEST: return "check_privilege";
+		case SECURITY_SERVER_MSG_TYPE_OBJECT_NAME_REQUEST: return "object_name";
+		case SECURITY_SERVER_MSG_TYPE_GID_REQUEST: return "gid";
+		case SECURITY_SERVER_MSG_TYPE_PID_REQUEST: return "pid";
+		case SECURITY_SERVER_MSG_TYPE_TOOL_REQUEST: return "tool";
+		case SECURITY_SERVER_MSG_TYPE_VALID_PWD_REQUEST: return "valid_pwd";
+		case SECURITY_SERVER_MSG_TYPE_SET_PWD_REQUEST: return "set_pwd";
+		case SECURITY_SERVER_MSG_TYPE_RESET_PWD_REQUEST: return "reset_pwd";
+		case SECURITY_SERVER_MSG_TYPE_CHK_PWD_REQUEST: return "chk_pwd";
+		case SECURITY_SERVER_MSG_TYPE_SET_PWD_HISTORY_REQUEST: return "set_pwd_history";
+		case SECURITY_SERVER_MSG_TYPE_CHECK_PRIVILEGE_NEW_REQUEST: return "check_privilege_new";
+		case SECURITY_SERVER_MSG_TYPE_SET_PWD_MAX_CHALLENGE_REQUEST: return "set_pwd_max_challenge";
+		case SECURITY_SERVER_MSG_TYPE_SET_PWD_VALIDITY_REQUEST: return "set_pwd_validity";
+		case SECURITY_SERVER_MSG_TYPE_SHM_CHANNEL_REQUEST: return "shm_channel";
+		case SECURITY_SERVER_MSG_TYPE_GET_STATS_REQUEST: return "get_stats";
+		case SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_REQUEST: return "set_log_level";
+		case SECURITY_SERVER_MSG_TYPE_PREPARE_COOKIE_REQUEST: return "prepare_cookie";
+		case SECURITY_SERVER_MSG_TYPE_SUBSCRIBE_REVOCATION_REQUEST: return "subscribe_revocation";
+		case SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_REQUEST: return "get_all_cookies";
+		case SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_PID_REQUEST: return "cookieinfo_from_pid";
+		case SECURITY_SERVER_MSG_TYPE_GET_COOKIEINFO_FROM_COOKIE_REQUEST: return "cookieinfo_from_cookie";
+		case 0x100: return "(unknown message)";
+		case 0x101: return "(wait for thread)";
+		case 0x102: return "(wait for cookie_mutex)";
+		case 0x103: return "(read /proc)";
+		case 0x104: return "(lingering close)";
+		case 0x105: return "(shed as busy)";
+		case 0x106: return "(expired)";
+		default: return "?";
+	}
+}
+
+/* Upper bound of a histogram bucket in microseconds */
+unsigned int bucket_limit(int bucket)
+{
+	int msb;
+
+	if(bucket < 4)
+		return bucket;
+	msb = bucket / 4 + 1;
+	return (1U << msb) + ((unsigned int)(bucket % 4 + 1) << (msb - 2)) - 1;
+}
+
+/* Bucket bound is clipped to the max, which is exact */
+unsigned int bucket_percentile(const unsigned int *buckets, int num_buckets, unsigned int count,
+		unsigned int max_usec, int percent)
+{
+	unsigned long long seen = 0, target = ((unsigned long long)count * percent + 99) / 100;
+	int i;
+
+	for(i = 0; i < num_buckets; i++)
+	{
+		seen += buckets[i];
+		if(seen >= target)
+			break;
+	}
+	if(i == num_buckets || bucket_limit(i) > max_usec)
+		return max_usec;
+	return bucket_limit(i);
+}
+
+int recv_stats(int sockfd)
+{
+	int retval, ptr, row_size;
+	unsigned int num, num_buckets, i, id, count, max_usec;
+	unsigned long long total_usec;
+	unsigned int buckets[256];
+	response_header hdr;
+	unsigned char *buf;
+
+	buf = malloc(0xffff);
+	if(buf == NULL)
+	{
+		printf("Error: Out of memory\n");
+		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+	}
+
+	retval = recv_response(sockfd, &hdr, buf, 0xffff);
+	if(retval < 0)
+	{
+		printf("Error: Receive failed %d\n", retval);
+		goto error;
+	}
+	if(hdr.return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
+	{
+		printf("Error: response error: %d\n", hdr.return_code);
+		retval = return_code_to_error_code(hdr.return_code);
+		goto error;
+	}
+	if(hdr.basic_hdr.msg_id != SECURITY_SERVER_MSG_TYPE_GET_STATS_RESPONSE || retval < 2 * (int)sizeof(int))
+	{
+		printf("Error: response error: different msg type %d\n", hdr.basic_hdr.msg_id);
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+
+	memcpy(&num, buf, sizeof(int));
+	memcpy(&num_buckets, buf + sizeof(int), sizeof(int));
+	if(num_buckets == 0 || num_buckets > 256)
+	{
+		printf("Error: bad number of buckets %u\n", num_buckets);
+		retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		goto error;
+	}
+	row_size = 3 * sizeof(int) + sizeof(unsigned long long) + num_buckets * sizeof(int);
+	ptr = 2 * sizeof(int);
+
+	printf("%-26s %10s %10s %10s %10s %10s\n", "request", "count", "avg(us)", "p50(us)", "p99(us)", "max(us)");
+	for(i = 0; i < num; i++)
+	{
+		if(ptr + row_size > retval)
+		{
+			printf("Error: malformed stats. %d, %d\n", ptr, retval);
+			retval = SECURITY_SERVER_ERROR_BAD_RESPONSE;
+			goto error;
+		}
+		memcpy(&id, buf + ptr, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(&count, buf + ptr, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(&max_usec, buf + ptr, sizeof(int));
+		ptr += sizeof(int);
+		memcpy(&total_usec, buf + ptr, sizeof(unsigned long long));
+		ptr += sizeof(unsigned long long);
+		memcpy(buckets, buf + ptr, num_buckets * sizeof(int));
+		ptr += num_buckets * sizeof(int);
+
+		printf("%-26s %10u %10llu %10u %10u %10u\n", stat_name(id), count,
+				count ? total_usec / count : 0,
+				bucket_percentile(buckets, num_buckets, count, max_usec, 50),
+				bucket_percentile(buckets, num_buckets, count, max_usec, 99),
+				max_usec);
+	}
+	retval = SECURITY_SERVER_SUCCESS;
+
+error:
+	free(buf);
+	return retval;
+}
+
+void util_send_stats_request(void)
 {
 	int sockfd = -1, retval;
 
-	retval = connect_to_server(&sockfd);
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE, SOCK_STREAM);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -433,17 +594,17 @@ void util_send_all_cookie_info_request(void)
 	}
 
 	/* make request packet */
-	retval = send_all_cookie_info_request(sockfd);
+	retval = send_stats_request(sockfd);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
 		SEC_SVR_DBG("Error: send request failed: %d", retval);
 		goto error;
 	}
-	retval = recv_all_cookie_info(sockfd);
+	retval = recv_stats(sockfd);
 	if(retval <0)
 	{
-		printf("Error: Error receiving cookie list: %d\n", retval);
+		printf("Error: Error receiving stats: %d\n", retval);
 		goto error;
 	}
 
@@ -455,6 +616,74 @@ error:
 	return;
 }
 
+/* Send log level request packet to security server *
+ * 
+ * Message format
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * |---------------------------------------------------------------|
+ * | version=0x01  |MessageID=0x21 |       Message Length = 1      |
+ * |---------------------------------------------------------------|
+ * |     level     |
+ * |----------------
+ */
+int send_log_level_request(int sockfd, unsigned char level)
+{
+	basic_header hdr;
+	msg_builder msg;
+	int retval;
+
+	/* Assemble header */
+	hdr.version = SECURITY_SERVER_MSG_VERSION;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_SET_LOG_LEVEL_REQUEST;
+	hdr.msg_len = sizeof(level);
+
+	/* Send to server */
+	init_msg_builder(&msg);
+	append_msg(&msg, &hdr, sizeof(hdr));
+	append_msg(&msg, &level, sizeof(level));
+	retval = send_msg(sockfd, &msg);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		printf("Error on sending request: %d\n", retval);
+	return retval;
+}
+
+void util_send_log_level_request(const char *level)
+{
+	int sockfd = -1, retval;
+	response_header hdr;
+
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE, SOCK_STREAM);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		printf("Error: %s\n", "connection failed");
+		goto error;
+	}
+
+	/* make request packet */
+	retval = send_log_level_request(sockfd, (unsigned char)atoi(level));
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		/* Error on socket */
+		SEC_SVR_DBG("Error: send request failed: %d", retval);
+		goto error;
+	}
+	retval = recv_generic_response(sockfd, &hdr);
+	if(retval < 0 || hdr.return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
+	{
+		printf("Error: Cannot set log level: %d, %d\n", retval, hdr.return_code);
+		goto error;
+	}
+	printf("Log level has been set to %s\n", level);
+
+error:
+	if(sockfd > 0)
+	{
+		close(sockfd);
+	}
+	return;
+}
+
 void util_read_cookie_from_bin_file(unsigned char *cookie, const char *path)
 {
 	char total_path[TOTAL_PATH_MAX] = {0, };
@@ -499,7 +728,7 @@ void util_send_cookie_info_request_from_cookie(unsigned char *cookie)
 {
 	int sockfd = -1, retval;
 
-	retval = connect_to_server(&sockfd);
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE, SOCK_STREAM);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -675,7 +904,7 @@ void util_send_cookie_info_request_from_pid(const char *str_pid)
 		return;
 	}
 
-	retval = connect_to_server(&sockfd);
+	retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE, SOCK_STREAM);
 	if(retval != SECURITY_SERVER_SUCCESS)
 	{
 		/* Error on socket */
@@ -740,6 +969,19 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if(strcmp(argv[1], "-t") == 0)
+	{
+		if(argc != 2)
+		{
+			printf("Wrong usage: %d\n", argc);
+			printusage(argv[0]);
+			exit(1);
+		}
+
+		util_send_stats_request();
+		exit(0);
+	}
+
 	if(argc < 3)
 	{
 		printf("Wrong usage: %d\n", argc);
@@ -754,6 +996,12 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if(strcmp(argv[1], "-l") == 0)
+	{
+		util_send_log_level_request(argv[2]);
+		exit(0);
+	}
+
 	if(strcmp(argv[1], "-p") == 0)
 	{
 		util_send_cookie_info_request_from_pid(argv[2]);
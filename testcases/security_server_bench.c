@@ -0,0 +1,477 @@
+/*
+ * security server
+ *
+ * Copyright (c) 2000 - 2010 Samsung Electronics Co., Ltd.
+ * Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ */
+
+/* Load generator for security-server *
+ *
+ * Forks simulated applications, which request cookies, and simulated
+ * middleware daemons, which check privileges of those cookies with
+ * security_server_check_privilege() and _by_cookie() in a given mix.
+ * Each process sends requests at a fixed rate or as fast as it can, and
+ * throughput and latency percentiles are reported per request type.
+ *
+ * With a fixed rate, latency is measured from the time the request was
+ * scheduled, so a stalled server is not hidden by the client slowing down.
+ *
+ * security-server must be running. Middleware processes must run as root
+ * and the path of this program must be listed in mw-list */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+
+#include "security-server.h"
+
+#define BENCH_MAX_PROCS			256
+#define BENCH_MAX_SAMPLES		1000000	/* Per process and request type */
+#define BENCH_COOKIE_LEN		20
+
+#define OP_COOKIE			0
+#define OP_CHECK_PRIVILEGE		1
+#define OP_CHECK_PRIVILEGE_NEW		2
+#define NUM_OPS				3
+
+static const char *op_names[NUM_OPS] = {"request_cookie", "check_privilege", "check_privilege_new"};
+
+struct bench_config {
+	int apps;
+	int middlewares;
+	int duration;		/* seconds */
+	int rate;		/* requests per second per process, 0 for no limit */
+	int new_percent;	/* check_privilege_new among middleware requests */
+	int use_channel;
+	uid_t app_uid;
+	gid_t gid;
+	const char *object;
+	const char *access;
+};
+
+/* Cookies of simulated apps, shared with the middleware processes */
+struct cookie_slot {
+	volatile int valid;
+	char cookie[BENCH_COOKIE_LEN];
+};
+
+struct op_result {
+	unsigned int count;	/* Successful requests */
+	unsigned int errors;
+	int last_error;
+	unsigned int kept;	/* Samples kept, at most BENCH_MAX_SAMPLES */
+	unsigned int *samples;	/* Latency in ns */
+};
+
+static long long now_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(long long when)
+{
+	struct timespec ts;
+
+	ts.tv_sec = when / 1000000000LL;
+	ts.tv_nsec = when % 1000000000LL;
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int compare_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+static void record(struct op_result *res, long long start, int retval)
+{
+	long long elapsed = now_nsec() - start;
+
+	if(retval < 0)
+	{
+		res->errors++;
+		res->last_error = retval;
+		return;
+	}
+	if(res->kept < BENCH_MAX_SAMPLES)
+		res->samples[res->kept++] = elapsed > 0xffffffffLL ? 0xffffffff : (unsigned int)elapsed;
+	res->count++;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while(done < len)
+	{
+		ret = write(fd, (const char *)buf + done, len - done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
+
+/* Write results of a process to the parent: per op count, errors, last *
+ * error, number of samples, then the samples */
+static int send_results(int fd, struct op_result *res)
+{
+	unsigned int hdr[4];
+	int i;
+
+	for(i = 0; i < NUM_OPS; i++)
+	{
+		hdr[0] = res[i].count;
+		hdr[1] = res[i].errors;
+		hdr[2] = (unsigned int)res[i].last_error;
+		hdr[3] = res[i].kept;
+		if(write_full(fd, hdr, sizeof(hdr)) != 0)
+			return -1;
+		if(write_full(fd, res[i].samples, res[i].kept * sizeof(unsigned int)) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	size_t done = 0;
+	ssize_t ret;
+
+	while(done < len)
+	{
+		ret = read(fd, (char *)buf + done, len - done);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			return -1;
+		done += ret;
+	}
+	return 0;
+}
+
+/* Pick a cookie of a running simulated app */
+static const char *pick_cookie(struct cookie_slot *slots, int num, unsigned int *seed)
+{
+	int i, start;
+
+	if(num == 0)
+		return NULL;
+	start = rand_r(seed) % num;
+	for(i = 0; i < num; i++)
+	{
+		if(slots[(start + i) % num].valid)
+			return slots[(start + i) % num].cookie;
+	}
+	return NULL;
+}
+
+static void run_process(const struct bench_config *conf, int is_app, int index,
+		struct cookie_slot *slots, int start_fd, int result_fd)
+{
+	struct op_result res[NUM_OPS];
+	char cookie[BENCH_COOKIE_LEN];
+	const char *target;
+	unsigned int seed = getpid();
+	long long start, end, next, interval = 0;
+	int i, retval, op;
+	char c;
+
+	memset(res, 0, sizeof(res));
+	for(i = 0; i < NUM_OPS; i++)
+	{
+		res[i].samples = malloc(BENCH_MAX_SAMPLES * sizeof(unsigned int));
+		if(res[i].samples == NULL)
+			exit(1);
+	}
+
+	if(is_app && conf->app_uid != 0 && setuid(conf->app_uid) != 0)
+	{
+		fprintf(stderr, "setuid(%d) failed: %s\n", conf->app_uid, strerror(errno));
+		exit(1);
+	}
+
+	/* Apps publish a cookie first so middleware has something to check */
+	if(is_app)
+	{
+		retval = security_server_request_cookie(cookie, sizeof(cookie));
+		if(retval == SECURITY_SERVER_API_SUCCESS)
+		{
+			memcpy(slots[index].cookie, cookie, sizeof(cookie));
+			__sync_synchronize();
+			slots[index].valid = 1;
+		}
+	}
+	else if(conf->use_channel)
+	{
+		retval = security_server_open_channel();
+		if(retval != SECURITY_SERVER_API_SUCCESS)
+			fprintf(stderr, "Cannot open channel: %d. Using socket\n", retval);
+	}
+
+	/* Wait for everyone to be ready */
+	while(read(start_fd, &c, 1) < 0 && errno == EINTR);
+
+	if(conf->rate > 0)
+		interval = 1000000000LL / conf->rate;
+	next = now_nsec();
+	end = next + conf->duration * 1000000000LL;
+	while(1)
+	{
+		if(interval > 0)
+		{
+			sleep_until(next);
+			start = next;
+			next += interval;
+		}
+		else
+			start = now_nsec();
+		if(start >= end)
+			break;
+
+		if(is_app)
+		{
+			retval = security_server_request_cookie(cookie, sizeof(cookie));
+			record(&res[OP_COOKIE], start, retval);
+			continue;
+		}
+
+		target = pick_cookie(slots, conf->apps, &seed);
+		if(target == NULL)
+		{
+			/* No app is running. Check own cookie */
+			retval = security_server_request_cookie(cookie, sizeof(cookie));
+			if(retval != SECURITY_SERVER_API_SUCCESS)
+			{
+				record(&res[OP_COOKIE], start, retval);
+				continue;
+			}
+			target = cookie;
+			start = now_nsec();
+		}
+		op = (int)(rand_r(&seed) % 100) < conf->new_percent ? OP_CHECK_PRIVILEGE_NEW : OP_CHECK_PRIVILEGE;
+		if(op == OP_CHECK_PRIVILEGE)
+			retval = security_server_check_privilege(target, conf->gid);
+		else
+			retval = security_server_check_privilege_by_cookie(target, conf->object, conf->access);
+		/* Denial is a valid answer */
+		if(retval == SECURITY_SERVER_API_ERROR_ACCESS_DENIED)
+			retval = SECURITY_SERVER_API_SUCCESS;
+		record(&res[op], start, retval);
+	}
+
+	if(!is_app && conf->use_channel)
+		security_server_close_channel();
+	send_results(result_fd, res);
+	exit(0);
+}
+
+static void print_op(const char *name, struct op_result *res, int duration)
+{
+	unsigned int num = res->kept, i;
+	double total = 0;
+
+	if(res->count == 0 && res->errors == 0)
+		return;
+	printf("%-20s %9u req %10.1f req/s %7u errors", name, res->count,
+			(double)res->count / duration, res->errors);
+	if(res->errors > 0)
+		printf(" (last %d)", res->last_error);
+	printf("\n");
+	if(num == 0)
+		return;
+
+	for(i = 0; i < num; i++)
+		total += res->samples[i];
+	qsort(res->samples, num, sizeof(unsigned int), compare_uint);
+	printf("%-20s avg=%8.2fus p50=%8.2fus p99=%8.2fus p999=%8.2fus max=%8.2fus\n", "",
+			total / 1000.0 / num,
+			res->samples[num / 2] / 1000.0,
+			res->samples[(unsigned long long)num * 99 / 100] / 1000.0,
+			res->samples[(unsigned long long)num * 999 / 1000] / 1000.0,
+			res->samples[num - 1] / 1000.0);
+}
+
+void printusage(char *cmdline)
+{
+	printf("%s\n", "Usage: ");
+	printf("%s [Options]\n", cmdline);
+	printf("%s\n", "[Options]");
+	printf("%s\n", "-a N:\tNumber of simulated apps requesting cookies (default 4)");
+	printf("%s\n", "-m N:\tNumber of simulated middleware daemons checking privileges (default 2)");
+	printf("%s\n", "-d sec:\tDuration in seconds (default 10)");
+	printf("%s\n", "-r N:\tRequests per second of each process, 0 for no limit (default 0)");
+	printf("%s\n", "-n pct:\tPercentage of check_privilege_new among middleware requests (default 50)");
+	printf("%s\n", "-c:\tMiddleware uses shared-memory channel");
+	printf("%s\n", "-u uid:\tUID the apps run as (default: don't change)");
+	printf("%s\n", "-g gid:\tGID checked by check_privilege (default 6001)");
+	printf("%s\n", "-o label:\tObject label checked by check_privilege_new (default \"_\")");
+	printf("%s\n", "-x rights:\tAccess rights checked by check_privilege_new (default \"r\")");
+	printf("%s\n", "Example:");
+	printf("%s -a 8 -m 4 -d 30 -r 200 -n 80\n", cmdline);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_config conf;
+	struct cookie_slot *slots;
+	struct op_result total[NUM_OPS];
+	pid_t pids[BENCH_MAX_PROCS];
+	int result_fds[BENCH_MAX_PROCS];
+	int start_pipe[2], result_pipe[2];
+	unsigned int hdr[4], keep, *buf;
+	int opt, i, j, num_procs;
+	long long started;
+	double elapsed;
+
+	memset(&conf, 0, sizeof(conf));
+	conf.apps = 4;
+	conf.middlewares = 2;
+	conf.duration = 10;
+	conf.new_percent = 50;
+	conf.gid = 6001;
+	conf.object = "_";
+	conf.access = "r";
+
+	while((opt = getopt(argc, argv, "a:m:d:r:n:cu:g:o:x:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'a': conf.apps = atoi(optarg); break;
+			case 'm': conf.middlewares = atoi(optarg); break;
+			case 'd': conf.duration = atoi(optarg); break;
+			case 'r': conf.rate = atoi(optarg); break;
+			case 'n': conf.new_percent = atoi(optarg); break;
+			case 'c': conf.use_channel = 1; break;
+			case 'u': conf.app_uid = atoi(optarg); break;
+			case 'g': conf.gid = atoi(optarg); break;
+			case 'o': conf.object = optarg; break;
+			case 'x': conf.access = optarg; break;
+			default:
+				printusage(argv[0]);
+				return 1;
+		}
+	}
+	num_procs = conf.apps + conf.middlewares;
+	if(conf.apps < 0 || conf.middlewares < 0 || num_procs == 0 || num_procs > BENCH_MAX_PROCS
+			|| conf.duration <= 0 || conf.rate < 0 || conf.new_percent < 0 || conf.new_percent > 100)
+	{
+		printusage(argv[0]);
+		return 1;
+	}
+	if(security_server_get_cookie_size() != BENCH_COOKIE_LEN)
+	{
+		printf("Unexpected cookie size %d\n", security_server_get_cookie_size());
+		return 1;
+	}
+
+	slots = mmap(NULL, sizeof(struct cookie_slot) * (conf.apps + 1), PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(slots == MAP_FAILED || pipe(start_pipe) != 0)
+	{
+		printf("%s\n", "Cannot set up shared memory or pipe");
+		return 1;
+	}
+
+	for(i = 0; i < num_procs; i++)
+	{
+		if(pipe(result_pipe) != 0)
+		{
+			printf("pipe() failed: %s\n", strerror(errno));
+			return 1;
+		}
+		pids[i] = fork();
+		if(pids[i] < 0)
+		{
+			printf("fork() failed: %s\n", strerror(errno));
+			return 1;
+		}
+		if(pids[i] == 0)
+		{
+			close(start_pipe[1]);
+			close(result_pipe[0]);
+			run_process(&conf, i < conf.apps, i, slots, start_pipe[0], result_pipe[1]);
+		}
+		close(result_pipe[1]);
+		result_fds[i] = result_pipe[0];
+	}
+
+	/* Let apps get their first cookie, then start all at once */
+	for(i = 0; i < 100; i++)
+	{
+		for(j = 0; j < conf.apps && slots[j].valid; j++);
+		if(j == conf.apps)
+			break;
+		usleep(10000);
+	}
+	close(start_pipe[0]);
+	started = now_nsec();
+	close(start_pipe[1]);
+
+	memset(total, 0, sizeof(total));
+	buf = malloc(BENCH_MAX_SAMPLES * sizeof(unsigned int));
+	for(j = 0; j < NUM_OPS; j++)
+	{
+		total[j].samples = malloc(BENCH_MAX_SAMPLES * sizeof(unsigned int));
+		if(total[j].samples == NULL || buf == NULL)
+		{
+			printf("%s\n", "Out of memory");
+			return 1;
+		}
+	}
+
+	/* Collect results. Samples are merged, keeping at most *
+	 * BENCH_MAX_SAMPLES per type for the percentiles */
+	for(i = 0; i < num_procs; i++)
+	{
+		for(j = 0; j < NUM_OPS; j++)
+		{
+			if(read_full(result_fds[i], hdr, sizeof(hdr)) != 0 || hdr[3] > BENCH_MAX_SAMPLES)
+			{
+				printf("Process %d did not report results\n", pids[i]);
+				break;
+			}
+			total[j].count += hdr[0];
+			total[j].errors += hdr[1];
+			if(hdr[1] > 0)
+				total[j].last_error = (int)hdr[2];
+			if(read_full(result_fds[i], buf, hdr[3] * sizeof(unsigned int)) != 0)
+			{
+				printf("Process %d did not report results\n", pids[i]);
+				break;
+			}
+			keep = BENCH_MAX_SAMPLES - total[j].kept;
+			if(keep > hdr[3])
+				keep = hdr[3];
+			memcpy(total[j].samples + total[j].kept, buf, keep * sizeof(unsigned int));
+			total[j].kept += keep;
+		}
+		close(result_fds[i]);
+		waitpid(pids[i], NULL, 0);
+	}
+	elapsed = (now_nsec() - started) / 1000000000.0;
+
+	printf("%d apps, %d middleware, %d s, rate %d/s per process%s\n", conf.apps, conf.middlewares,
+			conf.duration, conf.rate, conf.use_channel ? ", channel" : "");
+	for(j = 0; j < NUM_OPS; j++)
+		print_op(op_names[j], &total[j], conf.duration);
+	printf("Wall time %.2f s\n", elapsed);
+
+	if(total[OP_CHECK_PRIVILEGE].last_error == SECURITY_SERVER_API_ERROR_AUTHENTICATION_FAILED
+			|| total[OP_CHECK_PRIVILEGE_NEW].last_error == SECURITY_SERVER_API_ERROR_AUTHENTICATION_FAILED)
+		printf("Middleware must run as root and %s must be listed in mw-list\n", argv[0]);
+	return 0;
+}
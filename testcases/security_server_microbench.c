@@ -0,0 +1,542 @@
+/*
+ * security server
+ *
+ * Copyright (c) 2000 - 2010 Samsung Electronics Co., Ltd.
+ * Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ */
+
+/* Microbenchmarks of the server's lookup and storage primitives *
+ *
+ * Each primitive is called directly, without a running server, against a *
+ * sandbox of fake /proc, group file, mw-list and password directory that the *
+ * benchmark creates under /tmp and removes on exit. Lookups always search *
+ * for the last entry, which is the worst case of the linear paths. *
+ * Debug messages are compiled out, so only the primitive itself is timed.
+ *
+ * Output is one line per primitive and size:
+ *  name/size  iterations  average and minimum time of one call */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+#include "security-server-config.h"
+#include "security-server-cookie.h"
+#include "security-server-group.h"
+#include "security-server-password.h"
+
+#define BENCH_DEFAULT_MIN_MSEC		200
+#define BENCH_MIN_ITERATIONS		10
+#define BENCH_LIVE_PID_BASE		100000	/* Have a directory in fake /proc */
+#define BENCH_DEAD_PID_BASE		200000	/* Don't */
+#define BENCH_GID_BASE			20000
+#define BENCH_OBJECT			"bench-object"
+#define BENCH_ACCESS			"rx"
+
+typedef struct
+{
+	const char	*name;
+	const int	*sizes;				/* Zero terminated */
+	int		(*setup)(int size);
+	void		(*prepare)(int size);		/* Untimed, before each call. Optional */
+	int		(*run)(int size);
+	void		(*teardown)(int size);
+} microbench;
+
+static char sandbox[64];
+static cookie_list *bench_list = NULL;
+static int num_proc_dirs = 0;
+static unsigned char bench_pwd[SECURITY_SERVER_HASHED_PWD_LEN];
+
+static const int cookie_sizes[] = {10, 100, 1000, 10000, 0};
+static const int group_sizes[] = {10, 100, 1000, 10000, 0};
+static const int mw_sizes[] = {10, 100, 1000, 0};
+/* check_history() removes files beyond the history, the newest of which *
+ * is never counted. So the largest stable directory is one smaller */
+static const int pwd_sizes[] = {1, 10, SECURITY_SERVER_MAX_PASSWORD_HISTORY - 1, 0};
+
+static long long now_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int write_file(const char *path, const char *data, int len)
+{
+	FILE *fp;
+	int ret;
+
+	fp = fopen(path, "w");
+	if(fp == NULL)
+	{
+		printf("Cannot create %s\n", path);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	ret = fwrite(data, 1, len, fp);
+	fclose(fp);
+	if(ret != len)
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+	remove(path);
+	return 0;
+}
+
+static void remove_sandbox(void)
+{
+	if(sandbox[0] != 0)
+		nftw(sandbox, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* Create sandbox directory and load a config pointing into it */
+static int create_sandbox(void)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH], config[1024];
+	int len;
+
+	snprintf(sandbox, sizeof(sandbox), "%s", "/tmp/security-server-microbench.XXXXXX");
+	if(mkdtemp(sandbox) == NULL)
+	{
+		sandbox[0] = 0;
+		printf("%s\n", "Cannot create sandbox directory");
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+
+	snprintf(path, sizeof(path), "%s/proc", sandbox);
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/data", sandbox);
+	mkdir(path, 0700);
+
+	len = snprintf(config, sizeof(config),
+			"root = %s\n"
+			"proc = %s/proc\n"
+			"group_file = %s/group\n"
+			"mw_list = %s/mw-list\n"
+			"data_dir = %s/data\n"
+			"default_cookie = %s/cookie\n"
+			"smack = stub\n"
+			"privileged_uid = self\n",
+			sandbox, sandbox, sandbox, sandbox, sandbox, sandbox);
+	snprintf(path, sizeof(path), "%s/config", sandbox);
+	if(write_file(path, config, len) != SECURITY_SERVER_SUCCESS)
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	return load_config(path);
+}
+
+/* Fake /proc/[PID] directories for live cookies *
+ * Only existence is checked by garbage collection */
+static int create_proc_dirs(int num)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH], data[128];
+	int pid, len;
+
+	for(; num_proc_dirs < num; num_proc_dirs++)
+	{
+		pid = BENCH_LIVE_PID_BASE + num_proc_dirs;
+		snprintf(path, sizeof(path), "%s/proc/%d", sandbox, pid);
+		if(mkdir(path, 0700) != 0)
+		{
+			printf("Cannot create %s\n", path);
+			return SECURITY_SERVER_ERROR_FILE_OPERATION;
+		}
+
+		/* Liveness is checked by start time, which is the pid here */
+		snprintf(path, sizeof(path), "%s/proc/%d/stat", sandbox, pid);
+		len = snprintf(data, sizeof(data),
+				"%d (bench-app) S 1 1 1 0 -1 4194304 0 0 0 0 0 0 0 0 20 0 1 0 %d 0 0\n", pid, pid);
+		if(write_file(path, data, len) != SECURITY_SERVER_SUCCESS)
+			return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* cmdline and status of a fake process, as create_cookie_item() reads them */
+static int create_proc_files(int pid)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH], data[128];
+	int len;
+
+	snprintf(path, sizeof(path), "%s/proc/%d/cmdline", sandbox, pid);
+	len = snprintf(data, sizeof(data), "/usr/bin/bench-app-%d", pid) + 1;
+	if(write_file(path, data, len) != SECURITY_SERVER_SUCCESS)
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+
+	snprintf(path, sizeof(path), "%s/proc/%d/status", sandbox, pid);
+	len = snprintf(data, sizeof(data), "Name:\tbench-app\nPid:\t%d\nGroups:\t%d %d %d\n",
+			pid, BENCH_GID_BASE, BENCH_GID_BASE + 1, BENCH_GID_BASE + 2);
+	return write_file(path, data, len);
+}
+
+static void cookie_of(unsigned char *cookie, int num)
+{
+	memset(cookie, 0xa5, SECURITY_SERVER_COOKIE_LEN);
+	memcpy(cookie, &num, sizeof(num));
+}
+
+/* Append a cookie item the way create_cookie_item() fills it */
+static cookie_list *append_cookie(cookie_list *last, int num, int pid)
+{
+	cookie_list *added;
+	char path[64];
+
+	added = calloc(1, sizeof(cookie_list));
+	if(added == NULL)
+		return NULL;
+	cookie_of(added->cookie, num);
+	added->path_len = snprintf(path, sizeof(path), "/usr/bin/bench-app-%d", pid);
+	added->path = strdup(path);
+	added->permission_len = 3;
+	added->permissions = malloc(sizeof(int) * 3);
+	added->smack_label = strdup("_");
+	added->pid = pid;
+	added->start_time = pid;
+	if(added->path == NULL || added->permissions == NULL || added->smack_label == NULL)
+	{
+		free_cookie_item(added);
+		return NULL;
+	}
+	added->permissions[0] = BENCH_GID_BASE;
+	added->permissions[1] = BENCH_GID_BASE + 1;
+	added->permissions[2] = BENCH_GID_BASE + 2;
+	if(last != NULL)
+	{
+		last->next = added;
+		added->prev = last;
+	}
+	return added;
+}
+
+static void free_cookie_list(void)
+{
+	cookie_list *next;
+
+	while(bench_list != NULL)
+	{
+		next = bench_list->next;
+		bench_list->next = NULL;
+		free_cookie_item(bench_list);
+		bench_list = next;
+	}
+}
+
+/* Default cookie followed by 'size' cookies of 'pid_base' + n */
+static int create_cookie_list(int size, int pid_base)
+{
+	cookie_list *last;
+	int i;
+
+	free_cookie_list();
+	bench_list = append_cookie(NULL, -1, 0);
+	last = bench_list;
+	for(i = 0; i < size && last != NULL; i++)
+		last = append_cookie(last, i, pid_base + i);
+	if(last == NULL)
+	{
+		printf("%s\n", "Out of memory");
+		free_cookie_list();
+		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+	}
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static int setup_live_cookies(int size)
+{
+	if(create_proc_dirs(size) != SECURITY_SERVER_SUCCESS)
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	return create_cookie_list(size, BENCH_LIVE_PID_BASE);
+}
+
+static void teardown_cookies(int size)
+{
+	free_cookie_list();
+}
+
+static int run_search_cookie(int size)
+{
+	unsigned char cookie[SECURITY_SERVER_COOKIE_LEN];
+
+	cookie_of(cookie, size - 1);
+	if(search_cookie(bench_list, cookie, BENCH_GID_BASE + 2) == NULL)
+		return SECURITY_SERVER_ERROR_NO_SUCH_COOKIE;
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static int run_search_cookie_new(int size)
+{
+	unsigned char cookie[SECURITY_SERVER_COOKIE_LEN];
+
+	cookie_of(cookie, size - 1);
+	if(search_cookie_new(bench_list, cookie, BENCH_OBJECT, BENCH_ACCESS) == NULL)
+		return SECURITY_SERVER_ERROR_NO_SUCH_COOKIE;
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* New cookie for a process not in the list, then removed again */
+static int setup_create_cookie(int size)
+{
+	if(create_proc_dirs(size + 1) != SECURITY_SERVER_SUCCESS)
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	if(create_proc_files(BENCH_LIVE_PID_BASE + size) != SECURITY_SERVER_SUCCESS)
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	return create_cookie_list(size, BENCH_LIVE_PID_BASE);
+}
+
+static int run_create_cookie_item(int size)
+{
+	cookie_list *added;
+
+	added = create_cookie_item(BENCH_LIVE_PID_BASE + size, -1, bench_list);
+	if(added == NULL)
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+	delete_cookie_item(added);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Every cookie belongs to a dead process, so all of them are collected */
+static int setup_dead_cookies(int size)
+{
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static void prepare_dead_cookies(int size)
+{
+	create_cookie_list(size, BENCH_DEAD_PID_BASE);
+}
+
+static int run_garbage_collection(int size)
+{
+	if(bench_list == NULL)
+		return SECURITY_SERVER_ERROR_OUT_OF_MEMORY;
+	if(garbage_collection(bench_list->next) != NULL)
+		return SECURITY_SERVER_ERROR_SERVER_ERROR;
+	return SECURITY_SERVER_SUCCESS;
+}
+
+/* Group file of 'size' groups */
+static int setup_groups(int size)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/group", sandbox);
+	fp = fopen(path, "w");
+	if(fp == NULL)
+	{
+		printf("Cannot create %s\n", path);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	for(i = 0; i < size; i++)
+		fprintf(fp, "bench_group_%d:x:%d:app,bench\n", i, BENCH_GID_BASE + i);
+	fclose(fp);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static int run_search_gid(int size)
+{
+	char obj[64];
+
+	snprintf(obj, sizeof(obj), "bench_group_%d", size - 1);
+	if(search_gid(obj) != BENCH_GID_BASE + size - 1)
+		return SECURITY_SERVER_ERROR_NO_SUCH_OBJECT;
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static int run_search_object_name(int size)
+{
+	char obj[64];
+
+	return search_object_name(BENCH_GID_BASE + size - 1, obj, sizeof(obj));
+}
+
+/* mw-list of 'size' middleware *
+ * Entries are matched by prefix, so no name is a prefix of another */
+static int setup_mw_list(int size)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/mw-list", sandbox);
+	fp = fopen(path, "w");
+	if(fp == NULL)
+	{
+		printf("Cannot create %s\n", path);
+		return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	for(i = 0; i < size; i++)
+		fprintf(fp, "/usr/bin/bench-mw-%05d\n", i);
+	fclose(fp);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static int run_search_middleware_cmdline(int size)
+{
+	char cmdline[64];
+
+	snprintf(cmdline, sizeof(cmdline), "/usr/bin/bench-mw-%05d", size - 1);
+	return search_middleware_cmdline(cmdline);
+}
+
+/* Password directory of 'size' password files, all of them in history */
+static int setup_passwords(int size)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	unsigned char data[SECURITY_SERVER_HASHED_PWD_LEN + 2 * sizeof(unsigned int)];
+	int i;
+
+	memset(data, 0, sizeof(data));
+	for(i = 0; i < size; i++)
+	{
+		memset(data, i, SECURITY_SERVER_HASHED_PWD_LEN);
+		snprintf(path, sizeof(path), "%s/data/%d.pwd", sandbox, 1000000000 + i);
+		if(write_file(path, (char *)data, sizeof(data)) != SECURITY_SERVER_SUCCESS)
+			return SECURITY_SERVER_ERROR_FILE_OPERATION;
+	}
+	memset(bench_pwd, 0xff, sizeof(bench_pwd));
+	return set_history(size);
+}
+
+static void teardown_passwords(int size)
+{
+	char path[SECURITY_SERVER_MAX_CONFIG_PATH];
+	int i;
+
+	for(i = 0; i < size; i++)
+	{
+		snprintf(path, sizeof(path), "%s/data/%d.pwd", sandbox, 1000000000 + i);
+		unlink(path);
+	}
+}
+
+static int run_load_password(int size)
+{
+	unsigned char cur_pwd[SECURITY_SERVER_HASHED_PWD_LEN];
+	unsigned int max_attempt, expire_time;
+
+	return load_password(cur_pwd, &max_attempt, &expire_time);
+}
+
+static int run_check_history(int size)
+{
+	return check_history(bench_pwd);
+}
+
+static const microbench benchmarks[] = {
+	{"search_cookie", cookie_sizes, setup_live_cookies, NULL, run_search_cookie, teardown_cookies},
+	{"search_cookie_new", cookie_sizes, setup_live_cookies, NULL, run_search_cookie_new, teardown_cookies},
+	{"create_cookie_item", cookie_sizes, setup_create_cookie, NULL, run_create_cookie_item, teardown_cookies},
+	{"garbage_collection", cookie_sizes, setup_dead_cookies, prepare_dead_cookies, run_garbage_collection, teardown_cookies},
+	{"search_gid", group_sizes, setup_groups, NULL, run_search_gid, NULL},
+	{"search_object_name", group_sizes, setup_groups, NULL, run_search_object_name, NULL},
+	{"search_middleware_cmdline", mw_sizes, setup_mw_list, NULL, run_search_middleware_cmdline, NULL},
+	{"load_password", pwd_sizes, setup_passwords, NULL, run_load_password, teardown_passwords},
+	{"check_history", pwd_sizes, setup_passwords, NULL, run_check_history, teardown_passwords},
+};
+
+/* Call the primitive until 'min_msec' is spent in it */
+static int run_benchmark(const microbench *bench, int size, int min_msec)
+{
+	long long start, elapsed, total = 0, min = -1;
+	long iterations = 0;
+	char name[64];
+	int retval;
+
+	retval = bench->setup(size);
+	if(retval != SECURITY_SERVER_SUCCESS)
+		goto error;
+
+	while(total < min_msec * 1000000LL || iterations < BENCH_MIN_ITERATIONS)
+	{
+		if(bench->prepare != NULL)
+			bench->prepare(size);
+		start = now_nsec();
+		retval = bench->run(size);
+		elapsed = now_nsec() - start;
+		if(retval != SECURITY_SERVER_SUCCESS)
+			break;
+		total += elapsed;
+		if(min < 0 || elapsed < min)
+			min = elapsed;
+		iterations++;
+	}
+	if(bench->teardown != NULL)
+		bench->teardown(size);
+
+error:
+	snprintf(name, sizeof(name), "%s/%d", bench->name, size);
+	if(retval != SECURITY_SERVER_SUCCESS)
+	{
+		printf("%-32s failed: %d\n", name, retval);
+		return retval;
+	}
+	printf("%-32s %10ld %12.2fus %12.2fus\n", name, iterations,
+			total / 1000.0 / iterations, min / 1000.0);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static void print_usage(const char *argv0)
+{
+	printf("Usage: %s [-t msec] [-f filter]\n", argv0);
+	printf("%s\n", "  -t  Minimum time spent in each primitive and size (200)");
+	printf("%s\n", "  -f  Run only primitives whose name contains the filter");
+}
+
+int main(int argc, char *argv[])
+{
+	int min_msec = BENCH_DEFAULT_MIN_MSEC, opt, i, j, failed = 0;
+	const char *filter = NULL;
+
+	while((opt = getopt(argc, argv, "t:f:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 't':
+				min_msec = atoi(optarg);
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			default:
+				print_usage(argv[0]);
+				return 1;
+		}
+	}
+	if(min_msec <= 0 || optind != argc)
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+
+	if(create_sandbox() != SECURITY_SERVER_SUCCESS)
+	{
+		remove_sandbox();
+		return 1;
+	}
+
+	printf("%-32s %10s %14s %14s\n", "primitive/size", "iterations", "avg", "min");
+	for(i = 0; i < (int)(sizeof(benchmarks) / sizeof(benchmarks[0])); i++)
+	{
+		if(filter != NULL && strstr(benchmarks[i].name, filter) == NULL)
+			continue;
+		for(j = 0; benchmarks[i].sizes[j] != 0; j++)
+		{
+			if(run_benchmark(&benchmarks[i], benchmarks[i].sizes[j], min_msec) != SECURITY_SERVER_SUCCESS)
+				failed = 1;
+		}
+	}
+
+	remove_sandbox();
+	return failed;
+}
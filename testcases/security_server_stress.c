@@ -0,0 +1,524 @@
+/*
+ * security server
+ *
+ * Copyright (c) 2000 - 2010 Samsung Electronics Co., Ltd.
+ * Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ */
+
+/* Concurrency stress test of the cookie list *
+ *
+ * Runs these against one security-server at the same time:
+ *  - churn: short-lived child processes request a cookie and exit, leaving
+ *    garbage for the server to collect. Every other child exec()s itself
+ *    under another name and requests again, so the server sees its PID
+ *    reused by a different executable, as security_server_tc_pid_reuser.c
+ *    does by waiting for a PID cycle. With -L, churn threads act as the
+ *    launcher and have the cookie of each child prepared before it asks
+ *  - lookup: threads of this process request the cookie of this process
+ *  - middleware: threads check privileges of and look up PIDs of cookies
+ *    collected from the children, most of which are dead already
+ *  - dump: threads walk the whole cookie list with GET_ALL_COOKIES
+ *  - revocation: threads subscribe to cookie revocations and count them.
+ *    A dropped subscription is an error, as the server only drops
+ *    subscribers which fall behind
+ * and reports the throughput of each. Busy answers and failed connections
+ * are counted as busy, since the server sheds load under this test. Any other
+ * unexpected answer is an error and makes the exit status non-zero.
+ *
+ * Build security-server with -DSANITIZER=thread or -DSANITIZER=address to
+ * have races and memory errors it provokes reported by the server.
+ *
+ * The server serves SECURITY_SERVER_APP_THREADS app connections at a time and
+ * queues the rest, so keeping the total number of threads below that
+ * measures the server rather than the queue. Dump and middleware threads go
+ * to the middleware socket, which has its own workers.
+ *
+ * Middleware threads need the privileged UID and the path of this program
+ * in mw-list. When running as root, give an app UID with -u so children
+ * get cookies of their own instead of the default cookie */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <poll.h>
+
+#include "security-server.h"
+#include "security-server-common.h"
+#include "security-server-comm.h"
+#include "security-server-util.h"
+
+#define STRESS_MAX_THREADS		64
+#define STRESS_RING_SIZE		1024	/* Cookies kept for middleware threads */
+#define STRESS_REUSED_NAME		"security-server-stress-reused"
+#define STRESS_BUSY_BACKOFF_USEC	1000
+
+#define OP_CHURN			0
+#define OP_LOOKUP			1
+#define OP_CHECK_PRIVILEGE		2
+#define OP_CHECK_PRIVILEGE_NEW		3
+#define OP_GET_PID			4
+#define OP_DUMP				5
+#define OP_PREPARE			6
+#define OP_REVOKE			7
+#define NUM_OPS				8
+
+static const char *op_names[NUM_OPS] = {"churn", "lookup", "check_privilege",
+	"check_privilege_new", "get_cookie_pid", "dump", "prepare_cookie", "revocation"};
+
+struct stress_config {
+	int churners;
+	int lookups;
+	int middlewares;
+	int dumpers;
+	int subscribers;
+	int duration;		/* seconds */
+	int launcher;		/* Prepare cookies of children */
+	uid_t app_uid;
+	gid_t gid;
+	const char *object;
+	const char *access;
+};
+
+struct op_result {
+	unsigned long count;
+	unsigned long busy;	/* Shed or cannot connect. The server is saturated */
+	unsigned long errors;
+	int last_error;
+};
+
+static struct stress_config conf;
+static struct op_result results[NUM_OPS];
+static pthread_mutex_t results_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int stop = 0;
+
+/* Cookies of churned children. Guarded by ring_mutex */
+static char ring[STRESS_RING_SIZE][SECURITY_SERVER_COOKIE_LEN];
+static unsigned int ring_num = 0;
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static long long now_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_result(struct op_result *local, int op)
+{
+	pthread_mutex_lock(&results_mutex);
+	results[op].count += local[op].count;
+	results[op].busy += local[op].busy;
+	results[op].errors += local[op].errors;
+	if(local[op].errors > 0)
+		results[op].last_error = local[op].last_error;
+	pthread_mutex_unlock(&results_mutex);
+}
+
+static void record(struct op_result *res, int retval)
+{
+	if(retval == SECURITY_SERVER_API_SUCCESS)
+	{
+		res->count++;
+		return;
+	}
+	if(retval == SECURITY_SERVER_API_ERROR_SOCKET || retval == SECURITY_SERVER_API_ERROR_SERVER_BUSY)
+	{
+		/* Don't take the CPU away from the server by retrying at once */
+		res->busy++;
+		usleep(STRESS_BUSY_BACKOFF_USEC);
+		return;
+	}
+	res->errors++;
+	res->last_error = retval;
+}
+
+static void put_cookie(const char *cookie)
+{
+	pthread_mutex_lock(&ring_mutex);
+	memcpy(ring[ring_num % STRESS_RING_SIZE], cookie, SECURITY_SERVER_COOKIE_LEN);
+	ring_num++;
+	pthread_mutex_unlock(&ring_mutex);
+}
+
+static int get_cookie(char *cookie, unsigned int *seed)
+{
+	unsigned int num;
+
+	pthread_mutex_lock(&ring_mutex);
+	num = ring_num < STRESS_RING_SIZE ? ring_num : STRESS_RING_SIZE;
+	if(num > 0)
+		memcpy(cookie, ring[rand_r(seed) % num], SECURITY_SERVER_COOKIE_LEN);
+	pthread_mutex_unlock(&ring_mutex);
+	return num > 0;
+}
+
+/* Request a cookie and write return value and cookie to 'fd' */
+static int report_cookie(int fd)
+{
+	char buf[sizeof(int) + SECURITY_SERVER_COOKIE_LEN];
+	int retval;
+
+	memset(buf, 0, sizeof(buf));
+	retval = security_server_request_cookie(buf + sizeof(int), SECURITY_SERVER_COOKIE_LEN);
+	memcpy(buf, &retval, sizeof(int));
+	if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+		return -1;
+	return retval;
+}
+
+/* Child of a churn thread. Reports one or two cookies and exits *
+ * With a launcher, it waits for its cookie to be prepared first, *
+ * which is when 'go_fd' is closed */
+static void run_child(int fd, int go_fd, int reuse)
+{
+	char fdstr[16], c;
+	char *argv[] = {STRESS_REUSED_NAME, "-R", fdstr, NULL};
+
+	if(conf.app_uid != 0 && setuid(conf.app_uid) != 0)
+		_exit(1);
+	if(go_fd >= 0)
+		while(read(go_fd, &c, 1) < 0 && errno == EINTR);
+	if(report_cookie(fd) != SECURITY_SERVER_API_SUCCESS || !reuse)
+		_exit(0);
+
+	/* Same PID, different cmdline */
+	snprintf(fdstr, sizeof(fdstr), "%d", fd);
+	fcntl(fd, F_SETFD, 0);
+	execv("/proc/self/exe", argv);
+	_exit(1);
+}
+
+static void *churn_thread(void *arg)
+{
+	struct op_result res[NUM_OPS];
+	char buf[sizeof(int) + SECURITY_SERVER_COOKIE_LEN];
+	int fds[2], go[2] = {-1, -1}, retval, status, reuse = 0;
+	pid_t pid;
+
+	memset(res, 0, sizeof(res));
+	while(!stop)
+	{
+		/* Other children must not hold the write end */
+		if(pipe2(fds, O_CLOEXEC) != 0 || (conf.launcher && pipe2(go, O_CLOEXEC) != 0))
+		{
+			record(&res[OP_CHURN], -errno);
+			break;
+		}
+		pid = fork();
+		if(pid == 0)
+		{
+			close(fds[0]);
+			if(go[1] >= 0)
+				close(go[1]);
+			run_child(fds[1], go[0], reuse);
+		}
+		close(fds[1]);
+		if(go[0] >= 0)
+		{
+			close(go[0]);
+			if(pid > 0)
+				record(&res[OP_PREPARE], security_server_prepare_cookie(pid));
+			close(go[1]);
+			go[0] = go[1] = -1;
+		}
+		if(pid < 0)
+		{
+			close(fds[0]);
+			record(&res[OP_CHURN], -errno);
+			break;
+		}
+		reuse = !reuse;
+
+		while((retval = read(fds[0], buf, sizeof(buf))) == sizeof(buf))
+		{
+			memcpy(&retval, buf, sizeof(int));
+			record(&res[OP_CHURN], retval);
+			if(retval == SECURITY_SERVER_API_SUCCESS)
+				put_cookie(buf + sizeof(int));
+		}
+		close(fds[0]);
+		while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			record(&res[OP_CHURN], SECURITY_SERVER_API_ERROR_UNKNOWN);
+	}
+	add_result(res, OP_CHURN);
+	add_result(res, OP_PREPARE);
+	return NULL;
+}
+
+static void *lookup_thread(void *arg)
+{
+	struct op_result res[NUM_OPS];
+	char cookie[SECURITY_SERVER_COOKIE_LEN];
+
+	memset(res, 0, sizeof(res));
+	while(!stop)
+		record(&res[OP_LOOKUP], security_server_request_cookie(cookie, sizeof(cookie)));
+	add_result(res, OP_LOOKUP);
+	return NULL;
+}
+
+static void *middleware_thread(void *arg)
+{
+	struct op_result res[NUM_OPS];
+	char cookie[SECURITY_SERVER_COOKIE_LEN];
+	unsigned int seed = (unsigned int)(long)arg;
+	int retval, op;
+
+	memset(res, 0, sizeof(res));
+	while(!stop)
+	{
+		if(!get_cookie(cookie, &seed))
+		{
+			usleep(1000);
+			continue;
+		}
+		op = OP_CHECK_PRIVILEGE + rand_r(&seed) % 3;
+		if(op == OP_CHECK_PRIVILEGE)
+			retval = security_server_check_privilege(cookie, conf.gid);
+		else if(op == OP_CHECK_PRIVILEGE_NEW)
+			retval = security_server_check_privilege_by_cookie(cookie, conf.object, conf.access);
+		else
+			retval = security_server_get_cookie_pid(cookie);
+		/* The cookie may have been collected, and denial is a valid answer */
+		if(retval == SECURITY_SERVER_API_ERROR_ACCESS_DENIED
+				|| retval == SECURITY_SERVER_API_ERROR_NO_SUCH_COOKIE
+				|| retval > 0)
+			retval = SECURITY_SERVER_API_SUCCESS;
+		record(&res[op], retval);
+	}
+	add_result(res, OP_CHECK_PRIVILEGE);
+	add_result(res, OP_CHECK_PRIVILEGE_NEW);
+	add_result(res, OP_GET_PID);
+	return NULL;
+}
+
+/* Walk all pages of the cookie list. Only the page headers are looked at */
+static int dump_cookies(void)
+{
+	unsigned char buf[SECURITY_SERVER_COOKIE_PAGE_LEN];
+	unsigned int cursor = 0;
+	response_header hdr;
+	basic_header req;
+	msg_builder msg;
+	int sockfd, retval;
+
+	do
+	{
+		retval = connect_to_server_class(&sockfd, SECURITY_SERVER_SOCK_CLASS_MIDDLEWARE,
+				SECURITY_SERVER_CLIENT_SOCK_TYPE);
+		if(retval != SECURITY_SERVER_SUCCESS)
+			return retval;
+
+		req.version = SECURITY_SERVER_MSG_VERSION;
+		req.msg_id = SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_REQUEST;
+		req.msg_len = sizeof(cursor);
+		init_msg_builder(&msg);
+		append_msg(&msg, &req, sizeof(req));
+		append_msg(&msg, &cursor, sizeof(cursor));
+		retval = send_msg(sockfd, &msg);
+		if(retval == SECURITY_SERVER_SUCCESS)
+			retval = recv_response(sockfd, &hdr, buf, sizeof(buf));
+		close(sockfd);
+		if(retval < 0)
+			return retval;
+		if(hdr.return_code != SECURITY_SERVER_RETURN_CODE_SUCCESS)
+			return return_code_to_error_code(hdr.return_code);
+		if(hdr.basic_hdr.msg_id != SECURITY_SERVER_MSG_TYPE_GET_ALL_COOKIES_RESPONSE
+				|| retval < 2 * (int)sizeof(int))
+			return SECURITY_SERVER_ERROR_BAD_RESPONSE;
+		memcpy(&cursor, buf + sizeof(int), sizeof(cursor));
+	} while(cursor != 0);
+	return SECURITY_SERVER_SUCCESS;
+}
+
+static void *dump_thread(void *arg)
+{
+	struct op_result res[NUM_OPS];
+
+	memset(res, 0, sizeof(res));
+	while(!stop)
+		record(&res[OP_DUMP], dump_cookies());
+	add_result(res, OP_DUMP);
+	return NULL;
+}
+
+static void *subscriber_thread(void *arg)
+{
+	struct op_result res[NUM_OPS];
+	char cookie[SECURITY_SERVER_COOKIE_LEN];
+	struct pollfd pfd;
+	int fd = -1, pid, retval;
+
+	memset(res, 0, sizeof(res));
+	while(!stop)
+	{
+		if(fd < 0)
+		{
+			fd = security_server_subscribe_revocation();
+			if(fd < 0)
+			{
+				record(&res[OP_REVOKE], fd);
+				continue;
+			}
+		}
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, 100) <= 0)
+			continue;
+		retval = security_server_recv_revocation(fd, cookie, sizeof(cookie), &pid);
+		record(&res[OP_REVOKE], retval);
+		if(retval != SECURITY_SERVER_API_SUCCESS)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	if(fd >= 0)
+		close(fd);
+	add_result(res, OP_REVOKE);
+	return NULL;
+}
+
+static void printusage(char *cmdline)
+{
+	printf("%s\n", "Usage: ");
+	printf("%s [Options]\n", cmdline);
+	printf("%s\n", "[Options]");
+	printf("%s\n", "-p N:\tNumber of threads forking short-lived apps (default 2)");
+	printf("%s\n", "-l N:\tNumber of threads requesting the cookie of this process (default 1)");
+	printf("%s\n", "-m N:\tNumber of middleware threads checking privileges (default 2)");
+	printf("%s\n", "-D N:\tNumber of threads dumping all cookies (default 1)");
+	printf("%s\n", "-S N:\tNumber of threads subscribed to cookie revocations (default 0)");
+	printf("%s\n", "-L:\tForking threads prepare cookies of their apps as the launcher");
+	printf("%s\n", "-d sec:\tDuration in seconds (default 10)");
+	printf("%s\n", "-u uid:\tUID the forked apps run as (default: don't change)");
+	printf("%s\n", "-g gid:\tGID checked by check_privilege (default 6001)");
+	printf("%s\n", "-o label:\tObject label checked by check_privilege_new (default \"_\")");
+	printf("%s\n", "-x rights:\tAccess rights checked by check_privilege_new (default \"r\")");
+	printf("%s\n", "Example:");
+	printf("%s -p 3 -m 4 -D 1 -d 60 -u 5000\n", cmdline);
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t threads[STRESS_MAX_THREADS];
+	void *(*start)(void *);
+	char cookie[SECURITY_SERVER_COOKIE_LEN];
+	int opt, i, num = 0, failed = 0;
+	long long started;
+	double elapsed;
+
+	/* Exec'ed child of a churn thread */
+	if(argc == 3 && strcmp(argv[1], "-R") == 0)
+	{
+		report_cookie(atoi(argv[2]));
+		return 0;
+	}
+
+	memset(&conf, 0, sizeof(conf));
+	conf.churners = 2;
+	conf.lookups = 1;
+	conf.middlewares = 2;
+	conf.dumpers = 1;
+	conf.duration = 10;
+	conf.gid = 6001;
+	conf.object = "_";
+	conf.access = "r";
+
+	while((opt = getopt(argc, argv, "p:l:m:D:S:Ld:u:g:o:x:h")) != -1)
+	{
+		switch(opt)
+		{
+			case 'p': conf.churners = atoi(optarg); break;
+			case 'l': conf.lookups = atoi(optarg); break;
+			case 'm': conf.middlewares = atoi(optarg); break;
+			case 'D': conf.dumpers = atoi(optarg); break;
+			case 'S': conf.subscribers = atoi(optarg); break;
+			case 'L': conf.launcher = 1; break;
+			case 'd': conf.duration = atoi(optarg); break;
+			case 'u': conf.app_uid = atoi(optarg); break;
+			case 'g': conf.gid = atoi(optarg); break;
+			case 'o': conf.object = optarg; break;
+			case 'x': conf.access = optarg; break;
+			default:
+				printusage(argv[0]);
+				return 1;
+		}
+	}
+	if(conf.churners < 0 || conf.lookups < 0 || conf.middlewares < 0 || conf.dumpers < 0
+			|| conf.subscribers < 0
+			|| conf.churners + conf.lookups + conf.middlewares + conf.dumpers
+				+ conf.subscribers == 0
+			|| conf.churners + conf.lookups + conf.middlewares + conf.dumpers
+				+ conf.subscribers > STRESS_MAX_THREADS
+			|| conf.duration <= 0 || optind != argc)
+	{
+		printusage(argv[0]);
+		return 1;
+	}
+
+	/* Also makes sure the server is there */
+	if(security_server_request_cookie(cookie, sizeof(cookie)) != SECURITY_SERVER_API_SUCCESS)
+	{
+		printf("%s\n", "Cannot get a cookie. Is security-server running?");
+		return 1;
+	}
+
+	started = now_nsec();
+	for(i = 0; i < conf.churners + conf.lookups + conf.middlewares + conf.dumpers
+			+ conf.subscribers; i++)
+	{
+		if(i < conf.churners)
+			start = churn_thread;
+		else if(i < conf.churners + conf.lookups)
+			start = lookup_thread;
+		else if(i < conf.churners + conf.lookups + conf.middlewares)
+			start = middleware_thread;
+		else if(i < conf.churners + conf.lookups + conf.middlewares + conf.dumpers)
+			start = dump_thread;
+		else
+			start = subscriber_thread;
+		if(pthread_create(&threads[i], NULL, start, (void *)(long)(i + 1)) != 0)
+		{
+			printf("pthread_create() failed: %s\n", strerror(errno));
+			stop = 1;
+			failed = 1;
+			break;
+		}
+		num++;
+	}
+
+	sleep(conf.duration);
+	stop = 1;
+	for(i = 0; i < num; i++)
+		pthread_join(threads[i], NULL);
+	elapsed = (now_nsec() - started) / 1000000000.0;
+
+	printf("%d churn, %d lookup, %d middleware, %d dump, %d revocation threads, %.2f s\n",
+			conf.churners, conf.lookups, conf.middlewares, conf.dumpers, conf.subscribers,
+			elapsed);
+	for(i = 0; i < NUM_OPS; i++)
+	{
+		if(results[i].count == 0 && results[i].busy == 0 && results[i].errors == 0)
+			continue;
+		printf("%-20s %9lu ok %10.1f /s %7lu busy %7lu errors", op_names[i], results[i].count,
+				results[i].count / elapsed, results[i].busy, results[i].errors);
+		if(results[i].errors > 0)
+		{
+			printf(" (last %d)", results[i].last_error);
+			failed = 1;
+		}
+		printf("\n");
+	}
+	return failed;
+}
@@ -438,6 +438,22 @@ int main(int argc, char *argv[])
 	printf("TC S13: PASSED\n\n");
 	sleep(1);
 
+	printf("TC S13-1: check privilege by cookie --> object label and access rights of different lengths \n");
+	ret = security_server_check_privilege_by_cookie(cookie, "object", "r");
+	if(ret != SECURITY_SERVER_API_SUCCESS && ret != SECURITY_SERVER_API_ERROR_ACCESS_DENIED)
+	{
+		printf("Test failed: %d\n", ret);
+		exit(-1);
+	}
+	ret = security_server_check_privilege_by_cookie(cookie, "_", "rwxat");
+	if(ret != SECURITY_SERVER_API_SUCCESS && ret != SECURITY_SERVER_API_ERROR_ACCESS_DENIED)
+	{
+		printf("Test failed: %d\n", ret);
+		exit(-1);
+	}
+	printf("TC S13-1: PASSED\n\n");
+	sleep(1);
+
 	printf("TC S14: Communicating with client and test cookie and privilege control \n");
 	printf("\tWaiting for client...\n");
 	server_sockfd = create_new_socket();
@@ -0,0 +1,164 @@
+/*
+ * security server
+ *
+ * Copyright (c) 2000 - 2010 Samsung Electronics Co., Ltd.
+ * Contact: Bumjin Im <bj.im@samsung.com>
+ *
+ */
+
+/* Round trip latency of SOCK_STREAM and SOCK_SEQPACKET transports *
+ *
+ * Two patterns are measured for each transport:
+ *  - connect: v1 cookie request on a new connection, as the client library does
+ *  - pipelined: v2 cookie requests on one persistent connection
+ * security-server must be running */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+
+#include "security-server-common.h"
+#include "security-server-comm.h"
+
+#define BENCH_DEFAULT_ITERATIONS	10000
+
+static long long now_nsec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+static void print_result(const char *name, long long *samples, int num)
+{
+	long long total = 0;
+	int i;
+
+	if(num == 0)
+	{
+		printf("%-24s no successful round trip\n", name);
+		return;
+	}
+	for(i = 0; i < num; i++)
+		total += samples[i];
+	qsort(samples, num, sizeof(long long), compare_ll);
+	printf("%-24s n=%-7d avg=%8.2fus p50=%8.2fus p99=%8.2fus max=%8.2fus\n",
+			name, num, total / 1000.0 / num,
+			samples[num / 2] / 1000.0,
+			samples[(num * 99) / 100] / 1000.0,
+			samples[num - 1] / 1000.0);
+}
+
+/* One v1 cookie request per connection */
+static int bench_connect(int type, long long *samples, int iterations)
+{
+	int i, sockfd, retval, num = 0;
+	response_header hdr;
+	char cookie[SECURITY_SERVER_COOKIE_LEN];
+	long long start;
+
+	for(i = 0; i < iterations; i++)
+	{
+		start = now_nsec();
+		retval = connect_to_server_type(&sockfd, type);
+		if(retval != SECURITY_SERVER_SUCCESS)
+			return num;
+		retval = send_cookie_request(sockfd);
+		if(retval == SECURITY_SERVER_SUCCESS)
+			retval = recv_cookie(sockfd, &hdr, cookie);
+		close(sockfd);
+		if(retval != SECURITY_SERVER_SUCCESS)
+			return num;
+		samples[num++] = now_nsec() - start;
+	}
+	return num;
+}
+
+/* v2 cookie requests on one connection, one in flight at a time */
+static int bench_pipelined(int type, long long *samples, int iterations)
+{
+	int i, sockfd, retval, received, num = 0;
+	basic_header_v2 hdr;
+	response_header_v2 *resp;
+	unsigned char buf[sizeof(response_header_v2) + SECURITY_SERVER_COOKIE_LEN];
+	msg_builder msg;
+	long long start;
+
+	if(connect_to_server_type(&sockfd, type) != SECURITY_SERVER_SUCCESS)
+		return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.version = SECURITY_SERVER_MSG_VERSION_2;
+	hdr.msg_id = SECURITY_SERVER_MSG_TYPE_COOKIE_REQUEST;
+	resp = (response_header_v2 *)buf;
+
+	for(i = 0; i < iterations; i++)
+	{
+		start = now_nsec();
+		hdr.request_id = i;
+		init_msg_builder(&msg);
+		append_msg(&msg, &hdr, sizeof(hdr));
+		if(send_msg(sockfd, &msg) != SECURITY_SERVER_SUCCESS)
+			break;
+
+		/* SOCK_SEQPACKET returns the whole response at once */
+		received = 0;
+		while(received < (int)sizeof(buf))
+		{
+			if(check_socket_poll(sockfd, POLLIN, SECURITY_SERVER_SOCKET_TIMEOUT_MILISECOND) != SECURITY_SERVER_SUCCESS)
+				break;
+			retval = recv(sockfd, buf + received, sizeof(buf) - received, 0);
+			if(retval <= 0)
+				break;
+			received += retval;
+		}
+		if(received < (int)sizeof(buf) || resp->basic_hdr.request_id != (unsigned int)i)
+			break;
+		samples[num++] = now_nsec() - start;
+	}
+	close(sockfd);
+	return num;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = BENCH_DEFAULT_ITERATIONS, num;
+	long long *samples;
+
+	if(argc > 2 && strcmp(argv[1], "-n") == 0)
+		iterations = atoi(argv[2]);
+	if(iterations <= 0)
+	{
+		printf("Usage: %s [-n iterations]\n", argv[0]);
+		return 1;
+	}
+
+	samples = malloc(sizeof(long long) * iterations);
+	if(samples == NULL)
+	{
+		printf("%s\n", "Out of memory");
+		return 1;
+	}
+
+	num = bench_connect(SOCK_STREAM, samples, iterations);
+	print_result("stream/connect", samples, num);
+	num = bench_connect(SOCK_SEQPACKET, samples, iterations);
+	print_result("seqpacket/connect", samples, num);
+	num = bench_pipelined(SOCK_STREAM, samples, iterations);
+	print_result("stream/pipelined", samples, num);
+	num = bench_pipelined(SOCK_SEQPACKET, samples, iterations);
+	print_result("seqpacket/pipelined", samples, num);
+
+	free(samples);
+	return 0;
+}